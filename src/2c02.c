@@ -1,15 +1,705 @@
-#include <stdio.h>
+#include <string.h>
+#include "6502.h"
+#include "nesmem.h"
+#include "nestrace.h"
+#include "2c02.h"
 
-void initPPU() {
-    mm->write(PPU_CTRL,0);
-    mm->write(PPU_MASK,0);
-    mm->write()
-    
+// REGISTERS
+//
+// PPU_ADDR and PPU_SCROLL share one pair of writes and both end up in the
+// scroll registers, the way the hardware keeps them (ppuV, ppuT, ppuX and
+// ppuW in the memory map). PPU_DATA accesses during rendering would move
+// ppuV along with the picture; games do not do that and neither does this.
 
+#define PPU_STATUS__FLAGS ( PPU_STATUS__VBLANK | PPU_STATUS__SPRITE_0_HIT | PPU_STATUS__SPRITE_OVERFLOW )
 
+static void ppuIncrement( struct nesMemoryMap *mm ) {
+    mm->ppuV = ( mm->ppuV + ( ( mm->ppuReg[ PPU_CTRL_0 & 0x7 ] & PPU_CTRL_0__PPU_ADDRESS_INC ) ? 32 : 1 ) ) & 0x7fff;
+}
+
+uint8_t ppu2C02Read( struct nesMemoryMap *mm, const uint16_t addr ) {
+    uint8_t data;
+
+    switch ( addr & 0x7 ) {
+        case PPU_STATUS & 0x7:
+            // the bits without a flag read back whatever was on the bus
+            data = ( mm->ppuStatus & PPU_STATUS__FLAGS ) | ( mm->ppuLatch & ~PPU_STATUS__FLAGS );
+            mm->ppuStatus &= ~PPU_STATUS__VBLANK;
+            mm->ppuW = 0;
+            return data;
+        case OAM_DATA & 0x7:
+            return mm->oam[ mm->oamAddr ];
+        case PPU_DATA & 0x7:
+            // reads come out of a buffer one access behind, except from the
+            // palettes, which still fill it from the nametables underneath
+            if ( ( mm->ppuV & 0x3fff ) < IMAGE_PALETTE ) {
+                data = mm->ppuBuffer;
+                mm->ppuBuffer = ppuMemRead( mm, mm->ppuV );
+            } else {
+                data = ( ppuMemRead( mm, mm->ppuV ) & 0x3f ) | ( mm->ppuLatch & 0xc0 );
+                mm->ppuBuffer = ppuMemRead( mm, mm->ppuV - 0x1000 );
+            }
+            ppuIncrement( mm );
+            return data;
+        default:
+            // write only
+            return mm->ppuLatch;
+    }
+}
+
+void ppu2C02Write( struct nesMemoryMap *mm, const uint16_t addr, const uint8_t data ) {
+    const uint8_t was = mm->ppuReg[ PPU_CTRL_0 & 0x7 ];
+
+    mm->ppuReg[ addr & 0x7 ] = data;
+    mm->ppuLatch = data;
+
+    switch ( addr & 0x7 ) {
+        case PPU_CTRL_0 & 0x7:
+            mm->ppuT = ( mm->ppuT & ~PPU_V__NAME_TABLE ) | ( ( data & PPU_CTRL_0__NAME_TABLE_ADDR ) << 10 );
+            // enabling the NMI during vblank raises it straight away
+            if ( !( was & PPU_CTRL_0__VBLANK_NMI_ENABLE ) && ( data & PPU_CTRL_0__VBLANK_NMI_ENABLE ) &&
+                 ( mm->ppuStatus & PPU_STATUS__VBLANK ) && mm->cpu ) {
+                cpu6502Raise( mm->cpu, CPU_6502_SIGNAL__NMI );
+            }
+            break;
+        case OAM_ADDR & 0x7:
+            mm->oamAddr = data;
+            break;
+        case OAM_DATA & 0x7:
+            mm->oam[ mm->oamAddr++ ] = data;
+            break;
+        case PPU_SCROLL & 0x7:
+            if ( !mm->ppuW ) {
+                mm->ppuT = ( mm->ppuT & ~PPU_V__COARSE_X ) | ( data >> 3 );
+                mm->ppuX = data & 0x7;
+            } else {
+                mm->ppuT = ( mm->ppuT & ~( PPU_V__COARSE_Y | PPU_V__FINE_Y ) ) | ( ( data & 0xf8 ) << 2 ) | ( ( data & 0x7 ) << 12 );
+            }
+            mm->ppuW = !mm->ppuW;
+            break;
+        case PPU_ADDR & 0x7:
+            if ( !mm->ppuW ) {
+                mm->ppuT = ( mm->ppuT & 0x00ff ) | ( ( data & 0x3f ) << 8 );
+            } else {
+                mm->ppuT = ( mm->ppuT & 0xff00 ) | data;
+                mm->ppuV = mm->ppuT;
+                NES_TRACE_EVENT( mm, NES_TRACE__PPU_ADDR, mm->ppuV, 0 );
+            }
+            mm->ppuW = !mm->ppuW;
+            break;
+        case PPU_DATA & 0x7:
+            ppuMemWrite( mm, mm->ppuV, data );
+            ppuIncrement( mm );
+            break;
+    }
+}
+
+// copies a page of CPU memory into OAM, holding the CPU for the 513 or
+// 514 cycles the DMA takes
+
+void ppu2C02Dma( struct nesMemoryMap *mm, const uint8_t page ) {
+    unsigned int i;
+
+    for ( i = 0; i < NES_OAM_SIZE; i++ ) {
+        mm->oam[ (uint8_t) ( mm->oamAddr + i ) ] = nesMemRead( mm, page << 8 | i );
+    }
+    if ( mm->cpu ) {
+        mm->cpu->clk += 513 + ( mm->cpu->clk & 1 );
+    }
+}
+
+// FRAME EVENTS
+
+static int ppuRendering( const struct nesMemoryMap *mm ) {
+    return mm->ppuReg[ PPU_CTRL_1 & 0x7 ] & ( PPU_CTRL_1__BG_VISIBILITY | PPU_CTRL_1__SPRITE_VISIBILITY );
+}
 
+// scanline 241 dot 1
 
+void ppu2C02VBlankStart( struct nesMemoryMap *mm ) {
+    mm->ppuStatus |= PPU_STATUS__VBLANK;
+    if ( ( mm->ppuReg[ PPU_CTRL_0 & 0x7 ] & PPU_CTRL_0__VBLANK_NMI_ENABLE ) && mm->cpu ) {
+        cpu6502Raise( mm->cpu, CPU_6502_SIGNAL__NMI );
+    }
+}
+
+// the pre-render scanline, dot 1
+
+void ppu2C02VBlankEnd( struct nesMemoryMap *mm ) {
+    mm->ppuStatus &= ~PPU_STATUS__FLAGS;
+}
 
+// the pre-render scanline: the horizontal copy at dot 257 and the
+// vertical one over dots 280-304, so the next frame starts from the top
+// left of the scroll the game set
+
+void ppu2C02Reload( struct nesMemoryMap *mm ) {
+    if ( ppuRendering( mm ) ) {
+        mm->ppuV = ( mm->ppuV & ~( PPU_V__HORIZONTAL | PPU_V__VERTICAL ) ) |
+                   ( mm->ppuT & ( PPU_V__HORIZONTAL | PPU_V__VERTICAL ) );
+    }
 }
 
+// the first visible line from line on whose drawing could set the sprite
+// 0 hit or the overflow flag, with OAM and the registers as they are;
+// PPU_FRAME_HEIGHT if none could. Sprite 0 only has to be on the line.
+
+unsigned int ppu2C02StatusLine( const struct nesMemoryMap *mm, const unsigned int line ) {
+    const int height = ( mm->ppuReg[ PPU_CTRL_0 & 0x7 ] & PPU_CTRL_0__SPRITE_SIZE ) ? 16 : 8;
+    uint8_t count[ PPU_FRAME_HEIGHT ];
+    unsigned int first = PPU_FRAME_HEIGHT;
+    unsigned int top;
+    unsigned int y;
+    unsigned int i;
+    int r;
+
+    if ( !ppuRendering( mm ) ) {
+        return first;
+    }
+
+    if ( !( mm->ppuStatus & PPU_STATUS__SPRITE_0_HIT ) ) {
+        top = mm->oam[0] + 1;
+        if ( top + height > line ) {
+            first = ( top > line ) ? top : line;
+        }
+    }
+
+    if ( !( mm->ppuStatus & PPU_STATUS__SPRITE_OVERFLOW ) ) {
+        memset( count, 0, sizeof count );
+        for ( i = 0; i < PPU_SPRITES; i++ ) {
+            for ( r = 0; r < height; r++ ) {
+                y = mm->oam[ i * 4 ] + 1 + r;
+                if ( y >= line && y < first && ++count[y] > PPU_LINE_SPRITES ) {
+                    first = y;
+                }
+            }
+        }
+    }
+
+    return ( first < PPU_FRAME_HEIGHT ) ? first : PPU_FRAME_HEIGHT;
+}
+
+// TILE CACHE
+//
+// the expansion is the same eight bit tests for every pixel of a row, two
+// rows to a vector. With GCC this and the pixel kernels below are built
+// for AVX2, SSE4.1 and baseline SSE2 and picked at load time; other
+// compilers get a multiply that spreads the bits of a row into its bytes.
+
+#ifdef __GNUC__
+typedef uint8_t ppuVec __attribute__(( vector_size( 16 ) ));
+#endif
+
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__GLIBC__)
+#define PPU_KERNEL __attribute__(( target_clones( "avx2", "sse4.1", "default" ) ))
+// without SSSE3 a shuffle by a variable mask goes a byte at a time, and
+// the palette lookups are better off as plain loads
+#define PPU_SHUFFLES __builtin_cpu_supports( "ssse3" )
+#else
+#define PPU_KERNEL
+#define PPU_SHUFFLES 1
+#endif
+
+#define PPU_BYTES(B) ( (B) * 0x0101010101010101ULL )
 
+// 1 in each byte of x that is not 0, for bytes below $80
+
+static inline uint64_t ppuNonZero( const uint64_t x ) {
+    return ( ( x + PPU_BYTES( 0x7f ) ) >> 7 ) & PPU_BYTES( 0x01 );
+}
+
+// the 16 bytes of a tile into its 8 expanded rows
+
+static PPU_KERNEL void ppuExpandTile( const uint8_t *pattern, uint64_t *rows ) {
+#ifdef __GNUC__
+    static const ppuVec bits = { 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+                                 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 };
+    static const ppuVec planes[2][4] = {
+        { { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1 },
+          { 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3 },
+          { 4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 5, 5 },
+          { 6, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7 } },
+        { { 8, 8, 8, 8, 8, 8, 8, 8, 9, 9, 9, 9, 9, 9, 9, 9 },
+          { 10, 10, 10, 10, 10, 10, 10, 10, 11, 11, 11, 11, 11, 11, 11, 11 },
+          { 12, 12, 12, 12, 12, 12, 12, 12, 13, 13, 13, 13, 13, 13, 13, 13 },
+          { 14, 14, 14, 14, 14, 14, 14, 14, 15, 15, 15, 15, 15, 15, 15, 15 } } };
+    ppuVec t;
+    ppuVec px;
+    unsigned int r;
+
+    memcpy( &t, pattern, sizeof t );
+    for ( r = 0; r < 4; r++ ) {
+        px = ( (ppuVec) ( ( __builtin_shuffle( t, planes[0][r] ) & bits ) != 0 ) & 1 ) |
+             ( (ppuVec) ( ( __builtin_shuffle( t, planes[1][r] ) & bits ) != 0 ) & 2 );
+        memcpy( rows + r * 2, &px, sizeof px );
+    }
+#else
+    unsigned int r;
+
+    for ( r = 0; r < 8; r++ ) {
+        rows[r] = ppuNonZero( PPU_BYTES( pattern[r] ) & 0x0102040810204080ULL ) |
+                  ppuNonZero( PPU_BYTES( pattern[ r + 8 ] ) & 0x0102040810204080ULL ) << 1;
+    }
+#endif
+}
+
+// drops what a bank switch or a CHR RAM write made stale, before a line
+// is drawn
+
+static void ppuTileSync( struct ppu2C02 *ppu ) {
+    struct nesMemoryMap *mm = ppu->mm;
+    unsigned int p;
+
+    for ( p = 0; p < PPU_TILE_PAGES; p++ ) {
+        if ( ppu->tileBase[p] != mm->chrPage[p] ) {
+            ppu->tileBase[p] = mm->chrPage[p];
+            ppu->tileValid[p] = 0;
+        }
+        ppu->tileValid[p] &= ~mm->chrDirty[p];
+        mm->chrDirty[p] = 0;
+    }
+}
+
+// the expanded row at pattern table address addr
+
+static inline uint64_t ppuTileRow( struct ppu2C02 *ppu, const uint16_t addr ) {
+    const unsigned int tile = addr / 16;
+    const unsigned int p = tile / 64;
+
+    if ( !( ( ppu->tileValid[p] >> ( tile & 63 ) ) & 1 ) ) {
+        ppuExpandTile( ppu->tileBase[p] + ( addr & 0x3f0 ), ppu->tileRows[ tile ] );
+        ppu->tileValid[p] |= (uint64_t) 1 << ( tile & 63 );
+    }
+    return ppu->tileRows[ tile ][ addr & 7 ];
+}
+
+// RENDERING
+//
+// A visible scanline is drawn in one go from the scroll position and
+// memory as they were at its rendering dot. The machine holds lines back
+// until the CPU is about to change or look at the PPU, so that a run of
+// them drawn with the same registers, often a whole frame, shares one
+// setup and one pass over OAM. Each pixel is first a palette RAM index:
+// the background's 0-15, sprites' 16-31 with a pixel value of 0 for
+// transparent.
+
+#define PPU_SPRITE__BEHIND  0x40  // behind an opaque background pixel
+#define PPU_SPRITE__ZERO    0x80  // from sprite 0
+#define PPU_SPRITE__INDEX   0x1f
+
+// 33 tiles from ppuV, enough for any fine X scroll
+
+static void ppuBackgroundLine( struct ppu2C02 *ppu, uint8_t *out ) {
+    const struct nesMemoryMap *mm = ppu->mm;
+    const uint16_t table = ( mm->ppuReg[ PPU_CTRL_0 & 0x7 ] & PPU_CTRL_0__BG_PATTERN_TABLE ) ? PATTERN_TABLE_1 : PATTERN_TABLE_0;
+    const uint8_t *nt;
+    uint16_t v = mm->ppuV;
+    uint64_t row;
+    uint8_t attr;
+    uint8_t pal;
+    unsigned int i;
+
+    for ( i = 0; i < 33; i++ ) {
+        nt = mm->ntPage[ ( v & PPU_V__NAME_TABLE ) >> 10 ];
+        attr = nt[ NAME_TABLE_LENGTH | ( ( v >> 4 ) & 0x38 ) | ( ( v >> 2 ) & 0x07 ) ];
+        pal = ( attr >> ( ( ( v >> 4 ) & 0x4 ) | ( v & 0x2 ) ) ) & 0x3;
+
+        // the palette goes on the opaque pixels only
+        row = ppuTileRow( ppu, table + nt[ v & 0x3ff ] * 16 + ( v >> 12 ) );
+        row |= ppuNonZero( row ) * ( pal << 2 );
+        memcpy( out + i * 8, &row, 8 );
+
+        // coarse X, into the next nametable across after 32 tiles
+        if ( ( v & PPU_V__COARSE_X ) == PPU_V__COARSE_X ) {
+            v = ( v & ~PPU_V__COARSE_X ) ^ 0x0400;
+        } else {
+            v++;
+        }
+    }
+}
+
+// Sprites are found for every line being drawn in one pass over OAM,
+// the first eight on each line in OAM order
+
+struct ppuSprites {
+    uint8_t count[ PPU_FRAME_HEIGHT ];
+    uint8_t index[ PPU_FRAME_HEIGHT ][ PPU_LINE_SPRITES ];
+};
+
+static void ppuFindSprites( struct nesMemoryMap *mm, const unsigned int first, const unsigned int last, struct ppuSprites *found ) {
+    const unsigned int height = ( mm->ppuReg[ PPU_CTRL_0 & 0x7 ] & PPU_CTRL_0__SPRITE_SIZE ) ? 16 : 8;
+    unsigned int top;
+    unsigned int end;
+    unsigned int y;
+    unsigned int i;
+
+    memset( found->count + first, 0, last - first );
+
+    for ( i = 0; i < PPU_SPRITES; i++ ) {
+        // OAM holds the line above the sprite's top
+        top = mm->oam[ i * 4 ] + 1;
+        end = ( top + height < last ) ? top + height : last;
+        for ( y = ( top > first ) ? top : first; y < end; y++ ) {
+            if ( found->count[y] == PPU_LINE_SPRITES ) {
+                mm->ppuStatus |= PPU_STATUS__SPRITE_OVERFLOW;
+                continue;
+            }
+            found->index[y][ found->count[y]++ ] = i;
+        }
+    }
+}
+
+// the line's sprites, lower ones in front
+
+static void ppuSpriteLine( struct ppu2C02 *ppu, const unsigned int line, const struct ppuSprites *found, uint8_t *out ) {
+    const struct nesMemoryMap *mm = ppu->mm;
+    const uint8_t ctrl = mm->ppuReg[ PPU_CTRL_0 & 0x7 ];
+    const int height = ( ctrl & PPU_CTRL_0__SPRITE_SIZE ) ? 16 : 8;
+    const uint8_t *s;
+    unsigned int n;
+    unsigned int i;
+    unsigned int b;
+    unsigned int x;
+    uint16_t table;
+    uint64_t pixels;
+    uint8_t tile;
+    uint8_t px;
+    int row;
+
+    memset( out, 0, PPU_FRAME_WIDTH );
+
+    for ( n = 0; n < found->count[ line ]; n++ ) {
+        i = found->index[ line ][n];
+        s = mm->oam + i * 4;
+        row = (int) line - 1 - s[0];
+
+        if ( s[2] & 0x80 ) {
+            row = height - 1 - row;
+        }
+        if ( height == 16 ) {
+            table = ( s[1] & 1 ) ? PATTERN_TABLE_1 : PATTERN_TABLE_0;
+            tile = ( s[1] & 0xfe ) + ( row >= 8 );
+            row &= 7;
+        } else {
+            table = ( ctrl & PPU_CTRL_0__SPRITE_PATTERN_TABLE ) ? PATTERN_TABLE_1 : PATTERN_TABLE_0;
+            tile = s[1];
+        }
+        pixels = ppuTileRow( ppu, table + tile * 16 + row );
+
+        for ( b = 0; b < 8; b++ ) {
+            x = s[3] + b;
+            if ( x >= PPU_FRAME_WIDTH ) {
+                break;
+            }
+            // flipped sprites take their pixels from the right
+            px = pixels >> ( ( ( s[2] & 0x40 ) ? 7 - b : b ) * 8 );
+            if ( px == 0 || out[x] ) {
+                continue;
+            }
+            out[x] = 0x10 | ( s[2] & 0x3 ) << 2 | px |
+                ( ( s[2] & 0x20 ) ? PPU_SPRITE__BEHIND : 0 ) | ( i == 0 ? PPU_SPRITE__ZERO : 0 );
+        }
+    }
+}
+
+// PIXELS
+//
+// Palette lookups are byte shuffles, one for each 16 entries of the table
+// and a select on the index's top bits; formats wider than a byte are
+// looked up a byte plane at a time and interleaved.
+
+#ifdef __GNUC__
+
+// 16 indices below 64, split for looking up in any number of tables: the
+// low nibble to shuffle with and the lanes each 16 entries supply
+
+struct ppuIndex {
+    ppuVec low;
+    ppuVec quarter[4];
+};
+
+static inline void ppuSplit( struct ppuIndex *ix, const ppuVec idx ) {
+    const ppuVec high = idx >> 4;
+
+    ix->low = idx & 15;
+    ix->quarter[0] = (ppuVec) ( high == 0 );
+    ix->quarter[1] = (ppuVec) ( high == 1 );
+    ix->quarter[2] = (ppuVec) ( high == 2 );
+    ix->quarter[3] = (ppuVec) ( high == 3 );
+}
+
+// table[idx], for a table of 32 entries or of 64
+
+static inline ppuVec ppuLookup( const uint8_t *table, const unsigned int size, const struct ppuIndex *ix ) {
+    ppuVec q[4];
+    ppuVec r;
+
+    memcpy( q, table, size );
+    r = ( __builtin_shuffle( q[0], ix->low ) & ix->quarter[0] ) |
+        ( __builtin_shuffle( q[1], ix->low ) & ix->quarter[1] );
+    if ( size > 32 ) {
+        r |= ( __builtin_shuffle( q[2], ix->low ) & ix->quarter[2] ) |
+             ( __builtin_shuffle( q[3], ix->low ) & ix->quarter[3] );
+    }
+    return r;
+}
+
+static const ppuVec ppuLow = { 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23 };
+static const ppuVec ppuHigh = { 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31 };
+static const ppuVec ppuLow16 = { 0, 1, 16, 17, 2, 3, 18, 19, 4, 5, 20, 21, 6, 7, 22, 23 };
+static const ppuVec ppuHigh16 = { 8, 9, 24, 25, 10, 11, 26, 27, 12, 13, 28, 29, 14, 15, 30, 31 };
+
+#endif
+
+// a line of background and one of sprites, both already clipped, into
+// colour indices through the palette RAM; non zero if sprite 0 hit
+
+static PPU_KERNEL int ppuCompose( uint8_t *out, const uint8_t *bg, const uint8_t *sp, const uint8_t *palette, const uint8_t gray ) {
+    uint8_t table[ NES_PALETTE_SIZE ];
+    unsigned int x;
+    int hit = 0;
+
+    for ( x = 0; x < NES_PALETTE_SIZE; x++ ) {
+        table[x] = palette[x] & gray;
+    }
+
+#ifdef __GNUC__
+    if ( PPU_SHUFFLES ) {
+        ppuVec b;
+        ppuVec s;
+        ppuVec opaque;
+        ppuVec front;
+        ppuVec hits = { 0 };
+        ppuVec px;
+        struct ppuIndex ix;
+        uint64_t any[2];
+
+        for ( x = 0; x < PPU_FRAME_WIDTH; x += sizeof px ) {
+            memcpy( &b, bg + x, sizeof b );
+            memcpy( &s, sp + x, sizeof s );
+            opaque = (ppuVec) ( b != 0 );
+            hits |= (ppuVec) ( ( s & PPU_SPRITE__ZERO ) != 0 ) & opaque;
+            front = (ppuVec) ( s != 0 ) & ~( opaque & (ppuVec) ( ( s & PPU_SPRITE__BEHIND ) != 0 ) );
+            ppuSplit( &ix, ( front & s & PPU_SPRITE__INDEX ) | ( ~front & b ) );
+            px = ppuLookup( table, sizeof table, &ix );
+            memcpy( out + x, &px, sizeof px );
+        }
+        memcpy( any, &hits, sizeof any );
+        return ( any[0] | any[1] ) != 0;
+    }
+#endif
+
+    for ( x = 0; x < PPU_FRAME_WIDTH; x++ ) {
+        if ( sp[x] && bg[x] && ( sp[x] & PPU_SPRITE__ZERO ) ) {
+            hit = 1;
+        }
+        if ( sp[x] && !( bg[x] && ( sp[x] & PPU_SPRITE__BEHIND ) ) ) {
+            out[x] = table[ sp[x] & PPU_SPRITE__INDEX ];
+        } else {
+            out[x] = table[ bg[x] ];
+        }
+    }
+    return hit;
+}
+
+// a line of the frame into pixels
+
+static PPU_KERNEL void ppuConvertLine( const struct ppu2C02 *ppu, const unsigned int line, uint8_t *out, const unsigned int format ) {
+    const uint8_t *in = ppu->frame[ line ];
+    const unsigned int e = ppu->emphasis[ line ];
+    const uint8_t *r = ppu->colour[ PPU_PLANE__R ][e];
+    const uint8_t *g = ppu->colour[ PPU_PLANE__G ][e];
+    const uint8_t *b = ppu->colour[ PPU_PLANE__B ][e];
+    const uint8_t *w0 = ppu->colour[ PPU_PLANE__565_0 ][e];
+    const uint8_t *w1 = ppu->colour[ PPU_PLANE__565_1 ][e];
+    const uint8_t *l = ppu->colour[ PPU_PLANE__GRAY ][e];
+    unsigned int x;
+
+#ifdef __GNUC__
+    if ( PPU_SHUFFLES ) {
+        static const ppuVec opaque = { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 };
+        struct ppuIndex ix;
+        ppuVec idx;
+        ppuVec rg[2];
+        ppuVec ba[2];
+        ppuVec px[4];
+
+        for ( x = 0; x < PPU_FRAME_WIDTH; x += sizeof idx ) {
+            memcpy( &idx, in + x, sizeof idx );
+            ppuSplit( &ix, idx );
+            if ( format == PPU_PIXEL__RGBA32 ) {
+                px[0] = ppuLookup( r, PPU_COLOURS, &ix );
+                px[1] = ppuLookup( g, PPU_COLOURS, &ix );
+                px[2] = ppuLookup( b, PPU_COLOURS, &ix );
+                rg[0] = __builtin_shuffle( px[0], px[1], ppuLow );
+                rg[1] = __builtin_shuffle( px[0], px[1], ppuHigh );
+                ba[0] = __builtin_shuffle( px[2], opaque, ppuLow );
+                ba[1] = __builtin_shuffle( px[2], opaque, ppuHigh );
+                px[0] = __builtin_shuffle( rg[0], ba[0], ppuLow16 );
+                px[1] = __builtin_shuffle( rg[0], ba[0], ppuHigh16 );
+                px[2] = __builtin_shuffle( rg[1], ba[1], ppuLow16 );
+                px[3] = __builtin_shuffle( rg[1], ba[1], ppuHigh16 );
+                memcpy( out + x * 4, px, sizeof px );
+            } else if ( format == PPU_PIXEL__RGB565 ) {
+                px[2] = ppuLookup( w0, PPU_COLOURS, &ix );
+                px[3] = ppuLookup( w1, PPU_COLOURS, &ix );
+                px[0] = __builtin_shuffle( px[2], px[3], ppuLow );
+                px[1] = __builtin_shuffle( px[2], px[3], ppuHigh );
+                memcpy( out + x * 2, px, sizeof px[0] * 2 );
+            } else {
+                px[0] = ppuLookup( l, PPU_COLOURS, &ix );
+                memcpy( out + x, px, sizeof px[0] );
+            }
+        }
+        return;
+    }
+#endif
+
+    for ( x = 0; x < PPU_FRAME_WIDTH; x++ ) {
+        if ( format == PPU_PIXEL__RGBA32 ) {
+            out[ x * 4 ] = r[ in[x] ];
+            out[ x * 4 + 1 ] = g[ in[x] ];
+            out[ x * 4 + 2 ] = b[ in[x] ];
+            out[ x * 4 + 3 ] = 255;
+        } else if ( format == PPU_PIXEL__RGB565 ) {
+            out[ x * 2 ] = w0[ in[x] ];
+            out[ x * 2 + 1 ] = w1[ in[x] ];
+        } else {
+            out[x] = l[ in[x] ];
+        }
+    }
+}
+
+// the fine Y then coarse Y step at dot 256, wrapping into the nametable
+// below after row 29, and the horizontal reload at 257
+
+static void ppuNextLine( struct nesMemoryMap *mm ) {
+    uint16_t v = mm->ppuV;
+    unsigned int y;
+
+    if ( ( v & PPU_V__FINE_Y ) != PPU_V__FINE_Y ) {
+        v += 0x1000;
+    } else {
+        v &= ~PPU_V__FINE_Y;
+        y = ( v & PPU_V__COARSE_Y ) >> 5;
+        if ( y == 29 ) {
+            y = 0;
+            v ^= 0x0800;
+        } else {
+            y = ( y + 1 ) & 0x1f;
+        }
+        v = ( v & ~PPU_V__COARSE_Y ) | ( y << 5 );
+    }
+    mm->ppuV = ( v & ~PPU_V__HORIZONTAL ) | ( mm->ppuT & PPU_V__HORIZONTAL );
+}
+
+void ppu2C02Draw( struct ppu2C02 *ppu, const unsigned int first, const unsigned int last ) {
+    struct nesMemoryMap *mm = ppu->mm;
+    const uint8_t mask = mm->ppuReg[ PPU_CTRL_1 & 0x7 ];
+    const uint8_t gray = ( mask & PPU_CTRL_1__DISPLAY_TYPE ) ? 0x30 : 0x3f;
+    const unsigned int bgClip = ( mask & PPU_CTRL_1__BG_VISIBILITY ) ? ( ( mask & PPU_CTRL_1__BG_CLIP ) ? 0 : 8 ) : PPU_FRAME_WIDTH;
+    const unsigned int spClip = ( mask & PPU_CTRL_1__SPRITE_VISIBILITY ) ? ( ( mask & PPU_CTRL_1__SPRITE_CLIP ) ? 0 : 8 ) : PPU_FRAME_WIDTH;
+    struct ppuSprites found;
+    uint8_t bg[ 33 * 8 ];
+    uint8_t sp[ PPU_FRAME_WIDTH ];
+    unsigned int line;
+
+    if ( first >= last ) {
+        return;
+    }
+
+    memset( ppu->emphasis + first, ( mask & PPU_CTRL_1__INTENSITY ) >> 5, last - first );
+
+    if ( !ppuRendering( mm ) ) {
+        memset( ppu->frame[ first ], mm->palette[0] & gray, ( last - first ) * PPU_FRAME_WIDTH );
+        return;
+    }
+
+    ppuTileSync( ppu );
+    ppuFindSprites( mm, first, last, &found );
+
+    for ( line = first; line < last; line++ ) {
+        ppuBackgroundLine( ppu, bg );
+        ppuSpriteLine( ppu, line, &found, sp );
+
+        // the leftmost 8 pixels of either can be hidden, and sprite 0
+        // never hits at x 255
+        memset( bg + mm->ppuX, 0, bgClip );
+        memset( sp, 0, spClip );
+        sp[ PPU_FRAME_WIDTH - 1 ] &= ~PPU_SPRITE__ZERO;
+
+        if ( ppuCompose( ppu->frame[ line ], bg + mm->ppuX, sp, mm->palette, gray ) ) {
+            mm->ppuStatus |= PPU_STATUS__SPRITE_0_HIT;
+        }
+
+        ppuNextLine( mm );
+    }
+}
+
+// a 2C02's colours, as captured from the composite output
+
+static const uint8_t ppuColours[ PPU_COLOURS * 3 ] = {
+    0x66, 0x66, 0x66,  0x00, 0x2a, 0x88,  0x14, 0x12, 0xa7,  0x3b, 0x00, 0xa4,
+    0x5c, 0x00, 0x7e,  0x6e, 0x00, 0x40,  0x6c, 0x06, 0x00,  0x56, 0x1d, 0x00,
+    0x33, 0x35, 0x00,  0x0b, 0x48, 0x00,  0x00, 0x52, 0x00,  0x00, 0x4f, 0x08,
+    0x00, 0x40, 0x4d,  0x00, 0x00, 0x00,  0x00, 0x00, 0x00,  0x00, 0x00, 0x00,
+    0xad, 0xad, 0xad,  0x15, 0x5f, 0xd9,  0x42, 0x40, 0xff,  0x75, 0x27, 0xfe,
+    0xa0, 0x1a, 0xcc,  0xb7, 0x1e, 0x7b,  0xb5, 0x31, 0x20,  0x99, 0x4e, 0x00,
+    0x6b, 0x6d, 0x00,  0x38, 0x87, 0x00,  0x0c, 0x93, 0x00,  0x00, 0x8f, 0x32,
+    0x00, 0x7c, 0x8d,  0x00, 0x00, 0x00,  0x00, 0x00, 0x00,  0x00, 0x00, 0x00,
+    0xff, 0xfe, 0xff,  0x64, 0xb0, 0xff,  0x92, 0x90, 0xff,  0xc6, 0x76, 0xff,
+    0xf3, 0x6a, 0xff,  0xfe, 0x6e, 0xcc,  0xfe, 0x81, 0x70,  0xea, 0x9e, 0x22,
+    0xbc, 0xbe, 0x00,  0x88, 0xd8, 0x00,  0x5c, 0xe4, 0x30,  0x45, 0xe0, 0x82,
+    0x48, 0xcd, 0xde,  0x4f, 0x4f, 0x4f,  0x00, 0x00, 0x00,  0x00, 0x00, 0x00,
+    0xff, 0xfe, 0xff,  0xc0, 0xdf, 0xff,  0xd3, 0xd2, 0xff,  0xe8, 0xc8, 0xff,
+    0xfb, 0xc2, 0xff,  0xfe, 0xc4, 0xea,  0xfe, 0xcc, 0xc5,  0xf7, 0xd8, 0xa5,
+    0xe4, 0xe5, 0x94,  0xcf, 0xef, 0x96,  0xbd, 0xf4, 0xab,  0xb3, 0xf3, 0xcc,
+    0xb5, 0xeb, 0xf2,  0xb8, 0xb8, 0xb8,  0x00, 0x00, 0x00,  0x00, 0x00, 0x00,
+};
+
+void ppu2C02Palette( struct ppu2C02 *ppu, const uint8_t *rgb ) {
+    unsigned int e;
+    unsigned int c;
+    unsigned int k;
+    unsigned int ch[3];
+    uint16_t word;
+    uint8_t bytes[2];
+
+    for ( e = 0; e < PPU_EMPHASIS; e++ ) {
+        for ( c = 0; c < PPU_COLOURS; c++ ) {
+            // emphasising one of red, green or blue dims the other two
+            for ( k = 0; k < 3; k++ ) {
+                ch[k] = rgb[ c * 3 + k ];
+                if ( e & ~( 1u << k ) ) {
+                    ch[k] = ch[k] * 191 / 256;
+                }
+            }
+            word = ( ch[0] >> 3 ) << 11 | ( ch[1] >> 2 ) << 5 | ( ch[2] >> 3 );
+            memcpy( bytes, &word, sizeof bytes );
+
+            ppu->colour[ PPU_PLANE__R ][e][c] = ch[0];
+            ppu->colour[ PPU_PLANE__G ][e][c] = ch[1];
+            ppu->colour[ PPU_PLANE__B ][e][c] = ch[2];
+            ppu->colour[ PPU_PLANE__GRAY ][e][c] = ( ch[0] * 77 + ch[1] * 150 + ch[2] * 29 + 128 ) >> 8;
+            ppu->colour[ PPU_PLANE__565_0 ][e][c] = bytes[0];
+            ppu->colour[ PPU_PLANE__565_1 ][e][c] = bytes[1];
+        }
+    }
+}
+
+void ppu2C02Convert( const struct ppu2C02 *ppu, void *out, const size_t pitch, const unsigned int format ) {
+    unsigned int y;
+
+    for ( y = 0; y < PPU_FRAME_HEIGHT; y++ ) {
+        ppuConvertLine( ppu, y, (uint8_t *) out + y * pitch, format );
+    }
+}
+
+void ppu2C02Init( struct ppu2C02 *ppu, struct nesMemoryMap *mm ) {
+    ppu->mm = mm;
+    memset( ppu->frame, 0, sizeof ppu->frame );
+    memset( ppu->emphasis, 0, sizeof ppu->emphasis );
+    ppu2C02Palette( ppu, ppuColours );
+    memset( ppu->tileBase, 0, sizeof ppu->tileBase );
+    memset( ppu->tileValid, 0, sizeof ppu->tileValid );
+}
@@ -1,3 +1,15 @@
+#ifndef __2C02_H
+#define __2C02_H
+
+// The picture processing unit. Its registers and memory live in the
+// memory map with the rest of the machine state, so the CPU side of it
+// works on any map; drawing the picture and the frame timing need a
+// struct ppu2C02, driven by the machine through the frame events.
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct nesMemoryMap;
 
 #define PPU_CTRL_0   0x2000
 #define PPU_CTRL_1   0x2001
@@ -47,7 +59,7 @@
 #define NAME_TABLE_1 0x2400
 #define ATTR_TABLE_1 0x27c0
 #define NAME_TABLE_2 0x2800
-#define ATTR_TABLE_2 0x3bc0
+#define ATTR_TABLE_2 0x2bc0
 #define NAME_TABLE_3 0x2c00
 #define ATTR_TABLE_3 0x2fc0
 
@@ -59,3 +71,89 @@
 #define ATTR_TABLE_LENGTH 0x40
 #define PALETTE_LENGTH 0x10
 
+// SCROLL REGISTERS
+//
+// the VRAM address doubles as the scroll position while rendering:
+// yyy NN YYYYY XXXXX, fine y, nametable, coarse y and coarse x
+
+#define PPU_V__COARSE_X    0x001f
+#define PPU_V__COARSE_Y    0x03e0
+#define PPU_V__NAME_TABLE  0x0c00
+#define PPU_V__FINE_Y      0x7000
+#define PPU_V__HORIZONTAL  ( PPU_V__COARSE_X | 0x0400 )
+#define PPU_V__VERTICAL    ( PPU_V__COARSE_Y | 0x0800 | PPU_V__FINE_Y )
+
+// RENDERING
+
+#define PPU_FRAME_WIDTH   256
+#define PPU_FRAME_HEIGHT  240
+#define PPU_SPRITES       64
+#define PPU_LINE_SPRITES  8
+#define PPU_TILES         512  // in both pattern tables
+#define PPU_TILE_PAGES    8    // 1KB pages of them, as mappers bank them
+#define PPU_COLOURS       64
+#define PPU_EMPHASIS      8    // PPU_CTRL_1__INTENSITY settings
+
+// PIXEL FORMATS
+
+#define PPU_PIXEL__RGBA32  0  // bytes R, G, B, 255
+#define PPU_PIXEL__RGB565  1  // native endian 16 bit words
+#define PPU_PIXEL__GRAY8   2  // luma
+
+#define PPU_PLANE__R       0  // the tables ppu2C02Convert looks colours up in,
+#define PPU_PLANE__G       1  // a byte of output each
+#define PPU_PLANE__B       2
+#define PPU_PLANE__GRAY    3
+#define PPU_PLANE__565_0   4  // the word's bytes in memory order
+#define PPU_PLANE__565_1   5
+#define PPU_PLANES         6
+
+// One frame of NES colour indices, 0-63 each, as the palette RAM gave
+// them, with the colour emphasis bits each line was drawn with.
+// ppu2C02Convert turns it into pixels for a display, a screenshot or a
+// model's input, through tables built from a 64 colour RGB palette.
+//
+// The pattern tables are also kept expanded, each tile row as eight 2-bit
+// pixels a byte apiece with the leftmost first, so that drawing a row is
+// a single load. A page's tiles are expanded as they are first drawn and
+// dropped when the page is banked out or its CHR RAM written.
+
+struct ppu2C02 {
+    struct nesMemoryMap *mm;
+    uint8_t frame[ PPU_FRAME_HEIGHT ][ PPU_FRAME_WIDTH ];
+    uint8_t emphasis[ PPU_FRAME_HEIGHT ];  // PPU_CTRL_1__INTENSITY >> 5
+
+    uint8_t colour[ PPU_PLANES ][ PPU_EMPHASIS ][ PPU_COLOURS ];
+
+    uint64_t tileRows[ PPU_TILES ][ 8 ];
+    const uint8_t *tileBase[ PPU_TILE_PAGES ];  // chrPage the rows were expanded from
+    uint64_t tileValid[ PPU_TILE_PAGES ];       // tiles expanded, a bit each
+};
+
+void ppu2C02Init( struct ppu2C02 *ppu, struct nesMemoryMap *mm );
+
+// rgb is 64 colours of 3 bytes, as in a .pal file; Init loads a 2C02 one
+
+void ppu2C02Palette( struct ppu2C02 *ppu, const uint8_t *rgb );
+
+// writes the frame to out, a line every pitch bytes, in a PPU_PIXEL__ format
+
+void ppu2C02Convert( const struct ppu2C02 *ppu, void *out, const size_t pitch, const unsigned int format );
+
+// the CPU side: $2000-$3FFF and OAM_DMA
+
+uint8_t ppu2C02Read( struct nesMemoryMap *mm, const uint16_t addr );
+void ppu2C02Write( struct nesMemoryMap *mm, const uint16_t addr, const uint8_t data );
+void ppu2C02Dma( struct nesMemoryMap *mm, const uint8_t page );
+
+// frame events, at the dots nes.h gives. Draw takes visible lines first
+// up to last together, for when nothing the PPU sees changed between
+// their rendering dots.
+
+void ppu2C02Draw( struct ppu2C02 *ppu, const unsigned int first, const unsigned int last );
+void ppu2C02VBlankStart( struct nesMemoryMap *mm );
+void ppu2C02VBlankEnd( struct nesMemoryMap *mm );
+void ppu2C02Reload( struct nesMemoryMap *mm );
+unsigned int ppu2C02StatusLine( const struct nesMemoryMap *mm, const unsigned int line );
+
+#endif /* __2C02_H */
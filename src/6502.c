@@ -1,155 +1,47 @@
 #include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "6502.h"
+#include "6502op.h"
+#include "6502jit.h"
+#include "6502trace.h"
 
-#define ON  1
-#define OFF 0
+#if defined(__GNUC__) && !defined(CPU_6502_NO_COMPUTED_GOTO)
+#define CPU_6502_COMPUTED_GOTO
+#endif
+
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
 
 #define NMI_VECTOR_LO 0xfffa
 #define NMI_VECTOR_HI 0xfffb
+#define RESET_VECTOR_LO 0xfffc
+#define RESET_VECTOR_HI 0xfffd
+#define IRQ_VECTOR_LO 0xfffe
+#define IRQ_VECTOR_HI 0xffff
 
-// DATA LOCATIONS
-
-#define LOC_NULL    0
-#define LOC_REG_A   1
-#define LOC_REG_X   2
-#define LOC_REG_Y   3
-#define LOC_REG_SP  4
-#define LOC_REG_PC  5
-#define LOC_REG_P   6
-#define LOC_MEMORY  7
-#define LOC_STACK   8
-
-// ADDRESS MODE OPTIONS
-
-#define ADDR_MODE_IMMEDIATE           ( 1 << 0 )
-#define ADDR_MODE_INDIRECT            ( 1 << 1 )
-#define ADDR_MODE_INDEX               ( 1 << 2 )
-#define ADDR_MODE_INDEX_TIMING        ( 1 << 3 )
-#define ADDR_MODE_INDEX_TIMING__PRE   0
-#define ADDR_MODE_INDEX_TIMING__POST  ( 1 << 3 )
-#define ADDR_MODE_INDEX_REG           ( 1 << 4 )
-#define ADDR_MODE_INDEX_REG__X        0
-#define ADDR_MODE_INDEX_REG__Y        ( 1 << 4 )
-#define ADDR_MODE_RELATIVE            ( 1 << 5 )
-#define ADDR_MODE_ACCUMULATOR         ( 1 << 6 )
-#define ADDR_MODE                     ( 1 << 7 )
-
-// ALU OPERATIONS
-
-#define ALU_MODE_NOP             0
-#define ALU_MODE_ADD             1
-#define ALU_MODE_SUBTRACT        2
-#define ALU_MODE_OR              3
-#define ALU_MODE_AND             4
-#define ALU_MODE_XOR             5
-#define ALU_MODE_SHIFT_LEFT      6
-#define ALU_MODE_SHIFT_RIGHT     7
-#define ALU_MODE_ROTATE_LEFT     8
-#define ALU_MODE_ROTATE_RIGHT    9
-#define ALU_MODE_INCREMENT       10
-#define ALU_MODE_DECREMENT       11
-#define ALU_MODE_CMP             12
-
-// BIT MASKS FOR STATUS REGISTER
-
-#define STATUS_C  (1 << 0)  // CARRY
-#define STATUS_Z  (1 << 1)  // ZERO
-#define STATUS_I  (1 << 2)  // INTERRUPT DISABLE
-#define STATUS_D  (1 << 3)  // DECIMAL MODE
-#define STATUS_B  (1 << 4)  // BREAK (SOFTWARE INTERRUPT)
-#define STATUS_V  (1 << 6)  // OVERFLOW
-#define STATUS_N  (1 << 7)  // NEGATIVE
-
-#define STATUS(CPU,MASK) ( !!( CPU->P & MASK ) )
-
-#define READ(A) ( cpu->mm->read( cpu->mm,A ) )
-#define READ16(A) ( ( ( uint16_t ) READ(A+1) << 8 ) | READ(A) )
-#define WRITE(A,X) ( cpu->mm->write( cpu->mm,A,X) )
+#define INTERRUPT_CYCLES 7
 
-#define STACK_PUSH(X) ( WRITE( (cpu->SP)-- + 0x0100 , X ) )
-#define STACK_PULL() ( READ( ++(cpu->SP) + 0x0100 ) )
+#define CARRY() ( cpu->flagC & 1 )
 
-enum AddrMode {
-    ADDR_MODE__IMPLIED,
-    ADDR_MODE__IMMEDIATE,
-    ADDR_MODE__ACCUMULATOR,
-    ADDR_MODE__ZERO_PAGE,
-    ADDR_MODE__ABSOLUTE,
-    ADDR_MODE__RELATIVE,
-    ADDR_MODE__IDX_X,
-    ADDR_MODE__IDX_Y,
-    ADDR_MODE__ZERO_PAGE_IDX_X,
-    ADDR_MODE__ZERO_PAGE_IDX_Y,
-    ADDR_MODE__INDIRECT,
-    ADDR_MODE__INDEX_INDIRECT,
-    ADDR_MODE__INDIRECT_INDEX,
-};
+#define READ(A) ( nesMemRead( cpu->mm,A ) )
+#define READ16(A) ( ( ( uint16_t ) READ(A+1) << 8 ) | READ(A) )
+#define READ16_WRAP(A) ( ( ( uint16_t ) READ( ( (A) & 0xff00 ) | ( ( (A) + 1 ) & 0x00ff ) ) << 8 ) | READ(A) )
+#define WRITE(A,X) ( cpu6502Write( cpu,A,X) )
 
-typedef enum AddrMode addr_mode_t;
-
-enum Instruction {
-    INSTRUCTION__NOP,
-    INSTRUCTION__ADC,
-    INSTRUCTION__AND,
-    INSTRUCTION__ASL,
-    INSTRUCTION__BCC,
-    INSTRUCTION__BCS,
-    INSTRUCTION__BEQ,
-    INSTRUCTION__BIT,
-    INSTRUCTION__BMI,
-    INSTRUCTION__BNE,
-    INSTRUCTION__BPL,
-    INSTRUCTION__BRK,
-    INSTRUCTION__BVC,
-    INSTRUCTION__BVS,
-    INSTRUCTION__CLC,
-    INSTRUCTION__CLD,
-    INSTRUCTION__CLI,
-    INSTRUCTION__CLV,
-    INSTRUCTION__CMP,
-    INSTRUCTION__CPX,
-    INSTRUCTION__CPY,
-    INSTRUCTION__DEC,
-    INSTRUCTION__DEX,
-    INSTRUCTION__DEY,
-    INSTRUCTION__EOR,
-    INSTRUCTION__INC,
-    INSTRUCTION__INX,
-    INSTRUCTION__INY,
-    INSTRUCTION__JMP,
-    INSTRUCTION__JSR,
-    INSTRUCTION__LDA,
-    INSTRUCTION__LDX,
-    INSTRUCTION__LDY,
-    INSTRUCTION__LSR,
-    INSTRUCTION__ORA,
-    INSTRUCTION__PHA,
-    INSTRUCTION__PHP,
-    INSTRUCTION__PLA,
-    INSTRUCTION__PLP,
-    INSTRUCTION__ROL,
-    INSTRUCTION__ROR,
-    INSTRUCTION__RTI,
-    INSTRUCTION__RTS,
-    INSTRUCTION__SBC,
-    INSTRUCTION__SEC,
-    INSTRUCTION__SED,
-    INSTRUCTION__SEI,
-    INSTRUCTION__STA,
-    INSTRUCTION__STX,
-    INSTRUCTION__STY,
-    INSTRUCTION__TAX,
-    INSTRUCTION__TAY,
-    INSTRUCTION__TSX,
-    INSTRUCTION__TXA,
-    INSTRUCTION__TXS,
-    INSTRUCTION__TYA,
-};
+// writes that may hit decoded code or remap the page table keep the
+// decoded instruction cache coherent
 
-typedef enum Instruction instruction_t;
+static ALWAYS_INLINE void cpu6502Write( struct cpu6502 *cpu, const uint16_t addr, const uint8_t data );
 
-char instructionStringMap[56][4] = {
+#define STACK_PUSH(X) ( WRITE( (cpu->SP)-- + 0x0100 , X ) )
+#define STACK_PULL() ( READ( ++(cpu->SP) + 0x0100 ) )
+
+const char instructionStringMap[56][4] = {
     "NOP",
     "ADC",
     "AND",
@@ -208,639 +100,30 @@ char instructionStringMap[56][4] = {
     "TYA",
 };
 
-// ADDRESS MODE DEFINITIONS
-
-#define D_ADDR_MODE__IMPLIED \
-        .addr_mode_type = ADDR_MODE__IMPLIED, \
-        .size = 1,
-
-#define D_ADDR_MODE__ACCUMULATOR \
-        .addr_mode_type = ADDR_MODE__ACCUMULATOR, \
-        .addr_mode = ( ADDR_MODE | ADDR_MODE_ACCUMULATOR ), \
-        .size = 1,
-
-#define D_ADDR_MODE__IMMEDIATE \
-        .addr_mode_type = ADDR_MODE__IMMEDIATE, \
-        .addr_mode = ( ADDR_MODE | ADDR_MODE_IMMEDIATE ), \
-        .size = 2,
-
-#define D_ADDR_MODE__ZERO_PAGE \
-        .addr_mode_type = ADDR_MODE__ZERO_PAGE, \
-        .addr_mode = ( ADDR_MODE ), \
-        .size = 2,
-
-#define D_ADDR_MODE__ABSOLUTE \
-        .addr_mode_type = ADDR_MODE__ABSOLUTE, \
-        .addr_mode = ( ADDR_MODE ), \
-        .size = 3,
-
-#define D_ADDR_MODE__RELATIVE \
-        .addr_mode_type = ADDR_MODE__RELATIVE, \
-        .addr_mode = ( ADDR_MODE | ADDR_MODE_RELATIVE ), \
-        .size = 2,
-
-#define D_ADDR_MODE__IDX_X \
-        .addr_mode_type = ADDR_MODE__IDX_X, \
-        .addr_mode = ( ADDR_MODE | ADDR_MODE_INDEX | ADDR_MODE_INDEX_REG__X ), \
-        .size = 3,
-
-#define D_ADDR_MODE__IDX_Y \
-        .addr_mode_type = ADDR_MODE__IDX_Y, \
-        .addr_mode = ( ADDR_MODE | ADDR_MODE_INDEX | ADDR_MODE_INDEX_REG__Y ), \
-        .size = 3,
-
-#define D_ADDR_MODE__ZERO_PAGE_IDX_X \
-        .addr_mode_type = ADDR_MODE__ZERO_PAGE_IDX_X, \
-        .addr_mode = ( ADDR_MODE | ADDR_MODE_INDEX | ADDR_MODE_INDEX_REG__X ), \
-        .size = 2,
-
-#define D_ADDR_MODE__ZERO_PAGE_IDX_Y \
-        .addr_mode_type = ADDR_MODE__ZERO_PAGE_IDX_Y, \
-        .addr_mode = ( ADDR_MODE | ADDR_MODE_INDEX | ADDR_MODE_INDEX_REG__X ), \
-        .size = 2,
-
-#define D_ADDR_MODE__INDIRECT \
-        .addr_mode_type = ADDR_MODE__INDIRECT, \
-        .addr_mode = ( ADDR_MODE | ADDR_MODE_INDIRECT ), \
-        .size = 3, \
-
-#define D_ADDR_MODE__INDEX_INDIRECT \
-        .addr_mode_type = ADDR_MODE__INDEX_INDIRECT, \
-        .addr_mode = ( ADDR_MODE | ADDR_MODE_INDEX | ADDR_MODE_INDEX_REG__X | ADDR_MODE_INDEX_TIMING__PRE | ADDR_MODE_INDIRECT ), \
-        .size = 2,
-#define D_ADDR_MODE__INDIRECT_INDEX \
-        .addr_mode_type = ADDR_MODE__INDIRECT_INDEX, \
-        .addr_mode = ( ADDR_MODE | ADDR_MODE_INDEX | ADDR_MODE_INDEX_REG__Y | ADDR_MODE_INDEX_TIMING__POST | ADDR_MODE_INDIRECT ), \
-        .size = 2,
-
-// INSTRUCTION DEFINITIONS
-
-#define D_INSTRUCTION__ADC \
-        .instruction_type = INSTRUCTION__ADC,\
-        .src = LOC_MEMORY, \
-        .aux = LOC_REG_A, \
-        .dst = LOC_REG_A, \
-        .alu_mode = ALU_MODE_ADD, \
-        .status_update = ( STATUS_Z | STATUS_N | STATUS_V | STATUS_C ),
-
-#define D_INSTRUCTION__AND \
-        .instruction_type = INSTRUCTION__AND,\
-        .src = LOC_MEMORY, \
-        .aux = LOC_REG_A, \
-        .dst = LOC_REG_A, \
-        .alu_mode = ALU_MODE_AND, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__ASL \
-        .instruction_type = INSTRUCTION__ASL,\
-        .src = LOC_MEMORY, \
-        .dst = LOC_MEMORY, \
-        .alu_mode = ALU_MODE_SHIFT_LEFT, \
-        .status_update = ( STATUS_Z | STATUS_N | STATUS_C ),
-
-#define D_INSTRUCTION__BCC \
-        .instruction_type = INSTRUCTION__BCC,\
-        .branch_on = STATUS_C, \
-        .branch_if = OFF,
-
-#define D_INSTRUCTION__BCS \
-        .instruction_type = INSTRUCTION__BCS,\
-        .branch_on = STATUS_C, \
-        .branch_if = ON,
-
-#define D_INSTRUCTION__BEQ \
-        .instruction_type = INSTRUCTION__BEQ,\
-        .branch_on = STATUS_Z, \
-        .branch_if = ON,
-
-#define D_INSTRUCTION__BIT \
-        .instruction_type = INSTRUCTION__BIT,\
-        .src = LOC_MEMORY, \
-        .aux = LOC_REG_A, \
-        .dst = LOC_NULL, \
-        .alu_mode = ALU_MODE_AND, \
-        .status_update = ( STATUS_Z | STATUS_N | STATUS_V ),
-
-#define D_INSTRUCTION__BMI \
-        .instruction_type = INSTRUCTION__BMI,\
-        .branch_on = STATUS_N, \
-        .branch_if = ON,
-
-#define D_INSTRUCTION__BNE \
-        .instruction_type = INSTRUCTION__BNE,\
-        .branch_on = STATUS_Z, \
-        .branch_if = OFF,
-
-#define D_INSTRUCTION__BPL \
-        .instruction_type = INSTRUCTION__BPL,\
-        .branch_on = STATUS_N, \
-        .branch_if = OFF,
-
-#define D_INSTRUCTION__BRK \
-        .instruction_type = INSTRUCTION__BRK,\
-        .status_mod = STATUS_B, \
-        .status_val = ON,
-
-#define D_INSTRUCTION__BVC \
-        .instruction_type = INSTRUCTION__BVC,\
-        .branch_on = STATUS_V, \
-        .branch_if = OFF,
-
-#define D_INSTRUCTION__BVS \
-        .instruction_type = INSTRUCTION__BVS,\
-        .branch_on = STATUS_V, \
-        .branch_if = OFF,
-
-#define D_INSTRUCTION__CLC \
-        .instruction_type = INSTRUCTION__CLC,\
-        .status_mod = STATUS_C, \
-        .status_val = OFF,
-
-#define D_INSTRUCTION__CLD \
-        .instruction_type = INSTRUCTION__CLD,\
-        .status_mod = STATUS_D, \
-        .status_val = OFF,
-
-#define D_INSTRUCTION__CLI \
-        .instruction_type = INSTRUCTION__CLI,\
-        .status_mod = STATUS_I, \
-        .status_val = OFF,
-
-#define D_INSTRUCTION__CLV \
-        .instruction_type = INSTRUCTION__CLV,\
-        .status_mod = STATUS_V, \
-        .status_val = OFF,
-
-#define D_INSTRUCTION__CMP \
-        .instruction_type = INSTRUCTION__CMP,\
-        .src = LOC_MEMORY, \
-        .aux = LOC_REG_A, \
-        .dst = LOC_NULL, \
-        .alu_mode = ALU_MODE_CMP, \
-        .status_update = ( STATUS_Z | STATUS_N | STATUS_C ),
-
-#define D_INSTRUCTION__CPX \
-        .instruction_type = INSTRUCTION__CPX,\
-        .src = LOC_MEMORY, \
-        .aux = LOC_REG_X, \
-        .dst = LOC_NULL, \
-        .alu_mode = ALU_MODE_CMP, \
-        .status_update = ( STATUS_Z | STATUS_N | STATUS_C ),
-
-#define D_INSTRUCTION__CPY \
-        .instruction_type = INSTRUCTION__CPY,\
-        .src = LOC_MEMORY, \
-        .aux = LOC_REG_Y, \
-        .dst = LOC_NULL, \
-        .alu_mode = ALU_MODE_CMP, \
-        .status_update = ( STATUS_Z | STATUS_N | STATUS_C ),
-
-#define D_INSTRUCTION__DEC \
-        .instruction_type = INSTRUCTION__DEC,\
-        .src = LOC_MEMORY, \
-        .dst = LOC_MEMORY, \
-        .alu_mode = ALU_MODE_DECREMENT, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__DEX \
-        .instruction_type = INSTRUCTION__DEX,\
-        .src = LOC_REG_X, \
-        .dst = LOC_REG_X, \
-        .alu_mode = ALU_MODE_DECREMENT, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__DEY \
-        .instruction_type = INSTRUCTION__DEY,\
-        .src = LOC_REG_Y, \
-        .dst = LOC_REG_Y, \
-        .alu_mode = ALU_MODE_DECREMENT, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__EOR \
-        .instruction_type = INSTRUCTION__EOR,\
-        .src = LOC_MEMORY, \
-        .aux = LOC_REG_A, \
-        .dst = LOC_REG_A, \
-        .alu_mode = ALU_MODE_XOR, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__INC \
-        .instruction_type = INSTRUCTION__INC,\
-        .src = LOC_MEMORY, \
-        .dst = LOC_MEMORY, \
-        .alu_mode = ALU_MODE_INCREMENT, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__INX \
-        .instruction_type = INSTRUCTION__INX,\
-        .src = LOC_REG_X, \
-        .dst = LOC_REG_X, \
-        .alu_mode = ALU_MODE_INCREMENT, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__INY \
-        .instruction_type = INSTRUCTION__INY,\
-        .src = LOC_REG_Y, \
-        .dst = LOC_REG_Y, \
-        .alu_mode = ALU_MODE_INCREMENT, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__JMP \
-        .instruction_type = INSTRUCTION__JMP,
-
-#define D_INSTRUCTION__JSR \
-        .instruction_type = INSTRUCTION__JSR,
-
-#define D_INSTRUCTION__LDA \
-        .instruction_type = INSTRUCTION__LDA,\
-        .src = LOC_MEMORY, \
-        .dst = LOC_REG_A, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__LDX \
-        .instruction_type = INSTRUCTION__LDX,\
-        .src = LOC_MEMORY, \
-        .dst = LOC_REG_X, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__LDY \
-        .instruction_type = INSTRUCTION__LDY,\
-        .src = LOC_MEMORY, \
-        .dst = LOC_REG_Y, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__LSR \
-        .instruction_type = INSTRUCTION__LSR,\
-        .src = LOC_MEMORY, \
-        .dst = LOC_MEMORY, \
-        .alu_mode = ALU_MODE_SHIFT_RIGHT, \
-        .status_update = ( STATUS_Z | STATUS_N | STATUS_C ),
-
-#define D_INSTRUCTION__NOP \
-        .instruction_type = INSTRUCTION__NOP,\
-
-#define D_INSTRUCTION__ORA \
-        .instruction_type = INSTRUCTION__ORA,\
-        .src = LOC_MEMORY, \
-        .aux = LOC_REG_A, \
-        .dst = LOC_REG_A, \
-        .alu_mode = ALU_MODE_OR, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__PHA \
-        .instruction_type = INSTRUCTION__PHA,\
-        .src = LOC_REG_A, \
-        .dst = LOC_STACK, \
-
-#define D_INSTRUCTION__PHP \
-        .instruction_type = INSTRUCTION__PHP,\
-        .src = LOC_REG_P, \
-        .dst = LOC_STACK, \
-
-#define D_INSTRUCTION__PLA \
-        .instruction_type = INSTRUCTION__PLA,\
-        .src = LOC_STACK, \
-        .dst = LOC_REG_A, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__PLP \
-        .instruction_type = INSTRUCTION__PLP,\
-        .src = LOC_STACK, \
-        .dst = LOC_REG_P, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__ROL \
-        .instruction_type = INSTRUCTION__ROL,\
-        .src = LOC_MEMORY, \
-        .dst = LOC_MEMORY, \
-        .alu_mode = ALU_MODE_ROTATE_LEFT, \
-        .status_update = ( STATUS_Z | STATUS_N | STATUS_C ),
-
-#define D_INSTRUCTION__ROR \
-        .instruction_type = INSTRUCTION__ROR,\
-        .src = LOC_MEMORY, \
-        .dst = LOC_MEMORY, \
-        .alu_mode = ALU_MODE_ROTATE_RIGHT, \
-        .status_update = ( STATUS_Z | STATUS_N | STATUS_C ),
-
-#define D_INSTRUCTION__RTI \
-        .instruction_type = INSTRUCTION__RTI,\
-
-#define D_INSTRUCTION__RTS \
-        .instruction_type = INSTRUCTION__RTS,\
-
-#define D_INSTRUCTION__SBC \
-        .instruction_type = INSTRUCTION__SBC,\
-        .src = LOC_MEMORY, \
-        .aux = LOC_REG_A, \
-        .dst = LOC_REG_A, \
-        .alu_mode = ALU_MODE_SUBTRACT, \
-        .status_update = ( STATUS_Z | STATUS_N | STATUS_C | STATUS_V ),
-
-#define D_INSTRUCTION__SEC \
-        .instruction_type = INSTRUCTION__SEC,\
-        .status_mod = STATUS_C, \
-        .status_val = ON,
-
-#define D_INSTRUCTION__SED \
-        .instruction_type = INSTRUCTION__SED,\
-        .status_mod = STATUS_D, \
-        .status_val = ON,
-
-#define D_INSTRUCTION__SEI \
-        .instruction_type = INSTRUCTION__SEI,\
-        .status_mod = STATUS_I, \
-        .status_val = ON,
-
-#define D_INSTRUCTION__STA \
-        .instruction_type = INSTRUCTION__STA,\
-        .src = LOC_REG_A, \
-        .dst = LOC_MEMORY,
-
-#define D_INSTRUCTION__STX \
-        .instruction_type = INSTRUCTION__STX,\
-        .src = LOC_REG_X, \
-        .dst = LOC_MEMORY, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__STY \
-        .instruction_type = INSTRUCTION__STY,\
-        .src = LOC_REG_Y, \
-        .dst = LOC_MEMORY, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__TAX \
-        .instruction_type = INSTRUCTION__TAX,\
-        .src = LOC_REG_A, \
-        .dst = LOC_REG_X, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__TAY \
-        .instruction_type = INSTRUCTION__TAY,\
-        .src = LOC_REG_A, \
-        .dst = LOC_REG_Y, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__TSX \
-        .instruction_type = INSTRUCTION__TSX,\
-        .src = LOC_REG_SP, \
-        .dst = LOC_REG_X, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__TXA \
-        .instruction_type = INSTRUCTION__TXA,\
-        .src = LOC_REG_X, \
-        .dst = LOC_REG_A, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-#define D_INSTRUCTION__TXS \
-        .instruction_type = INSTRUCTION__TXS,\
-        .src = LOC_REG_X, \
-        .dst = LOC_REG_SP,
-
-#define D_INSTRUCTION__TYA \
-        .instruction_type = INSTRUCTION__TYA,\
-        .src = LOC_REG_Y, \
-        .dst = LOC_REG_A, \
-        .status_update = ( STATUS_Z | STATUS_N ),
-
-struct operation {
-
-    addr_mode_t addr_mode_type;
-    instruction_t instruction_type;
-
-    unsigned int size;
-    unsigned int addr_mode;
-
-    unsigned int src;
-    unsigned int aux;
-    unsigned int dst;
-    unsigned int alu_mode;
-
-    uint8_t branch_on;
-    uint8_t branch_if;
-
-    uint8_t status_update;
-
-    uint8_t status_mod;
-    uint8_t status_val;
+#define D_OPERATION(OPC,INS,MODE,CYC,PG) \
+    [OPC] = { D_INSTRUCTION__##INS D_ADDR_MODE__##MODE D_CYCLES(CYC,PG) },
 
+const struct operation instructionSet[256] = {
+    CPU_6502_OPCODES(D_OPERATION)
 };
 
-struct operation instructionSet[256] = {
-
-    [0x69] = { D_INSTRUCTION__ADC  D_ADDR_MODE__IMMEDIATE },
-    [0x65] = { D_INSTRUCTION__ADC  D_ADDR_MODE__ZERO_PAGE },
-    [0x75] = { D_INSTRUCTION__ADC  D_ADDR_MODE__ZERO_PAGE_IDX_X },
-    [0x6d] = { D_INSTRUCTION__ADC  D_ADDR_MODE__ABSOLUTE },
-    [0x7d] = { D_INSTRUCTION__ADC  D_ADDR_MODE__IDX_X },
-    [0x79] = { D_INSTRUCTION__ADC  D_ADDR_MODE__IDX_Y },
-    [0x61] = { D_INSTRUCTION__ADC  D_ADDR_MODE__INDEX_INDIRECT },
-    [0x71] = { D_INSTRUCTION__ADC  D_ADDR_MODE__INDIRECT_INDEX },
-
-    [0x29] = { D_INSTRUCTION__AND  D_ADDR_MODE__IMMEDIATE },
-    [0x25] = { D_INSTRUCTION__AND  D_ADDR_MODE__ZERO_PAGE },
-    [0x35] = { D_INSTRUCTION__AND  D_ADDR_MODE__ZERO_PAGE_IDX_X },
-    [0x2d] = { D_INSTRUCTION__AND  D_ADDR_MODE__ABSOLUTE },
-    [0x3d] = { D_INSTRUCTION__AND  D_ADDR_MODE__IDX_X },
-    [0x39] = { D_INSTRUCTION__AND  D_ADDR_MODE__IDX_Y },
-    [0x21] = { D_INSTRUCTION__AND  D_ADDR_MODE__INDEX_INDIRECT },
-    [0x31] = { D_INSTRUCTION__AND  D_ADDR_MODE__INDIRECT_INDEX },
-
-    [0x0a] = { D_INSTRUCTION__ASL  D_ADDR_MODE__ACCUMULATOR },
-    [0x06] = { D_INSTRUCTION__ASL  D_ADDR_MODE__ZERO_PAGE },
-    [0x16] = { D_INSTRUCTION__ASL  D_ADDR_MODE__ZERO_PAGE_IDX_X },
-    [0x0e] = { D_INSTRUCTION__ASL  D_ADDR_MODE__ABSOLUTE },
-    [0x1e] = { D_INSTRUCTION__ASL  D_ADDR_MODE__IDX_X },
-
-    [0x90] = { D_INSTRUCTION__BCC  D_ADDR_MODE__RELATIVE },
-
-    [0xb0] = { D_INSTRUCTION__BCS  D_ADDR_MODE__RELATIVE },
-
-    [0xf0] = { D_INSTRUCTION__BEQ  D_ADDR_MODE__RELATIVE },
-
-    [0x24] = { D_INSTRUCTION__BIT  D_ADDR_MODE__ZERO_PAGE },
-    [0x2c] = { D_INSTRUCTION__BIT  D_ADDR_MODE__ABSOLUTE },
-
-    [0x30] = { D_INSTRUCTION__BMI  D_ADDR_MODE__RELATIVE },
-
-    [0xd0] = { D_INSTRUCTION__BNE  D_ADDR_MODE__RELATIVE },
-
-    [0x10] = { D_INSTRUCTION__BPL  D_ADDR_MODE__RELATIVE },
-
-    [0x00] = { D_INSTRUCTION__BRK  D_ADDR_MODE__IMPLIED },
-
-    [0x50] = { D_INSTRUCTION__BVC  D_ADDR_MODE__RELATIVE },
-
-    [0x70] = { D_INSTRUCTION__BVS  D_ADDR_MODE__RELATIVE },
-
-    [0x18] = { D_INSTRUCTION__CLC  D_ADDR_MODE__IMPLIED },
-
-    [0xd8] = { D_INSTRUCTION__CLD  D_ADDR_MODE__IMPLIED },
-
-    [0x58] = { D_INSTRUCTION__CLI  D_ADDR_MODE__IMPLIED },
-
-    [0xb8] = { D_INSTRUCTION__CLV  D_ADDR_MODE__IMPLIED },
-
-    [0xc9] = { D_INSTRUCTION__CMP  D_ADDR_MODE__IMMEDIATE },
-    [0xc5] = { D_INSTRUCTION__CMP  D_ADDR_MODE__ZERO_PAGE },
-    [0xd5] = { D_INSTRUCTION__CMP  D_ADDR_MODE__ZERO_PAGE_IDX_X },
-    [0xcd] = { D_INSTRUCTION__CMP  D_ADDR_MODE__ABSOLUTE },
-    [0xdd] = { D_INSTRUCTION__CMP  D_ADDR_MODE__IDX_X },
-    [0xd9] = { D_INSTRUCTION__CMP  D_ADDR_MODE__IDX_Y },
-    [0xc1] = { D_INSTRUCTION__CMP  D_ADDR_MODE__INDEX_INDIRECT },
-    [0xd1] = { D_INSTRUCTION__CMP  D_ADDR_MODE__INDIRECT_INDEX },
-
-    [0xe0] = { D_INSTRUCTION__CPX  D_ADDR_MODE__IMMEDIATE },
-    [0xe4] = { D_INSTRUCTION__CPX  D_ADDR_MODE__ZERO_PAGE },   
-    [0xec] = { D_INSTRUCTION__CPX  D_ADDR_MODE__ABSOLUTE },
-
-    [0xc0] = { D_INSTRUCTION__CPY  D_ADDR_MODE__IMMEDIATE },
-    [0xc4] = { D_INSTRUCTION__CPY  D_ADDR_MODE__ZERO_PAGE },   
-    [0xcc] = { D_INSTRUCTION__CPY  D_ADDR_MODE__ABSOLUTE },
-
-    [0xc6] = { D_INSTRUCTION__DEC  D_ADDR_MODE__ZERO_PAGE },
-    [0xd6] = { D_INSTRUCTION__DEC  D_ADDR_MODE__ZERO_PAGE_IDX_X },
-    [0xce] = { D_INSTRUCTION__DEC  D_ADDR_MODE__ABSOLUTE },
-    [0xde] = { D_INSTRUCTION__DEC  D_ADDR_MODE__IDX_X },
-
-    [0xca] = { D_INSTRUCTION__DEX  D_ADDR_MODE__IMPLIED },
-
-    [0x88] = { D_INSTRUCTION__DEY  D_ADDR_MODE__IMPLIED },
-
-    [0x49] = { D_INSTRUCTION__EOR  D_ADDR_MODE__IMMEDIATE },
-    [0x45] = { D_INSTRUCTION__EOR  D_ADDR_MODE__ZERO_PAGE },
-    [0x55] = { D_INSTRUCTION__EOR  D_ADDR_MODE__ZERO_PAGE_IDX_X },
-    [0x4d] = { D_INSTRUCTION__EOR  D_ADDR_MODE__ABSOLUTE },
-    [0x5d] = { D_INSTRUCTION__EOR  D_ADDR_MODE__IDX_X },
-    [0x59] = { D_INSTRUCTION__EOR  D_ADDR_MODE__IDX_Y },
-    [0x41] = { D_INSTRUCTION__EOR  D_ADDR_MODE__INDEX_INDIRECT },
-    [0x51] = { D_INSTRUCTION__EOR  D_ADDR_MODE__INDIRECT_INDEX },
-    
-    [0xe6] = { D_INSTRUCTION__INC  D_ADDR_MODE__ZERO_PAGE },
-    [0xf6] = { D_INSTRUCTION__INC  D_ADDR_MODE__ZERO_PAGE_IDX_X },
-    [0xee] = { D_INSTRUCTION__INC  D_ADDR_MODE__ABSOLUTE },
-    [0xfe] = { D_INSTRUCTION__INC  D_ADDR_MODE__IDX_X },
-
-    [0xe8] = { D_INSTRUCTION__INX  D_ADDR_MODE__IMPLIED },
-    [0xc8] = { D_INSTRUCTION__INY  D_ADDR_MODE__IMPLIED },
-
-    [0x4c] = { D_INSTRUCTION__JMP  D_ADDR_MODE__ABSOLUTE },
-    [0x6c] = { D_INSTRUCTION__JMP  D_ADDR_MODE__INDIRECT },
-
-    [0x20] = { D_INSTRUCTION__JSR  D_ADDR_MODE__ABSOLUTE },
-
-    [0xa9] = { D_INSTRUCTION__LDA  D_ADDR_MODE__IMMEDIATE },
-    [0xa5] = { D_INSTRUCTION__LDA  D_ADDR_MODE__ZERO_PAGE },
-    [0xb5] = { D_INSTRUCTION__LDA  D_ADDR_MODE__ZERO_PAGE_IDX_X },
-    [0xad] = { D_INSTRUCTION__LDA  D_ADDR_MODE__ABSOLUTE },
-    [0xbd] = { D_INSTRUCTION__LDA  D_ADDR_MODE__IDX_X },
-    [0xb9] = { D_INSTRUCTION__LDA  D_ADDR_MODE__IDX_Y },
-    [0xa1] = { D_INSTRUCTION__LDA  D_ADDR_MODE__INDEX_INDIRECT },
-    [0xb1] = { D_INSTRUCTION__LDA  D_ADDR_MODE__INDIRECT_INDEX },
-
-    [0xa2] = { D_INSTRUCTION__LDX  D_ADDR_MODE__IMMEDIATE },
-    [0xa6] = { D_INSTRUCTION__LDX  D_ADDR_MODE__ZERO_PAGE },
-    [0xb6] = { D_INSTRUCTION__LDX  D_ADDR_MODE__ZERO_PAGE_IDX_Y },
-    [0xae] = { D_INSTRUCTION__LDX  D_ADDR_MODE__ABSOLUTE },
-    [0xbe] = { D_INSTRUCTION__LDX  D_ADDR_MODE__IDX_Y },
-
-    [0xa0] = { D_INSTRUCTION__LDY  D_ADDR_MODE__IMMEDIATE },
-    [0xa4] = { D_INSTRUCTION__LDY  D_ADDR_MODE__ZERO_PAGE },
-    [0xb4] = { D_INSTRUCTION__LDY  D_ADDR_MODE__ZERO_PAGE_IDX_X },
-    [0xac] = { D_INSTRUCTION__LDY  D_ADDR_MODE__ABSOLUTE },
-    [0xbc] = { D_INSTRUCTION__LDY  D_ADDR_MODE__IDX_X },
-    
-    [0x4a] = { D_INSTRUCTION__LSR  D_ADDR_MODE__ACCUMULATOR },
-    [0x46] = { D_INSTRUCTION__LSR  D_ADDR_MODE__ZERO_PAGE },
-    [0x56] = { D_INSTRUCTION__LSR  D_ADDR_MODE__ZERO_PAGE_IDX_X },
-    [0x4e] = { D_INSTRUCTION__LSR  D_ADDR_MODE__ABSOLUTE },
-    [0x5e] = { D_INSTRUCTION__LSR  D_ADDR_MODE__IDX_X },
-
-    [0xea] = { D_INSTRUCTION__NOP  D_ADDR_MODE__IMPLIED},
-
-    [0x09] = { D_INSTRUCTION__ORA  D_ADDR_MODE__IMMEDIATE },
-    [0x05] = { D_INSTRUCTION__ORA  D_ADDR_MODE__ZERO_PAGE },
-    [0x15] = { D_INSTRUCTION__ORA  D_ADDR_MODE__ZERO_PAGE_IDX_X },
-    [0x0d] = { D_INSTRUCTION__ORA  D_ADDR_MODE__ABSOLUTE },
-    [0x1d] = { D_INSTRUCTION__ORA  D_ADDR_MODE__IDX_X },
-    [0x19] = { D_INSTRUCTION__ORA  D_ADDR_MODE__IDX_Y },
-    [0x01] = { D_INSTRUCTION__ORA  D_ADDR_MODE__INDEX_INDIRECT },
-    [0x11] = { D_INSTRUCTION__ORA  D_ADDR_MODE__INDIRECT_INDEX },
-
-    [0x48] = { D_INSTRUCTION__PHA  D_ADDR_MODE__IMPLIED },
-
-    [0x08] = { D_INSTRUCTION__PHP  D_ADDR_MODE__IMPLIED },
-
-    [0x68] = { D_INSTRUCTION__PLA  D_ADDR_MODE__IMPLIED },
-    
-    [0x28] = { D_INSTRUCTION__PLP  D_ADDR_MODE__IMPLIED },
-
-    [0x2a] = { D_INSTRUCTION__ROL  D_ADDR_MODE__ACCUMULATOR },
-    [0x26] = { D_INSTRUCTION__ROL  D_ADDR_MODE__ZERO_PAGE },
-    [0x36] = { D_INSTRUCTION__ROL  D_ADDR_MODE__ZERO_PAGE_IDX_X },
-    [0x2e] = { D_INSTRUCTION__ROL  D_ADDR_MODE__ABSOLUTE },
-    [0x3e] = { D_INSTRUCTION__ROL  D_ADDR_MODE__IDX_X },
-
-    [0x6a] = { D_INSTRUCTION__ROR  D_ADDR_MODE__ACCUMULATOR },
-    [0x66] = { D_INSTRUCTION__ROR  D_ADDR_MODE__ZERO_PAGE },
-    [0x76] = { D_INSTRUCTION__ROR  D_ADDR_MODE__ZERO_PAGE_IDX_X },
-    [0x6e] = { D_INSTRUCTION__ROR  D_ADDR_MODE__ABSOLUTE },
-    [0x7e] = { D_INSTRUCTION__ROR  D_ADDR_MODE__IDX_X },
-
-    [0x40] = { D_INSTRUCTION__RTI  D_ADDR_MODE__IMPLIED },
-
-    [0x60] = { D_INSTRUCTION__RTS  D_ADDR_MODE__IMPLIED},
-
-    [0xe9] = { D_INSTRUCTION__SBC  D_ADDR_MODE__IMMEDIATE },
-    [0xe5] = { D_INSTRUCTION__SBC  D_ADDR_MODE__ZERO_PAGE },
-    [0xf5] = { D_INSTRUCTION__SBC  D_ADDR_MODE__ZERO_PAGE_IDX_X },
-    [0xed] = { D_INSTRUCTION__SBC  D_ADDR_MODE__ABSOLUTE },
-    [0xfd] = { D_INSTRUCTION__SBC  D_ADDR_MODE__IDX_X },
-    [0xf9] = { D_INSTRUCTION__SBC  D_ADDR_MODE__IDX_Y },
-    [0xe1] = { D_INSTRUCTION__SBC  D_ADDR_MODE__INDEX_INDIRECT },
-    [0xf1] = { D_INSTRUCTION__SBC  D_ADDR_MODE__INDIRECT_INDEX },
-
-    [0x38] = { D_INSTRUCTION__SEC  D_ADDR_MODE__IMPLIED },
-    
-    [0xf8] = { D_INSTRUCTION__SED  D_ADDR_MODE__IMPLIED },
-
-    [0x78] = { D_INSTRUCTION__SEI  D_ADDR_MODE__IMPLIED },
-
-    [0x85] = { D_INSTRUCTION__STA  D_ADDR_MODE__ZERO_PAGE },
-    [0x95] = { D_INSTRUCTION__STA  D_ADDR_MODE__ZERO_PAGE_IDX_X },
-    [0x8d] = { D_INSTRUCTION__STA  D_ADDR_MODE__ABSOLUTE },
-    [0x9d] = { D_INSTRUCTION__STA  D_ADDR_MODE__IDX_X },
-    [0x99] = { D_INSTRUCTION__STA  D_ADDR_MODE__IDX_Y },
-    [0x81] = { D_INSTRUCTION__STA  D_ADDR_MODE__INDEX_INDIRECT },
-    [0x91] = { D_INSTRUCTION__STA  D_ADDR_MODE__INDIRECT_INDEX },
-
-    [0x86] = { D_INSTRUCTION__STX D_ADDR_MODE__ZERO_PAGE },
-    [0x96] = { D_INSTRUCTION__STX D_ADDR_MODE__ZERO_PAGE_IDX_Y },
-    [0x8e] = { D_INSTRUCTION__STX D_ADDR_MODE__ABSOLUTE },
-
-    [0x84] = { D_INSTRUCTION__STY D_ADDR_MODE__ZERO_PAGE },
-    [0x94] = { D_INSTRUCTION__STY D_ADDR_MODE__ZERO_PAGE_IDX_X },
-    [0x8c] = { D_INSTRUCTION__STY D_ADDR_MODE__ABSOLUTE },
-
-    [0xaa] = { D_INSTRUCTION__TAX D_ADDR_MODE__IMPLIED },
+#define D_FUSED_FORM2(NAME,A,B) \
+    [FUSED__##NAME] = { { A, B, 0 }, 2, #NAME },
 
-    [0xa8] = { D_INSTRUCTION__TAY D_ADDR_MODE__IMPLIED },
-
-    [0xba] = { D_INSTRUCTION__TSX D_ADDR_MODE__IMPLIED },
-
-    [0x8a] = { D_INSTRUCTION__TXA D_ADDR_MODE__IMPLIED },
-
-    [0x9a] = { D_INSTRUCTION__TXS D_ADDR_MODE__IMPLIED },
-
-    [0x98] = { D_INSTRUCTION__TYA D_ADDR_MODE__IMPLIED },
+#define D_FUSED_FORM3(NAME,A,B,C) \
+    [FUSED__##NAME] = { { A, B, C }, 3, #NAME },
 
+const struct fusedForm fusedForms[FUSED__COUNT] = {
+    CPU_6502_FUSED(D_FUSED_FORM2,D_FUSED_FORM3)
 };
 
+// fusedCount in struct cpu6502 needs a counter for every form
+typedef char cpu6502FusedFormsFit[ ( FUSED__COUNT <= CPU_6502_FUSED_FORMS ) ? 1 : -1 ];
+
 void cpu6502PrintDebugInfo( struct cpu6502 *cpu ) {
     int i;
 
-    printf("<%d>\n",cpu->clk);
+    printf("<%" PRIu64 ">\n",cpu->clk);
     printf("0x%" PRIx8 " 0x%" PRIx8 " 0x%" PRIx8 "\n", cpu->opcode,cpu->o1,cpu->o2);
     printf("A: $%02" PRIx8 " ",cpu->A);
     printf("X: $%02" PRIx8 " ",cpu->X);
@@ -855,6 +138,17 @@ void cpu6502PrintDebugInfo( struct cpu6502 *cpu ) {
     return;
 }
 
+void cpu6502PrintFusedCounts( struct cpu6502 *cpu ) {
+    int f;
+
+    for ( f = 0; f < FUSED__COUNT; f++ ) {
+        if ( cpu->fusedCount[f] ) {
+            printf("%-20s %" PRIu64 "\n",fusedForms[f].name,cpu->fusedCount[f]);
+        }
+    }
+    return;
+}
+
 void cpu6502PrintInstruction( struct cpu6502 *cpu ) {
 
     struct operation op = instructionSet[cpu->opcode];
@@ -913,37 +207,71 @@ void cpu6502Init( struct cpu6502 * cpu ) {
     cpu->X = 0x00;
     cpu->Y = 0x00;
     cpu->P = 0x34;
+    cpu->engine = CPU_6502_ENGINE__FAST;
 }
 
-void cpu6502Step( struct cpu6502 *cpu, cpu6502Signal sig ) {
+// STATUS FLAGS
+//
+// While running, Z, N, V and C are not kept in P. Each instruction stores
+// the values they derive from and P is only assembled when something
+// reads it as a whole: PHP, BRK, interrupts and the end of a run.
+
+static ALWAYS_INLINE uint8_t cpu6502Flags( const struct cpu6502 *cpu ) {
+    return ( cpu->P & ~( STATUS_Z | STATUS_N | STATUS_V | STATUS_C ) )
+        | ( !cpu->flagZ * STATUS_Z )
+        | ( cpu->flagN & STATUS_N )
+        | ( ( cpu->flagV >> 1 ) & STATUS_V )
+        | ( cpu->flagC & STATUS_C );
+}
 
-    struct operation op;
-    uint8_t idx;
-    uint16_t addr;
-    uint8_t srcv;
-    uint8_t auxv;
-    uint8_t dstv;
-    uint8_t tmpc;
-    uint8_t tmpv;
-    uint16_t talu;
-    uint16_t temppc;
-    
-    cpu->clk++;
-    
-    // INSTRUCTION FETCH AND DECODE
+static ALWAYS_INLINE void cpu6502SetFlags( struct cpu6502 *cpu, const uint8_t p ) {
+    cpu->P = p;
+    cpu->flagZ = !( p & STATUS_Z );
+    cpu->flagN = p;
+    cpu->flagV = p << 1;
+    cpu->flagC = p;
+}
 
-    cpu->opcode = READ( cpu->PC );
+// value of a single flag, folds to one test when mask is a constant
+
+static ALWAYS_INLINE int cpu6502Flag( const struct cpu6502 *cpu, const uint8_t mask ) {
+    switch ( mask ) {
+        case STATUS_Z:
+            return !cpu->flagZ;
+        case STATUS_N:
+            return cpu->flagN >> 7;
+        case STATUS_V:
+            return cpu->flagV >> 7;
+        case STATUS_C:
+            return cpu->flagC & 1;
+        default:
+            return !!( cpu->P & mask );
+    }
+}
 
-    op = instructionSet[cpu->opcode];
+// Executes the instruction at cpu->PC given its operand bytes (o2 << 8 |
+// o1). Called with a runtime table entry by the reference interpreter and
+// with a constant entry by the specialized handlers, in which case the
+// compiler folds away every decode branch below. Only the traced
+// interpreter and the traced handlers pass a record, the others pass a
+// constant NULL.
 
-    if ( op.size >= 2 ) {
-        cpu->o1 = READ( cpu->PC + 1 );
-    }
+static ALWAYS_INLINE void cpu6502Execute( struct cpu6502 *cpu, const struct operation op, const uint16_t operand, struct cpu6502TraceRecord *rec ) {
 
-    if ( op.size >= 3 ) {
-        cpu->o2 = READ( cpu->PC + 2 ) ;
-    }
+    uint8_t idx;
+    uint16_t addr = 0;
+    uint8_t srcv = 0;
+    uint8_t auxv = 0;
+    uint8_t dstv = 0;
+    uint8_t tmpn;
+    uint8_t tmpc = 0;
+    uint8_t tmpv = 0;
+    uint16_t talu;
+    uint16_t temppc;
+    uint16_t base;
+    unsigned int cycles;
 
+    cycles = op.cycles;
 
     // ADDRESS CALCULATION
 
@@ -955,7 +283,7 @@ void cpu6502Step( struct cpu6502 *cpu, cpu6502Signal sig ) {
         if ( op.addr_mode & ADDR_MODE_IMMEDIATE ) {
             addr = cpu->PC + 1;
         } else if ( op.addr_mode & ADDR_MODE_RELATIVE ) {
-            addr = cpu->PC + op.size + *( (int8_t *) &(cpu->o1) );
+            addr = cpu->PC + op.size + (int8_t) operand;
         } else {
 
 
@@ -967,30 +295,38 @@ void cpu6502Step( struct cpu6502 *cpu, cpu6502Signal sig ) {
                 }
             }
                 
-            if ( op.size > 2 ) {
-                addr = ( ( (uint16_t) ( cpu->o2 ) ) << 8 ) + cpu->o1;
-
-            } else {
-                addr = ( cpu->o1 );
-            }
+            addr = operand;
 
             if ( ( op.addr_mode & ADDR_MODE_INDEX ) && (( op.addr_mode & ADDR_MODE_INDEX_TIMING ) == ADDR_MODE_INDEX_TIMING__PRE ) ) {
+                base = addr;
                 addr = ( addr + idx );
                 if ( op.size <= 2 ) {
                     addr %= 0x100;
+                } else if ( op.page_cycles && ( ( base ^ addr ) & 0xff00 ) ) {
+                    cycles += op.page_cycles;
                 }
             }
 
             if ( op.addr_mode & ADDR_MODE_INDIRECT ) {
-                addr = READ16( addr );
+                // pointers never carry into the next page: ($xxff) and
+                // zero page pointers at $ff wrap around within their page
+                addr = READ16_WRAP( addr );
                 if ( ( op.addr_mode & ADDR_MODE_INDEX ) && ( ( op.addr_mode & ADDR_MODE_INDEX_TIMING ) == ADDR_MODE_INDEX_TIMING__POST ) ) {
+                    base = addr;
                     addr += idx;
+                    if ( op.page_cycles && ( ( base ^ addr ) & 0xff00 ) ) {
+                        cycles += op.page_cycles;
+                    }
                 }
 
             }
         }
     }
 
+    if ( rec ) {
+        rec->addr = addr;
+    }
+
 
     // READ SOURCE
 
@@ -1001,6 +337,11 @@ void cpu6502Step( struct cpu6502 *cpu, cpu6502Signal sig ) {
             }
             else {
                 srcv = READ(addr);
+                if ( rec && !( op.addr_mode & ADDR_MODE_IMMEDIATE ) ) {
+                    rec->access = CPU_6502_TRACE_ACCESS__READ;
+                    rec->before = srcv;
+                    rec->after = srcv;
+                }
             }
             break;
         case LOC_STACK:
@@ -1019,7 +360,7 @@ void cpu6502Step( struct cpu6502 *cpu, cpu6502Signal sig ) {
             srcv = cpu->SP;
             break;
         case LOC_REG_P:
-            srcv = cpu->P;
+            srcv = cpu6502Flags( cpu ) | STATUS_B | STATUS_U;
             break;
 
     }
@@ -1041,14 +382,16 @@ void cpu6502Step( struct cpu6502 *cpu, cpu6502Signal sig ) {
     switch ( op.alu_mode ) {
 
         case ALU_MODE_ADD:
-            talu = cpu->A + srcv + STATUS(cpu,STATUS_C);
+            talu = cpu->A + srcv + CARRY();
+            dstv = (uint8_t) talu;
             tmpc = ( talu > 0xff );
-            tmpv = !((auxv ^ srcv) & 0x80) && (auxv ^ talu) & 0x80;
+            tmpv = ~( auxv ^ srcv ) & ( auxv ^ talu );
             break;
         case ALU_MODE_SUBTRACT:
-            talu = cpu->A - srcv - !STATUS(cpu,STATUS_C);
+            talu = cpu->A - srcv - !CARRY();
+            dstv = (uint8_t) talu;
             tmpc = ( talu <= 0xff );
-            tmpv = ((auxv ^ talu) & 0x80) && (auxv ^ srcv) & 0x80;
+            tmpv = ( auxv ^ talu ) & ( auxv ^ srcv );
             break;
         case ALU_MODE_CMP:
             dstv = auxv - srcv;
@@ -1063,7 +406,7 @@ void cpu6502Step( struct cpu6502 *cpu, cpu6502Signal sig ) {
         case ALU_MODE_AND:
             dstv = cpu->A & srcv;
             if (op.instruction_type == INSTRUCTION__BIT) {
-                tmpv = !!( dstv & 0x40 );
+                tmpv = srcv << 1;
             }
             break;
         case ALU_MODE_SHIFT_LEFT:
@@ -1071,17 +414,15 @@ void cpu6502Step( struct cpu6502 *cpu, cpu6502Signal sig ) {
             tmpc = !!( srcv & 0x80 );
             dstv = srcv << 1;
             if ( op.alu_mode == ALU_MODE_ROTATE_LEFT ) {
-                dstv = dstv | !!( cpu->P & STATUS_C );
+                dstv = dstv | CARRY();
             }
             break;
         case ALU_MODE_SHIFT_RIGHT:
         case ALU_MODE_ROTATE_RIGHT:
-            printf("++\n");
-
             tmpc = !!( srcv & 0x01 );
             dstv = ( 0x7f & ( srcv >> 1 ) );
             if ( op.alu_mode == ALU_MODE_ROTATE_RIGHT ) {
-                dstv = dstv | !!( cpu->P & STATUS_C )<<7;
+                dstv = dstv | CARRY() << 7;
             }
             break;
         case ALU_MODE_INCREMENT:
@@ -1097,17 +438,20 @@ void cpu6502Step( struct cpu6502 *cpu, cpu6502Signal sig ) {
 
     // EVALUATE STATUS
 
+    // BIT takes N straight from bit 7 of the operand
+    tmpn = ( op.instruction_type == INSTRUCTION__BIT ) ? srcv : dstv;
+
     if ( op.status_update & STATUS_Z ) {
-        cpu->P = ( cpu->P & ~(STATUS_Z ) ) | ( !(dstv) * STATUS_Z );
+        cpu->flagZ = dstv;
     }
     if ( op.status_update & STATUS_N ) {
-        cpu->P = ( cpu->P & ~(STATUS_N ) ) | ( !!( dstv & 0x80 ) * STATUS_N );
+        cpu->flagN = tmpn;
     }
     if ( op.status_update & STATUS_V ) {
-        cpu->P = ( cpu->P & ~(STATUS_V) ) | ( tmpv * STATUS_V );
+        cpu->flagV = tmpv;
     }
     if ( op.status_update & STATUS_C) {
-        cpu->P = ( cpu->P & ~(STATUS_C) ) | ( tmpc * STATUS_C );
+        cpu->flagC = tmpc;
     }
 
 
@@ -1119,11 +463,20 @@ void cpu6502Step( struct cpu6502 *cpu, cpu6502Signal sig ) {
                 cpu->A = dstv;
             }
             else {
+                if ( rec ) {
+                    if ( !rec->access ) {
+                        // a plain store: look without going through the handlers
+                        rec->before = cpu->mm->readPage[ addr >> 8 ] ? cpu->mm->readPage[ addr >> 8 ][ addr & 0xff ] : 0;
+                    }
+                    rec->access |= CPU_6502_TRACE_ACCESS__WRITE;
+                    rec->after = dstv;
+                }
                 WRITE(addr,dstv);
             }
             break;
         case LOC_STACK:
             STACK_PUSH(dstv);
+            break;
         case LOC_REG_A:
             cpu->A = dstv;
             break;
@@ -1137,19 +490,33 @@ void cpu6502Step( struct cpu6502 *cpu, cpu6502Signal sig ) {
             cpu->SP = dstv;
             break;
         case LOC_REG_P:
-            cpu->P = dstv;
+            cpu6502SetFlags( cpu, ( dstv & ~STATUS_B ) | STATUS_U );
             break;
     }
 
     // STATUS CTRL
 
-    if ( op.status_mod ) {
+    if ( op.status_mod & STATUS_C ) {
+        cpu->flagC = op.status_val;
+    }
+    if ( op.status_mod & STATUS_V ) {
+        cpu->flagV = op.status_val << 7;
+    }
+    if ( op.status_mod & ~( STATUS_C | STATUS_V ) ) {
         cpu->P = ( cpu->P & ~(op.status_mod) ) | ( op.status_val * op.status_mod );
     }
 
     // BRANCH (needs cleanup)
 
-    if ( (op.instruction_type == INSTRUCTION__JMP) || ( op.branch_on && ( !( !!( op.branch_on & cpu->P ) ^ !!(op.branch_if) ) ) ) ) {
+    if ( op.instruction_type == INSTRUCTION__JMP ) {
+        cpu->PC = addr;
+    } else if ( op.branch_on && ( !( cpu6502Flag( cpu, op.branch_on ) ^ !!(op.branch_if) ) ) ) {
+        // taken branch: one extra cycle, plus one more if the target is on
+        // a different page than the next instruction
+        cycles += op.page_cycles;
+        if ( ( ( cpu->PC + op.size ) ^ addr ) & 0xff00 ) {
+            cycles += op.page_cycles;
+        }
         cpu->PC = addr;
     } else if ( op.instruction_type == INSTRUCTION__JSR ) {
         temppc = cpu->PC + 2;
@@ -1158,7 +525,7 @@ void cpu6502Step( struct cpu6502 *cpu, cpu6502Signal sig ) {
         cpu->PC = addr;
     } else if ( ( op.instruction_type == INSTRUCTION__RTS ) || (op.instruction_type == INSTRUCTION__RTI) ) {
         if ( ( op.instruction_type == INSTRUCTION__RTI ) ) {
-            cpu->P == STACK_PULL();
+            cpu6502SetFlags( cpu, ( STACK_PULL() & ~STATUS_B ) | STATUS_U );
         }
         *( (uint8_t *) &temppc ) = STACK_PULL();
         *( ((uint8_t *) &temppc) + 1 ) = STACK_PULL();
@@ -1169,21 +536,1338 @@ void cpu6502Step( struct cpu6502 *cpu, cpu6502Signal sig ) {
 
         cpu->PC = temppc;
 
+    } else if ( op.instruction_type == INSTRUCTION__BRK ) {
+        // BRK skips a padding byte and pushes P with B set
+        temppc = cpu->PC + 2;
+        STACK_PUSH( *( ( (uint8_t *) &temppc ) + 1 ) );
+        STACK_PUSH( *( (uint8_t *) &temppc ) );
+        STACK_PUSH( cpu6502Flags( cpu ) | STATUS_B | STATUS_U );
+        cpu->P |= STATUS_I;
+        cpu->PC = READ( IRQ_VECTOR_LO );
+        cpu->PC |= READ( IRQ_VECTOR_HI ) << 8;
     } else {
         cpu->PC += op.size;
     }
 
-    if ( sig & CPU_6502_SIGNAL__NMI ) {
-        printf("NMI\n");
-        temppc = cpu->PC;
-        STACK_PUSH( *( ( (uint8_t *) &temppc ) + 1 ) );
-        STACK_PUSH( *( (uint8_t *) &temppc ) );
-        STACK_PUSH( cpu->P );
-        cpu->PC = READ( NMI_VECTOR_LO );
-        cpu->PC |= READ( NMI_VECTOR_HI ) << 8;
+    cpu->clk += cycles;
+
+}
+
+// REFERENCE INTERPRETER
+
+static int cpu6502StepReference( struct cpu6502 *cpu ) {
+
+    uint16_t operand = 0;
+
+    // INSTRUCTION FETCH AND DECODE
+
+    cpu->opcode = READ( cpu->PC );
+
+    if ( instructionSet[cpu->opcode].size == 0 ) {
+        return CPU_6502_STOP__JAM;
+    }
+
+    if ( instructionSet[cpu->opcode].size >= 2 ) {
+        cpu->o1 = READ( cpu->PC + 1 );
+        operand = cpu->o1;
+    }
+
+    if ( instructionSet[cpu->opcode].size >= 3 ) {
+        cpu->o2 = READ( cpu->PC + 2 ) ;
+        operand |= (uint16_t) cpu->o2 << 8;
+    }
+
+    cpu6502Execute( cpu, instructionSet[cpu->opcode], operand, NULL );
+
+    return CPU_6502_STOP__BUDGET;
+
+}
+
+// TRACED INTERPRETER
+//
+// the reference interpreter, appending a record of every instruction to
+// cpu->trace
+
+static int cpu6502StepTraced( struct cpu6502 *cpu ) {
+
+    struct cpu6502TraceRecord *rec;
+    const struct operation *op;
+    uint16_t operand = 0;
+
+    cpu->opcode = READ( cpu->PC );
+    op = &instructionSet[cpu->opcode];
+
+    if ( op->size == 0 ) {
+        return CPU_6502_STOP__JAM;
+    }
+
+    rec = cpu6502TraceNext( cpu->trace );
+    cpu->o1 = ( op->size >= 2 ) ? READ( cpu->PC + 1 ) : 0;
+    cpu->o2 = ( op->size >= 3 ) ? READ( cpu->PC + 2 ) : 0;
+    operand = (uint16_t) cpu->o2 << 8 | cpu->o1;
+
+    rec->clk = cpu->clk;
+    rec->PC = cpu->PC;
+    rec->opcode = cpu->opcode;
+    rec->o1 = cpu->o1;
+    rec->o2 = cpu->o2;
+    rec->A = cpu->A;
+    rec->X = cpu->X;
+    rec->Y = cpu->Y;
+    rec->P = cpu6502Flags( cpu );
+    rec->SP = cpu->SP;
+    rec->access = 0;
+    rec->before = 0;
+    rec->after = 0;
+
+    cpu6502Execute( cpu, *op, operand, rec );
+
+    cpu6502TracePublish( cpu->trace );
+
+    return CPU_6502_STOP__BUDGET;
+
+}
+
+// DECODED INSTRUCTION CACHE
+//
+// The fast engine keeps one decoded entry per PC, allocated a page at a
+// time the first time code runs there. Pages are dropped when the CPU
+// writes to memory backing them (self-modifying or RAM code) and when the
+// page table is remapped under them (bank switches).
+
+static void cpu6502InvalidateDecodedPage( struct cpu6502 *cpu, const unsigned int p ) {
+    memset( cpu->decoded[p], 0, NES_MEM_PAGE_SIZE * sizeof( struct cpu6502Decoded ) );
+    cpu->decodedBase[p] = NULL;
+    cpu->decodedNext[p] = NULL;
+}
+
+// flags every write page aliasing memory that decoded page p was read
+// from. The last instructions of a page may have operands in the next
+// one, and code at $ffxx wraps around into page zero.
+
+static void cpu6502MarkCode( struct cpu6502 *cpu, const unsigned int p ) {
+    unsigned int q;
+
+    for ( q = 0; q < NES_MEM_PAGES; q++ ) {
+        if ( cpu->mm->writePage[q] &&
+             ( cpu->mm->writePage[q] == cpu->decodedBase[p] || cpu->mm->writePage[q] == cpu->decodedNext[p] ) ) {
+            cpu->codeWrite[q] = 1;
+        }
+    }
+}
+
+static void cpu6502CodeWritten( struct cpu6502 *cpu, const uint16_t addr ) {
+    unsigned int p;
+    unsigned int q;
+    uint8_t *backing;
+
+    backing = cpu->mm->writePage[ addr >> 8 ];
+
+    for ( p = 0; p < NES_MEM_PAGES; p++ ) {
+        if ( cpu->decodedBase[p] && ( cpu->decodedBase[p] == backing || cpu->decodedNext[p] == backing ) ) {
+            cpu6502InvalidateDecodedPage( cpu, p );
+        }
+    }
+
+    // nothing decoded is read from this memory any more
+    for ( q = 0; q < NES_MEM_PAGES; q++ ) {
+        if ( cpu->mm->writePage[q] == backing ) {
+            cpu->codeWrite[q] = 0;
+        }
+    }
+}
+
+static void cpu6502Remapped( struct cpu6502 *cpu ) {
+    unsigned int p;
+
+    memset( cpu->codeWrite, 0, sizeof cpu->codeWrite );
+
+    for ( p = 0; p < NES_MEM_PAGES; p++ ) {
+        if ( cpu->decodedBase[p] == NULL ) {
+            continue;
+        }
+        if ( cpu->decodedBase[p] != cpu->mm->readPage[p] ||
+             cpu->decodedNext[p] != cpu->mm->readPage[ ( p + 1 ) % NES_MEM_PAGES ] ) {
+            cpu6502InvalidateDecodedPage( cpu, p );
+        } else {
+            cpu6502MarkCode( cpu, p );
+        }
+    }
+    cpu->decodedEpoch = cpu->mm->epoch;
+}
+
+// picks the longest fused form starting at pc. All of it has to be in
+// the page so that dropping the page also drops the fused entry.
+
+static uint16_t cpu6502Fuse( struct cpu6502 *cpu, const uint16_t pc ) {
+
+    uint8_t opcodes[3];
+    unsigned int count;
+    unsigned int off;
+    unsigned int size;
+    unsigned int best;
+    unsigned int f;
+    uint16_t handler;
+
+    count = 0;
+    off = pc & 0xff;
+
+    while ( count < 3 && off < NES_MEM_PAGE_SIZE ) {
+        opcodes[count] = READ( ( pc & 0xff00 ) | off );
+        size = instructionSet[ opcodes[count] ].size;
+        if ( size == 0 || off + size > NES_MEM_PAGE_SIZE ) {
+            break;
+        }
+        off += size;
+        count++;
+    }
+
+    handler = READ( pc );
+    best = 0;
+
+    for ( f = 0; f < FUSED__COUNT; f++ ) {
+        if ( fusedForms[f].length <= count && fusedForms[f].length > best &&
+             memcmp( fusedForms[f].opcodes, opcodes, fusedForms[f].length ) == 0 ) {
+            best = fusedForms[f].length;
+            handler = FUSED_HANDLER( f );
+        }
+    }
+
+    return handler;
+
+}
+
+// worst case cycles of a fused form: branches taken across a page and
+// indexed accesses crossing one
+
+static uint8_t cpu6502FusedCycles( const unsigned int f ) {
+    const struct operation *op;
+    unsigned int i;
+    uint8_t cycles;
+
+    cycles = 0;
+    for ( i = 0; i < fusedForms[f].length; i++ ) {
+        op = &instructionSet[ fusedForms[f].opcodes[i] ];
+        cycles += op->cycles + ( op->branch_on ? 2 : 1 ) * op->page_cycles;
+    }
+    return cycles;
+}
+
+static struct cpu6502Decoded * cpu6502Decode( struct cpu6502 *cpu, const uint16_t pc ) {
+
+    struct cpu6502Decoded *d;
+    const struct operation *op;
+    struct memLoop loop;
+    unsigned int idle;
+    unsigned int p;
+
+    p = pc >> 8;
+    d = &cpu->decodedScratch;
+
+    if ( cpu->mm->readPage[p] ) {
+        if ( cpu->decoded[p] == NULL ) {
+            cpu->decoded[p] = calloc( NES_MEM_PAGE_SIZE, sizeof( struct cpu6502Decoded ) );
+        }
+        if ( cpu->decoded[p] ) {
+            if ( cpu->decodedBase[p] == NULL ) {
+                // let writes through any alias of this page find it
+                cpu->decodedBase[p] = cpu->mm->readPage[p];
+                cpu->decodedNext[p] = cpu->mm->readPage[ ( p + 1 ) % NES_MEM_PAGES ];
+                cpu6502MarkCode( cpu, p );
+            }
+            d = &( cpu->decoded[p][ pc & 0xff ] );
+        }
+    }
+
+    d->opcode = READ( pc );
+    op = &instructionSet[d->opcode];
+    d->operand = ( op->size >= 2 ) ? READ( pc + 1 ) : 0;
+    d->operand |= ( op->size >= 3 ) ? READ( pc + 2 ) << 8 : 0;
+    d->handler = d->opcode;
+    d->cycles = op->cycles;
+
+    if ( d != &cpu->decodedScratch ) {
+        idle = cpu6502IdleLoop( cpu, pc );
+        if ( idle ) {
+            d->handler = IDLE_HANDLER;
+            d->cycles = idle;
+        } else if ( cpu6502MemLoop( cpu, pc, &loop ) ) {
+            d->handler = MEM_LOOP_HANDLER;
+        } else {
+            d->handler = cpu6502Fuse( cpu, pc );
+            if ( d->handler >= FUSED_HANDLER( 0 ) ) {
+                d->cycles = cpu6502FusedCycles( d->handler - FUSED_HANDLER( 0 ) );
+            }
+        }
+    }
+    d->size = op->size;
+
+    return d;
+
+}
+
+static ALWAYS_INLINE struct cpu6502Decoded * cpu6502Decoded( struct cpu6502 *cpu, const uint16_t pc ) {
+    struct cpu6502Decoded *page;
+
+    page = cpu->decoded[ pc >> 8 ];
+    if ( page && page[ pc & 0xff ].size ) {
+        return &page[ pc & 0xff ];
+    }
+    return cpu6502Decode( cpu, pc );
+}
+
+void cpu6502Destroy( struct cpu6502 *cpu ) {
+    unsigned int p;
+
+    for ( p = 0; p < NES_MEM_PAGES; p++ ) {
+        free( cpu->decoded[p] );
+        cpu->decoded[p] = NULL;
+        cpu->decodedBase[p] = NULL;
+        cpu->decodedNext[p] = NULL;
+    }
+    memset( cpu->codeWrite, 0, sizeof cpu->codeWrite );
+
+    cpu6502JitDestroy( cpu );
+}
+
+static ALWAYS_INLINE void cpu6502Write( struct cpu6502 *cpu, const uint16_t addr, const uint8_t data ) {
+    uint8_t *page;
+
+    page = cpu->mm->writePage[ addr >> 8 ];
+    if ( page ) {
+        page[ addr & 0xff ] = data;
+        if ( cpu->codeWrite[ addr >> 8 ] ) {
+            cpu6502CodeWritten( cpu, addr );
+        }
+    } else {
+        cpu->mm->write( cpu->mm, addr, data );
+        if ( cpu->decodedEpoch != cpu->mm->epoch ) {
+            cpu6502Remapped( cpu );
+        }
+    }
+}
+
+void cpu6502Store( struct cpu6502 *cpu, const uint16_t addr, const uint8_t data ) {
+    cpu6502Write( cpu, addr, data );
+}
+
+// INTERRUPTS AND BREAKPOINTS
+
+static ALWAYS_INLINE int cpu6502Interrupted( struct cpu6502 *cpu ) {
+    // IRQ is level triggered and only counts while I is clear
+    return cpu->pending && ( ( cpu->pending & ~CPU_6502_SIGNAL__IRQ ) || !( cpu->P & STATUS_I ) );
+}
+
+static ALWAYS_INLINE int cpu6502AtBreakpoint( struct cpu6502 *cpu ) {
+    return cpu->breakpoints && ( cpu->breakpoints[ cpu->PC >> 3 ] & ( 1 << ( cpu->PC & 7 ) ) );
+}
+
+static void cpu6502Interrupt( struct cpu6502 *cpu, const uint16_t vector ) {
+    uint16_t temppc;
+
+    temppc = cpu->PC;
+    STACK_PUSH( *( ( (uint8_t *) &temppc ) + 1 ) );
+    STACK_PUSH( *( (uint8_t *) &temppc ) );
+    STACK_PUSH( ( cpu6502Flags( cpu ) & ~STATUS_B ) | STATUS_U );
+    cpu->P |= STATUS_I;
+    cpu->PC = READ16( vector );
+    cpu->clk += INTERRUPT_CYCLES;
+}
+
+static void cpu6502Service( struct cpu6502 *cpu ) {
+
+    if ( cpu->pending & CPU_6502_SIGNAL__RESET ) {
+        cpu6502Release( cpu, CPU_6502_SIGNAL__RESET | CPU_6502_SIGNAL__NMI );
+        cpu->SP -= 3;
+        cpu->P |= STATUS_I;
+        cpu->PC = READ16( RESET_VECTOR_LO );
+        cpu->clk += INTERRUPT_CYCLES;
+    } else if ( cpu->pending & CPU_6502_SIGNAL__NMI ) {
+        cpu6502Release( cpu, CPU_6502_SIGNAL__NMI );
+        cpu6502Interrupt( cpu, NMI_VECTOR_LO );
+    } else if ( ( cpu->pending & CPU_6502_SIGNAL__IRQ ) && !( cpu->P & STATUS_I ) ) {
+        // the line stays asserted until the device releases it
+        cpu6502Interrupt( cpu, IRQ_VECTOR_LO );
+    }
+
+}
+
+void cpu6502Raise( struct cpu6502 *cpu, cpu6502Signal sig ) {
+#ifdef __GNUC__
+    __sync_fetch_and_or( &cpu->pending, sig );
+#else
+    cpu->pending |= sig;
+#endif
+}
+
+void cpu6502Release( struct cpu6502 *cpu, cpu6502Signal sig ) {
+#ifdef __GNUC__
+    __sync_fetch_and_and( &cpu->pending, ~sig );
+#else
+    cpu->pending &= ~sig;
+#endif
+}
+
+// IDLE LOOPS
+//
+// Games wait for vblank by polling memory that only an outside event can
+// change: LDA $2002 / BPL, LDA flag / BEQ until the NMI handler sets the
+// flag, or just JMP * until the NMI arrives. Once such a loop has gone
+// round, every further iteration leaves the CPU in the same state. The
+// caller runs the CPU up to its next event, so the loop is skipped ahead
+// in whole iterations to just before the end of the budget and the last
+// partial iteration runs normally.
+
+#define IDLE_LOOP_LENGTH 8  // instructions in a loop at most
+
+#define IDLE_REG(LOC) ( ( (LOC) == LOC_REG_A || (LOC) == LOC_REG_X || (LOC) == LOC_REG_Y ) ? ( 1 << (LOC) ) : 0 )
+
+// worst case cycles of one iteration if pc heads an idle loop, else 0.
+// The loop has to sit in one page, only load and compare registers from
+// memory that reads the same every time, and not read a register before
+// setting it unless the loop never sets it.
+
+unsigned int cpu6502IdleLoop( struct cpu6502 *cpu, const uint16_t pc ) {
+
+    const struct operation *op;
+    unsigned int n;
+    unsigned int at;
+    unsigned int next;
+    unsigned int cycles;
+    unsigned int written;
+    unsigned int readFirst;
+    uint16_t operand;
+    uint16_t target;
+
+    if ( cpu->mm->readPage[ pc >> 8 ] == NULL ) {
+        return 0;
+    }
+
+    at = pc;
+    cycles = 0;
+    written = 0;
+    readFirst = 0;
+
+    for ( n = 0; n < IDLE_LOOP_LENGTH; n++ ) {
+
+        op = &instructionSet[ READ( at ) ];
+        next = at + op->size;
+
+        if ( op->size == 0 || ( ( next - 1 ) >> 8 ) != (unsigned int) ( pc >> 8 ) ) {
+            return 0;
+        }
+
+        operand = ( op->size >= 2 ) ? READ( at + 1 ) : 0;
+        operand |= ( op->size >= 3 ) ? READ( at + 2 ) << 8 : 0;
+
+        if ( op->branch_on || op->instruction_type == INSTRUCTION__JMP ) {
+            if ( op->instruction_type == INSTRUCTION__JMP ) {
+                if ( op->addr_mode_type != ADDR_MODE__ABSOLUTE ) {
+                    return 0;
+                }
+                target = operand;
+                cycles += op->cycles;
+            } else {
+                target = next + (int8_t) operand;
+                cycles += op->cycles + op->page_cycles;
+                if ( ( next ^ target ) & 0xff00 ) {
+                    cycles += op->page_cycles;
+                }
+            }
+            return ( target == pc && !( readFirst & written ) ) ? cycles : 0;
+        }
+
+        switch ( op->instruction_type ) {
+            case INSTRUCTION__LDA:
+            case INSTRUCTION__LDX:
+            case INSTRUCTION__LDY:
+            case INSTRUCTION__BIT:
+            case INSTRUCTION__CMP:
+            case INSTRUCTION__CPX:
+            case INSTRUCTION__CPY:
+            case INSTRUCTION__AND:
+            case INSTRUCTION__ORA:
+            case INSTRUCTION__EOR:
+            case INSTRUCTION__NOP:
+                break;
+            default:
+                return 0;
+        }
+
+        switch ( op->addr_mode_type ) {
+            case ADDR_MODE__IMPLIED:
+            case ADDR_MODE__IMMEDIATE:
+                break;
+            case ADDR_MODE__ZERO_PAGE:
+            case ADDR_MODE__ABSOLUTE:
+                if ( cpu->mm->readPage[ operand >> 8 ] == NULL &&
+                     !( cpu->mm->quiet && cpu->mm->quiet( cpu->mm, operand ) ) ) {
+                    return 0;
+                }
+                break;
+            default:
+                return 0;
+        }
+
+        readFirst |= IDLE_REG( op->aux ) & ~written;
+        written |= IDLE_REG( op->dst );
+        cycles += op->cycles;
+        at = next;
+
+    }
+
+    return 0;
+
+}
+
+// runs two iterations of the idle loop at cpu->PC and, if both went round,
+// skips as many more as fit before end. The first read of a quiet address
+// may still change what the next one returns (reading $2002 clears vblank),
+// so only the second iteration shows the loop is steady. The caller makes
+// sure that one iteration fits in the budget and that there are no
+// breakpoints. Returns nonzero if an interrupt became serviceable inside
+// the loop.
+
+static int cpu6502RunIdle( struct cpu6502 *cpu, const uint64_t end ) {
+
+    struct cpu6502Decoded *d;
+    const struct operation *op;
+    unsigned int n;
+    uint16_t head;
+    uint64_t start;
+    uint64_t period = 0;
+
+    head = cpu->PC;
+
+    for ( n = 0; n < 2; n++ ) {
+
+        // the loop runs straight through to its branch, so going round
+        // again takes no longer than the first time did
+        if ( cpu->clk + period >= end ) {
+            return 0;
+        }
+
+        start = cpu->clk;
+        for (;;) {
+            d = cpu6502Decoded( cpu, cpu->PC );
+            op = &instructionSet[ d->opcode ];
+            cpu6502Handlers[ d->opcode ]( cpu, d->operand );
+            if ( op->branch_on || op->instruction_type == INSTRUCTION__JMP ) {
+                break;
+            }
+            if ( cpu6502Interrupted( cpu ) ) {
+                return 1;
+            }
+        }
+
+        if ( cpu->PC != head ) {
+            return 0;
+        }
+        period = cpu->clk - start;
+
+    }
+
+    cpu->clk += ( ( end - 1 - cpu->clk ) / period ) * period;
+
+    return 0;
+
+}
+
+// FILL AND COPY LOOPS
+//
+// Clearing RAM and copying buffers with STA $0200,X / INX / BNE style
+// loops runs as memset / memcpy over the page tables whenever every byte
+// the loop touches is plain memory. Registers, flags, cycles and the point
+// where the budget runs out come out as if the loop had been stepped.
+
+static const struct operation * cpu6502MemLoopNext( struct cpu6502 *cpu, unsigned int *at, uint16_t *operand ) {
+    const struct operation *op;
+
+    op = &instructionSet[ READ( *at ) ];
+    if ( op->size == 0 || ( ( *at + op->size - 1 ) >> 8 ) != ( *at >> 8 ) ) {
+        return NULL;
+    }
+    *operand = ( op->size >= 2 ) ? READ( *at + 1 ) : 0;
+    *operand |= ( op->size >= 3 ) ? READ( *at + 2 ) << 8 : 0;
+    *at += op->size;
+    return op;
+}
+
+// fills in loop and returns nonzero if pc heads a fill or copy loop that
+// sits in one page
+
+int cpu6502MemLoop( struct cpu6502 *cpu, const uint16_t pc, struct memLoop *loop ) {
+
+    const struct operation *op;
+    unsigned int at;
+    unsigned int mode;
+    uint16_t operand;
+    uint16_t target;
+
+    if ( cpu->mm->readPage[ pc >> 8 ] == NULL ) {
+        return 0;
+    }
+
+    at = pc;
+    mode = 0;
+    loop->copy = 0;
+    loop->stores = 0;
+    loop->cycles = 0;
+
+    op = cpu6502MemLoopNext( cpu, &at, &operand );
+
+    if ( op && op->instruction_type == INSTRUCTION__LDA &&
+         ( op->addr_mode_type == ADDR_MODE__IDX_X || op->addr_mode_type == ADDR_MODE__IDX_Y ) ) {
+        loop->copy = 1;
+        loop->src = operand;
+        loop->cycles += op->cycles;
+        mode = op->addr_mode_type;
+        op = cpu6502MemLoopNext( cpu, &at, &operand );
+    }
+
+    while ( op && op->instruction_type == INSTRUCTION__STA && loop->stores < MEM_LOOP_STORES &&
+            ( op->addr_mode_type == ADDR_MODE__IDX_X || op->addr_mode_type == ADDR_MODE__IDX_Y ) &&
+            ( mode == 0 || op->addr_mode_type == mode ) ) {
+        loop->dst[ loop->stores++ ] = operand;
+        loop->cycles += op->cycles;
+        mode = op->addr_mode_type;
+        op = cpu6502MemLoopNext( cpu, &at, &operand );
+    }
+
+    if ( op == NULL || loop->stores == 0 ) {
+        return 0;
+    }
+
+    switch ( op->instruction_type ) {
+        case INSTRUCTION__INX:
+        case INSTRUCTION__INY:
+            loop->step = 1;
+            break;
+        case INSTRUCTION__DEX:
+        case INSTRUCTION__DEY:
+            loop->step = -1;
+            break;
+        default:
+            return 0;
+    }
+
+    loop->reg = op->dst;
+    if ( loop->reg != ( ( mode == ADDR_MODE__IDX_X ) ? LOC_REG_X : LOC_REG_Y ) ) {
+        return 0;
+    }
+    loop->cycles += op->cycles;
+
+    op = cpu6502MemLoopNext( cpu, &at, &operand );
+    if ( op == NULL || op->instruction_type != INSTRUCTION__BNE ) {
+        return 0;
+    }
+
+    target = at + (int8_t) operand;
+    if ( target != pc ) {
+        return 0;
+    }
+
+    loop->exit = at;
+    loop->notTaken = op->page_cycles;
+    if ( ( loop->exit ^ target ) & 0xff00 ) {
+        loop->notTaken += op->page_cycles;
+    }
+    loop->cycles += op->cycles + loop->notTaken;
+
+    return 1;
+
+}
+
+// backing memory for addr, NULL unless it is plain RAM (or, for reads,
+// ROM) that no decoded code lives in
+
+static uint8_t * cpu6502Plain( struct cpu6502 *cpu, const uint16_t addr, const int write ) {
+    unsigned int p;
+
+    p = addr >> 8;
+    if ( write ) {
+        if ( cpu->mm->writePage[p] == NULL || cpu->codeWrite[p] ) {
+            return NULL;
+        }
+        return cpu->mm->writePage[p] + ( addr & 0xff );
+    }
+    if ( cpu->mm->readPage[p] == NULL ) {
+        return NULL;
+    }
+    return cpu->mm->readPage[p] + ( addr & 0xff );
+}
+
+// whether base + lo .. base + hi is plain memory, in pages
+
+static int cpu6502PlainRange( struct cpu6502 *cpu, const uint16_t base, const unsigned int lo, const unsigned int hi, const int write ) {
+    unsigned int a;
+
+    if ( base + hi > 0xffff ) {
+        return 0;
+    }
+    for ( a = ( base + lo ) & 0xff00; a <= base + hi; a += NES_MEM_PAGE_SIZE ) {
+        if ( cpu6502Plain( cpu, a, write ) == NULL ) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int cpu6502Overlaps( struct cpu6502 *cpu, const uint16_t a, const uint16_t b, const unsigned int len ) {
+    unsigned int i;
+    unsigned int j;
+    uint8_t *pa;
+    uint8_t *pb;
+
+    // compare the backing of every page pair, mirrors can alias
+    for ( i = a & 0xff00; i < a + len; i += NES_MEM_PAGE_SIZE ) {
+        for ( j = b & 0xff00; j < b + len; j += NES_MEM_PAGE_SIZE ) {
+            pa = cpu6502Plain( cpu, i, 0 );
+            pb = cpu6502Plain( cpu, j, 0 );
+            if ( pa < pb + NES_MEM_PAGE_SIZE && pb < pa + NES_MEM_PAGE_SIZE ) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// len bytes from addr on, one memset per page
+
+static void cpu6502Fill( struct cpu6502 *cpu, const uint16_t addr, const unsigned int len, const uint8_t value ) {
+    unsigned int a;
+    unsigned int n;
+
+    for ( a = addr; a < addr + len; a += n ) {
+        n = NES_MEM_PAGE_SIZE - ( a & 0xff );
+        if ( n > addr + len - a ) {
+            n = addr + len - a;
+        }
+        memset( cpu6502Plain( cpu, a, 1 ), value, n );
+    }
+}
+
+// len bytes from src to dst, one memcpy per run that stays in a page on
+// both sides. Only for ranges that do not overlap.
+
+static void cpu6502Copy( struct cpu6502 *cpu, const uint16_t dst, const uint16_t src, const unsigned int len ) {
+    unsigned int i;
+    unsigned int n;
+    unsigned int m;
+
+    for ( i = 0; i < len; i += n ) {
+        n = NES_MEM_PAGE_SIZE - ( ( src + i ) & 0xff );
+        m = NES_MEM_PAGE_SIZE - ( ( dst + i ) & 0xff );
+        if ( m < n ) {
+            n = m;
+        }
+        if ( n > len - i ) {
+            n = len - i;
+        }
+        memcpy( cpu6502Plain( cpu, dst + i, 1 ), cpu6502Plain( cpu, src + i, 0 ), n );
+    }
+}
+
+// runs as many whole iterations of the loop at cpu->PC as the budget
+// allows. Returns zero, leaving the CPU untouched, if the loop is not
+// plain memory or not even one iteration fits.
+
+static int cpu6502RunMemLoop( struct cpu6502 *cpu, const uint64_t end ) {
+
+    struct memLoop loop;
+    uint8_t *reg;
+    uint8_t *sp;
+    uint8_t value;
+    unsigned int idx;
+    unsigned int n;
+    unsigned int k;
+    unsigned int lo;
+    unsigned int hi;
+    unsigned int i;
+    unsigned int s;
+    unsigned int c;
+    uint64_t clk;
+    uint8_t v;
+    int overlap;
+
+    if ( !cpu6502MemLoop( cpu, cpu->PC, &loop ) ) {
+        return 0;
+    }
+
+    reg = ( loop.reg == LOC_REG_X ) ? &cpu->X : &cpu->Y;
+    idx = *reg;
+
+    // iterations until the index register reaches zero
+    if ( loop.step > 0 ) {
+        n = NES_MEM_PAGE_SIZE - idx;
+    } else {
+        n = idx ? idx : NES_MEM_PAGE_SIZE;
+    }
+
+    // whole iterations that end before the budget does
+
+    clk = cpu->clk;
+    v = idx;
+    for ( k = 0; k < n; k++ ) {
+        c = loop.cycles;
+        if ( loop.copy && ( ( loop.src & 0xff ) + v ) > 0xff ) {
+            c += instructionSet[ READ( cpu->PC ) ].page_cycles;
+        }
+        if ( k == n - 1 ) {
+            c -= loop.notTaken;
+        }
+        if ( clk + c >= end ) {
+            break;
+        }
+        clk += c;
+        v += loop.step;
+    }
+
+    if ( k == 0 ) {
+        return 0;
+    }
+
+    // the index values the iterations went through, as one range; DEX
+    // from zero starts with 0 and then runs down from $ff
+    if ( loop.step > 0 ) {
+        lo = idx;
+        hi = idx + k - 1;
+    } else if ( idx ) {
+        lo = idx - k + 1;
+        hi = idx;
+    } else {
+        lo = ( k > 1 ) ? NES_MEM_PAGE_SIZE - ( k - 1 ) : 0;
+        hi = ( k > 1 ) ? 0xff : 0;
+    }
+
+    for ( s = 0; s < loop.stores; s++ ) {
+        if ( !cpu6502PlainRange( cpu, loop.dst[s], lo, hi, 1 ) || ( idx == 0 && loop.step < 0 && !cpu6502PlainRange( cpu, loop.dst[s], 0, 0, 1 ) ) ) {
+            return 0;
+        }
+    }
+    if ( loop.copy && ( !cpu6502PlainRange( cpu, loop.src, lo, hi, 0 ) || ( idx == 0 && loop.step < 0 && !cpu6502PlainRange( cpu, loop.src, 0, 0, 0 ) ) ) ) {
+        return 0;
+    }
+
+    if ( !loop.copy ) {
+        for ( s = 0; s < loop.stores; s++ ) {
+            if ( idx == 0 && loop.step < 0 ) {
+                cpu6502Fill( cpu, loop.dst[s], 1, cpu->A );
+            }
+            if ( k > 1 || idx != 0 || loop.step > 0 ) {
+                cpu6502Fill( cpu, loop.dst[s] + lo, hi - lo + 1, cpu->A );
+            }
+        }
+    } else {
+        value = cpu->A;
+        overlap = 0;
+        for ( s = 0; s < loop.stores; s++ ) {
+            overlap |= cpu6502Overlaps( cpu, loop.dst[s], loop.src, NES_MEM_PAGE_SIZE );
+            for ( i = 0; i < s; i++ ) {
+                overlap |= cpu6502Overlaps( cpu, loop.dst[s], loop.dst[i], NES_MEM_PAGE_SIZE );
+            }
+        }
+        if ( !overlap ) {
+            for ( s = 0; s < loop.stores; s++ ) {
+                if ( idx == 0 && loop.step < 0 ) {
+                    cpu6502Copy( cpu, loop.dst[s], loop.src, 1 );
+                }
+                if ( k > 1 || idx != 0 || loop.step > 0 ) {
+                    cpu6502Copy( cpu, loop.dst[s] + lo, loop.src + lo, hi - lo + 1 );
+                }
+            }
+            v = idx + loop.step * (int) ( k - 1 );
+            value = *cpu6502Plain( cpu, loop.src + v, 0 );
+        } else {
+            // overlapping buffers, byte by byte in loop order so that the
+            // same stores win
+            v = idx;
+            for ( i = 0; i < k; i++ ) {
+                sp = cpu6502Plain( cpu, loop.src + v, 0 );
+                value = *sp;
+                for ( s = 0; s < loop.stores; s++ ) {
+                    *cpu6502Plain( cpu, loop.dst[s] + v, 1 ) = value;
+                }
+                v += loop.step;
+            }
+        }
+        cpu->A = value;
+    }
+
+    *reg = idx + loop.step * (int) k;
+    cpu->flagZ = *reg;
+    cpu->flagN = *reg;
+    cpu->clk = clk;
+    cpu->PC = ( k == n ) ? loop.exit : cpu->PC;
+
+    return 1;
+
+}
+
+// SPECIALIZED HANDLERS
+//
+// every opcode in the table gets its own copy of cpu6502Execute with the
+// operation fixed at compile time. They are threaded together with
+// computed goto where the compiler supports it, and a switch otherwise.
+//
+// The loop runs until the clock reaches end, an interrupt becomes
+// serviceable or a breakpoint is reached. The first instruction is always
+// executed so that a run can resume from a breakpoint.
+
+#define D_SPECIALIZED_RECORDED(INS,MODE,CYC,PG,OPERAND,REC) \
+    { \
+        static const struct operation op = { D_INSTRUCTION__##INS D_ADDR_MODE__##MODE D_CYCLES(CYC,PG) }; \
+        cpu6502Execute( cpu, op, OPERAND, REC ); \
+    }
+
+#define D_SPECIALIZED(INS,MODE,CYC,PG,OPERAND) \
+    D_SPECIALIZED_RECORDED(INS,MODE,CYC,PG,OPERAND,NULL)
+
+#define D_DISPATCH_LABEL(OPC,INS,MODE,CYC,PG) \
+    [OPC] = &&op_##OPC,
+
+#define D_LABEL(OPC,INS,MODE,CYC,PG) \
+    op_##OPC: \
+        D_SPECIALIZED(INS,MODE,CYC,PG,d->operand) \
+        DISPATCH();
+
+#define D_CASE(OPC,INS,MODE,CYC,PG) \
+    case OPC: \
+        D_SPECIALIZED(INS,MODE,CYC,PG,d->operand) \
+        break;
+
+#define CHECK_STOP() \
+    if ( cpu->clk >= end ) { \
+        return CPU_6502_STOP__BUDGET; \
+    } \
+    if ( cpu6502Interrupted( cpu ) ) { \
+        return CPU_6502_STOP__INTERRUPT; \
+    } \
+    if ( cpu6502AtBreakpoint( cpu ) ) { \
+        return CPU_6502_STOP__BREAKPOINT; \
+    }
+
+#define FETCH() \
+    d = cpu6502Decoded( cpu, cpu->PC );
+
+// CALLABLE HANDLERS
+//
+// the same specialized bodies as plain functions, for the fused forms
+// below and for code that cannot jump into the threaded loop (the JIT
+// calls them from native code)
+
+#define D_HANDLER(OPC,INS,MODE,CYC,PG) \
+    static ALWAYS_INLINE void cpu6502Op_##OPC( struct cpu6502 *cpu, const uint16_t operand ) \
+        D_SPECIALIZED(INS,MODE,CYC,PG,operand)
+
+#define D_HANDLER_ENTRY(OPC,INS,MODE,CYC,PG) \
+    [OPC] = &cpu6502Op_##OPC,
+
+CPU_6502_OPCODES(D_HANDLER)
+
+const cpu6502Handler cpu6502Handlers[256] = {
+    CPU_6502_OPCODES(D_HANDLER_ENTRY)
+};
+
+// TRACED HANDLERS
+//
+// the specialized bodies once more, filling in the access part of a
+// trace record as the reference interpreter does
+
+typedef void (*cpu6502TracedHandler)( struct cpu6502 *, const uint16_t, struct cpu6502TraceRecord * );
+
+#define D_TRACED_HANDLER(OPC,INS,MODE,CYC,PG) \
+    static void cpu6502TracedOp_##OPC( struct cpu6502 *cpu, const uint16_t operand, struct cpu6502TraceRecord *rec ) \
+        D_SPECIALIZED_RECORDED(INS,MODE,CYC,PG,operand,rec)
+
+#define D_TRACED_HANDLER_ENTRY(OPC,INS,MODE,CYC,PG) \
+    [OPC] = &cpu6502TracedOp_##OPC,
+
+CPU_6502_OPCODES(D_TRACED_HANDLER)
+
+static const cpu6502TracedHandler cpu6502TracedHandlers[256] = {
+    CPU_6502_OPCODES(D_TRACED_HANDLER_ENTRY)
+};
+
+// FUSED HANDLERS
+//
+// A fused form runs its instructions back to back without going through
+// dispatch. It is only entered when the budget covers its worst case
+// cycles and no breakpoints are set, so only interrupts need checking
+// between the parts; otherwise the first instruction runs on its own.
+// Code that changed under the form falls back to normal dispatch.
+
+#define D_FUSED_PART(OPC) \
+    if ( cpu6502Interrupted( cpu ) ) { \
+        return CPU_6502_STOP__INTERRUPT; \
+    } \
+    d = next; \
+    next = d + d->size; \
+    if ( d->opcode != OPC ) { \
+        FETCH(); \
+        FUSED_MISS(); \
+    } \
+    cpu6502Op_##OPC( cpu, d->operand );
+
+#define D_FUSED2(NAME,A,B) \
+    if ( cpu->clk + d->cycles >= end || cpu->breakpoints ) { \
+        FUSED_UNFUSE(); \
+    } \
+    next = d + d->size; \
+    cpu6502Op_##A( cpu, d->operand ); \
+    D_FUSED_PART(B) \
+    cpu->fusedCount[FUSED__##NAME]++;
+
+#define D_FUSED3(NAME,A,B,C) \
+    if ( cpu->clk + d->cycles >= end || cpu->breakpoints ) { \
+        FUSED_UNFUSE(); \
+    } \
+    next = d + d->size; \
+    cpu6502Op_##A( cpu, d->operand ); \
+    D_FUSED_PART(B) \
+    D_FUSED_PART(C) \
+    cpu->fusedCount[FUSED__##NAME]++;
+
+// a form that branches back to itself (DEX/BNE delay loops and the like)
+// goes round again without a dispatch
+
+#define D_FUSED_LOOP(NAME) \
+    if ( cpu->PC == start && form->handler == FUSED_HANDLER(FUSED__##NAME) ) { \
+        CHECK_STOP(); \
+        d = form; \
+        goto fused_##NAME; \
+    }
+
+#define D_FUSED_DISPATCH_LABEL2(NAME,A,B) \
+    [FUSED_HANDLER(FUSED__##NAME)] = &&fused_##NAME,
+
+#define D_FUSED_DISPATCH_LABEL3(NAME,A,B,C) \
+    [FUSED_HANDLER(FUSED__##NAME)] = &&fused_##NAME,
+
+#define D_FUSED_LABEL2(NAME,A,B) \
+    fused_##NAME: \
+        form = d; \
+        start = cpu->PC; \
+        D_FUSED2(NAME,A,B) \
+        D_FUSED_LOOP(NAME) \
+        DISPATCH();
+
+#define D_FUSED_LABEL3(NAME,A,B,C) \
+    fused_##NAME: \
+        form = d; \
+        start = cpu->PC; \
+        D_FUSED3(NAME,A,B,C) \
+        D_FUSED_LOOP(NAME) \
+        DISPATCH();
+
+#define D_FUSED_CASE2(NAME,A,B) \
+    case FUSED_HANDLER(FUSED__##NAME): \
+        D_FUSED2(NAME,A,B) \
+        break;
+
+#define D_FUSED_CASE3(NAME,A,B,C) \
+    case FUSED_HANDLER(FUSED__##NAME): \
+        D_FUSED3(NAME,A,B,C) \
+        break;
+
+static int cpu6502RunThreaded( struct cpu6502 *cpu, const uint64_t end ) {
+
+    struct cpu6502Decoded *d;
+    struct cpu6502Decoded *next;
+#ifdef CPU_6502_COMPUTED_GOTO
+    struct cpu6502Decoded *form;
+    uint16_t start;
+#endif
+
+    if ( cpu->decodedEpoch != cpu->mm->epoch ) {
+        cpu6502Remapped( cpu );
+    }
+
+#ifdef CPU_6502_COMPUTED_GOTO
+
+    // every opcode starts out undefined and the defined ones override it
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+    static const void *dispatch[CPU_6502_HANDLERS] = {
+        [0 ... 255] = &&op_undefined,
+        CPU_6502_OPCODES(D_DISPATCH_LABEL)
+        CPU_6502_FUSED(D_FUSED_DISPATCH_LABEL2,D_FUSED_DISPATCH_LABEL3)
+        [IDLE_HANDLER] = &&idle_loop,
+        [MEM_LOOP_HANDLER] = &&mem_loop,
+    };
+#pragma GCC diagnostic pop
+
+#define DISPATCH() \
+    CHECK_STOP(); \
+    FETCH(); \
+    goto *dispatch[d->handler];
+
+#define FUSED_MISS() \
+    goto *dispatch[d->handler];
+
+#define FUSED_UNFUSE() \
+    goto *dispatch[d->opcode];
+
+    FETCH();
+    goto *dispatch[d->handler];
+
+    CPU_6502_OPCODES(D_LABEL)
+    CPU_6502_FUSED(D_FUSED_LABEL2,D_FUSED_LABEL3)
+
+idle_loop:
+    if ( cpu->clk + d->cycles >= end || cpu->breakpoints ) {
+        goto *dispatch[d->opcode];
+    }
+    if ( cpu6502RunIdle( cpu, end ) ) {
+        return CPU_6502_STOP__INTERRUPT;
+    }
+    DISPATCH();
+
+mem_loop:
+    if ( cpu->breakpoints || !cpu6502RunMemLoop( cpu, end ) ) {
+        goto *dispatch[d->opcode];
+    }
+    DISPATCH();
+
+op_undefined:
+    return CPU_6502_STOP__JAM;
+
+#undef DISPATCH
+#undef FUSED_MISS
+#undef FUSED_UNFUSE
+
+#else
+
+#define FUSED_MISS() \
+    continue;
+
+#define FUSED_UNFUSE() \
+    cpu6502Handlers[ d->opcode ]( cpu, d->operand ); \
+    break;
+
+    for (;;) {
+        FETCH();
+        switch ( d->handler ) {
+            CPU_6502_OPCODES(D_CASE)
+            CPU_6502_FUSED(D_FUSED_CASE2,D_FUSED_CASE3)
+            case IDLE_HANDLER:
+                if ( cpu->clk + d->cycles >= end || cpu->breakpoints ) {
+                    cpu6502Handlers[d->opcode]( cpu, d->operand );
+                } else if ( cpu6502RunIdle( cpu, end ) ) {
+                    return CPU_6502_STOP__INTERRUPT;
+                }
+                break;
+            case MEM_LOOP_HANDLER:
+                if ( cpu->breakpoints || !cpu6502RunMemLoop( cpu, end ) ) {
+                    cpu6502Handlers[d->opcode]( cpu, d->operand );
+                }
+                break;
+            default:
+                return CPU_6502_STOP__JAM;
+        }
+        CHECK_STOP();
+    }
+
+#undef FUSED_MISS
+#undef FUSED_UNFUSE
+
+#endif /* CPU_6502_COMPUTED_GOTO */
+
+}
+
+// TRACED RUN
+//
+// the fast engine with cpu->trace attached. Every instruction needs its
+// own record, so this goes one decoded entry at a time and leaves out the
+// fused forms and the idle and memory loops. The records are the ones the
+// reference interpreter writes.
+
+static int cpu6502RunTraced( struct cpu6502 *cpu, const uint64_t end ) {
+
+    struct cpu6502TraceRecord *rec;
+    struct cpu6502Decoded *d;
+
+    if ( cpu->decodedEpoch != cpu->mm->epoch ) {
+        cpu6502Remapped( cpu );
+    }
+
+    for (;;) {
+
+        FETCH();
+
+        if ( d->size == 0 ) {
+            return CPU_6502_STOP__JAM;
+        }
+
+        rec = cpu6502TraceNext( cpu->trace );
+        rec->clk = cpu->clk;
+        rec->PC = cpu->PC;
+        rec->opcode = d->opcode;
+        rec->o1 = d->operand & 0xff;
+        rec->o2 = d->operand >> 8;
+        rec->A = cpu->A;
+        rec->X = cpu->X;
+        rec->Y = cpu->Y;
+        rec->P = cpu6502Flags( cpu );
+        rec->SP = cpu->SP;
+        rec->access = 0;
+        rec->before = 0;
+        rec->after = 0;
+
+        cpu6502TracedHandlers[ d->opcode ]( cpu, d->operand, rec );
+
+        cpu6502TracePublish( cpu->trace );
+
+        CHECK_STOP();
+
     }
 
+}
+
+// JIT
+//
+// ROM code runs as native blocks (see 6502jit.c). Everything else, and
+// any block that could run past the budget, goes to the threaded
+// interpreter. Blocks end on any instruction after which the interpreter
+// could have stopped, so both engines stop at the same points.
+
+static int cpu6502RunJit( struct cpu6502 *cpu, const uint64_t end ) {
+
+    struct cpu6502JitBlock *b;
+    int r;
+
+    if ( cpu->decodedEpoch != cpu->mm->epoch ) {
+        cpu6502Remapped( cpu );
+    }
+
+    for (;;) {
+
+        b = cpu6502JitLookup( cpu, cpu->PC );
+
+        if ( b == NULL ) {
+            r = cpu6502RunThreaded( cpu, cpu->clk + 1 );
+            if ( r == CPU_6502_STOP__JAM ) {
+                return r;
+            }
+        } else if ( b->idle && cpu->clk + b->idle < end ) {
+            if ( cpu6502RunIdle( cpu, end ) ) {
+                return CPU_6502_STOP__INTERRUPT;
+            }
+        } else if ( b->memLoop && !cpu->breakpoints && cpu6502RunMemLoop( cpu, end ) ) {
+            // ran as memset / memcpy
+        } else if ( cpu->clk + b->maxCycles < end ) {
+            b->code( cpu );
+        } else {
+            return cpu6502RunThreaded( cpu, end );
+        }
+
+        CHECK_STOP();
+
+    }
+
+}
+
+static int cpu6502RunReference( struct cpu6502 *cpu, const uint64_t end ) {
+
+    int r;
+
+    for (;;) {
+        // the opcode is fetched once, a jam leaves the CPU where it was
+        r = cpu->trace ? cpu6502StepTraced( cpu ) : cpu6502StepReference( cpu );
+        if ( r == CPU_6502_STOP__JAM ) {
+            return r;
+        }
+        CHECK_STOP();
+    }
+
+}
+
+int cpu6502Run( struct cpu6502 *cpu, const uint64_t budget ) {
+
+    uint64_t end;
+    int r;
+
+    end = cpu->clk + budget;
+
+    cpu6502SetFlags( cpu, cpu->P );
+
+    for (;;) {
+
+        // before servicing anything, so that whoever asked sees the CPU
+        // where it would have been had the budget ended here
+        if ( cpu->pending & CPU_6502_SIGNAL__STOP ) {
+            cpu6502Release( cpu, CPU_6502_SIGNAL__STOP );
+            r = CPU_6502_STOP__BUDGET;
+            break;
+        }
+
+        if ( cpu6502Interrupted( cpu ) ) {
+            cpu6502Service( cpu );
+        }
+
+        if ( cpu->clk >= end ) {
+            r = CPU_6502_STOP__BUDGET;
+            break;
+        }
+
+        // the JIT's blocks write no trace records, so a traced run stays
+        // in the interpreters
+        if ( cpu->engine == CPU_6502_ENGINE__REFERENCE ) {
+            r = cpu6502RunReference( cpu, end );
+        } else if ( cpu->trace ) {
+            r = cpu6502RunTraced( cpu, end );
+        } else if ( cpu->engine == CPU_6502_ENGINE__JIT && cpu->breakpoints == NULL && cpu6502JitAvailable() ) {
+            r = cpu6502RunJit( cpu, end );
+        } else {
+            r = cpu6502RunThreaded( cpu, end );
+        }
+
+        if ( r != CPU_6502_STOP__INTERRUPT ) {
+            break;
+        }
+
+    }
+
+    cpu->P = cpu6502Flags( cpu );
+
+    return r;
+
+}
+
+void cpu6502Step( struct cpu6502 *cpu ) {
+
+    struct cpu6502Decoded *d;
+
+    cpu6502SetFlags( cpu, cpu->P );
+
+    if ( cpu6502Interrupted( cpu ) ) {
+        cpu6502Service( cpu );
+    }
+
+    // a one cycle budget stops after exactly one instruction
+
+    if ( cpu->trace ) {
+        cpu6502StepTraced( cpu );
+    } else if ( cpu->engine == CPU_6502_ENGINE__REFERENCE ) {
+        cpu6502StepReference( cpu );
+    } else if ( cpu->mm->readPage[ cpu->PC >> 8 ] ) {
+        d = cpu6502Decoded( cpu, cpu->PC );
+        cpu->opcode = d->opcode;
+        cpu->o1 = d->operand & 0xff;
+        cpu->o2 = d->operand >> 8;
+        cpu6502RunThreaded( cpu, cpu->clk + 1 );
+    } else {
+        // the callbacks' pages are decoded afresh each time and decoding
+        // ahead would read their registers twice, so take the instruction
+        // from the scratch entry the run decoded it into
+        cpu6502RunThreaded( cpu, cpu->clk + 1 );
+        d = &cpu->decodedScratch;
+        cpu->opcode = d->opcode;
+        cpu->o1 = d->operand & 0xff;
+        cpu->o2 = d->operand >> 8;
+    }
 
+    cpu->P = cpu6502Flags( cpu );
 
 }
 
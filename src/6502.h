@@ -7,12 +7,41 @@
 #define CPU_6502_SIGNAL__RESET  ( 1 << 0 )
 #define CPU_6502_SIGNAL__NMI    ( 1 << 1 )
 #define CPU_6502_SIGNAL__IRQ    ( 1 << 2 )
+#define CPU_6502_SIGNAL__STOP   ( 1 << 3 )  // cpu6502Run returns after the current
+                                            // instruction, as if its budget ran out
+
+// EXECUTION ENGINES
+
+#define CPU_6502_ENGINE__FAST       0  // specialized per-opcode handlers
+#define CPU_6502_ENGINE__REFERENCE  1  // generic table-driven interpreter
+#define CPU_6502_ENGINE__JIT        2  // native x86-64 blocks for ROM code
+
+// RUN STOP REASONS
+
+#define CPU_6502_STOP__BUDGET      0  // cycle budget used up
+#define CPU_6502_STOP__INTERRUPT   1  // interrupt serviceable (internal)
+#define CPU_6502_STOP__BREAKPOINT  2  // PC reached a breakpoint
+#define CPU_6502_STOP__JAM         3  // undefined opcode at PC
+
+// room for the fused instruction forms listed in 6502op.h
+
+#define CPU_6502_FUSED_FORMS  32
 
 typedef unsigned int cpu6502Signal;
 
+// one predecoded instruction, see the decoded instruction cache in 6502.c
+
+struct cpu6502Decoded {
+    uint16_t handler;  // dispatch slot, the opcode or a fused form
+    uint16_t operand;  // o2 << 8 | o1
+    uint8_t opcode;
+    uint8_t size;      // 0 while the entry is not decoded
+    uint8_t cycles;    // base cycle cost
+};
+
 struct cpu6502 {
 
-    unsigned int clk;  // tick counter
+    uint64_t clk;  // cycle counter
 
     uint16_t PC;  // Program Counter
     uint8_t  SP;  // Stack Pointer
@@ -21,18 +50,52 @@ struct cpu6502 {
     uint8_t  Y;   // Index Register Y
     uint8_t  P;   // Processor Status
 
+    // Z, N, V and C while cpu6502Run or cpu6502Step is executing, P is
+    // only brought up to date when they return
+    uint8_t flagZ;  // Z set when zero
+    uint8_t flagN;  // N is bit 7
+    uint8_t flagV;  // V is bit 7
+    uint8_t flagC;  // C is bit 0
+
+    // last instruction executed by cpu6502Step
     uint8_t opcode;   // opcode
     uint8_t o1;   // operand 1
     uint8_t o2;   // operand 2
 
     struct nesMemoryMap *mm;
 
+    unsigned int engine;  // CPU_6502_ENGINE__*
+
+    volatile cpu6502Signal pending;  // raised and not yet serviced signals
+    uint8_t *breakpoints;            // 0x2000 byte PC bitmap, NULL for none
+
+    // decoded instruction cache (fast engine only)
+    struct cpu6502Decoded *decoded[NES_MEM_PAGES];  // per page, lazily allocated
+    uint8_t *decodedBase[NES_MEM_PAGES];  // readPage each page was decoded from
+    uint8_t *decodedNext[NES_MEM_PAGES];  // readPage of the page after it, which
+                                          // holds the tail of its last instructions
+    uint8_t codeWrite[NES_MEM_PAGES];     // write pages aliasing decoded code
+    unsigned int decodedEpoch;            // mm->epoch the cache matches
+    struct cpu6502Decoded decodedScratch; // used for code outside mapped pages
+
+    struct cpu6502Jit *jit;  // translated blocks (JIT engine only)
+
+    struct cpu6502Trace *trace;  // execution trace, NULL for none; see 6502trace.h
+
+    uint64_t fusedCount[CPU_6502_FUSED_FORMS];  // completed runs of each fused form
+
 };
 
 void cpu6502Init( struct cpu6502 *cpu );
-void cpu6502Step( struct cpu6502 *cpu, cpu6502Signal sig );
+void cpu6502Destroy( struct cpu6502 *cpu );
+void cpu6502Step( struct cpu6502 *cpu );
+int cpu6502Run( struct cpu6502 *cpu, const uint64_t budget );
+void cpu6502Raise( struct cpu6502 *cpu, cpu6502Signal sig );
+void cpu6502Release( struct cpu6502 *cpu, cpu6502Signal sig );
 void cpu6502PrintDebugInfo( struct cpu6502 *cpu);
 void cpu6502PrintInstruction( struct cpu6502 *cpu );
+void cpu6502PrintFusedCounts( struct cpu6502 *cpu );
+void cpuDumpStack( struct cpu6502 * cpu );
 
 #endif /* __6502_H */
 
@@ -0,0 +1,1060 @@
+#define _DEFAULT_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "6502.h"
+#include "6502op.h"
+#include "6502batch.h"
+
+// Runs many CPU instances through the same code at once.
+//
+// The lanes whose PC agrees form a group that shares one PC: every
+// instruction is fetched and decoded once, from the opcode table the
+// reference interpreter uses, and then applied to all of them. Registers
+// and flags are kept one array per register so that register and ALU work
+// is done across lanes with vector operations; memory accesses go to each
+// lane's own memory map one lane at a time.
+//
+// A lane leaves the group as soon as it cannot follow it: its branch went
+// the other way, its code differs from the others', an interrupt became
+// serviceable or it used up its budget. Its registers are written back
+// and, unless the budget is used up, cpu6502Run finishes the run on its
+// own engine. Each lane ends up exactly where cpu6502Run on it alone would
+// have left it. Lanes meet again at the start of the next run, which picks
+// the most common PC as the new group, so frame by frame runs of the same
+// game keep most lanes together.
+
+// lanes per vector operation. With GCC the kernels below are built for
+// AVX2 and for baseline SSE2 and picked at load time; other compilers get
+// plain loops.
+
+#ifdef __GNUC__
+#define BATCH_WIDTH 32
+typedef uint8_t batchVec __attribute__(( vector_size( BATCH_WIDTH ), may_alias ));
+#define MASK(X) ( (batchVec) ( X ) )
+#else
+#define BATCH_WIDTH 1
+typedef uint8_t batchVec;
+#define MASK(X) ( (batchVec) -( X ) )
+#endif
+
+#define VEC(P,I) ( *(batchVec *) ( (P) + (I) ) )
+
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__GLIBC__)
+#define BATCH_KERNEL __attribute__(( target_clones( "avx2", "default" ) ))
+#else
+#define BATCH_KERNEL
+#endif
+
+#define BATCH_ALIGN 32
+
+// fewer lanes than this run faster on their own
+#define BATCH_MIN_LANES 24
+
+// stop reason of a lane that still has to finish on the scalar engine
+#define BATCH_STOP__SCALAR ( -1 )
+
+#define STACK 0x0100
+
+// SETUP
+
+static void * batchAlloc( const size_t size ) {
+    void *p;
+
+    if ( posix_memalign( &p, BATCH_ALIGN, size ) ) {
+        return NULL;
+    }
+    memset( p, 0, size );
+    return p;
+}
+
+int cpu6502BatchInit( struct cpu6502Batch *b, struct cpu6502 *cpus, const unsigned int lanes ) {
+
+    unsigned int n;
+    unsigned int w;
+
+    memset( b, 0, sizeof( struct cpu6502Batch ) );
+
+    b->cpu = cpus;
+    b->lanes = lanes;
+    b->stride = ( lanes + BATCH_WIDTH - 1 ) / BATCH_WIDTH * BATCH_WIDTH;
+    b->words = ( lanes + 63 ) / 64;
+
+    n = b->stride;
+    w = b->words * NES_MEM_PAGES;
+
+    b->stop = batchAlloc( n * sizeof( int ) );
+    b->A = batchAlloc( n );
+    b->X = batchAlloc( n );
+    b->Y = batchAlloc( n );
+    b->SP = batchAlloc( n );
+    b->P = batchAlloc( n );
+    b->flagZ = batchAlloc( n );
+    b->flagN = batchAlloc( n );
+    b->flagV = batchAlloc( n );
+    b->flagC = batchAlloc( n );
+    b->clk = batchAlloc( n * sizeof( uint64_t ) );
+    b->end = batchAlloc( n * sizeof( uint64_t ) );
+    b->mm = batchAlloc( n * sizeof( struct nesMemoryMap * ) );
+    b->active = batchAlloc( n * sizeof( unsigned int ) );
+    b->addr = batchAlloc( n * sizeof( uint16_t ) );
+    b->next = batchAlloc( n * sizeof( uint16_t ) );
+    b->src = batchAlloc( n );
+    b->dst = batchAlloc( n );
+    b->tmpc = batchAlloc( n );
+    b->tmpv = batchAlloc( n );
+    b->snap = batchAlloc( NES_MEM_SIZE );
+    b->same = batchAlloc( w * sizeof( uint64_t ) );
+    b->tried = batchAlloc( w * sizeof( uint64_t ) );
+    b->epoch = batchAlloc( n * sizeof( unsigned int ) );
+    b->pcCount = batchAlloc( NES_MEM_SIZE * sizeof( uint32_t ) );
+
+    if ( !( b->stop && b->A && b->X && b->Y && b->SP && b->P && b->flagZ && b->flagN &&
+            b->flagV && b->flagC && b->clk && b->end && b->mm && b->active && b->addr &&
+            b->next && b->src && b->dst && b->tmpc && b->tmpv && b->snap && b->same &&
+            b->tried && b->epoch && b->pcCount ) ) {
+        cpu6502BatchDestroy( b );
+        return -1;
+    }
+
+    return 0;
+
+}
+
+void cpu6502BatchDestroy( struct cpu6502Batch *b ) {
+    unsigned int p;
+
+    for ( p = 0; p < NES_MEM_PAGES; p++ ) {
+        free( b->readBase[p] );
+        free( b->writeBase[p] );
+    }
+    free( b->stop );
+    free( b->A );
+    free( b->X );
+    free( b->Y );
+    free( b->SP );
+    free( b->P );
+    free( b->flagZ );
+    free( b->flagN );
+    free( b->flagV );
+    free( b->flagC );
+    free( b->clk );
+    free( b->end );
+    free( b->mm );
+    free( b->active );
+    free( b->addr );
+    free( b->next );
+    free( b->src );
+    free( b->dst );
+    free( b->tmpc );
+    free( b->tmpv );
+    free( b->snap );
+    free( b->same );
+    free( b->tried );
+    free( b->epoch );
+    free( b->pcCount );
+    memset( b, 0, sizeof( struct cpu6502Batch ) );
+}
+
+void cpu6502BatchPrintStats( struct cpu6502Batch *b ) {
+    printf( "lockstep: %" PRIu64 " steps for %" PRIu64 " instructions, %" PRIu64 " lanes split off\n",
+        b->steps, b->laneSteps, b->splits );
+}
+
+// LANE STATE
+
+static int batchInterrupted( struct cpu6502Batch *b, const unsigned int l ) {
+    cpu6502Signal pending;
+
+    pending = b->cpu[l].pending;
+    return pending && ( ( pending & ~CPU_6502_SIGNAL__IRQ ) || !( b->P[l] & STATUS_I ) );
+}
+
+static void batchSetFlags( struct cpu6502Batch *b, const unsigned int l, const uint8_t p ) {
+    b->P[l] = p;
+    b->flagZ[l] = !( p & STATUS_Z );
+    b->flagN[l] = p;
+    b->flagV[l] = p << 1;
+    b->flagC[l] = p;
+}
+
+static uint8_t batchFlags( struct cpu6502Batch *b, const unsigned int l ) {
+    return ( b->P[l] & ~( STATUS_Z | STATUS_N | STATUS_V | STATUS_C ) )
+        | ( !b->flagZ[l] * STATUS_Z )
+        | ( b->flagN[l] & STATUS_N )
+        | ( ( b->flagV[l] >> 1 ) & STATUS_V )
+        | ( b->flagC[l] & STATUS_C );
+}
+
+static void batchLoad( struct cpu6502Batch *b, const unsigned int l ) {
+    struct cpu6502 *cpu = &b->cpu[l];
+
+    b->A[l] = cpu->A;
+    b->X[l] = cpu->X;
+    b->Y[l] = cpu->Y;
+    b->SP[l] = cpu->SP;
+    batchSetFlags( b, l, cpu->P );
+    b->clk[l] = cpu->clk;
+    b->mm[l] = cpu->mm;
+}
+
+static void batchSave( struct cpu6502Batch *b, const unsigned int l, const uint16_t pc ) {
+    struct cpu6502 *cpu = &b->cpu[l];
+
+    cpu->A = b->A[l];
+    cpu->X = b->X[l];
+    cpu->Y = b->Y[l];
+    cpu->SP = b->SP[l];
+    cpu->P = batchFlags( b, l );
+    cpu->clk = b->clk[l];
+    cpu->PC = pc;
+}
+
+// takes the i-th active lane out of the group, leaving it at pc
+
+static void batchDrop( struct cpu6502Batch *b, const unsigned int i, const uint16_t pc, const int stop ) {
+    unsigned int l;
+
+    l = b->active[i];
+    batchSave( b, l, pc );
+    b->stop[l] = stop;
+    if ( stop == BATCH_STOP__SCALAR ) {
+        b->splits++;
+    }
+    b->active[i] = b->active[ --b->count ];
+}
+
+// MEMORY
+//
+// Each lane has its own memory map. Stores go through the CPU core so the
+// lane's decoded instruction cache stays coherent for when it runs alone.
+
+static inline uint8_t batchRead( struct cpu6502Batch *b, const unsigned int l, const uint16_t addr ) {
+    struct nesMemoryMap *mm = b->mm[l];
+    uint8_t *page;
+
+    page = mm->readPage[ addr >> 8 ];
+    if ( page ) {
+        return page[ addr & 0xff ];
+    }
+    b->io = 1;
+    return mm->read( mm, addr );
+}
+
+static inline void batchWrite( struct cpu6502Batch *b, const unsigned int l, const uint16_t addr, const uint8_t data ) {
+    struct cpu6502 *cpu = &b->cpu[l];
+    uint8_t *page;
+
+    page = b->mm[l]->writePage[ addr >> 8 ];
+    if ( page && !cpu->codeWrite[ addr >> 8 ] ) {
+        page[ addr & 0xff ] = data;
+        return;
+    }
+    if ( page == NULL ) {
+        b->io = 1;
+    }
+    cpu6502Store( cpu, addr, data );
+}
+
+// the lanes' pointers to page p, for reading or for writing. Lanes do not
+// get a write pointer to a page their decoded instruction cache covers.
+// NULL when there is no memory for the table.
+
+static uint8_t ** batchPages( struct cpu6502Batch *b, const unsigned int p, const int write ) {
+
+    struct nesMemoryMap *mm;
+    unsigned int i;
+    unsigned int l;
+
+    if ( b->baseGen[p] != b->gen ) {
+        if ( b->readBase[p] == NULL ) {
+            b->readBase[p] = batchAlloc( b->stride * sizeof( uint8_t * ) );
+            b->writeBase[p] = batchAlloc( b->stride * sizeof( uint8_t * ) );
+            if ( b->readBase[p] == NULL || b->writeBase[p] == NULL ) {
+                free( b->readBase[p] );
+                free( b->writeBase[p] );
+                b->readBase[p] = NULL;
+                b->writeBase[p] = NULL;
+                return NULL;
+            }
+        }
+        for ( i = 0; i < b->count; i++ ) {
+            l = b->active[i];
+            mm = b->mm[l];
+            b->readBase[p][l] = mm->readPage[p];
+            b->writeBase[p][l] = b->cpu[l].codeWrite[p] ? NULL : mm->writePage[p];
+        }
+        b->baseGen[p] = b->gen;
+    }
+
+    return write ? b->writeBase[p] : b->readBase[p];
+
+}
+
+// batchRead and batchWrite through the table of page p
+
+static inline uint8_t batchReadVia( struct cpu6502Batch *b, uint8_t **base, const unsigned int p, const unsigned int l, const uint16_t addr ) {
+    uint8_t *page;
+
+    if ( base && ( addr >> 8 ) == p && ( page = base[l] ) ) {
+        return page[ addr & 0xff ];
+    }
+    return batchRead( b, l, addr );
+}
+
+static inline void batchWriteVia( struct cpu6502Batch *b, uint8_t **base, const unsigned int p, const unsigned int l, const uint16_t addr, const uint8_t data ) {
+    uint8_t *page;
+
+    if ( base && ( addr >> 8 ) == p && ( page = base[l] ) ) {
+        page[ addr & 0xff ] = data;
+        return;
+    }
+    batchWrite( b, l, addr, data );
+}
+
+// SHARED CODE
+//
+// Instructions are fetched from the first lane of the group. Another lane
+// may skip comparing its own code bytes only when both its page and the
+// first lane's are ROM with the same contents, which is found out once per
+// page and lane and forgotten when the lane's page tables change.
+
+static int batchSame( struct cpu6502Batch *b, const unsigned int l, const unsigned int p ) {
+    struct nesMemoryMap *mm;
+    unsigned int w;
+    uint64_t bit;
+
+    w = p * b->words + ( l >> 6 );
+    bit = (uint64_t) 1 << ( l & 63 );
+
+    if ( b->tried[w] & bit ) {
+        return !!( b->same[w] & bit );
+    }
+    b->tried[w] |= bit;
+
+    mm = b->mm[l];
+    if ( mm->readPage[p] == NULL || mm->writePage[p] != NULL ) {
+        return 0;
+    }
+    if ( !b->snapValid[p] ) {
+        memcpy( b->snap + p * NES_MEM_PAGE_SIZE, mm->readPage[p], NES_MEM_PAGE_SIZE );
+        b->snapValid[p] = 1;
+    }
+    if ( memcmp( b->snap + p * NES_MEM_PAGE_SIZE, mm->readPage[p], NES_MEM_PAGE_SIZE ) ) {
+        return 0;
+    }
+
+    b->same[w] |= bit;
+    return 1;
+}
+
+// makes lane l's page p the one the others are compared with, after a
+// bank switch changed what the lanes have there
+
+static void batchResnap( struct cpu6502Batch *b, const unsigned int l, const unsigned int p ) {
+    struct nesMemoryMap *mm = b->mm[l];
+
+    if ( mm->readPage[p] == NULL || mm->writePage[p] != NULL ) {
+        return;
+    }
+    b->snapValid[p] = 0;
+    memset( b->same + p * b->words, 0, b->words * sizeof( uint64_t ) );
+    memset( b->tried + p * b->words, 0, b->words * sizeof( uint64_t ) );
+    b->gen++;
+}
+
+static void batchRemapped( struct cpu6502Batch *b, const unsigned int l ) {
+    unsigned int p;
+    uint64_t bit;
+
+    bit = (uint64_t) 1 << ( l & 63 );
+    for ( p = 0; p < NES_MEM_PAGES; p++ ) {
+        b->same[ p * b->words + ( l >> 6 ) ] &= ~bit;
+        b->tried[ p * b->words + ( l >> 6 ) ] &= ~bit;
+    }
+    b->epoch[l] = b->mm[l]->epoch;
+    b->gen++;
+}
+
+// decodes the instruction at the group's PC and drops the lanes that have
+// different code there. NULL for an undefined opcode.
+
+static const struct operation * batchFetch( struct cpu6502Batch *b, uint16_t *operand ) {
+
+    const struct operation *op;
+    unsigned int lead;
+    unsigned int i;
+    unsigned int l;
+    unsigned int p;
+    unsigned int q;
+    uint16_t pc;
+    uint8_t opcode;
+    int shared;
+    int all;
+
+    pc = b->pc;
+    lead = b->active[0];
+
+    opcode = batchRead( b, lead, pc );
+    op = &instructionSet[opcode];
+    if ( op->size == 0 ) {
+        return NULL;
+    }
+    *operand = ( op->size >= 2 ) ? batchRead( b, lead, pc + 1 ) : 0;
+    *operand |= ( op->size >= 3 ) ? batchRead( b, lead, pc + 2 ) << 8 : 0;
+
+    p = pc >> 8;
+    q = (uint16_t) ( pc + op->size - 1 ) >> 8;
+
+    if ( b->pageOk[p] == b->gen && b->pageOk[q] == b->gen ) {
+        return op;
+    }
+
+    if ( !batchSame( b, lead, p ) ) {
+        batchResnap( b, lead, p );
+    }
+    if ( !batchSame( b, lead, q ) ) {
+        batchResnap( b, lead, q );
+    }
+
+    shared = batchSame( b, lead, p ) && batchSame( b, lead, q );
+    all = shared;
+
+    for ( i = b->count; i-- > 1; ) {
+        l = b->active[i];
+        if ( shared && batchSame( b, l, p ) && batchSame( b, l, q ) ) {
+            continue;
+        }
+        all = 0;
+        if ( batchRead( b, l, pc ) == opcode &&
+             ( op->size < 2 || batchRead( b, l, pc + 1 ) == ( *operand & 0xff ) ) &&
+             ( op->size < 3 || batchRead( b, l, pc + 2 ) == ( *operand >> 8 ) ) ) {
+            continue;
+        }
+        batchDrop( b, i, pc, BATCH_STOP__SCALAR );
+    }
+
+    // the group only shrinks, so this holds until a lane is remapped
+    if ( all ) {
+        b->pageOk[p] = b->gen;
+        b->pageOk[q] = b->gen;
+    }
+
+    return op;
+
+}
+
+// KERNELS
+//
+// The ALU step of cpu6502Execute over every lane at once. Lanes that are
+// not in the group compute garbage that is never read back.
+
+static BATCH_KERNEL void batchAlu( struct cpu6502Batch *b, const unsigned int mode, const uint8_t *s, const uint8_t *x ) {
+
+    batchVec v;
+    batchVec c;
+    batchVec t;
+    batchVec u;
+    batchVec borrow;
+    unsigned int i;
+
+    switch ( mode ) {
+        case ALU_MODE_ADD:
+            for ( i = 0; i < b->stride; i += BATCH_WIDTH ) {
+                v = VEC( s, i );
+                t = VEC( b->A, i ) + v;
+                u = t + ( VEC( b->flagC, i ) & 1 );
+                VEC( b->dst, i ) = u;
+                VEC( b->tmpc, i ) = ( MASK( t < v ) | MASK( u < t ) ) & 1;
+                VEC( b->tmpv, i ) = ~( VEC( x, i ) ^ v ) & ( VEC( x, i ) ^ u );
+            }
+            break;
+        case ALU_MODE_SUBTRACT:
+            for ( i = 0; i < b->stride; i += BATCH_WIDTH ) {
+                v = VEC( s, i );
+                borrow = ~VEC( b->flagC, i ) & 1;
+                t = VEC( b->A, i ) - v;
+                u = t - borrow;
+                VEC( b->dst, i ) = u;
+                VEC( b->tmpc, i ) = ~( MASK( VEC( b->A, i ) < v ) | MASK( t < borrow ) ) & 1;
+                VEC( b->tmpv, i ) = ( VEC( x, i ) ^ u ) & ( VEC( x, i ) ^ v );
+            }
+            break;
+        case ALU_MODE_CMP:
+            for ( i = 0; i < b->stride; i += BATCH_WIDTH ) {
+                v = VEC( s, i );
+                VEC( b->dst, i ) = VEC( x, i ) - v;
+                VEC( b->tmpc, i ) = MASK( VEC( x, i ) >= v ) & 1;
+            }
+            break;
+        case ALU_MODE_XOR:
+            for ( i = 0; i < b->stride; i += BATCH_WIDTH ) {
+                VEC( b->dst, i ) = VEC( b->A, i ) ^ VEC( s, i );
+            }
+            break;
+        case ALU_MODE_OR:
+            for ( i = 0; i < b->stride; i += BATCH_WIDTH ) {
+                VEC( b->dst, i ) = VEC( b->A, i ) | VEC( s, i );
+            }
+            break;
+        case ALU_MODE_AND:
+            // V only matters for BIT
+            for ( i = 0; i < b->stride; i += BATCH_WIDTH ) {
+                VEC( b->dst, i ) = VEC( b->A, i ) & VEC( s, i );
+                VEC( b->tmpv, i ) = VEC( s, i ) << 1;
+            }
+            break;
+        case ALU_MODE_SHIFT_LEFT:
+            for ( i = 0; i < b->stride; i += BATCH_WIDTH ) {
+                VEC( b->tmpc, i ) = VEC( s, i ) >> 7;
+                VEC( b->dst, i ) = VEC( s, i ) << 1;
+            }
+            break;
+        case ALU_MODE_ROTATE_LEFT:
+            for ( i = 0; i < b->stride; i += BATCH_WIDTH ) {
+                c = VEC( b->flagC, i ) & 1;
+                VEC( b->tmpc, i ) = VEC( s, i ) >> 7;
+                VEC( b->dst, i ) = ( VEC( s, i ) << 1 ) | c;
+            }
+            break;
+        case ALU_MODE_SHIFT_RIGHT:
+            for ( i = 0; i < b->stride; i += BATCH_WIDTH ) {
+                VEC( b->tmpc, i ) = VEC( s, i ) & 1;
+                VEC( b->dst, i ) = VEC( s, i ) >> 1;
+            }
+            break;
+        case ALU_MODE_ROTATE_RIGHT:
+            for ( i = 0; i < b->stride; i += BATCH_WIDTH ) {
+                c = VEC( b->flagC, i ) << 7;
+                VEC( b->tmpc, i ) = VEC( s, i ) & 1;
+                VEC( b->dst, i ) = ( VEC( s, i ) >> 1 ) | c;
+            }
+            break;
+        case ALU_MODE_INCREMENT:
+            for ( i = 0; i < b->stride; i += BATCH_WIDTH ) {
+                VEC( b->dst, i ) = VEC( s, i ) + 1;
+            }
+            break;
+        case ALU_MODE_DECREMENT:
+            for ( i = 0; i < b->stride; i += BATCH_WIDTH ) {
+                VEC( b->dst, i ) = VEC( s, i ) - 1;
+            }
+            break;
+    }
+
+}
+
+// P as PHP pushes it
+
+static BATCH_KERNEL void batchPack( struct cpu6502Batch *b, uint8_t *out ) {
+    unsigned int i;
+
+    for ( i = 0; i < b->stride; i += BATCH_WIDTH ) {
+        VEC( out, i ) = ( VEC( b->P, i ) & (uint8_t) ~( STATUS_Z | STATUS_N | STATUS_V | STATUS_C ) )
+            | ( MASK( VEC( b->flagZ, i ) == 0 ) & STATUS_Z )
+            | ( VEC( b->flagN, i ) & STATUS_N )
+            | ( ( VEC( b->flagV, i ) >> 1 ) & STATUS_V )
+            | ( VEC( b->flagC, i ) & STATUS_C )
+            | STATUS_B | STATUS_U;
+    }
+}
+
+static BATCH_KERNEL void batchStatus( struct cpu6502Batch *b, const uint8_t mod, const uint8_t val ) {
+    unsigned int i;
+
+    for ( i = 0; i < b->stride; i += BATCH_WIDTH ) {
+        VEC( b->P, i ) = ( VEC( b->P, i ) & (uint8_t) ~mod ) | (uint8_t) ( val * mod );
+    }
+}
+
+// EXECUTION
+
+// the instruction's effective address for lane l, see cpu6502Execute
+
+#define ADDR(L) ( indexed ? b->addr[L] : addr )
+
+// lanes now at different PCs: the group follows the larger side and the
+// rest leave it
+
+static void batchDiverge( struct cpu6502Batch *b ) {
+
+    unsigned int i;
+    unsigned int n;
+    uint16_t pc;
+    uint16_t other;
+    unsigned int count;
+
+    pc = b->next[ b->active[0] ];
+    other = pc;
+    count = 0;
+
+    for ( i = 0; i < b->count; i++ ) {
+        if ( b->next[ b->active[i] ] == pc ) {
+            count++;
+        } else {
+            other = b->next[ b->active[i] ];
+        }
+    }
+
+    if ( count * 2 < b->count ) {
+        n = 0;
+        for ( i = 0; i < b->count; i++ ) {
+            n += ( b->next[ b->active[i] ] == other );
+        }
+        if ( n > count ) {
+            pc = other;
+        }
+    }
+
+    for ( i = b->count; i-- > 0; ) {
+        if ( b->next[ b->active[i] ] != pc ) {
+            batchDrop( b, i, b->next[ b->active[i] ], BATCH_STOP__SCALAR );
+        }
+    }
+
+    b->pc = pc;
+
+}
+
+static void batchExecute( struct cpu6502Batch *b, const struct operation *op, const uint16_t operand ) {
+
+    const unsigned int *act = b->active;
+    const unsigned int n = b->count;
+    const uint8_t *src = b->src;
+    const uint8_t *aux = b->A;
+    const uint8_t *dst;
+    const uint8_t *index = NULL;
+    uint8_t **base;
+    unsigned int i;
+    unsigned int l;
+    unsigned int p;
+    uint16_t addr = 0;
+    uint16_t a;
+    uint16_t pc;
+    uint16_t ret;
+    int indexed = 0;
+    int diverged = 0;
+    int flag;
+
+    pc = b->pc;
+
+    // ADDRESS CALCULATION
+
+    if ( op->addr_mode & ADDR_MODE ) {
+
+        if ( op->addr_mode & ADDR_MODE_IMMEDIATE ) {
+            addr = pc + 1;
+        } else if ( op->addr_mode & ADDR_MODE_RELATIVE ) {
+            addr = pc + op->size + (int8_t) operand;
+        } else {
+
+            if ( op->addr_mode & ADDR_MODE_INDEX ) {
+                index = ( ( op->addr_mode & ADDR_MODE_INDEX_REG ) == ADDR_MODE_INDEX_REG__X ) ? b->X : b->Y;
+            }
+
+            addr = operand;
+
+            if ( index && ( op->addr_mode & ADDR_MODE_INDEX_TIMING ) == ADDR_MODE_INDEX_TIMING__PRE ) {
+                for ( i = 0; i < n; i++ ) {
+                    l = act[i];
+                    a = operand + index[l];
+                    if ( op->size <= 2 ) {
+                        a &= 0xff;
+                    } else if ( op->page_cycles && ( ( operand ^ a ) & 0xff00 ) ) {
+                        b->clk[l] += op->page_cycles;
+                    }
+                    b->addr[l] = a;
+                }
+                indexed = 1;
+            }
+
+            if ( op->addr_mode & ADDR_MODE_INDIRECT ) {
+                // pointers never carry into the next page
+                p = ADDR( act[0] ) >> 8;
+                base = batchPages( b, p, 0 );
+                for ( i = 0; i < n; i++ ) {
+                    l = act[i];
+                    a = ADDR( l );
+                    a = batchReadVia( b, base, p, l, a ) |
+                        batchReadVia( b, base, p, l, ( a & 0xff00 ) | ( ( a + 1 ) & 0x00ff ) ) << 8;
+                    if ( index && ( op->addr_mode & ADDR_MODE_INDEX_TIMING ) == ADDR_MODE_INDEX_TIMING__POST ) {
+                        if ( op->page_cycles && ( ( a ^ ( a + index[l] ) ) & 0xff00 ) ) {
+                            b->clk[l] += op->page_cycles;
+                        }
+                        a += index[l];
+                    }
+                    b->addr[l] = a;
+                }
+                indexed = 1;
+            }
+
+        }
+    }
+
+    // READ SOURCE
+
+    switch ( op->src ) {
+        case LOC_MEMORY:
+            if ( op->addr_mode & ADDR_MODE_ACCUMULATOR ) {
+                src = b->A;
+            } else if ( op->addr_mode & ADDR_MODE_IMMEDIATE ) {
+                memset( b->src, operand, b->stride );
+            } else {
+                p = ADDR( act[0] ) >> 8;
+                base = batchPages( b, p, 0 );
+                for ( i = 0; i < n; i++ ) {
+                    l = act[i];
+                    b->src[l] = batchReadVia( b, base, p, l, ADDR( l ) );
+                }
+            }
+            break;
+        case LOC_STACK:
+            base = batchPages( b, STACK >> 8, 0 );
+            for ( i = 0; i < n; i++ ) {
+                l = act[i];
+                b->src[l] = batchReadVia( b, base, STACK >> 8, l, STACK + ++b->SP[l] );
+            }
+            break;
+        case LOC_REG_A:
+            src = b->A;
+            break;
+        case LOC_REG_X:
+            src = b->X;
+            break;
+        case LOC_REG_Y:
+            src = b->Y;
+            break;
+        case LOC_REG_SP:
+            src = b->SP;
+            break;
+        case LOC_REG_P:
+            batchPack( b, b->src );
+            break;
+    }
+
+    switch ( op->aux ) {
+        case LOC_REG_X:
+            aux = b->X;
+            break;
+        case LOC_REG_Y:
+            aux = b->Y;
+            break;
+    }
+
+    // ALU EXECUTION
+
+    dst = src;
+    if ( op->alu_mode != ALU_MODE_NOP ) {
+        batchAlu( b, op->alu_mode, src, aux );
+        dst = b->dst;
+    }
+
+    // EVALUATE STATUS
+
+    if ( op->status_update & STATUS_Z ) {
+        memcpy( b->flagZ, dst, b->stride );
+    }
+    if ( op->status_update & STATUS_N ) {
+        memcpy( b->flagN, ( op->instruction_type == INSTRUCTION__BIT ) ? src : dst, b->stride );
+    }
+    if ( op->status_update & STATUS_V ) {
+        memcpy( b->flagV, b->tmpv, b->stride );
+    }
+    if ( op->status_update & STATUS_C ) {
+        memcpy( b->flagC, b->tmpc, b->stride );
+    }
+
+    // WRITE DST
+
+    switch ( op->dst ) {
+        case LOC_MEMORY:
+            if ( op->addr_mode & ADDR_MODE_ACCUMULATOR ) {
+                memmove( b->A, dst, b->stride );
+            } else {
+                p = ADDR( act[0] ) >> 8;
+                base = batchPages( b, p, 1 );
+                for ( i = 0; i < n; i++ ) {
+                    l = act[i];
+                    batchWriteVia( b, base, p, l, ADDR( l ), dst[l] );
+                }
+            }
+            break;
+        case LOC_STACK:
+            base = batchPages( b, STACK >> 8, 1 );
+            for ( i = 0; i < n; i++ ) {
+                l = act[i];
+                batchWriteVia( b, base, STACK >> 8, l, STACK + b->SP[l]--, dst[l] );
+            }
+            break;
+        case LOC_REG_A:
+            memmove( b->A, dst, b->stride );
+            break;
+        case LOC_REG_X:
+            memmove( b->X, dst, b->stride );
+            break;
+        case LOC_REG_Y:
+            memmove( b->Y, dst, b->stride );
+            break;
+        case LOC_REG_SP:
+            memmove( b->SP, dst, b->stride );
+            break;
+        case LOC_REG_P:
+            for ( i = 0; i < n; i++ ) {
+                l = act[i];
+                batchSetFlags( b, l, ( dst[l] & ~STATUS_B ) | STATUS_U );
+            }
+            break;
+    }
+
+    // STATUS CTRL
+
+    if ( op->status_mod & STATUS_C ) {
+        memset( b->flagC, op->status_val, b->stride );
+    }
+    if ( op->status_mod & STATUS_V ) {
+        memset( b->flagV, op->status_val << 7, b->stride );
+    }
+    if ( op->status_mod & ~( STATUS_C | STATUS_V ) ) {
+        batchStatus( b, op->status_mod, op->status_val );
+    }
+
+    // BRANCH
+
+    if ( op->instruction_type == INSTRUCTION__JMP ) {
+        if ( indexed ) {
+            for ( i = 0; i < n; i++ ) {
+                b->next[ act[i] ] = b->addr[ act[i] ];
+            }
+            diverged = 1;
+        } else {
+            b->pc = addr;
+        }
+    } else if ( op->branch_on ) {
+        for ( i = 0; i < n; i++ ) {
+            l = act[i];
+            switch ( op->branch_on ) {
+                case STATUS_Z:
+                    flag = !b->flagZ[l];
+                    break;
+                case STATUS_N:
+                    flag = b->flagN[l] >> 7;
+                    break;
+                case STATUS_V:
+                    flag = b->flagV[l] >> 7;
+                    break;
+                default:
+                    flag = b->flagC[l] & 1;
+                    break;
+            }
+            if ( flag == !!op->branch_if ) {
+                b->clk[l] += op->page_cycles;
+                if ( ( ( pc + op->size ) ^ addr ) & 0xff00 ) {
+                    b->clk[l] += op->page_cycles;
+                }
+                b->next[l] = addr;
+            } else {
+                b->next[l] = pc + op->size;
+            }
+        }
+        diverged = 1;
+    } else if ( op->instruction_type == INSTRUCTION__JSR ) {
+        ret = pc + 2;
+        base = batchPages( b, STACK >> 8, 1 );
+        for ( i = 0; i < n; i++ ) {
+            l = act[i];
+            batchWriteVia( b, base, STACK >> 8, l, STACK + b->SP[l]--, ret >> 8 );
+            batchWriteVia( b, base, STACK >> 8, l, STACK + b->SP[l]--, ret & 0xff );
+        }
+        b->pc = addr;
+    } else if ( op->instruction_type == INSTRUCTION__RTS || op->instruction_type == INSTRUCTION__RTI ) {
+        base = batchPages( b, STACK >> 8, 0 );
+        for ( i = 0; i < n; i++ ) {
+            l = act[i];
+            if ( op->instruction_type == INSTRUCTION__RTI ) {
+                batchSetFlags( b, l, ( batchReadVia( b, base, STACK >> 8, l, STACK + ++b->SP[l] ) & ~STATUS_B ) | STATUS_U );
+            }
+            ret = batchReadVia( b, base, STACK >> 8, l, STACK + ++b->SP[l] );
+            ret |= batchReadVia( b, base, STACK >> 8, l, STACK + ++b->SP[l] ) << 8;
+            if ( op->instruction_type == INSTRUCTION__RTS ) {
+                ret++;
+            }
+            b->next[l] = ret;
+        }
+        diverged = 1;
+    } else if ( op->instruction_type == INSTRUCTION__BRK ) {
+        ret = pc + 2;
+        batchPack( b, b->src );
+        for ( i = 0; i < n; i++ ) {
+            l = act[i];
+            batchWrite( b, l, STACK + b->SP[l]--, ret >> 8 );
+            batchWrite( b, l, STACK + b->SP[l]--, ret & 0xff );
+            batchWrite( b, l, STACK + b->SP[l]--, b->src[l] );
+            b->P[l] |= STATUS_I;
+            b->next[l] = batchRead( b, l, 0xfffe ) | batchRead( b, l, 0xffff ) << 8;
+        }
+        diverged = 1;
+    } else {
+        b->pc = pc + op->size;
+    }
+
+    for ( i = 0; i < n; i++ ) {
+        b->clk[ act[i] ] += op->cycles;
+    }
+
+    if ( diverged ) {
+        batchDiverge( b );
+    }
+
+}
+
+// after every instruction, in the order cpu6502Run checks them: lanes out
+// of budget stop, lanes with a serviceable interrupt go to the scalar
+// engine, which services it
+
+static void batchCheckStop( struct cpu6502Batch *b, const struct operation *op ) {
+
+    unsigned int i;
+    unsigned int l;
+    int64_t left;
+
+    b->slack -= op->cycles + 2 * op->page_cycles;
+
+    if ( b->slack <= 0 ) {
+        b->slack = INT64_MAX;
+        for ( i = b->count; i-- > 0; ) {
+            l = b->active[i];
+            left = (int64_t) ( b->end[l] - b->clk[l] );
+            if ( b->clk[l] >= b->end[l] ) {
+                batchDrop( b, i, b->pc, CPU_6502_STOP__BUDGET );
+            } else if ( left < b->slack ) {
+                b->slack = left;
+            }
+        }
+    }
+
+    // only the memory callbacks can raise a signal or switch banks, and
+    // only CLI, PLP and RTI can unmask a pending IRQ
+    if ( b->io || op->instruction_type == INSTRUCTION__CLI ||
+         op->instruction_type == INSTRUCTION__PLP || op->instruction_type == INSTRUCTION__RTI ) {
+        for ( i = b->count; i-- > 0; ) {
+            l = b->active[i];
+            if ( b->epoch[l] != b->mm[l]->epoch ) {
+                batchRemapped( b, l );
+            }
+            if ( batchInterrupted( b, l ) ) {
+                batchDrop( b, i, b->pc, BATCH_STOP__SCALAR );
+            }
+        }
+    }
+
+}
+
+// RUN
+
+// groups the lanes that can start in lockstep: the most common PC among
+// those without breakpoints, a trace or a serviceable interrupt
+
+static void batchGroup( struct cpu6502Batch *b, const uint64_t budget ) {
+
+    unsigned int l;
+    uint32_t best;
+    uint16_t pc;
+
+    best = 0;
+    pc = 0;
+
+    for ( l = 0; l < b->lanes; l++ ) {
+        b->P[l] = b->cpu[l].P;
+        if ( b->cpu[l].breakpoints || b->cpu[l].trace || batchInterrupted( b, l ) ) {
+            continue;
+        }
+        if ( ++b->pcCount[ b->cpu[l].PC ] > best ) {
+            best = b->pcCount[ b->cpu[l].PC ];
+            pc = b->cpu[l].PC;
+        }
+    }
+
+    for ( l = 0; l < b->lanes; l++ ) {
+        b->pcCount[ b->cpu[l].PC ] = 0;
+    }
+
+    b->count = 0;
+    b->pc = pc;
+    b->slack = budget;
+    b->gen++;
+
+    // with no budget cpu6502Run only services interrupts
+    if ( best < BATCH_MIN_LANES || budget == 0 ) {
+        return;
+    }
+
+    for ( l = 0; l < b->lanes; l++ ) {
+        if ( b->cpu[l].PC != pc || b->cpu[l].breakpoints || b->cpu[l].trace || batchInterrupted( b, l ) ) {
+            continue;
+        }
+        batchLoad( b, l );
+        if ( b->epoch[l] != b->mm[l]->epoch ) {
+            batchRemapped( b, l );
+        }
+        b->active[ b->count++ ] = l;
+    }
+
+}
+
+// runs every lane for budget cycles, as cpu6502Run( &cpu[l], budget ) on
+// each would. The stop reasons are left in b->stop.
+
+void cpu6502BatchRun( struct cpu6502Batch *b, const uint64_t budget ) {
+
+    const struct operation *op;
+    uint16_t operand;
+    unsigned int l;
+    uint64_t start;
+
+    for ( l = 0; l < b->lanes; l++ ) {
+        b->end[l] = b->cpu[l].clk + budget;
+        b->stop[l] = BATCH_STOP__SCALAR;
+    }
+
+    batchGroup( b, budget );
+
+    while ( b->count >= BATCH_MIN_LANES ) {
+
+        op = batchFetch( b, &operand );
+        if ( op == NULL || b->count < BATCH_MIN_LANES ) {
+            // an undefined opcode is left to the scalar engine to report
+            break;
+        }
+
+        b->io = 0;
+        b->steps++;
+        b->laneSteps += b->count;
+
+        batchExecute( b, op, operand );
+        batchCheckStop( b, op );
+
+    }
+
+    while ( b->count ) {
+        batchDrop( b, b->count - 1, b->pc, BATCH_STOP__SCALAR );
+    }
+
+    // everything that left the group early finishes on its own
+
+    for ( l = 0; l < b->lanes; l++ ) {
+        if ( b->stop[l] != BATCH_STOP__SCALAR ) {
+            continue;
+        }
+        // a lane that ran anything was already checked against the budget
+        // like cpu6502Run does after each instruction
+        start = b->end[l] - budget;
+        if ( b->cpu[l].clk > start && b->cpu[l].clk >= b->end[l] ) {
+            b->stop[l] = CPU_6502_STOP__BUDGET;
+        } else {
+            b->stop[l] = cpu6502Run( &b->cpu[l], b->end[l] - b->cpu[l].clk );
+        }
+    }
+
+}
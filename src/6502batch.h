@@ -0,0 +1,78 @@
+#ifndef __6502BATCH_H
+#define __6502BATCH_H
+
+// Lockstep engine for many CPU instances running the same program, such
+// as a search or regression farm with one struct cpu6502 and memory map
+// per run. See 6502batch.c.
+
+#include <stdint.h>
+#include "6502.h"
+
+struct cpu6502Batch {
+
+    struct cpu6502 *cpu;    // lane l runs cpu[l]
+    unsigned int lanes;
+    unsigned int stride;    // lanes rounded up to the vector width
+
+    int *stop;              // CPU_6502_STOP__* of each lane's last run
+
+    // registers of the lanes in lockstep, one array per register indexed
+    // by lane. The group shares a single PC.
+    uint16_t pc;
+    uint8_t *A;
+    uint8_t *X;
+    uint8_t *Y;
+    uint8_t *SP;
+    uint8_t *P;
+    uint8_t *flagZ;
+    uint8_t *flagN;
+    uint8_t *flagV;
+    uint8_t *flagC;
+    uint64_t *clk;
+    uint64_t *end;
+    struct nesMemoryMap **mm;
+
+    unsigned int *active;   // lanes in lockstep
+    unsigned int count;
+    int64_t slack;          // cycles every active lane has left at least
+
+    // per instruction values of every lane
+    uint16_t *addr;
+    uint16_t *next;
+    uint8_t *src;
+    uint8_t *dst;
+    uint8_t *tmpc;
+    uint8_t *tmpv;
+    int io;                 // an access went through the memory callbacks
+
+    // code pages each lane was found to share with the others
+    uint8_t *snap;                  // page contents the lanes matched
+    uint8_t snapValid[NES_MEM_PAGES];
+    uint64_t *same;                 // per page, bit per lane: page matches snap
+    uint64_t *tried;                // per page, bit per lane: compared already
+    unsigned int words;             // uint64_t per page in same and tried
+    unsigned int *epoch;            // per lane, mm->epoch same and tried are for
+    unsigned int pageOk[NES_MEM_PAGES];  // every active lane matched at gen
+    unsigned int gen;
+
+    // per page, each lane's pointer to its memory there, NULL where the
+    // access has to take the slow path. Rebuilt on first use after gen
+    // changes.
+    uint8_t **readBase[NES_MEM_PAGES];
+    uint8_t **writeBase[NES_MEM_PAGES];
+    unsigned int baseGen[NES_MEM_PAGES];
+
+    uint32_t *pcCount;      // lanes per PC, for picking the group
+
+    uint64_t steps;         // instructions run in lockstep
+    uint64_t laneSteps;     // instructions they stood for
+    uint64_t splits;        // lanes sent to the scalar engine early
+
+};
+
+int cpu6502BatchInit( struct cpu6502Batch *b, struct cpu6502 *cpus, const unsigned int lanes );
+void cpu6502BatchDestroy( struct cpu6502Batch *b );
+void cpu6502BatchRun( struct cpu6502Batch *b, const uint64_t budget );
+void cpu6502BatchPrintStats( struct cpu6502Batch *b );
+
+#endif /* __6502BATCH_H */
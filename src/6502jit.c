@@ -0,0 +1,972 @@
+#define _DEFAULT_SOURCE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "6502.h"
+#include "6502op.h"
+#include "6502jit.h"
+
+// Translates straight-line runs of 6502 code in PRG ROM into x86-64.
+//
+// A block starts at any ROM PC and runs to the first instruction after
+// which the interpreter might have to stop: a branch or jump, anything
+// that can unmask IRQ (CLI, PLP, RTI), or a memory access that could reach
+// I/O registers or mapper ports. That instruction is the last one in the
+// block, so interrupts, PPU accesses and bank switches are only ever seen
+// between blocks, exactly where the threaded interpreter would see them.
+//
+// Register, flag, load, store, logic, arithmetic, compare, shift and
+// increment instructions are compiled to native code, with PC and the
+// cycle counter updated lazily. Their memory operands, in zero page or
+// absolute, plain or indexed, go through the same page tables as
+// nesMemRead / nesMemWrite at run time. Only pages the tables back
+// directly are reached that way; where a block was translated with them
+// mapped, they stay mapped until the next flush. Stores that land on a
+// page holding decoded code take cpu6502Store so the interpreter's cache
+// stays coherent. The rest (stack, jumps and pointer modes) calls the
+// specialized handler the interpreter uses. Blocks never cross a page so
+// a bank switch can drop them by page.
+//
+// The code buffer is only ever writable or executable, never both: it
+// is made writable around each translation and executable again after.
+
+#if defined(__x86_64__) && defined(__unix__)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define JIT_CODE_SIZE      ( 1 << 20 )  // 1MB of native code per CPU
+#define JIT_BLOCK_LENGTH   64           // instructions per block at most
+#define JIT_BLOCK_RESERVE  16384        // worst case bytes for one block
+
+#define CPU_OFFSET(F) ( (int32_t) offsetof( struct cpu6502, F ) )
+#define MM_OFFSET(F)  ( (int32_t) offsetof( struct nesMemoryMap, F ) )
+
+// how the page tables backed each page when the blocks were built
+
+#define JIT_PLAIN__READ   1
+#define JIT_PLAIN__WRITE  2
+
+struct cpu6502Jit {
+    uint8_t *code;
+    size_t used;
+    struct cpu6502JitBlock *blocks[NES_MEM_PAGES];  // per ROM page, by offset
+    uint8_t *blockBase[NES_MEM_PAGES];              // readPage they came from
+    uint8_t plain[NES_MEM_PAGES];                   // JIT_PLAIN__* bits
+    unsigned int epoch;
+};
+
+// EMITTER
+
+struct emitter {
+    uint8_t *p;
+};
+
+static void emit8( struct emitter *e, const uint8_t b ) {
+    *( e->p++ ) = b;
+}
+
+static void emit16( struct emitter *e, const uint16_t v ) {
+    memcpy( e->p, &v, 2 );
+    e->p += 2;
+}
+
+static void emit32( struct emitter *e, const uint32_t v ) {
+    memcpy( e->p, &v, 4 );
+    e->p += 4;
+}
+
+static void emit64( struct emitter *e, const uint64_t v ) {
+    memcpy( e->p, &v, 8 );
+    e->p += 8;
+}
+
+// all cpu fields are addressed as [rbx + disp32]
+
+#define MODRM_RBX_DISP32(REG) ( 0x83 | ( (REG) << 3 ) )
+
+static void emitByteImm( struct emitter *e, const uint8_t opc, const uint8_t ext, const int32_t field, const uint8_t imm ) {
+    emit8( e, opc );
+    emit8( e, MODRM_RBX_DISP32( ext ) );
+    emit32( e, field );
+    emit8( e, imm );
+}
+
+// mov byte [rbx+field], imm8
+static void emitStoreImm( struct emitter *e, const int32_t field, const uint8_t imm ) {
+    emitByteImm( e, 0xc6, 0, field, imm );
+}
+
+// and byte [rbx+field], imm8
+static void emitAndImm( struct emitter *e, const int32_t field, const uint8_t imm ) {
+    emitByteImm( e, 0x80, 4, field, imm );
+}
+
+// or byte [rbx+field], imm8
+static void emitOrImm( struct emitter *e, const int32_t field, const uint8_t imm ) {
+    emitByteImm( e, 0x80, 1, field, imm );
+}
+
+// movzx eax, byte [rbx+field]
+static void emitLoadAl( struct emitter *e, const int32_t field ) {
+    emit8( e, 0x0f );
+    emit8( e, 0xb6 );
+    emit8( e, MODRM_RBX_DISP32( 0 ) );
+    emit32( e, field );
+}
+
+// mov byte [rbx+field], al
+static void emitStoreAl( struct emitter *e, const int32_t field ) {
+    emit8( e, 0x88 );
+    emit8( e, MODRM_RBX_DISP32( 0 ) );
+    emit32( e, field );
+}
+
+// inc / dec byte [rbx+field]
+static void emitIncDec( struct emitter *e, const int32_t field, const int dec ) {
+    emit8( e, 0xfe );
+    emit8( e, MODRM_RBX_DISP32( dec ? 1 : 0 ) );
+    emit32( e, field );
+}
+
+// Z and N come straight from the result, see cpu6502Flags in 6502.c
+
+static void emitFlagsZN( struct emitter *e ) {
+    emitStoreAl( e, CPU_OFFSET( flagZ ) );
+    emitStoreAl( e, CPU_OFFSET( flagN ) );
+}
+
+static void emitFlagsZNConst( struct emitter *e, const uint8_t v ) {
+    emitStoreImm( e, CPU_OFFSET( flagZ ), v );
+    emitStoreImm( e, CPU_OFFSET( flagN ), v );
+}
+
+// bring PC and the cycle counter up to date before a handler runs
+static void emitSync( struct emitter *e, const uint16_t pc, unsigned int *clk ) {
+    emit8( e, 0x66 );                       // mov word [rbx+PC], imm16
+    emit8( e, 0xc7 );
+    emit8( e, MODRM_RBX_DISP32( 0 ) );
+    emit32( e, CPU_OFFSET( PC ) );
+    emit16( e, pc );
+    if ( *clk ) {
+        emit8( e, 0x48 );                   // add qword [rbx+clk], imm32
+        emit8( e, 0x81 );
+        emit8( e, MODRM_RBX_DISP32( 0 ) );
+        emit32( e, CPU_OFFSET( clk ) );
+        emit32( e, *clk );
+        *clk = 0;
+    }
+}
+
+static void emitCall( struct emitter *e, const cpu6502Handler h, const uint16_t operand ) {
+    emit8( e, 0x48 );                       // mov rdi, rbx
+    emit8( e, 0x89 );
+    emit8( e, 0xdf );
+    emit8( e, 0xbe );                       // mov esi, operand
+    emit32( e, operand );
+    emit8( e, 0x48 );                       // mov rax, handler
+    emit8( e, 0xb8 );
+    emit64( e, (uint64_t) (uintptr_t) h );
+    emit8( e, 0xff );                       // call rax
+    emit8( e, 0xd0 );
+}
+
+// MEMORY OPERANDS
+//
+// The effective address goes to edx, its page to r8 and its offset in
+// the page to r9, then rcx is pointed at the byte through readPage or
+// writePage as nesMemRead / nesMemWrite would. The value read or to be
+// written is in al.
+
+// edx, r8d, r9d = the address; an indexed read that crosses a page takes
+// its extra cycle here
+static void emitAddress( struct emitter *e, const struct operation *op, const uint16_t operand ) {
+    const int32_t reg = ( op->addr_mode & ADDR_MODE_INDEX_REG__Y ) ? CPU_OFFSET( Y ) : CPU_OFFSET( X );
+
+    switch ( op->addr_mode_type ) {
+        case ADDR_MODE__ZERO_PAGE_IDX_X:
+        case ADDR_MODE__ZERO_PAGE_IDX_Y:
+            emit8( e, 0x0f );               // movzx edx, byte [rbx+reg]
+            emit8( e, 0xb6 );
+            emit8( e, MODRM_RBX_DISP32( 2 ) );
+            emit32( e, reg );
+            emit8( e, 0x80 );               // add dl, imm8: wraps in zero page
+            emit8( e, 0xc2 );
+            emit8( e, operand );
+            break;
+        case ADDR_MODE__IDX_X:
+        case ADDR_MODE__IDX_Y:
+            emit8( e, 0x0f );               // movzx edx, byte [rbx+reg]
+            emit8( e, 0xb6 );
+            emit8( e, MODRM_RBX_DISP32( 2 ) );
+            emit32( e, reg );
+            emit8( e, 0x81 );               // add edx, imm32
+            emit8( e, 0xc2 );
+            emit32( e, operand );
+            break;
+        default:
+            emit8( e, 0xba );               // mov edx, imm32
+            emit32( e, operand );
+            break;
+    }
+
+    emit8( e, 0x41 );                       // mov r8d, edx
+    emit8( e, 0x89 );
+    emit8( e, 0xd0 );
+    emit8( e, 0x41 );                       // shr r8d, 8
+    emit8( e, 0xc1 );
+    emit8( e, 0xe8 );
+    emit8( e, 0x08 );
+    emit8( e, 0x44 );                       // movzx r9d, dl
+    emit8( e, 0x0f );
+    emit8( e, 0xb6 );
+    emit8( e, 0xca );
+
+    if ( ( op->addr_mode_type == ADDR_MODE__IDX_X || op->addr_mode_type == ADDR_MODE__IDX_Y ) && op->page_cycles ) {
+        emit8( e, 0x31 );                   // xor eax, eax
+        emit8( e, 0xc0 );
+        emit8( e, 0x41 );                   // cmp r8d, imm32
+        emit8( e, 0x81 );
+        emit8( e, 0xf8 );
+        emit32( e, operand >> 8 );
+        emit8( e, 0x0f );                   // setne al
+        emit8( e, 0x95 );
+        emit8( e, 0xc0 );
+        emit8( e, 0x48 );                   // add qword [rbx+clk], rax
+        emit8( e, 0x01 );
+        emit8( e, MODRM_RBX_DISP32( 0 ) );
+        emit32( e, CPU_OFFSET( clk ) );
+    }
+}
+
+// rcx = table[r8] + r9, table being readPage or writePage
+static void emitPointer( struct emitter *e, const int32_t table ) {
+    emit8( e, 0x48 );                       // mov rcx, [rbx+mm]
+    emit8( e, 0x8b );
+    emit8( e, MODRM_RBX_DISP32( 1 ) );
+    emit32( e, CPU_OFFSET( mm ) );
+    emit8( e, 0x4a );                       // mov rcx, [rcx+r8*8+table]
+    emit8( e, 0x8b );
+    emit8( e, 0x8c );
+    emit8( e, 0xc1 );
+    emit32( e, table );
+    emit8( e, 0x4c );                       // add rcx, r9
+    emit8( e, 0x01 );
+    emit8( e, 0xc9 );
+}
+
+// movzx eax, byte [rcx]
+static void emitLoadMem( struct emitter *e ) {
+    emit8( e, 0x0f );
+    emit8( e, 0xb6 );
+    emit8( e, 0x01 );
+}
+
+// [rcx] = al, or cpu6502Store( cpu, r8 << 8 | r9, al ) if the page holds
+// decoded code
+static void emitStoreMem( struct emitter *e ) {
+    emit8( e, 0x42 );                       // cmp byte [rbx+r8+codeWrite], 0
+    emit8( e, 0x80 );
+    emit8( e, 0xbc );
+    emit8( e, 0x03 );
+    emit32( e, CPU_OFFSET( codeWrite ) );
+    emit8( e, 0x00 );
+    emit8( e, 0x75 );                       // jne slow
+    emit8( e, 0x04 );
+    emit8( e, 0x88 );                       // mov [rcx], al
+    emit8( e, 0x01 );
+    emit8( e, 0xeb );                       // jmp done
+    emit8( e, 27 );
+    // slow:
+    emit8( e, 0x48 );                       // mov rdi, rbx
+    emit8( e, 0x89 );
+    emit8( e, 0xdf );
+    emit8( e, 0x44 );                       // mov esi, r8d
+    emit8( e, 0x89 );
+    emit8( e, 0xc6 );
+    emit8( e, 0xc1 );                       // shl esi, 8
+    emit8( e, 0xe6 );
+    emit8( e, 0x08 );
+    emit8( e, 0x44 );                       // or esi, r9d
+    emit8( e, 0x09 );
+    emit8( e, 0xce );
+    emit8( e, 0x0f );                       // movzx edx, al
+    emit8( e, 0xb6 );
+    emit8( e, 0xd0 );
+    emit8( e, 0x48 );                       // mov rax, cpu6502Store
+    emit8( e, 0xb8 );
+    emit64( e, (uint64_t) (uintptr_t) &cpu6502Store );
+    emit8( e, 0xff );                       // call rax
+    emit8( e, 0xd0 );
+    // done:
+}
+
+// mov byte [rbx+field], r8 where r8 is 0 al, 1 cl or 2 dl
+static void emitStoreByte( struct emitter *e, const uint8_t reg, const int32_t field ) {
+    emit8( e, 0x88 );
+    emit8( e, MODRM_RBX_DISP32( reg ) );
+    emit32( e, field );
+}
+
+// x86 ALU operations, as the opcode of "op r/m8, r8"
+#define X86_OR   0x08
+#define X86_ADC  0x10
+#define X86_SBB  0x18
+#define X86_AND  0x20
+#define X86_SUB  0x28
+#define X86_XOR  0x30
+#define X86_CMP  0x38
+
+// op al, the operand: the immediate, or the byte at rcx
+static void emitAlu( struct emitter *e, const uint8_t x86, const int imm, const uint16_t operand ) {
+    if ( imm ) {
+        emit8( e, x86 + 4 );                // op al, imm8
+        emit8( e, operand );
+    } else {
+        emit8( e, x86 + 2 );                // op al, [rcx]
+        emit8( e, 0x01 );
+    }
+}
+
+// the shifts and rotates of al, C out (and in) through flagC
+static void emitShift( struct emitter *e, const unsigned int type ) {
+    if ( type == INSTRUCTION__ROL || type == INSTRUCTION__ROR ) {
+        emit8( e, 0x0f );                   // movzx ecx, byte [rbx+flagC]
+        emit8( e, 0xb6 );
+        emit8( e, MODRM_RBX_DISP32( 1 ) );
+        emit32( e, CPU_OFFSET( flagC ) );
+        emit8( e, type == INSTRUCTION__ROL ? 0x80 : 0xc0 );  // and cl, 1 / shl cl, 7
+        emit8( e, 0xe1 );
+        emit8( e, type == INSTRUCTION__ROL ? 0x01 : 0x07 );
+    }
+    emit8( e, 0x89 );                       // mov edx, eax
+    emit8( e, 0xc2 );
+    if ( type == INSTRUCTION__ASL || type == INSTRUCTION__ROL ) {
+        emit8( e, 0xc0 );                   // shr dl, 7
+        emit8( e, 0xea );
+        emit8( e, 0x07 );
+    } else {
+        emit8( e, 0x80 );                   // and dl, 1
+        emit8( e, 0xe2 );
+        emit8( e, 0x01 );
+    }
+    emitStoreByte( e, 2, CPU_OFFSET( flagC ) );
+    if ( type == INSTRUCTION__ASL || type == INSTRUCTION__ROL ) {
+        emit8( e, 0x00 );                   // add al, al
+        emit8( e, 0xc0 );
+    } else {
+        emit8( e, 0xd0 );                   // shr al, 1
+        emit8( e, 0xe8 );
+    }
+    if ( type == INSTRUCTION__ROL || type == INSTRUCTION__ROR ) {
+        emit8( e, 0x08 );                   // or al, cl
+        emit8( e, 0xc8 );
+    }
+}
+
+static int32_t emitRegister( const unsigned int loc ) {
+    switch ( loc ) {
+        case LOC_REG_X:
+            return CPU_OFFSET( X );
+        case LOC_REG_Y:
+            return CPU_OFFSET( Y );
+        default:
+            return CPU_OFFSET( A );
+    }
+}
+
+// Instructions that read or write a memory operand, or work on A through
+// the ALU. The operand must be on pages jitEndsBlock found plain.
+
+static int emitInlineMemory( struct emitter *e, const struct operation *op, const uint16_t operand ) {
+    const int imm = ( op->addr_mode_type == ADDR_MODE__IMMEDIATE );
+    const int acc = ( op->addr_mode_type == ADDR_MODE__ACCUMULATOR );
+
+    switch ( op->addr_mode_type ) {
+        case ADDR_MODE__IMMEDIATE:
+        case ADDR_MODE__ACCUMULATOR:
+        case ADDR_MODE__ZERO_PAGE:
+        case ADDR_MODE__ABSOLUTE:
+        case ADDR_MODE__IDX_X:
+        case ADDR_MODE__IDX_Y:
+        case ADDR_MODE__ZERO_PAGE_IDX_X:
+        case ADDR_MODE__ZERO_PAGE_IDX_Y:
+            break;
+        default:
+            return 0;
+    }
+
+    switch ( op->instruction_type ) {
+        case INSTRUCTION__LDA:
+        case INSTRUCTION__LDX:
+        case INSTRUCTION__LDY:
+            if ( imm ) {
+                emit8( e, 0xb8 );           // mov eax, imm32
+                emit32( e, operand );
+            } else {
+                emitAddress( e, op, operand );
+                emitPointer( e, MM_OFFSET( readPage ) );
+                emitLoadMem( e );
+            }
+            emitStoreAl( e, emitRegister( op->dst ) );
+            emitFlagsZN( e );
+            return 1;
+
+        case INSTRUCTION__STA:
+        case INSTRUCTION__STX:
+        case INSTRUCTION__STY:
+            emitAddress( e, op, operand );
+            emitPointer( e, MM_OFFSET( writePage ) );
+            emitLoadAl( e, emitRegister( op->src ) );
+            emitStoreMem( e );
+            return 1;
+
+        case INSTRUCTION__ORA:
+        case INSTRUCTION__AND:
+        case INSTRUCTION__EOR:
+            if ( !imm ) {
+                emitAddress( e, op, operand );
+                emitPointer( e, MM_OFFSET( readPage ) );
+            }
+            emitLoadAl( e, CPU_OFFSET( A ) );
+            emitAlu( e, op->instruction_type == INSTRUCTION__ORA ? X86_OR :
+                        op->instruction_type == INSTRUCTION__AND ? X86_AND : X86_XOR, imm, operand );
+            emitStoreAl( e, CPU_OFFSET( A ) );
+            emitFlagsZN( e );
+            return 1;
+
+        case INSTRUCTION__ADC:
+        case INSTRUCTION__SBC:
+            if ( !imm ) {
+                emitAddress( e, op, operand );
+                emitPointer( e, MM_OFFSET( readPage ) );
+            }
+            // x86 carry in: C for ADC, borrow (not C) for SBC
+            emit8( e, 0x0f );               // movzx edx, byte [rbx+flagC]
+            emit8( e, 0xb6 );
+            emit8( e, MODRM_RBX_DISP32( 2 ) );
+            emit32( e, CPU_OFFSET( flagC ) );
+            if ( op->instruction_type == INSTRUCTION__SBC ) {
+                emit8( e, 0x80 );           // xor dl, 1
+                emit8( e, 0xf2 );
+                emit8( e, 0x01 );
+            }
+            emit8( e, 0xd0 );               // shr dl, 1
+            emit8( e, 0xea );
+            emitLoadAl( e, CPU_OFFSET( A ) );
+            emitAlu( e, op->instruction_type == INSTRUCTION__ADC ? X86_ADC : X86_SBB, imm, operand );
+            emit8( e, 0x0f );               // setc dl / setnc dl
+            emit8( e, op->instruction_type == INSTRUCTION__ADC ? 0x92 : 0x93 );
+            emit8( e, 0xc2 );
+            emit8( e, 0x0f );               // seto cl
+            emit8( e, 0x90 );
+            emit8( e, 0xc1 );
+            emit8( e, 0xc0 );               // shl cl, 7: V is bit 7 of flagV
+            emit8( e, 0xe1 );
+            emit8( e, 0x07 );
+            emitStoreByte( e, 2, CPU_OFFSET( flagC ) );
+            emitStoreByte( e, 1, CPU_OFFSET( flagV ) );
+            emitStoreAl( e, CPU_OFFSET( A ) );
+            emitFlagsZN( e );
+            return 1;
+
+        case INSTRUCTION__CMP:
+        case INSTRUCTION__CPX:
+        case INSTRUCTION__CPY:
+            if ( !imm ) {
+                emitAddress( e, op, operand );
+                emitPointer( e, MM_OFFSET( readPage ) );
+            }
+            emitLoadAl( e, emitRegister( op->aux ) );
+            emitAlu( e, X86_CMP, imm, operand );
+            emit8( e, 0x0f );               // setnc dl
+            emit8( e, 0x93 );
+            emit8( e, 0xc2 );
+            emitStoreByte( e, 2, CPU_OFFSET( flagC ) );
+            emitAlu( e, X86_SUB, imm, operand );
+            emitFlagsZN( e );
+            return 1;
+
+        case INSTRUCTION__BIT:
+            emitAddress( e, op, operand );
+            emitPointer( e, MM_OFFSET( readPage ) );
+            emitLoadMem( e );
+            emitStoreAl( e, CPU_OFFSET( flagN ) );
+            emit8( e, 0x89 );               // mov edx, eax
+            emit8( e, 0xc2 );
+            emit8( e, 0x00 );               // add dl, dl
+            emit8( e, 0xd2 );
+            emitStoreByte( e, 2, CPU_OFFSET( flagV ) );
+            emit8( e, 0x22 );               // and al, byte [rbx+A]
+            emit8( e, MODRM_RBX_DISP32( 0 ) );
+            emit32( e, CPU_OFFSET( A ) );
+            emitStoreAl( e, CPU_OFFSET( flagZ ) );
+            return 1;
+
+        case INSTRUCTION__INC:
+        case INSTRUCTION__DEC:
+        case INSTRUCTION__ASL:
+        case INSTRUCTION__LSR:
+        case INSTRUCTION__ROL:
+        case INSTRUCTION__ROR:
+            if ( acc ) {
+                emitLoadAl( e, CPU_OFFSET( A ) );
+            } else {
+                emitAddress( e, op, operand );
+                emitPointer( e, MM_OFFSET( readPage ) );
+                emitLoadMem( e );
+            }
+            if ( op->instruction_type == INSTRUCTION__INC || op->instruction_type == INSTRUCTION__DEC ) {
+                emit8( e, 0xfe );           // inc al / dec al
+                emit8( e, op->instruction_type == INSTRUCTION__INC ? 0xc0 : 0xc8 );
+            } else {
+                emitShift( e, op->instruction_type );
+            }
+            emitFlagsZN( e );
+            if ( acc ) {
+                emitStoreAl( e, CPU_OFFSET( A ) );
+            } else {
+                emitPointer( e, MM_OFFSET( writePage ) );
+                emitStoreMem( e );
+            }
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+// INLINE INSTRUCTIONS
+//
+// returns 0 if the opcode has no inline form
+
+static int emitInline( struct emitter *e, const uint8_t opcode, const uint16_t operand ) {
+
+    switch ( opcode ) {
+        case 0xa9:  // LDA #
+            emitStoreImm( e, CPU_OFFSET( A ), operand );
+            emitFlagsZNConst( e, operand );
+            return 1;
+        case 0xa2:  // LDX #
+            emitStoreImm( e, CPU_OFFSET( X ), operand );
+            emitFlagsZNConst( e, operand );
+            return 1;
+        case 0xa0:  // LDY #
+            emitStoreImm( e, CPU_OFFSET( Y ), operand );
+            emitFlagsZNConst( e, operand );
+            return 1;
+        case 0xaa:  // TAX
+            emitLoadAl( e, CPU_OFFSET( A ) );
+            emitStoreAl( e, CPU_OFFSET( X ) );
+            emitFlagsZN( e );
+            return 1;
+        case 0xa8:  // TAY
+            emitLoadAl( e, CPU_OFFSET( A ) );
+            emitStoreAl( e, CPU_OFFSET( Y ) );
+            emitFlagsZN( e );
+            return 1;
+        case 0x8a:  // TXA
+            emitLoadAl( e, CPU_OFFSET( X ) );
+            emitStoreAl( e, CPU_OFFSET( A ) );
+            emitFlagsZN( e );
+            return 1;
+        case 0x98:  // TYA
+            emitLoadAl( e, CPU_OFFSET( Y ) );
+            emitStoreAl( e, CPU_OFFSET( A ) );
+            emitFlagsZN( e );
+            return 1;
+        case 0xba:  // TSX
+            emitLoadAl( e, CPU_OFFSET( SP ) );
+            emitStoreAl( e, CPU_OFFSET( X ) );
+            emitFlagsZN( e );
+            return 1;
+        case 0x9a:  // TXS
+            emitLoadAl( e, CPU_OFFSET( X ) );
+            emitStoreAl( e, CPU_OFFSET( SP ) );
+            return 1;
+        case 0xe8:  // INX
+        case 0xca:  // DEX
+            emitIncDec( e, CPU_OFFSET( X ), opcode == 0xca );
+            emitLoadAl( e, CPU_OFFSET( X ) );
+            emitFlagsZN( e );
+            return 1;
+        case 0xc8:  // INY
+        case 0x88:  // DEY
+            emitIncDec( e, CPU_OFFSET( Y ), opcode == 0x88 );
+            emitLoadAl( e, CPU_OFFSET( Y ) );
+            emitFlagsZN( e );
+            return 1;
+        case 0x18:  // CLC
+            emitStoreImm( e, CPU_OFFSET( flagC ), 0 );
+            return 1;
+        case 0x38:  // SEC
+            emitStoreImm( e, CPU_OFFSET( flagC ), 1 );
+            return 1;
+        case 0xd8:  // CLD
+            emitAndImm( e, CPU_OFFSET( P ), (uint8_t) ~STATUS_D );
+            return 1;
+        case 0xf8:  // SED
+            emitOrImm( e, CPU_OFFSET( P ), STATUS_D );
+            return 1;
+        case 0xb8:  // CLV
+            emitStoreImm( e, CPU_OFFSET( flagV ), 0 );
+            return 1;
+        case 0x78:  // SEI
+            emitOrImm( e, CPU_OFFSET( P ), STATUS_I );
+            return 1;
+        case 0xea:  // NOP
+            return 1;
+    }
+
+    return emitInlineMemory( e, &instructionSet[opcode], operand );
+
+}
+
+// BLOCK BOUNDARIES
+
+// an access is plain, and can stay in the block, if every page it could
+// touch is backed directly by the page table: those never have side
+// effects. The rest go through the callbacks to I/O registers or mapper
+// ports.
+
+static int jitPlain( const struct nesMemoryMap *mm, const uint32_t lo, const uint32_t hi, const int reads, const int writes ) {
+    unsigned int p;
+
+    for ( p = lo >> 8; p <= hi >> 8; p++ ) {
+        if ( ( reads && mm->readPage[p] == NULL ) || ( writes && mm->writePage[p] == NULL ) ) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int jitEndsBlock( const struct nesMemoryMap *mm, const struct operation *op, const uint16_t operand ) {
+
+    uint32_t lo;
+    uint32_t hi;
+    int reads;
+    int writes;
+
+    switch ( op->instruction_type ) {
+        case INSTRUCTION__JMP:
+        case INSTRUCTION__JSR:
+        case INSTRUCTION__RTS:
+        case INSTRUCTION__RTI:
+        case INSTRUCTION__BRK:
+        case INSTRUCTION__CLI:
+        case INSTRUCTION__PLP:
+            return 1;
+        default:
+            break;
+    }
+
+    if ( op->branch_on ) {
+        return 1;
+    }
+
+    reads = ( op->src == LOC_MEMORY );
+    writes = ( op->dst == LOC_MEMORY );
+
+    if ( !( reads || writes ) || ( op->addr_mode & ( ADDR_MODE_ACCUMULATOR | ADDR_MODE_IMMEDIATE ) ) ) {
+        return 0;
+    }
+
+    switch ( op->addr_mode_type ) {
+        case ADDR_MODE__ZERO_PAGE:
+        case ADDR_MODE__ZERO_PAGE_IDX_X:
+        case ADDR_MODE__ZERO_PAGE_IDX_Y:
+            lo = 0;
+            hi = 0xff;
+            break;
+        case ADDR_MODE__ABSOLUTE:
+            lo = hi = operand;
+            break;
+        case ADDR_MODE__IDX_X:
+        case ADDR_MODE__IDX_Y:
+            lo = operand;
+            hi = operand + 0xff;
+            if ( hi > 0xffff ) {
+                // wraps into zero page
+                return 1;
+            }
+            break;
+        default:
+            // pointer based, could go anywhere
+            return 1;
+    }
+
+    return !jitPlain( mm, lo, hi, reads, writes );
+
+}
+
+// TRANSLATION
+
+// Makes the part of the code buffer a block built at offset from can be
+// written to writable, and only writable, or executable again. 0 on
+// success.
+
+static int jitProtect( struct cpu6502Jit *jit, const size_t from, const int prot ) {
+    const size_t page = sysconf( _SC_PAGESIZE );
+    size_t lo;
+    size_t hi;
+
+    lo = from & ~( page - 1 );
+    hi = ( from + JIT_BLOCK_RESERVE + page - 1 ) & ~( page - 1 );
+    if ( hi > JIT_CODE_SIZE ) {
+        hi = JIT_CODE_SIZE;
+    }
+    return mprotect( jit->code + lo, hi - lo, prot );
+}
+
+static void jitTranslate( struct cpu6502 *cpu, struct cpu6502JitBlock *b, const uint16_t start ) {
+
+    struct cpu6502Jit *jit = cpu->jit;
+    struct emitter e;
+    struct memLoop loop;
+    const struct operation *op;
+    const uint8_t *page;
+    unsigned int n;
+    unsigned int off;
+    unsigned int pending;
+    unsigned int maxCycles;
+    uint16_t pc;
+    uint16_t operand;
+    uint8_t opcode;
+    int dirty;
+    int last;
+
+    if ( jitProtect( jit, jit->used, PROT_READ | PROT_WRITE ) < 0 ) {
+        b->code = NULL;
+        b->state = JIT_BLOCK__FAILED;
+        return;
+    }
+
+    page = cpu->mm->readPage[ start >> 8 ];
+    e.p = jit->code + jit->used;
+    b->code = (void (*)( struct cpu6502 * )) e.p;
+
+    emit8( &e, 0x53 );                      // push rbx
+    emit8( &e, 0x48 );                      // mov rbx, rdi
+    emit8( &e, 0x89 );
+    emit8( &e, 0xfb );
+
+    pc = start;
+    pending = 0;
+    maxCycles = 0;
+    dirty = 0;
+    last = 0;
+
+    for ( n = 0; n < JIT_BLOCK_LENGTH && !last && ( pc >> 8 ) == ( start >> 8 ); n++ ) {
+
+        off = pc & 0xff;
+        opcode = page[off];
+        op = &instructionSet[opcode];
+
+        if ( op->size == 0 || off + op->size > NES_MEM_PAGE_SIZE ) {
+            break;
+        }
+
+        operand = 0;
+        if ( op->size >= 2 ) {
+            operand = page[off + 1];
+        }
+        if ( op->size >= 3 ) {
+            operand |= page[off + 2] << 8;
+        }
+
+        // branches can take two extra cycles, indexed reads one
+        maxCycles += op->cycles + ( op->branch_on ? 2 * op->page_cycles : op->page_cycles );
+        last = jitEndsBlock( cpu->mm, op, operand );
+
+        if ( !last && emitInline( &e, opcode, operand ) ) {
+            pending += op->cycles;
+            dirty = 1;
+        } else {
+            emitSync( &e, pc, &pending );
+            emitCall( &e, cpu6502Handlers[opcode], operand );
+            dirty = 0;
+        }
+
+        pc += op->size;
+
+    }
+
+    if ( n == 0 ) {
+        jitProtect( jit, jit->used, PROT_READ | PROT_EXEC );
+        b->code = NULL;
+        b->state = JIT_BLOCK__FAILED;
+        return;
+    }
+
+    if ( dirty ) {
+        emitSync( &e, pc, &pending );
+    }
+
+    emit8( &e, 0x5b );                      // pop rbx
+    emit8( &e, 0xc3 );                      // ret
+
+    if ( jitProtect( jit, jit->used, PROT_READ | PROT_EXEC ) < 0 ) {
+        b->code = NULL;
+        b->state = JIT_BLOCK__FAILED;
+        return;
+    }
+
+    jit->used = e.p - jit->code;
+    b->maxCycles = maxCycles;
+    b->idle = cpu6502IdleLoop( cpu, start );
+    b->memLoop = cpu6502MemLoop( cpu, start, &loop );
+    b->state = JIT_BLOCK__READY;
+
+}
+
+// BLOCK CACHE
+
+static void jitDropPage( struct cpu6502Jit *jit, const unsigned int p ) {
+    free( jit->blocks[p] );
+    jit->blocks[p] = NULL;
+    jit->blockBase[p] = NULL;
+}
+
+// records how the page tables back each page, nonzero if that changed
+
+static int jitPlainPages( struct cpu6502Jit *jit, const struct nesMemoryMap *mm ) {
+    unsigned int p;
+    uint8_t plain;
+    int changed = 0;
+
+    for ( p = 0; p < NES_MEM_PAGES; p++ ) {
+        plain = ( mm->readPage[p] ? JIT_PLAIN__READ : 0 ) | ( mm->writePage[p] ? JIT_PLAIN__WRITE : 0 );
+        changed |= ( plain != jit->plain[p] );
+        jit->plain[p] = plain;
+    }
+    return changed;
+}
+
+int cpu6502JitAvailable( void ) {
+    return 1;
+}
+
+void cpu6502JitFlush( struct cpu6502 *cpu ) {
+    unsigned int p;
+
+    if ( cpu->jit == NULL ) {
+        return;
+    }
+
+    for ( p = 0; p < NES_MEM_PAGES; p++ ) {
+        jitDropPage( cpu->jit, p );
+    }
+    cpu->jit->used = 0;
+}
+
+struct cpu6502JitBlock * cpu6502JitLookup( struct cpu6502 *cpu, const uint16_t pc ) {
+
+    struct cpu6502Jit *jit;
+    struct cpu6502JitBlock *b;
+    unsigned int p;
+
+    jit = cpu->jit;
+    p = pc >> 8;
+
+    if ( jit && jit->blocks[p] ) {
+        if ( jit->epoch == cpu->mm->epoch ) {
+            b = &jit->blocks[p][ pc & 0xff ];
+            if ( b->state == JIT_BLOCK__READY ) {
+                return b;
+            }
+        }
+    }
+
+    // only ROM: mapped for reads and not writable through the page table
+    if ( cpu->mm->readPage[p] == NULL || cpu->mm->writePage[p] != NULL ) {
+        return NULL;
+    }
+
+    if ( jit == NULL ) {
+        jit = calloc( 1, sizeof( struct cpu6502Jit ) );
+        if ( jit == NULL ) {
+            return NULL;
+        }
+        jit->code = mmap( NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if ( jit->code == MAP_FAILED ) {
+            free( jit );
+            return NULL;
+        }
+        jitPlainPages( jit, cpu->mm );
+        jit->epoch = cpu->mm->epoch;
+        cpu->jit = jit;
+    }
+
+    if ( jit->epoch != cpu->mm->epoch ) {
+        // a page going to or from the callbacks moves block ends and
+        // takes away pages inline accesses rely on: start over
+        if ( jitPlainPages( jit, cpu->mm ) ) {
+            cpu6502JitFlush( cpu );
+        }
+        // a bank switch: drop the pages that now show different memory
+        for ( p = 0; p < NES_MEM_PAGES; p++ ) {
+            if ( jit->blockBase[p] && jit->blockBase[p] != cpu->mm->readPage[p] ) {
+                jitDropPage( jit, p );
+            }
+        }
+        jit->epoch = cpu->mm->epoch;
+        p = pc >> 8;
+    }
+
+    if ( jit->used + JIT_BLOCK_RESERVE > JIT_CODE_SIZE ) {
+        cpu6502JitFlush( cpu );
+    }
+
+    if ( jit->blocks[p] == NULL ) {
+        jit->blocks[p] = calloc( NES_MEM_PAGE_SIZE, sizeof( struct cpu6502JitBlock ) );
+        if ( jit->blocks[p] == NULL ) {
+            return NULL;
+        }
+        jit->blockBase[p] = cpu->mm->readPage[p];
+    }
+
+    b = &jit->blocks[p][ pc & 0xff ];
+
+    if ( b->state == JIT_BLOCK__NEW ) {
+        jitTranslate( cpu, b, pc );
+    }
+
+    return ( b->state == JIT_BLOCK__READY ) ? b : NULL;
+
+}
+
+void cpu6502JitDestroy( struct cpu6502 *cpu ) {
+
+    if ( cpu->jit == NULL ) {
+        return;
+    }
+
+    cpu6502JitFlush( cpu );
+    munmap( cpu->jit->code, JIT_CODE_SIZE );
+    free( cpu->jit );
+    cpu->jit = NULL;
+
+}
+
+#else
+
+// no native backend on this platform, cpu6502Run falls back to the
+// threaded interpreter
+
+int cpu6502JitAvailable( void ) {
+    return 0;
+}
+
+struct cpu6502JitBlock * cpu6502JitLookup( struct cpu6502 *cpu, const uint16_t pc ) {
+    return NULL;
+}
+
+void cpu6502JitFlush( struct cpu6502 *cpu ) {
+}
+
+void cpu6502JitDestroy( struct cpu6502 *cpu ) {
+}
+
+#endif /* __x86_64__ && __unix__ */
@@ -0,0 +1,29 @@
+#ifndef __6502JIT_H
+#define __6502JIT_H
+
+// x86-64 block translator for the 6502 core. Internal to the CPU core,
+// selected with CPU_6502_ENGINE__JIT.
+
+#include <stdint.h>
+#include "6502.h"
+
+#define JIT_BLOCK__NEW     0
+#define JIT_BLOCK__READY   1
+#define JIT_BLOCK__FAILED  2
+
+struct cpu6502JitBlock {
+    void (*code)( struct cpu6502 * );  // NULL if the block could not be built
+    unsigned int maxCycles;            // upper bound on the cycles it takes
+    unsigned int state;                // JIT_BLOCK__*
+    unsigned int idle;                 // cycles of one iteration if the block
+                                       // heads an idle loop, else 0
+    unsigned int memLoop;              // nonzero if it heads a fill or copy
+                                       // loop (see cpu6502MemLoop)
+};
+
+int cpu6502JitAvailable( void );
+struct cpu6502JitBlock * cpu6502JitLookup( struct cpu6502 *cpu, const uint16_t pc );
+void cpu6502JitFlush( struct cpu6502 *cpu );
+void cpu6502JitDestroy( struct cpu6502 *cpu );
+
+#endif /* __6502JIT_H */
@@ -0,0 +1,882 @@
+#ifndef __6502OP_H
+#define __6502OP_H
+
+// Instruction set description shared by the interpreter and the other
+// execution engines. Internal to the CPU core.
+
+#include <stdint.h>
+
+#define ON  1
+#define OFF 0
+
+// DATA LOCATIONS
+
+#define LOC_NULL    0
+#define LOC_REG_A   1
+#define LOC_REG_X   2
+#define LOC_REG_Y   3
+#define LOC_REG_SP  4
+#define LOC_REG_PC  5
+#define LOC_REG_P   6
+#define LOC_MEMORY  7
+#define LOC_STACK   8
+
+// ADDRESS MODE OPTIONS
+
+#define ADDR_MODE_IMMEDIATE           ( 1 << 0 )
+#define ADDR_MODE_INDIRECT            ( 1 << 1 )
+#define ADDR_MODE_INDEX               ( 1 << 2 )
+#define ADDR_MODE_INDEX_TIMING        ( 1 << 3 )
+#define ADDR_MODE_INDEX_TIMING__PRE   0
+#define ADDR_MODE_INDEX_TIMING__POST  ( 1 << 3 )
+#define ADDR_MODE_INDEX_REG           ( 1 << 4 )
+#define ADDR_MODE_INDEX_REG__X        0
+#define ADDR_MODE_INDEX_REG__Y        ( 1 << 4 )
+#define ADDR_MODE_RELATIVE            ( 1 << 5 )
+#define ADDR_MODE_ACCUMULATOR         ( 1 << 6 )
+#define ADDR_MODE                     ( 1 << 7 )
+
+// ALU OPERATIONS
+
+#define ALU_MODE_NOP             0
+#define ALU_MODE_ADD             1
+#define ALU_MODE_SUBTRACT        2
+#define ALU_MODE_OR              3
+#define ALU_MODE_AND             4
+#define ALU_MODE_XOR             5
+#define ALU_MODE_SHIFT_LEFT      6
+#define ALU_MODE_SHIFT_RIGHT     7
+#define ALU_MODE_ROTATE_LEFT     8
+#define ALU_MODE_ROTATE_RIGHT    9
+#define ALU_MODE_INCREMENT       10
+#define ALU_MODE_DECREMENT       11
+#define ALU_MODE_CMP             12
+
+// BIT MASKS FOR STATUS REGISTER
+
+#define STATUS_C  (1 << 0)  // CARRY
+#define STATUS_Z  (1 << 1)  // ZERO
+#define STATUS_I  (1 << 2)  // INTERRUPT DISABLE
+#define STATUS_D  (1 << 3)  // DECIMAL MODE
+#define STATUS_B  (1 << 4)  // BREAK (SOFTWARE INTERRUPT)
+#define STATUS_U  (1 << 5)  // UNUSED (ALWAYS PUSHED AS 1)
+#define STATUS_V  (1 << 6)  // OVERFLOW
+#define STATUS_N  (1 << 7)  // NEGATIVE
+
+enum AddrMode {
+    ADDR_MODE__IMPLIED,
+    ADDR_MODE__IMMEDIATE,
+    ADDR_MODE__ACCUMULATOR,
+    ADDR_MODE__ZERO_PAGE,
+    ADDR_MODE__ABSOLUTE,
+    ADDR_MODE__RELATIVE,
+    ADDR_MODE__IDX_X,
+    ADDR_MODE__IDX_Y,
+    ADDR_MODE__ZERO_PAGE_IDX_X,
+    ADDR_MODE__ZERO_PAGE_IDX_Y,
+    ADDR_MODE__INDIRECT,
+    ADDR_MODE__INDEX_INDIRECT,
+    ADDR_MODE__INDIRECT_INDEX,
+};
+
+typedef enum AddrMode addr_mode_t;
+
+enum Instruction {
+    INSTRUCTION__NOP,
+    INSTRUCTION__ADC,
+    INSTRUCTION__AND,
+    INSTRUCTION__ASL,
+    INSTRUCTION__BCC,
+    INSTRUCTION__BCS,
+    INSTRUCTION__BEQ,
+    INSTRUCTION__BIT,
+    INSTRUCTION__BMI,
+    INSTRUCTION__BNE,
+    INSTRUCTION__BPL,
+    INSTRUCTION__BRK,
+    INSTRUCTION__BVC,
+    INSTRUCTION__BVS,
+    INSTRUCTION__CLC,
+    INSTRUCTION__CLD,
+    INSTRUCTION__CLI,
+    INSTRUCTION__CLV,
+    INSTRUCTION__CMP,
+    INSTRUCTION__CPX,
+    INSTRUCTION__CPY,
+    INSTRUCTION__DEC,
+    INSTRUCTION__DEX,
+    INSTRUCTION__DEY,
+    INSTRUCTION__EOR,
+    INSTRUCTION__INC,
+    INSTRUCTION__INX,
+    INSTRUCTION__INY,
+    INSTRUCTION__JMP,
+    INSTRUCTION__JSR,
+    INSTRUCTION__LDA,
+    INSTRUCTION__LDX,
+    INSTRUCTION__LDY,
+    INSTRUCTION__LSR,
+    INSTRUCTION__ORA,
+    INSTRUCTION__PHA,
+    INSTRUCTION__PHP,
+    INSTRUCTION__PLA,
+    INSTRUCTION__PLP,
+    INSTRUCTION__ROL,
+    INSTRUCTION__ROR,
+    INSTRUCTION__RTI,
+    INSTRUCTION__RTS,
+    INSTRUCTION__SBC,
+    INSTRUCTION__SEC,
+    INSTRUCTION__SED,
+    INSTRUCTION__SEI,
+    INSTRUCTION__STA,
+    INSTRUCTION__STX,
+    INSTRUCTION__STY,
+    INSTRUCTION__TAX,
+    INSTRUCTION__TAY,
+    INSTRUCTION__TSX,
+    INSTRUCTION__TXA,
+    INSTRUCTION__TXS,
+    INSTRUCTION__TYA,
+};
+
+typedef enum Instruction instruction_t;
+
+// ADDRESS MODE DEFINITIONS
+
+#define D_ADDR_MODE__IMPLIED \
+        .addr_mode_type = ADDR_MODE__IMPLIED, \
+        .size = 1,
+
+#define D_ADDR_MODE__ACCUMULATOR \
+        .addr_mode_type = ADDR_MODE__ACCUMULATOR, \
+        .addr_mode = ( ADDR_MODE | ADDR_MODE_ACCUMULATOR ), \
+        .size = 1,
+
+#define D_ADDR_MODE__IMMEDIATE \
+        .addr_mode_type = ADDR_MODE__IMMEDIATE, \
+        .addr_mode = ( ADDR_MODE | ADDR_MODE_IMMEDIATE ), \
+        .size = 2,
+
+#define D_ADDR_MODE__ZERO_PAGE \
+        .addr_mode_type = ADDR_MODE__ZERO_PAGE, \
+        .addr_mode = ( ADDR_MODE ), \
+        .size = 2,
+
+#define D_ADDR_MODE__ABSOLUTE \
+        .addr_mode_type = ADDR_MODE__ABSOLUTE, \
+        .addr_mode = ( ADDR_MODE ), \
+        .size = 3,
+
+#define D_ADDR_MODE__RELATIVE \
+        .addr_mode_type = ADDR_MODE__RELATIVE, \
+        .addr_mode = ( ADDR_MODE | ADDR_MODE_RELATIVE ), \
+        .size = 2,
+
+#define D_ADDR_MODE__IDX_X \
+        .addr_mode_type = ADDR_MODE__IDX_X, \
+        .addr_mode = ( ADDR_MODE | ADDR_MODE_INDEX | ADDR_MODE_INDEX_REG__X ), \
+        .size = 3,
+
+#define D_ADDR_MODE__IDX_Y \
+        .addr_mode_type = ADDR_MODE__IDX_Y, \
+        .addr_mode = ( ADDR_MODE | ADDR_MODE_INDEX | ADDR_MODE_INDEX_REG__Y ), \
+        .size = 3,
+
+#define D_ADDR_MODE__ZERO_PAGE_IDX_X \
+        .addr_mode_type = ADDR_MODE__ZERO_PAGE_IDX_X, \
+        .addr_mode = ( ADDR_MODE | ADDR_MODE_INDEX | ADDR_MODE_INDEX_REG__X ), \
+        .size = 2,
+
+#define D_ADDR_MODE__ZERO_PAGE_IDX_Y \
+        .addr_mode_type = ADDR_MODE__ZERO_PAGE_IDX_Y, \
+        .addr_mode = ( ADDR_MODE | ADDR_MODE_INDEX | ADDR_MODE_INDEX_REG__Y ), \
+        .size = 2,
+
+#define D_ADDR_MODE__INDIRECT \
+        .addr_mode_type = ADDR_MODE__INDIRECT, \
+        .addr_mode = ( ADDR_MODE | ADDR_MODE_INDIRECT ), \
+        .size = 3, \
+
+#define D_ADDR_MODE__INDEX_INDIRECT \
+        .addr_mode_type = ADDR_MODE__INDEX_INDIRECT, \
+        .addr_mode = ( ADDR_MODE | ADDR_MODE_INDEX | ADDR_MODE_INDEX_REG__X | ADDR_MODE_INDEX_TIMING__PRE | ADDR_MODE_INDIRECT ), \
+        .size = 2,
+#define D_ADDR_MODE__INDIRECT_INDEX \
+        .addr_mode_type = ADDR_MODE__INDIRECT_INDEX, \
+        .addr_mode = ( ADDR_MODE | ADDR_MODE_INDEX | ADDR_MODE_INDEX_REG__Y | ADDR_MODE_INDEX_TIMING__POST | ADDR_MODE_INDIRECT ), \
+        .size = 2,
+
+// TIMING DEFINITIONS
+
+// base cycle count, plus one extra cycle when an indexed read crosses a page
+// boundary (branches use the flag for their taken/page-cross penalties)
+
+#define D_CYCLES(N,P) \
+        .cycles = N, \
+        .page_cycles = P,
+
+// INSTRUCTION DEFINITIONS
+
+#define D_INSTRUCTION__ADC \
+        .instruction_type = INSTRUCTION__ADC,\
+        .src = LOC_MEMORY, \
+        .aux = LOC_REG_A, \
+        .dst = LOC_REG_A, \
+        .alu_mode = ALU_MODE_ADD, \
+        .status_update = ( STATUS_Z | STATUS_N | STATUS_V | STATUS_C ),
+
+#define D_INSTRUCTION__AND \
+        .instruction_type = INSTRUCTION__AND,\
+        .src = LOC_MEMORY, \
+        .aux = LOC_REG_A, \
+        .dst = LOC_REG_A, \
+        .alu_mode = ALU_MODE_AND, \
+        .status_update = ( STATUS_Z | STATUS_N ),
+
+#define D_INSTRUCTION__ASL \
+        .instruction_type = INSTRUCTION__ASL,\
+        .src = LOC_MEMORY, \
+        .dst = LOC_MEMORY, \
+        .alu_mode = ALU_MODE_SHIFT_LEFT, \
+        .status_update = ( STATUS_Z | STATUS_N | STATUS_C ),
+
+#define D_INSTRUCTION__BCC \
+        .instruction_type = INSTRUCTION__BCC,\
+        .branch_on = STATUS_C, \
+        .branch_if = OFF,
+
+#define D_INSTRUCTION__BCS \
+        .instruction_type = INSTRUCTION__BCS,\
+        .branch_on = STATUS_C, \
+        .branch_if = ON,
+
+#define D_INSTRUCTION__BEQ \
+        .instruction_type = INSTRUCTION__BEQ,\
+        .branch_on = STATUS_Z, \
+        .branch_if = ON,
+
+#define D_INSTRUCTION__BIT \
+        .instruction_type = INSTRUCTION__BIT,\
+        .src = LOC_MEMORY, \
+        .aux = LOC_REG_A, \
+        .dst = LOC_NULL, \
+        .alu_mode = ALU_MODE_AND, \
+        .status_update = ( STATUS_Z | STATUS_N | STATUS_V ),
+
+#define D_INSTRUCTION__BMI \
+        .instruction_type = INSTRUCTION__BMI,\
+        .branch_on = STATUS_N, \
+        .branch_if = ON,
+
+#define D_INSTRUCTION__BNE \
+        .instruction_type = INSTRUCTION__BNE,\
+        .branch_on = STATUS_Z, \
+        .branch_if = OFF,
+
+#define D_INSTRUCTION__BPL \
+        .instruction_type = INSTRUCTION__BPL,\
+        .branch_on = STATUS_N, \
+        .branch_if = OFF,
+
+#define D_INSTRUCTION__BRK \
+        .instruction_type = INSTRUCTION__BRK,
+
+#define D_INSTRUCTION__BVC \
+        .instruction_type = INSTRUCTION__BVC,\
+        .branch_on = STATUS_V, \
+        .branch_if = OFF,
+
+#define D_INSTRUCTION__BVS \
+        .instruction_type = INSTRUCTION__BVS,\
+        .branch_on = STATUS_V, \
+        .branch_if = ON,
+
+#define D_INSTRUCTION__CLC \
+        .instruction_type = INSTRUCTION__CLC,\
+        .status_mod = STATUS_C, \
+        .status_val = OFF,
+
+#define D_INSTRUCTION__CLD \
+        .instruction_type = INSTRUCTION__CLD,\
+        .status_mod = STATUS_D, \
+        .status_val = OFF,
+
+#define D_INSTRUCTION__CLI \
+        .instruction_type = INSTRUCTION__CLI,\
+        .status_mod = STATUS_I, \
+        .status_val = OFF,
+
+#define D_INSTRUCTION__CLV \
+        .instruction_type = INSTRUCTION__CLV,\
+        .status_mod = STATUS_V, \
+        .status_val = OFF,
+
+#define D_INSTRUCTION__CMP \
+        .instruction_type = INSTRUCTION__CMP,\
+        .src = LOC_MEMORY, \
+        .aux = LOC_REG_A, \
+        .dst = LOC_NULL, \
+        .alu_mode = ALU_MODE_CMP, \
+        .status_update = ( STATUS_Z | STATUS_N | STATUS_C ),
+
+#define D_INSTRUCTION__CPX \
+        .instruction_type = INSTRUCTION__CPX,\
+        .src = LOC_MEMORY, \
+        .aux = LOC_REG_X, \
+        .dst = LOC_NULL, \
+        .alu_mode = ALU_MODE_CMP, \
+        .status_update = ( STATUS_Z | STATUS_N | STATUS_C ),
+
+#define D_INSTRUCTION__CPY \
+        .instruction_type = INSTRUCTION__CPY,\
+        .src = LOC_MEMORY, \
+        .aux = LOC_REG_Y, \
+        .dst = LOC_NULL, \
+        .alu_mode = ALU_MODE_CMP, \
+        .status_update = ( STATUS_Z | STATUS_N | STATUS_C ),
+
+#define D_INSTRUCTION__DEC \
+        .instruction_type = INSTRUCTION__DEC,\
+        .src = LOC_MEMORY, \
+        .dst = LOC_MEMORY, \
+        .alu_mode = ALU_MODE_DECREMENT, \
+        .status_update = ( STATUS_Z | STATUS_N ),
+
+#define D_INSTRUCTION__DEX \
+        .instruction_type = INSTRUCTION__DEX,\
+        .src = LOC_REG_X, \
+        .dst = LOC_REG_X, \
+        .alu_mode = ALU_MODE_DECREMENT, \
+        .status_update = ( STATUS_Z | STATUS_N ),
+
+#define D_INSTRUCTION__DEY \
+        .instruction_type = INSTRUCTION__DEY,\
+        .src = LOC_REG_Y, \
+        .dst = LOC_REG_Y, \
+        .alu_mode = ALU_MODE_DECREMENT, \
+        .status_update = ( STATUS_Z | STATUS_N ),
+
+#define D_INSTRUCTION__EOR \
+        .instruction_type = INSTRUCTION__EOR,\
+        .src = LOC_MEMORY, \
+        .aux = LOC_REG_A, \
+        .dst = LOC_REG_A, \
+        .alu_mode = ALU_MODE_XOR, \
+        .status_update = ( STATUS_Z | STATUS_N ),
+
+#define D_INSTRUCTION__INC \
+        .instruction_type = INSTRUCTION__INC,\
+        .src = LOC_MEMORY, \
+        .dst = LOC_MEMORY, \
+        .alu_mode = ALU_MODE_INCREMENT, \
+        .status_update = ( STATUS_Z | STATUS_N ),
+
+#define D_INSTRUCTION__INX \
+        .instruction_type = INSTRUCTION__INX,\
+        .src = LOC_REG_X, \
+        .dst = LOC_REG_X, \
+        .alu_mode = ALU_MODE_INCREMENT, \
+        .status_update = ( STATUS_Z | STATUS_N ),
+
+#define D_INSTRUCTION__INY \
+        .instruction_type = INSTRUCTION__INY,\
+        .src = LOC_REG_Y, \
+        .dst = LOC_REG_Y, \
+        .alu_mode = ALU_MODE_INCREMENT, \
+        .status_update = ( STATUS_Z | STATUS_N ),
+
+#define D_INSTRUCTION__JMP \
+        .instruction_type = INSTRUCTION__JMP,
+
+#define D_INSTRUCTION__JSR \
+        .instruction_type = INSTRUCTION__JSR,
+
+#define D_INSTRUCTION__LDA \
+        .instruction_type = INSTRUCTION__LDA,\
+        .src = LOC_MEMORY, \
+        .dst = LOC_REG_A, \
+        .status_update = ( STATUS_Z | STATUS_N ),
+
+#define D_INSTRUCTION__LDX \
+        .instruction_type = INSTRUCTION__LDX,\
+        .src = LOC_MEMORY, \
+        .dst = LOC_REG_X, \
+        .status_update = ( STATUS_Z | STATUS_N ),
+
+#define D_INSTRUCTION__LDY \
+        .instruction_type = INSTRUCTION__LDY,\
+        .src = LOC_MEMORY, \
+        .dst = LOC_REG_Y, \
+        .status_update = ( STATUS_Z | STATUS_N ),
+
+#define D_INSTRUCTION__LSR \
+        .instruction_type = INSTRUCTION__LSR,\
+        .src = LOC_MEMORY, \
+        .dst = LOC_MEMORY, \
+        .alu_mode = ALU_MODE_SHIFT_RIGHT, \
+        .status_update = ( STATUS_Z | STATUS_N | STATUS_C ),
+
+#define D_INSTRUCTION__NOP \
+        .instruction_type = INSTRUCTION__NOP,\
+
+#define D_INSTRUCTION__ORA \
+        .instruction_type = INSTRUCTION__ORA,\
+        .src = LOC_MEMORY, \
+        .aux = LOC_REG_A, \
+        .dst = LOC_REG_A, \
+        .alu_mode = ALU_MODE_OR, \
+        .status_update = ( STATUS_Z | STATUS_N ),
+
+#define D_INSTRUCTION__PHA \
+        .instruction_type = INSTRUCTION__PHA,\
+        .src = LOC_REG_A, \
+        .dst = LOC_STACK, \
+
+#define D_INSTRUCTION__PHP \
+        .instruction_type = INSTRUCTION__PHP,\
+        .src = LOC_REG_P, \
+        .dst = LOC_STACK, \
+
+#define D_INSTRUCTION__PLA \
+        .instruction_type = INSTRUCTION__PLA,\
+        .src = LOC_STACK, \
+        .dst = LOC_REG_A, \
+        .status_update = ( STATUS_Z | STATUS_N ),
+
+#define D_INSTRUCTION__PLP \
+        .instruction_type = INSTRUCTION__PLP,\
+        .src = LOC_STACK, \
+        .dst = LOC_REG_P,
+
+#define D_INSTRUCTION__ROL \
+        .instruction_type = INSTRUCTION__ROL,\
+        .src = LOC_MEMORY, \
+        .dst = LOC_MEMORY, \
+        .alu_mode = ALU_MODE_ROTATE_LEFT, \
+        .status_update = ( STATUS_Z | STATUS_N | STATUS_C ),
+
+#define D_INSTRUCTION__ROR \
+        .instruction_type = INSTRUCTION__ROR,\
+        .src = LOC_MEMORY, \
+        .dst = LOC_MEMORY, \
+        .alu_mode = ALU_MODE_ROTATE_RIGHT, \
+        .status_update = ( STATUS_Z | STATUS_N | STATUS_C ),
+
+#define D_INSTRUCTION__RTI \
+        .instruction_type = INSTRUCTION__RTI,\
+
+#define D_INSTRUCTION__RTS \
+        .instruction_type = INSTRUCTION__RTS,\
+
+#define D_INSTRUCTION__SBC \
+        .instruction_type = INSTRUCTION__SBC,\
+        .src = LOC_MEMORY, \
+        .aux = LOC_REG_A, \
+        .dst = LOC_REG_A, \
+        .alu_mode = ALU_MODE_SUBTRACT, \
+        .status_update = ( STATUS_Z | STATUS_N | STATUS_C | STATUS_V ),
+
+#define D_INSTRUCTION__SEC \
+        .instruction_type = INSTRUCTION__SEC,\
+        .status_mod = STATUS_C, \
+        .status_val = ON,
+
+#define D_INSTRUCTION__SED \
+        .instruction_type = INSTRUCTION__SED,\
+        .status_mod = STATUS_D, \
+        .status_val = ON,
+
+#define D_INSTRUCTION__SEI \
+        .instruction_type = INSTRUCTION__SEI,\
+        .status_mod = STATUS_I, \
+        .status_val = ON,
+
+#define D_INSTRUCTION__STA \
+        .instruction_type = INSTRUCTION__STA,\
+        .src = LOC_REG_A, \
+        .dst = LOC_MEMORY,
+
+#define D_INSTRUCTION__STX \
+        .instruction_type = INSTRUCTION__STX,\
+        .src = LOC_REG_X, \
+        .dst = LOC_MEMORY,
+
+#define D_INSTRUCTION__STY \
+        .instruction_type = INSTRUCTION__STY,\
+        .src = LOC_REG_Y, \
+        .dst = LOC_MEMORY,
+
+#define D_INSTRUCTION__TAX \
+        .instruction_type = INSTRUCTION__TAX,\
+        .src = LOC_REG_A, \
+        .dst = LOC_REG_X, \
+        .status_update = ( STATUS_Z | STATUS_N ),
+
+#define D_INSTRUCTION__TAY \
+        .instruction_type = INSTRUCTION__TAY,\
+        .src = LOC_REG_A, \
+        .dst = LOC_REG_Y, \
+        .status_update = ( STATUS_Z | STATUS_N ),
+
+#define D_INSTRUCTION__TSX \
+        .instruction_type = INSTRUCTION__TSX,\
+        .src = LOC_REG_SP, \
+        .dst = LOC_REG_X, \
+        .status_update = ( STATUS_Z | STATUS_N ),
+
+#define D_INSTRUCTION__TXA \
+        .instruction_type = INSTRUCTION__TXA,\
+        .src = LOC_REG_X, \
+        .dst = LOC_REG_A, \
+        .status_update = ( STATUS_Z | STATUS_N ),
+
+#define D_INSTRUCTION__TXS \
+        .instruction_type = INSTRUCTION__TXS,\
+        .src = LOC_REG_X, \
+        .dst = LOC_REG_SP,
+
+#define D_INSTRUCTION__TYA \
+        .instruction_type = INSTRUCTION__TYA,\
+        .src = LOC_REG_Y, \
+        .dst = LOC_REG_A, \
+        .status_update = ( STATUS_Z | STATUS_N ),
+
+struct operation {
+
+    addr_mode_t addr_mode_type;
+    instruction_t instruction_type;
+
+    unsigned int size;
+    unsigned int addr_mode;
+
+    unsigned int src;
+    unsigned int aux;
+    unsigned int dst;
+    unsigned int alu_mode;
+
+    uint8_t branch_on;
+    uint8_t branch_if;
+
+    uint8_t status_update;
+
+    uint8_t status_mod;
+    uint8_t status_val;
+
+    uint8_t cycles;
+    uint8_t page_cycles;
+
+};
+
+// OPCODE TABLE
+//
+// OP( opcode, instruction, address mode, cycles, page cycles )
+//
+// expanded in 6502.c into the instructionSet table used by the reference
+// interpreter and into one specialized handler per opcode
+
+#define CPU_6502_OPCODES(OP) \
+    OP( 0x69, ADC, IMMEDIATE, 2, 0 ) \
+    OP( 0x65, ADC, ZERO_PAGE, 3, 0 ) \
+    OP( 0x75, ADC, ZERO_PAGE_IDX_X, 4, 0 ) \
+    OP( 0x6d, ADC, ABSOLUTE, 4, 0 ) \
+    OP( 0x7d, ADC, IDX_X, 4, 1 ) \
+    OP( 0x79, ADC, IDX_Y, 4, 1 ) \
+    OP( 0x61, ADC, INDEX_INDIRECT, 6, 0 ) \
+    OP( 0x71, ADC, INDIRECT_INDEX, 5, 1 ) \
+    \
+    OP( 0x29, AND, IMMEDIATE, 2, 0 ) \
+    OP( 0x25, AND, ZERO_PAGE, 3, 0 ) \
+    OP( 0x35, AND, ZERO_PAGE_IDX_X, 4, 0 ) \
+    OP( 0x2d, AND, ABSOLUTE, 4, 0 ) \
+    OP( 0x3d, AND, IDX_X, 4, 1 ) \
+    OP( 0x39, AND, IDX_Y, 4, 1 ) \
+    OP( 0x21, AND, INDEX_INDIRECT, 6, 0 ) \
+    OP( 0x31, AND, INDIRECT_INDEX, 5, 1 ) \
+    \
+    OP( 0x0a, ASL, ACCUMULATOR, 2, 0 ) \
+    OP( 0x06, ASL, ZERO_PAGE, 5, 0 ) \
+    OP( 0x16, ASL, ZERO_PAGE_IDX_X, 6, 0 ) \
+    OP( 0x0e, ASL, ABSOLUTE, 6, 0 ) \
+    OP( 0x1e, ASL, IDX_X, 7, 0 ) \
+    \
+    OP( 0x90, BCC, RELATIVE, 2, 1 ) \
+    \
+    OP( 0xb0, BCS, RELATIVE, 2, 1 ) \
+    \
+    OP( 0xf0, BEQ, RELATIVE, 2, 1 ) \
+    \
+    OP( 0x24, BIT, ZERO_PAGE, 3, 0 ) \
+    OP( 0x2c, BIT, ABSOLUTE, 4, 0 ) \
+    \
+    OP( 0x30, BMI, RELATIVE, 2, 1 ) \
+    \
+    OP( 0xd0, BNE, RELATIVE, 2, 1 ) \
+    \
+    OP( 0x10, BPL, RELATIVE, 2, 1 ) \
+    \
+    OP( 0x00, BRK, IMPLIED, 7, 0 ) \
+    \
+    OP( 0x50, BVC, RELATIVE, 2, 1 ) \
+    \
+    OP( 0x70, BVS, RELATIVE, 2, 1 ) \
+    \
+    OP( 0x18, CLC, IMPLIED, 2, 0 ) \
+    \
+    OP( 0xd8, CLD, IMPLIED, 2, 0 ) \
+    \
+    OP( 0x58, CLI, IMPLIED, 2, 0 ) \
+    \
+    OP( 0xb8, CLV, IMPLIED, 2, 0 ) \
+    \
+    OP( 0xc9, CMP, IMMEDIATE, 2, 0 ) \
+    OP( 0xc5, CMP, ZERO_PAGE, 3, 0 ) \
+    OP( 0xd5, CMP, ZERO_PAGE_IDX_X, 4, 0 ) \
+    OP( 0xcd, CMP, ABSOLUTE, 4, 0 ) \
+    OP( 0xdd, CMP, IDX_X, 4, 1 ) \
+    OP( 0xd9, CMP, IDX_Y, 4, 1 ) \
+    OP( 0xc1, CMP, INDEX_INDIRECT, 6, 0 ) \
+    OP( 0xd1, CMP, INDIRECT_INDEX, 5, 1 ) \
+    \
+    OP( 0xe0, CPX, IMMEDIATE, 2, 0 ) \
+    OP( 0xe4, CPX, ZERO_PAGE, 3, 0 ) \
+    OP( 0xec, CPX, ABSOLUTE, 4, 0 ) \
+    \
+    OP( 0xc0, CPY, IMMEDIATE, 2, 0 ) \
+    OP( 0xc4, CPY, ZERO_PAGE, 3, 0 ) \
+    OP( 0xcc, CPY, ABSOLUTE, 4, 0 ) \
+    \
+    OP( 0xc6, DEC, ZERO_PAGE, 5, 0 ) \
+    OP( 0xd6, DEC, ZERO_PAGE_IDX_X, 6, 0 ) \
+    OP( 0xce, DEC, ABSOLUTE, 6, 0 ) \
+    OP( 0xde, DEC, IDX_X, 7, 0 ) \
+    \
+    OP( 0xca, DEX, IMPLIED, 2, 0 ) \
+    \
+    OP( 0x88, DEY, IMPLIED, 2, 0 ) \
+    \
+    OP( 0x49, EOR, IMMEDIATE, 2, 0 ) \
+    OP( 0x45, EOR, ZERO_PAGE, 3, 0 ) \
+    OP( 0x55, EOR, ZERO_PAGE_IDX_X, 4, 0 ) \
+    OP( 0x4d, EOR, ABSOLUTE, 4, 0 ) \
+    OP( 0x5d, EOR, IDX_X, 4, 1 ) \
+    OP( 0x59, EOR, IDX_Y, 4, 1 ) \
+    OP( 0x41, EOR, INDEX_INDIRECT, 6, 0 ) \
+    OP( 0x51, EOR, INDIRECT_INDEX, 5, 1 ) \
+    \
+    OP( 0xe6, INC, ZERO_PAGE, 5, 0 ) \
+    OP( 0xf6, INC, ZERO_PAGE_IDX_X, 6, 0 ) \
+    OP( 0xee, INC, ABSOLUTE, 6, 0 ) \
+    OP( 0xfe, INC, IDX_X, 7, 0 ) \
+    \
+    OP( 0xe8, INX, IMPLIED, 2, 0 ) \
+    OP( 0xc8, INY, IMPLIED, 2, 0 ) \
+    \
+    OP( 0x4c, JMP, ABSOLUTE, 3, 0 ) \
+    OP( 0x6c, JMP, INDIRECT, 5, 0 ) \
+    \
+    OP( 0x20, JSR, ABSOLUTE, 6, 0 ) \
+    \
+    OP( 0xa9, LDA, IMMEDIATE, 2, 0 ) \
+    OP( 0xa5, LDA, ZERO_PAGE, 3, 0 ) \
+    OP( 0xb5, LDA, ZERO_PAGE_IDX_X, 4, 0 ) \
+    OP( 0xad, LDA, ABSOLUTE, 4, 0 ) \
+    OP( 0xbd, LDA, IDX_X, 4, 1 ) \
+    OP( 0xb9, LDA, IDX_Y, 4, 1 ) \
+    OP( 0xa1, LDA, INDEX_INDIRECT, 6, 0 ) \
+    OP( 0xb1, LDA, INDIRECT_INDEX, 5, 1 ) \
+    \
+    OP( 0xa2, LDX, IMMEDIATE, 2, 0 ) \
+    OP( 0xa6, LDX, ZERO_PAGE, 3, 0 ) \
+    OP( 0xb6, LDX, ZERO_PAGE_IDX_Y, 4, 0 ) \
+    OP( 0xae, LDX, ABSOLUTE, 4, 0 ) \
+    OP( 0xbe, LDX, IDX_Y, 4, 1 ) \
+    \
+    OP( 0xa0, LDY, IMMEDIATE, 2, 0 ) \
+    OP( 0xa4, LDY, ZERO_PAGE, 3, 0 ) \
+    OP( 0xb4, LDY, ZERO_PAGE_IDX_X, 4, 0 ) \
+    OP( 0xac, LDY, ABSOLUTE, 4, 0 ) \
+    OP( 0xbc, LDY, IDX_X, 4, 1 ) \
+    \
+    OP( 0x4a, LSR, ACCUMULATOR, 2, 0 ) \
+    OP( 0x46, LSR, ZERO_PAGE, 5, 0 ) \
+    OP( 0x56, LSR, ZERO_PAGE_IDX_X, 6, 0 ) \
+    OP( 0x4e, LSR, ABSOLUTE, 6, 0 ) \
+    OP( 0x5e, LSR, IDX_X, 7, 0 ) \
+    \
+    OP( 0xea, NOP, IMPLIED, 2, 0 ) \
+    \
+    OP( 0x09, ORA, IMMEDIATE, 2, 0 ) \
+    OP( 0x05, ORA, ZERO_PAGE, 3, 0 ) \
+    OP( 0x15, ORA, ZERO_PAGE_IDX_X, 4, 0 ) \
+    OP( 0x0d, ORA, ABSOLUTE, 4, 0 ) \
+    OP( 0x1d, ORA, IDX_X, 4, 1 ) \
+    OP( 0x19, ORA, IDX_Y, 4, 1 ) \
+    OP( 0x01, ORA, INDEX_INDIRECT, 6, 0 ) \
+    OP( 0x11, ORA, INDIRECT_INDEX, 5, 1 ) \
+    \
+    OP( 0x48, PHA, IMPLIED, 3, 0 ) \
+    \
+    OP( 0x08, PHP, IMPLIED, 3, 0 ) \
+    \
+    OP( 0x68, PLA, IMPLIED, 4, 0 ) \
+    \
+    OP( 0x28, PLP, IMPLIED, 4, 0 ) \
+    \
+    OP( 0x2a, ROL, ACCUMULATOR, 2, 0 ) \
+    OP( 0x26, ROL, ZERO_PAGE, 5, 0 ) \
+    OP( 0x36, ROL, ZERO_PAGE_IDX_X, 6, 0 ) \
+    OP( 0x2e, ROL, ABSOLUTE, 6, 0 ) \
+    OP( 0x3e, ROL, IDX_X, 7, 0 ) \
+    \
+    OP( 0x6a, ROR, ACCUMULATOR, 2, 0 ) \
+    OP( 0x66, ROR, ZERO_PAGE, 5, 0 ) \
+    OP( 0x76, ROR, ZERO_PAGE_IDX_X, 6, 0 ) \
+    OP( 0x6e, ROR, ABSOLUTE, 6, 0 ) \
+    OP( 0x7e, ROR, IDX_X, 7, 0 ) \
+    \
+    OP( 0x40, RTI, IMPLIED, 6, 0 ) \
+    \
+    OP( 0x60, RTS, IMPLIED, 6, 0 ) \
+    \
+    OP( 0xe9, SBC, IMMEDIATE, 2, 0 ) \
+    OP( 0xe5, SBC, ZERO_PAGE, 3, 0 ) \
+    OP( 0xf5, SBC, ZERO_PAGE_IDX_X, 4, 0 ) \
+    OP( 0xed, SBC, ABSOLUTE, 4, 0 ) \
+    OP( 0xfd, SBC, IDX_X, 4, 1 ) \
+    OP( 0xf9, SBC, IDX_Y, 4, 1 ) \
+    OP( 0xe1, SBC, INDEX_INDIRECT, 6, 0 ) \
+    OP( 0xf1, SBC, INDIRECT_INDEX, 5, 1 ) \
+    \
+    OP( 0x38, SEC, IMPLIED, 2, 0 ) \
+    \
+    OP( 0xf8, SED, IMPLIED, 2, 0 ) \
+    \
+    OP( 0x78, SEI, IMPLIED, 2, 0 ) \
+    \
+    OP( 0x85, STA, ZERO_PAGE, 3, 0 ) \
+    OP( 0x95, STA, ZERO_PAGE_IDX_X, 4, 0 ) \
+    OP( 0x8d, STA, ABSOLUTE, 4, 0 ) \
+    OP( 0x9d, STA, IDX_X, 5, 0 ) \
+    OP( 0x99, STA, IDX_Y, 5, 0 ) \
+    OP( 0x81, STA, INDEX_INDIRECT, 6, 0 ) \
+    OP( 0x91, STA, INDIRECT_INDEX, 6, 0 ) \
+    \
+    OP( 0x86, STX, ZERO_PAGE, 3, 0 ) \
+    OP( 0x96, STX, ZERO_PAGE_IDX_Y, 4, 0 ) \
+    OP( 0x8e, STX, ABSOLUTE, 4, 0 ) \
+    \
+    OP( 0x84, STY, ZERO_PAGE, 3, 0 ) \
+    OP( 0x94, STY, ZERO_PAGE_IDX_X, 4, 0 ) \
+    OP( 0x8c, STY, ABSOLUTE, 4, 0 ) \
+    \
+    OP( 0xaa, TAX, IMPLIED, 2, 0 ) \
+    \
+    OP( 0xa8, TAY, IMPLIED, 2, 0 ) \
+    \
+    OP( 0xba, TSX, IMPLIED, 2, 0 ) \
+    \
+    OP( 0x8a, TXA, IMPLIED, 2, 0 ) \
+    \
+    OP( 0x9a, TXS, IMPLIED, 2, 0 ) \
+    \
+    OP( 0x98, TYA, IMPLIED, 2, 0 )
+
+// FUSED INSTRUCTIONS
+//
+// F2( name, opcode, opcode ) and F3( name, opcode, opcode, opcode )
+//
+// common sequences the fast engine runs as one handler when they sit in
+// the same page. A longer form wins over a shorter one it starts with.
+
+#define CPU_6502_FUSED(F2,F3) \
+    F3( LDA_ZP_CLC_ADC_IMM, 0xa5, 0x18, 0x69 ) \
+    F3( LDA_ZP_SEC_SBC_IMM, 0xa5, 0x38, 0xe9 ) \
+    F3( INX_CPX_IMM_BNE, 0xe8, 0xe0, 0xd0 ) \
+    F3( INY_CPY_IMM_BNE, 0xc8, 0xc0, 0xd0 ) \
+    \
+    F2( DEX_BNE, 0xca, 0xd0 ) \
+    F2( DEY_BNE, 0x88, 0xd0 ) \
+    F2( INX_BNE, 0xe8, 0xd0 ) \
+    F2( INY_BNE, 0xc8, 0xd0 ) \
+    F2( CMP_IMM_BEQ, 0xc9, 0xf0 ) \
+    F2( CMP_IMM_BNE, 0xc9, 0xd0 ) \
+    F2( CPX_IMM_BNE, 0xe0, 0xd0 ) \
+    F2( CPY_IMM_BNE, 0xc0, 0xd0 ) \
+    F2( AND_IMM_BEQ, 0x29, 0xf0 ) \
+    F2( AND_IMM_BNE, 0x29, 0xd0 ) \
+    F2( LDA_ZP_BEQ, 0xa5, 0xf0 ) \
+    F2( LDA_ZP_BNE, 0xa5, 0xd0 ) \
+    F2( LDA_ABS_BPL, 0xad, 0x10 ) \
+    F2( BIT_ABS_BPL, 0x2c, 0x10 ) \
+    F2( BIT_ABS_BMI, 0x2c, 0x30 ) \
+    F2( LDA_IMM_STA_ZP, 0xa9, 0x85 ) \
+    F2( LDA_IMM_STA_ABS, 0xa9, 0x8d ) \
+    F2( LDA_ZP_STA_ZP, 0xa5, 0x85 ) \
+    F2( LDA_ZP_STA_ABS, 0xa5, 0x8d ) \
+    F2( LDA_ABS_STA_ABS, 0xad, 0x8d ) \
+    F2( LDA_ABX_STA_ABX, 0xbd, 0x9d ) \
+    F2( INC_ZP_LDA_ZP, 0xe6, 0xa5 ) \
+    F2( INC_ABS_LDA_ABS, 0xee, 0xad )
+
+#define D_FUSED_ENUM2(NAME,A,B) FUSED__##NAME,
+#define D_FUSED_ENUM3(NAME,A,B,C) FUSED__##NAME,
+
+enum Fused {
+    CPU_6502_FUSED(D_FUSED_ENUM2,D_FUSED_ENUM3)
+    FUSED__COUNT
+};
+
+// dispatch slots after the 256 opcodes: the fused forms, then the heads
+// of idle loops and of fill / copy loops (see 6502.c)
+#define FUSED_HANDLER(F)    ( 0x100 + (F) )
+#define IDLE_HANDLER        FUSED_HANDLER( FUSED__COUNT )
+#define MEM_LOOP_HANDLER    ( IDLE_HANDLER + 1 )
+#define CPU_6502_HANDLERS   ( MEM_LOOP_HANDLER + 1 )
+
+struct fusedForm {
+    uint8_t opcodes[3];
+    uint8_t length;
+    const char *name;
+};
+
+// executes one instruction at cpu->PC, given its operand word
+
+struct cpu6502;
+
+typedef void (*cpu6502Handler)( struct cpu6502 *, const uint16_t );
+
+extern const struct operation instructionSet[256];
+extern const char instructionStringMap[56][4];
+extern const cpu6502Handler cpu6502Handlers[256];
+extern const struct fusedForm fusedForms[FUSED__COUNT];
+
+// a store from outside the interpreter loops, keeping the decoded
+// instruction cache coherent
+void cpu6502Store( struct cpu6502 *cpu, const uint16_t addr, const uint8_t data );
+
+unsigned int cpu6502IdleLoop( struct cpu6502 *cpu, const uint16_t pc );
+
+// a fill or copy loop:
+//
+//     [LDA src,X]  STA dst,X  [STA dst,X ...]  INX / DEX  BNE
+//
+// or the same indexed by Y
+
+#define MEM_LOOP_STORES 4
+
+struct memLoop {
+    unsigned int copy;                 // starts with a load from src
+    uint16_t src;
+    uint16_t dst[MEM_LOOP_STORES];
+    unsigned int stores;
+    unsigned int reg;                  // LOC_REG_X or LOC_REG_Y
+    int step;                          // +1 or -1
+    unsigned int cycles;               // per iteration, branch taken
+    unsigned int notTaken;             // cycles the final branch saves
+    uint16_t exit;                     // PC after the loop
+};
+
+int cpu6502MemLoop( struct cpu6502 *cpu, const uint16_t pc, struct memLoop *loop );
+
+#endif /* __6502OP_H */
@@ -0,0 +1,185 @@
+#define _DEFAULT_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "6502.h"
+#include "6502op.h"
+#include "6502trace.h"
+#include "nes.h"
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// the formats rely on records packing without holes
+typedef char cpu6502TraceRecordSize[ ( sizeof( struct cpu6502TraceRecord ) == 24 ) ? 1 : -1 ];
+typedef char cpu6502TraceHeaderSize[ ( sizeof( struct cpu6502TraceHeader ) == 64 ) ? 1 : -1 ];
+
+// OPENING AND CLOSING
+
+// a ring of 1 << order records in fname, replacing whatever was there
+
+int cpu6502TraceOpen( struct cpu6502Trace *t, const char *fname, const unsigned int order ) {
+    uint8_t *base;
+
+    t->mask = ( (uint64_t) 1 << order ) - 1;
+    t->mapSize = sizeof( struct cpu6502TraceHeader ) + ( sizeof( struct cpu6502TraceRecord ) << order );
+    t->fd = -1;
+    t->fname = NULL;
+    t->log = NULL;
+    t->tailSeen = 0;
+
+#ifdef __unix__
+    t->fd = open( fname, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if ( t->fd < 0 ) {
+        return -1;
+    }
+    if ( ftruncate( t->fd, t->mapSize ) < 0 ) {
+        close( t->fd );
+        return -1;
+    }
+    base = mmap( NULL, t->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, t->fd, 0 );
+    if ( base == MAP_FAILED ) {
+        close( t->fd );
+        return -1;
+    }
+#else
+    // no mapping: kept in memory and written out on close
+    base = calloc( 1, t->mapSize );
+    t->fname = malloc( strlen( fname ) + 1 );
+    if ( base == NULL || t->fname == NULL ) {
+        free( base );
+        free( t->fname );
+        return -1;
+    }
+    strcpy( t->fname, fname );
+#endif
+
+    t->header = (struct cpu6502TraceHeader *) base;
+    t->records = (struct cpu6502TraceRecord *) ( base + sizeof( struct cpu6502TraceHeader ) );
+
+    memset( t->header, 0, sizeof( struct cpu6502TraceHeader ) );
+    t->header->magic = CPU_6502_TRACE_MAGIC;
+    t->header->recordSize = sizeof( struct cpu6502TraceRecord );
+    t->header->capacity = t->mask + 1;
+    return 0;
+}
+
+void cpu6502TraceClose( struct cpu6502Trace *t ) {
+#ifdef __unix__
+    munmap( t->header, t->mapSize );
+    close( t->fd );
+#else
+    FILE *f;
+
+    f = fopen( t->fname, "wb" );
+    if ( f ) {
+        fwrite( t->header, 1, t->mapSize, f );
+        fclose( f );
+    }
+    free( t->header );
+    free( t->fname );
+#endif
+    t->header = NULL;
+    t->records = NULL;
+}
+
+// the ring is full: waits for the log writer to take records
+
+void cpu6502TraceWait( struct cpu6502Trace *t ) {
+    for (;;) {
+#ifdef __GNUC__
+        t->tailSeen = __atomic_load_n( &t->header->tail, __ATOMIC_ACQUIRE );
+#else
+        t->tailSeen = t->header->tail;
+#endif
+        if ( t->header->head - t->tailSeen <= t->mask ) {
+            return;
+        }
+#ifdef __unix__
+        sched_yield();
+#endif
+    }
+}
+
+// FORMATTING
+
+// the operand as nestest.log shows it, with the address and the value the
+// instruction found there
+
+static int traceOperand( char *buf, const size_t len, const struct cpu6502TraceRecord *r ) {
+    const struct operation *op = &instructionSet[ r->opcode ];
+    const uint16_t abs = (uint16_t) r->o2 << 8 | r->o1;
+    const int mem = r->access != 0;
+
+    switch ( op->addr_mode_type ) {
+        case ADDR_MODE__IMPLIED:
+            return snprintf( buf, len, "%s", instructionStringMap[ op->instruction_type ] );
+        case ADDR_MODE__ACCUMULATOR:
+            return snprintf( buf, len, "%s A", instructionStringMap[ op->instruction_type ] );
+        case ADDR_MODE__IMMEDIATE:
+            return snprintf( buf, len, "%s #$%02" PRIX8, instructionStringMap[ op->instruction_type ], r->o1 );
+        case ADDR_MODE__RELATIVE:
+            return snprintf( buf, len, "%s $%04" PRIX16, instructionStringMap[ op->instruction_type ], r->addr );
+        case ADDR_MODE__ZERO_PAGE:
+            return snprintf( buf, len, "%s $%02" PRIX8 " = %02" PRIX8,
+                instructionStringMap[ op->instruction_type ], r->o1, r->before );
+        case ADDR_MODE__ABSOLUTE:
+            if ( !mem ) {
+                // JMP and JSR
+                return snprintf( buf, len, "%s $%04" PRIX16, instructionStringMap[ op->instruction_type ], abs );
+            }
+            return snprintf( buf, len, "%s $%04" PRIX16 " = %02" PRIX8,
+                instructionStringMap[ op->instruction_type ], abs, r->before );
+        case ADDR_MODE__IDX_X:
+        case ADDR_MODE__IDX_Y:
+            return snprintf( buf, len, "%s $%04" PRIX16 ",%c @ %04" PRIX16 " = %02" PRIX8,
+                instructionStringMap[ op->instruction_type ], abs,
+                ( op->addr_mode_type == ADDR_MODE__IDX_X ) ? 'X' : 'Y', r->addr, r->before );
+        case ADDR_MODE__ZERO_PAGE_IDX_X:
+        case ADDR_MODE__ZERO_PAGE_IDX_Y:
+            return snprintf( buf, len, "%s $%02" PRIX8 ",%c @ %02" PRIX16 " = %02" PRIX8,
+                instructionStringMap[ op->instruction_type ], r->o1,
+                ( op->addr_mode_type == ADDR_MODE__ZERO_PAGE_IDX_X ) ? 'X' : 'Y', r->addr, r->before );
+        case ADDR_MODE__INDIRECT:
+            return snprintf( buf, len, "%s ($%04" PRIX16 ") = %04" PRIX16,
+                instructionStringMap[ op->instruction_type ], abs, r->addr );
+        case ADDR_MODE__INDEX_INDIRECT:
+            return snprintf( buf, len, "%s ($%02" PRIX8 ",X) @ %02" PRIX8 " = %04" PRIX16 " = %02" PRIX8,
+                instructionStringMap[ op->instruction_type ], r->o1, (uint8_t) ( r->o1 + r->X ), r->addr, r->before );
+        case ADDR_MODE__INDIRECT_INDEX:
+            return snprintf( buf, len, "%s ($%02" PRIX8 "),Y = %04" PRIX16 " @ %04" PRIX16 " = %02" PRIX8,
+                instructionStringMap[ op->instruction_type ], r->o1, (uint16_t) ( r->addr - r->Y ), r->addr, r->before );
+    }
+    return snprintf( buf, len, "???" );
+}
+
+// one line in the layout of nestest.log, without the newline
+
+int cpu6502TraceFormat( char *buf, const size_t len, const struct cpu6502TraceRecord *r ) {
+    char bytes[12];
+    char text[48];
+    unsigned int size;
+    uint64_t dot;
+
+    size = instructionSet[ r->opcode ].size;
+    if ( size >= 3 ) {
+        snprintf( bytes, sizeof bytes, "%02" PRIX8 " %02" PRIX8 " %02" PRIX8, r->opcode, r->o1, r->o2 );
+    } else if ( size == 2 ) {
+        snprintf( bytes, sizeof bytes, "%02" PRIX8 " %02" PRIX8, r->opcode, r->o1 );
+    } else {
+        snprintf( bytes, sizeof bytes, "%02" PRIX8, r->opcode );
+    }
+    traceOperand( text, sizeof text, r );
+
+    dot = r->clk * 3;
+    return snprintf( buf, len, "%04" PRIX16 "  %-8s  %-32sA:%02" PRIX8 " X:%02" PRIX8 " Y:%02" PRIX8 " P:%02" PRIX8 " SP:%02" PRIX8 " PPU:%3u,%3u CYC:%" PRIu64,
+        r->PC, bytes, text, r->A, r->X, r->Y, r->P, r->SP,
+        (unsigned int) ( ( dot % NES_FRAME_DOTS ) / NES_DOTS_PER_SCANLINE ),
+        (unsigned int) ( dot % NES_DOTS_PER_SCANLINE ), r->clk );
+}
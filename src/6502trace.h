@@ -0,0 +1,90 @@
+#ifndef __6502TRACE_H
+#define __6502TRACE_H
+
+// Execution traces. With a trace attached the CPU appends one fixed size
+// record per instruction to a ring buffer mapped from a file, so the
+// last records survive a crash and can be read while the emulator is
+// still running. tracedump turns them into nestest style log lines.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CPU_6502_TRACE_MAGIC 0x58455436  // "6TEX"
+
+// what the instruction did with the memory at addr, apart from stack and
+// instruction fetches
+
+#define CPU_6502_TRACE_ACCESS__READ   ( 1 << 0 )
+#define CPU_6502_TRACE_ACCESS__WRITE  ( 1 << 1 )
+
+struct cpu6502TraceRecord {
+    uint64_t clk;     // cycle the instruction started on
+    uint16_t PC;
+    uint16_t addr;    // effective address, if access is set
+    uint8_t opcode;
+    uint8_t o1;       // operand bytes, 0 past the instruction's size
+    uint8_t o2;
+    uint8_t A;        // registers before the instruction
+    uint8_t X;
+    uint8_t Y;
+    uint8_t P;
+    uint8_t SP;
+    uint8_t access;   // CPU_6502_TRACE_ACCESS__*
+    uint8_t before;   // memory at addr before the instruction, 0 for a
+                      // store to a page the handlers answer
+    uint8_t after;    // and after it
+};
+
+// The file starts with this header, followed by capacity records. The
+// record for instruction n sits at n % capacity. head only moves after
+// the record it counts is complete. A reader that copies records out
+// while the CPU runs must read head again afterwards and drop any record
+// older than head - capacity.
+//
+// A ring drained by a trace log writer (6502tracelog.h) is not mapped;
+// there the CPU waits rather than overwrite records the writer has not
+// taken yet.
+
+struct cpu6502TraceHeader {
+    uint32_t magic;
+    uint32_t recordSize;
+    uint64_t capacity;  // a power of two
+    uint64_t head;      // records written since the trace was opened
+    uint64_t tail;      // records the log writer has taken
+    uint8_t reserved[32];
+};
+
+struct cpu6502TraceLog;
+
+struct cpu6502Trace {
+    struct cpu6502TraceHeader *header;
+    struct cpu6502TraceRecord *records;
+    uint64_t mask;
+    size_t mapSize;
+    int fd;             // -1 when not backed by a mapping
+    char *fname;        // written on close when not mapped
+    struct cpu6502TraceLog *log;  // the writer draining the ring, if any
+    uint64_t tailSeen;            // header->tail as last read by the CPU
+};
+
+int cpu6502TraceOpen( struct cpu6502Trace *t, const char *fname, const unsigned int order );
+void cpu6502TraceClose( struct cpu6502Trace *t );
+int cpu6502TraceFormat( char *buf, const size_t len, const struct cpu6502TraceRecord *r );
+void cpu6502TraceWait( struct cpu6502Trace *t );
+
+static inline struct cpu6502TraceRecord * cpu6502TraceNext( struct cpu6502Trace *t ) {
+    if ( t->log && t->header->head - t->tailSeen > t->mask ) {
+        cpu6502TraceWait( t );
+    }
+    return &t->records[ t->header->head & t->mask ];
+}
+
+static inline void cpu6502TracePublish( struct cpu6502Trace *t ) {
+#ifdef __GNUC__
+    __atomic_store_n( &t->header->head, t->header->head + 1, __ATOMIC_RELEASE );
+#else
+    t->header->head++;
+#endif
+}
+
+#endif /* __6502TRACE_H */
@@ -0,0 +1,490 @@
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "6502op.h"
+#include "6502trace.h"
+#include "6502tracelog.h"
+
+#ifndef __GNUC__
+#error "6502tracelog.c needs the GCC __atomic builtins"
+#endif
+
+#define LOG_BLOCK          ( 1 << 20 )  // encoded bytes in a block, about
+#define LOG_BLOCK_RECORDS  ( 1u << 30 ) // records in a block, at most
+#define LOG_RECORD_MAX     48           // longest encoding of one record, with a run ended before it
+#define LOG_RELEASE        4096         // records taken between handing ring space back
+#define LOG_IDLE_FLUSH     10000        // polls of an empty ring, 100us apart, before a partial block is written
+
+// TAGS
+//
+// each record starts with a tag byte saying which of its fields the
+// prediction missed; those follow in the order of the bits
+
+#define TAG_PC          0x03
+#define TAG_PC__NEXT    0x00  // what followed the last record's PC last time
+#define TAG_PC__FALL    0x01  // right after the last instruction
+#define TAG_PC__STORED  0x02  // two bytes
+#define TAG_PC__RUN     0x03  // not a record: a count of predicted ones
+#define TAG_REGS        0x04  // a mask byte, then each register it names
+#define TAG_CLK         0x08  // cycles since the last record
+#define TAG_CODE        0x10  // opcode, o1, o2 and access
+#define TAG_ADDR        0x20  // two bytes
+#define TAG_BEFORE      0x40
+#define TAG_AFTER       0x80
+
+// PREDICTION
+//
+// the encoder and the decoder keep the same state and change it in step
+
+struct logVisit {
+    uint64_t clk;       // cycles since the record before
+    uint16_t next;      // PC of the record after
+    uint16_t addr;
+    uint16_t stride;    // addr step since the visit before
+    uint8_t opcode;
+    uint8_t o1;
+    uint8_t o2;
+    uint8_t access;
+    uint8_t regs[5];    // A X Y P SP steps from the record before
+    uint8_t before;
+    uint8_t beforeStep; // before step since the visit before
+    uint8_t change;     // after - before
+};
+
+struct logPredictor {
+    struct cpu6502TraceRecord last;
+    struct logVisit visit[ 0x10000 ];
+};
+
+// the record at pc, as the last visit to it says it will be
+
+static void logPredict( const struct logPredictor *p, const uint16_t pc, struct cpu6502TraceRecord *r ) {
+    const struct logVisit *v = &p->visit[ pc ];
+
+    r->clk = p->last.clk + v->clk;
+    r->PC = pc;
+    r->addr = v->addr + v->stride;
+    r->opcode = v->opcode;
+    r->o1 = v->o1;
+    r->o2 = v->o2;
+    r->A = p->last.A + v->regs[0];
+    r->X = p->last.X + v->regs[1];
+    r->Y = p->last.Y + v->regs[2];
+    r->P = p->last.P + v->regs[3];
+    r->SP = p->last.SP + v->regs[4];
+    r->access = v->access;
+    r->before = v->before + v->beforeStep;
+    r->after = r->before + v->change;
+}
+
+static void logLearn( struct logPredictor *p, const struct cpu6502TraceRecord *r ) {
+    struct logVisit *v = &p->visit[ r->PC ];
+
+    p->visit[ p->last.PC ].next = r->PC;
+
+    v->clk = r->clk - p->last.clk;
+    v->stride = r->addr - v->addr;
+    v->addr = r->addr;
+    v->opcode = r->opcode;
+    v->o1 = r->o1;
+    v->o2 = r->o2;
+    v->access = r->access;
+    v->regs[0] = r->A - p->last.A;
+    v->regs[1] = r->X - p->last.X;
+    v->regs[2] = r->Y - p->last.Y;
+    v->regs[3] = r->P - p->last.P;
+    v->regs[4] = r->SP - p->last.SP;
+    v->beforeStep = r->before - v->before;
+    v->before = r->before;
+    v->change = r->after - r->before;
+
+    p->last = *r;
+}
+
+static uint16_t logFallThrough( const struct logPredictor *p ) {
+    return p->last.PC + instructionSet[ p->last.opcode ].size;
+}
+
+static unsigned int logPutVarint( uint8_t *o, uint64_t v ) {
+    unsigned int n = 0;
+
+    while ( v >= 0x80 ) {
+        o[ n++ ] = (uint8_t) v | 0x80;
+        v >>= 7;
+    }
+    o[ n++ ] = (uint8_t) v;
+    return n;
+}
+
+static unsigned int logGetVarint( const uint8_t *i, uint64_t *v ) {
+    unsigned int n = 0;
+
+    *v = 0;
+    do {
+        *v |= (uint64_t) ( i[n] & 0x7f ) << ( 7 * n );
+    } while ( ( i[ n++ ] & 0x80 ) && n < 10 );
+    return n;
+}
+
+// WRITER
+
+struct cpu6502TraceLog {
+    struct cpu6502Trace *trace;
+    FILE *f;
+    pthread_t thread;
+    int quit;
+    int error;
+    struct logPredictor predictor;
+    uint64_t run;       // predicted records not stored yet
+    uint32_t records;   // in the block being built, run included
+    size_t size;
+    uint8_t block[ LOG_BLOCK + LOG_RECORD_MAX ];
+};
+
+static void logEndRun( struct cpu6502TraceLog *log ) {
+    if ( log->run == 1 ) {
+        log->block[ log->size++ ] = TAG_PC__NEXT;
+    } else if ( log->run ) {
+        log->block[ log->size++ ] = TAG_PC__RUN;
+        log->size += logPutVarint( log->block + log->size, log->run );
+    }
+    log->run = 0;
+}
+
+static void logFlush( struct cpu6502TraceLog *log ) {
+    struct cpu6502TraceLogBlock b;
+
+    logEndRun( log );
+    b.records = log->records;
+    b.size = (uint32_t) log->size;
+    if ( fwrite( &b, sizeof b, 1, log->f ) != 1 ||
+         fwrite( log->block, 1, log->size, log->f ) != log->size ||
+         fflush( log->f ) ) {
+        log->error = 1;
+    }
+    log->records = 0;
+    log->size = 0;
+}
+
+static void logEncode( struct cpu6502TraceLog *log, const struct cpu6502TraceRecord *r ) {
+    struct logPredictor *p = &log->predictor;
+    struct cpu6502TraceRecord e;
+    const uint8_t have[5] = { r->A, r->X, r->Y, r->P, r->SP };
+    uint8_t want[5];
+    uint8_t mask;
+    uint8_t tag;
+    uint8_t *o;
+    int i;
+
+    if ( r->PC == p->visit[ p->last.PC ].next ) {
+        tag = TAG_PC__NEXT;
+    } else if ( r->PC == logFallThrough( p ) ) {
+        tag = TAG_PC__FALL;
+    } else {
+        tag = TAG_PC__STORED;
+    }
+    logPredict( p, r->PC, &e );
+    want[0] = e.A;
+    want[1] = e.X;
+    want[2] = e.Y;
+    want[3] = e.P;
+    want[4] = e.SP;
+
+    mask = 0;
+    for ( i = 0; i < 5; i++ ) {
+        if ( have[i] != want[i] ) {
+            mask |= 1 << i;
+        }
+    }
+    tag |= mask ? TAG_REGS : 0;
+    tag |= ( r->clk != e.clk ) ? TAG_CLK : 0;
+    tag |= ( r->opcode != e.opcode || r->o1 != e.o1 || r->o2 != e.o2 || r->access != e.access ) ? TAG_CODE : 0;
+    tag |= ( r->addr != e.addr ) ? TAG_ADDR : 0;
+    tag |= ( r->before != e.before ) ? TAG_BEFORE : 0;
+    tag |= ( r->after != (uint8_t) ( r->before + p->visit[ r->PC ].change ) ) ? TAG_AFTER : 0;
+
+    if ( tag == TAG_PC__NEXT ) {
+        log->run++;
+        log->records++;
+        logLearn( p, r );
+        return;
+    }
+
+    logEndRun( log );
+    o = log->block + log->size;
+    *o++ = tag;
+    if ( ( tag & TAG_PC ) == TAG_PC__STORED ) {
+        *o++ = (uint8_t) r->PC;
+        *o++ = r->PC >> 8;
+    }
+    if ( tag & TAG_REGS ) {
+        *o++ = mask;
+        for ( i = 0; i < 5; i++ ) {
+            if ( mask & ( 1 << i ) ) {
+                *o++ = have[i];
+            }
+        }
+    }
+    if ( tag & TAG_CLK ) {
+        o += logPutVarint( o, r->clk - p->last.clk );
+    }
+    if ( tag & TAG_CODE ) {
+        *o++ = r->opcode;
+        *o++ = r->o1;
+        *o++ = r->o2;
+        *o++ = r->access;
+    }
+    if ( tag & TAG_ADDR ) {
+        *o++ = (uint8_t) r->addr;
+        *o++ = r->addr >> 8;
+    }
+    if ( tag & TAG_BEFORE ) {
+        *o++ = r->before;
+    }
+    if ( tag & TAG_AFTER ) {
+        *o++ = r->after;
+    }
+    log->size = o - log->block;
+    log->records++;
+    logLearn( p, r );
+}
+
+// takes records from the ring until the log is closed and the ring is empty
+
+static void * logWriter( void *arg ) {
+    struct cpu6502TraceLog *log = arg;
+    struct cpu6502Trace *t = log->trace;
+    const struct timespec nap = { 0, 100000 };
+    uint64_t tail = 0;
+    uint64_t head;
+    unsigned int idle = 0;
+    int quit;
+
+    for (;;) {
+        // quit first: once it is set, head holds every record there will be
+        quit = __atomic_load_n( &log->quit, __ATOMIC_ACQUIRE );
+        head = __atomic_load_n( &t->header->head, __ATOMIC_ACQUIRE );
+
+        if ( tail == head ) {
+            if ( quit ) {
+                break;
+            }
+            // a stopped CPU should not keep the last records out of the file
+            if ( ++idle == LOG_IDLE_FLUSH && log->records ) {
+                logFlush( log );
+            }
+            nanosleep( &nap, NULL );
+            continue;
+        }
+        idle = 0;
+
+        while ( tail != head ) {
+            logEncode( log, &t->records[ tail & t->mask ] );
+            if ( log->size >= LOG_BLOCK || log->records >= LOG_BLOCK_RECORDS ) {
+                logFlush( log );
+            }
+            if ( ( ++tail & ( LOG_RELEASE - 1 ) ) == 0 ) {
+                __atomic_store_n( &t->header->tail, tail, __ATOMIC_RELEASE );
+            }
+        }
+        __atomic_store_n( &t->header->tail, tail, __ATOMIC_RELEASE );
+    }
+
+    if ( log->records ) {
+        logFlush( log );
+    }
+    return NULL;
+}
+
+int cpu6502TraceLogOpen( struct cpu6502Trace *t, const char *fname, const unsigned int order ) {
+    struct cpu6502TraceLogHeader h;
+    struct cpu6502TraceLog *log;
+    uint8_t *base;
+
+    t->mask = ( (uint64_t) 1 << order ) - 1;
+    t->mapSize = sizeof( struct cpu6502TraceHeader ) + ( sizeof( struct cpu6502TraceRecord ) << order );
+    t->fd = -1;
+    t->fname = NULL;
+    t->tailSeen = 0;
+
+    base = calloc( 1, t->mapSize );
+    log = calloc( 1, sizeof( struct cpu6502TraceLog ) );
+    if ( base == NULL || log == NULL ) {
+        free( base );
+        free( log );
+        return -1;
+    }
+
+    log->f = fopen( fname, "wb" );
+    h.magic = CPU_6502_TRACE_LOG_MAGIC;
+    h.recordSize = sizeof( struct cpu6502TraceRecord );
+    if ( log->f == NULL || fwrite( &h, sizeof h, 1, log->f ) != 1 ) {
+        if ( log->f ) {
+            fclose( log->f );
+        }
+        free( base );
+        free( log );
+        return -1;
+    }
+
+    t->header = (struct cpu6502TraceHeader *) base;
+    t->records = (struct cpu6502TraceRecord *) ( base + sizeof( struct cpu6502TraceHeader ) );
+    t->header->magic = CPU_6502_TRACE_MAGIC;
+    t->header->recordSize = sizeof( struct cpu6502TraceRecord );
+    t->header->capacity = t->mask + 1;
+
+    log->trace = t;
+    if ( pthread_create( &log->thread, NULL, logWriter, log ) ) {
+        fclose( log->f );
+        free( base );
+        free( log );
+        return -1;
+    }
+    t->log = log;
+    return 0;
+}
+
+int cpu6502TraceLogClose( struct cpu6502Trace *t ) {
+    struct cpu6502TraceLog *log = t->log;
+    int r;
+
+    __atomic_store_n( &log->quit, 1, __ATOMIC_RELEASE );
+    pthread_join( log->thread, NULL );
+
+    r = ( fclose( log->f ) == 0 && !log->error ) ? 0 : -1;
+    free( t->header );
+    free( log );
+    t->log = NULL;
+    t->header = NULL;
+    t->records = NULL;
+    return r;
+}
+
+// READER
+
+int cpu6502TraceLogDecode( FILE *f, int (*emit)( const struct cpu6502TraceRecord *r, void *ctx ), void *ctx ) {
+    struct cpu6502TraceLogHeader h;
+    struct cpu6502TraceLogBlock b;
+    struct cpu6502TraceRecord r;
+    struct logPredictor *p;
+    uint8_t *regs[5] = { &r.A, &r.X, &r.Y, &r.P, &r.SP };
+    uint8_t *buf = NULL;
+    uint8_t *grown;
+    size_t cap = 0;
+    const uint8_t *i;
+    const uint8_t *end;
+    uint64_t run;
+    uint64_t v;
+    uint32_t n;
+    uint16_t pc;
+    uint8_t mask;
+    uint8_t tag;
+    int j;
+
+    if ( fread( &h, sizeof h, 1, f ) != 1 || h.magic != CPU_6502_TRACE_LOG_MAGIC ||
+         h.recordSize != sizeof( struct cpu6502TraceRecord ) ) {
+        return -1;
+    }
+    p = calloc( 1, sizeof( struct logPredictor ) );
+    if ( p == NULL ) {
+        return -1;
+    }
+
+    while ( fread( &b, sizeof b, 1, f ) == 1 ) {
+        // zeroed slack past the end keeps a corrupt block from reading out
+        // of the buffer, checked once per record
+        if ( b.size + LOG_RECORD_MAX > cap ) {
+            grown = realloc( buf, b.size + LOG_RECORD_MAX );
+            if ( grown == NULL ) {
+                break;
+            }
+            buf = grown;
+            cap = b.size + LOG_RECORD_MAX;
+        }
+        if ( fread( buf, 1, b.size, f ) != b.size ) {
+            break;
+        }
+        memset( buf + b.size, 0, LOG_RECORD_MAX );
+
+        i = buf;
+        end = buf + b.size;
+        for ( n = 0; n < b.records && i < end; n++ ) {
+            tag = *i++;
+
+            if ( ( tag & TAG_PC ) == TAG_PC__RUN ) {
+                i += logGetVarint( i, &run );
+                for ( ; run && n < b.records; run--, n++ ) {
+                    logPredict( p, p->visit[ p->last.PC ].next, &r );
+                    logLearn( p, &r );
+                    if ( emit( &r, ctx ) ) {
+                        goto done;
+                    }
+                }
+                n--;
+                continue;
+            }
+
+            switch ( tag & TAG_PC ) {
+                case TAG_PC__NEXT:
+                    pc = p->visit[ p->last.PC ].next;
+                    break;
+                case TAG_PC__FALL:
+                    pc = logFallThrough( p );
+                    break;
+                default:
+                    pc = i[0] | i[1] << 8;
+                    i += 2;
+                    break;
+            }
+            logPredict( p, pc, &r );
+
+            if ( tag & TAG_REGS ) {
+                mask = *i++;
+                for ( j = 0; j < 5; j++ ) {
+                    if ( mask & ( 1 << j ) ) {
+                        *regs[j] = *i++;
+                    }
+                }
+            }
+            if ( tag & TAG_CLK ) {
+                i += logGetVarint( i, &v );
+                r.clk = p->last.clk + v;
+            }
+            if ( tag & TAG_CODE ) {
+                r.opcode = i[0];
+                r.o1 = i[1];
+                r.o2 = i[2];
+                r.access = i[3];
+                i += 4;
+            }
+            if ( tag & TAG_ADDR ) {
+                r.addr = i[0] | i[1] << 8;
+                i += 2;
+            }
+            if ( tag & TAG_BEFORE ) {
+                r.before = *i++;
+                r.after = r.before + p->visit[ pc ].change;
+            }
+            if ( tag & TAG_AFTER ) {
+                r.after = *i++;
+            }
+            if ( i > end ) {
+                goto done;
+            }
+
+            logLearn( p, &r );
+            if ( emit( &r, ctx ) ) {
+                goto done;
+            }
+        }
+    }
+
+done:
+    free( buf );
+    free( p );
+    return 0;
+}
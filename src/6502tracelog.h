@@ -0,0 +1,53 @@
+#ifndef __6502TRACELOG_H
+#define __6502TRACELOG_H
+
+// Compressed execution trace logs, for recording whole sessions. The CPU
+// appends records to an in-memory trace ring exactly as it does for a
+// mapped one; a writer thread takes them from the ring, encodes them
+// against what it has seen so far and writes the result to the log in
+// large blocks. The CPU only ever waits if the writer falls a whole ring
+// behind.
+//
+// Each record is predicted from the one before it and from the last visit
+// to its PC: the successor PC, the cycle count, the registers and the
+// effective address and memory values each advance by the step they took
+// last time. Only the fields that miss are stored. A loop whose iterations
+// follow those steps predicts completely, and a run of completely
+// predicted records is stored as a count, so a polling or delay loop costs
+// a few bytes however long it spins.
+
+#include <stdio.h>
+#include <stdint.h>
+#include "6502trace.h"
+
+#define CPU_6502_TRACE_LOG_MAGIC 0x5a455436  // "6TEZ"
+
+// A log is this header followed by blocks. Decoding a block needs every
+// block before it; a block cut short, by a crash or because the writer is
+// still busy with it, ends the log.
+
+struct cpu6502TraceLogHeader {
+    uint32_t magic;
+    uint32_t recordSize;  // of the records it decodes to
+};
+
+struct cpu6502TraceLogBlock {
+    uint32_t records;
+    uint32_t size;        // bytes of encoded records following
+};
+
+// opens a ring of 1 << order records on t, drained into fname
+
+int cpu6502TraceLogOpen( struct cpu6502Trace *t, const char *fname, const unsigned int order );
+
+// waits for the writer to take every record published and closes the log;
+// -1 if anything could not be written
+
+int cpu6502TraceLogClose( struct cpu6502Trace *t );
+
+// calls emit with each record in a log, oldest first, until emit returns
+// non zero; -1 if f is not a log
+
+int cpu6502TraceLogDecode( FILE *f, int (*emit)( const struct cpu6502TraceRecord *r, void *ctx ), void *ctx );
+
+#endif /* __6502TRACELOG_H */
@@ -0,0 +1,638 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "6502.h"
+#include "6502batch.h"
+#include "6502trace.h"
+#include "nesmem.h"
+
+// difftest [test ...]
+//
+// Differential tests of the execution engines against the reference
+// interpreter. Each seed fills 64KB of memory, gives a CPU on each engine
+// its own copy and the same registers, then runs both through the same
+// mix of budgets, single steps and interrupts. After every one of those
+// the two must agree on the stop reason, every register, the cycle count
+// and every byte of memory. The batch test runs a cpu6502Batch of CPUs
+// with slightly different memory against one reference each. The traced
+// test attaches a trace to both CPUs, and their records must agree too.
+// With no arguments every test runs.
+
+#define DIFF_SEEDS 2000
+#define DIFF_RUNS  300
+#define DIFF_LANES 37     // not a multiple of any vector width
+#define DIFF_TRACE 12     // log2 of the records a traced run keeps, more than its budget can write
+
+// A 64KB bus with every page backed by mem, or with a few of the NES's
+// arrangements on top
+
+#define DIFF_MAP__ROM  1  // $8000-$FFFF read only, writes to it go to the callback
+#define DIFF_MAP__IO   2  // $2000-$20FF only through the callbacks, quiet to poll
+#define DIFF_MAP__RAM  4  // $0000-$1FFF repeats the first 2KB
+#define DIFF_MAP__BANK 8  // writes to ROM switch $C000-$CFFF to $D000-$DFFF and back
+
+struct diffMemory {
+    struct nesMemoryMap mm;  // first, so the callbacks can cast back
+    uint8_t mem[NES_MEM_SIZE];
+    unsigned int map;        // DIFF_MAP__*
+};
+
+static struct diffMemory diffA, diffB;
+static struct diffMemory diffLanes[2][DIFF_LANES];
+
+static struct cpu6502TraceHeader diffTraceHeaders[2];
+static struct cpu6502TraceRecord diffTraceRecords[2][ 1 << DIFF_TRACE ];
+
+// reading $2002 clears bit 7, like the PPU's vblank flag
+
+static uint8_t diffRead( struct nesMemoryMap *mm, uint16_t addr ) {
+    struct diffMemory *d = (struct diffMemory *) mm;
+    const uint8_t data = d->mem[ addr ];
+
+    if ( addr == 0x2002 ) {
+        d->mem[ addr ] &= 0x7f;
+    }
+    return data;
+}
+
+static void diffWrite( struct nesMemoryMap *mm, uint16_t addr, const uint8_t data ) {
+    struct diffMemory *d = (struct diffMemory *) mm;
+
+    if ( addr < 0x8000 || !( d->map & DIFF_MAP__ROM ) ) {
+        d->mem[ addr ] = data;
+    } else if ( d->map & DIFF_MAP__BANK ) {
+        nesMemMapPages( mm, 0xc000, 0x1000, d->mem + ( ( data & 1 ) ? 0xd000 : 0xc000 ), NULL, 0x1000 );
+    }
+}
+
+// nothing changes the IO page behind the CPU's back, and only the first
+// read of $2002 has an effect
+
+static int diffQuiet( struct nesMemoryMap *mm, uint16_t addr ) {
+    (void) mm;
+    (void) addr;
+    return 1;
+}
+
+static void diffMap( struct diffMemory *d, const unsigned int map ) {
+    memset( &d->mm, 0, sizeof d->mm );
+    d->mm.read = &diffRead;
+    d->mm.write = &diffWrite;
+    d->map = map;
+    nesMemMapPages( &d->mm, 0x0000, NES_MEM_SIZE, d->mem, d->mem, NES_MEM_SIZE );
+    if ( map & DIFF_MAP__RAM ) {
+        nesMemMapPages( &d->mm, 0x0000, 0x2000, d->mem, d->mem, 0x0800 );
+    }
+    if ( map & DIFF_MAP__ROM ) {
+        nesMemMapPages( &d->mm, 0x8000, 0x8000, d->mem + 0x8000, NULL, 0x8000 );
+    }
+    if ( map & DIFF_MAP__IO ) {
+        nesMemMapPages( &d->mm, 0x2000, 0x100, NULL, NULL, 0x100 );
+        d->mm.quiet = &diffQuiet;
+    }
+}
+
+// MEMORY CONTENTS
+
+static void diffFillRandom( uint8_t *mem ) {
+    unsigned int i;
+
+    for ( i = 0; i < NES_MEM_SIZE; i++ ) {
+        mem[i] = rand();
+    }
+}
+
+// ROM code that keeps storing to and jumping into a page of RAM code that
+// jumps back, for the JIT's stores into code the interpreter has decoded
+
+static void diffFillSelfModifying( uint8_t *mem ) {
+    unsigned int i;
+
+    diffFillRandom( mem );
+    for ( i = 0x8000; i + 5 <= NES_MEM_SIZE; i += rand() % 8 ) {
+        switch ( rand() % 4 ) {
+            case 0:  // LDA #, STA $03xx
+                mem[ i++ ] = 0xa9;
+                mem[ i++ ] = rand();
+                mem[ i++ ] = 0x8d;
+                mem[ i++ ] = rand();
+                mem[ i++ ] = 0x03;
+                break;
+            case 1:  // INC $03xx
+                mem[ i++ ] = 0xee;
+                mem[ i++ ] = rand();
+                mem[ i++ ] = 0x03;
+                break;
+            case 2:  // JMP $03xx
+                mem[ i++ ] = 0x4c;
+                mem[ i++ ] = rand();
+                mem[ i++ ] = 0x03;
+                break;
+        }
+    }
+    for ( i = 0x0300; i < 0x0400; i += 3 + rand() % 8 ) {
+        // JMP back to ROM
+        mem[ i ] = 0x4c;
+        mem[ ( i + 1 ) & 0xffff ] = rand();
+        mem[ ( i + 2 ) & 0xffff ] = 0x80 | rand();
+    }
+}
+
+// Runs of instructions the fast engine fuses into one handler, laid end
+// to end with the odd random byte between them. Operands are mostly small,
+// so the loops meet each other's counters and addresses.
+
+#define DIFF_ARG__NONE  0
+#define DIFF_ARG__BYTE  1  // immediate, zero page or branch offset
+#define DIFF_ARG__WORD  2  // an address in the first 2KB
+#define DIFF_ARG__LOOP  3  // branch offset, half the time back to the piece
+#define DIFF_ARG__HERE  4  // the piece's own address
+#define DIFF_ARG__POLL  5  // $2002 or an address in zero page
+
+struct diffPiece {
+    unsigned int count;
+    uint8_t opcode[3];
+    uint8_t arg[3];     // DIFF_ARG__* after each opcode
+};
+
+static const struct diffPiece diffFused[] = {
+    { 3, { 0xa5, 0x18, 0x69 }, { DIFF_ARG__BYTE, DIFF_ARG__NONE, DIFF_ARG__BYTE } },  // LDA zp, CLC, ADC #
+    { 3, { 0xa5, 0x38, 0xe9 }, { DIFF_ARG__BYTE, DIFF_ARG__NONE, DIFF_ARG__BYTE } },  // LDA zp, SEC, SBC #
+    { 3, { 0xe8, 0xe0, 0xd0 }, { DIFF_ARG__NONE, DIFF_ARG__BYTE, DIFF_ARG__LOOP } },  // INX, CPX #, BNE
+    { 3, { 0xc8, 0xc0, 0xd0 }, { DIFF_ARG__NONE, DIFF_ARG__BYTE, DIFF_ARG__LOOP } },  // INY, CPY #, BNE
+    { 2, { 0xca, 0xd0 },       { DIFF_ARG__NONE, DIFF_ARG__LOOP } },                  // DEX, BNE
+    { 2, { 0x88, 0xd0 },       { DIFF_ARG__NONE, DIFF_ARG__LOOP } },                  // DEY, BNE
+    { 2, { 0xe8, 0xd0 },       { DIFF_ARG__NONE, DIFF_ARG__LOOP } },                  // INX, BNE
+    { 2, { 0xc9, 0xf0 },       { DIFF_ARG__BYTE, DIFF_ARG__LOOP } },                  // CMP #, BEQ
+    { 2, { 0xc9, 0xd0 },       { DIFF_ARG__BYTE, DIFF_ARG__LOOP } },                  // CMP #, BNE
+    { 2, { 0xa9, 0x85 },       { DIFF_ARG__BYTE, DIFF_ARG__BYTE } },                  // LDA #, STA zp
+    { 2, { 0xa9, 0x8d },       { DIFF_ARG__BYTE, DIFF_ARG__WORD } },                  // LDA #, STA abs
+    { 2, { 0xa5, 0x8d },       { DIFF_ARG__BYTE, DIFF_ARG__WORD } },                  // LDA zp, STA abs
+    { 2, { 0xbd, 0x9d },       { DIFF_ARG__WORD, DIFF_ARG__WORD } },                  // LDA abs,X, STA abs,X
+    { 2, { 0xe6, 0xa5 },       { DIFF_ARG__BYTE, DIFF_ARG__BYTE } },                  // INC zp, LDA zp
+    { 2, { 0xee, 0xad },       { DIFF_ARG__WORD, DIFF_ARG__WORD } },                  // INC abs, LDA abs
+    { 2, { 0x2c, 0x10 },       { DIFF_ARG__WORD, DIFF_ARG__LOOP } },                  // BIT abs, BPL
+    { 2, { 0xad, 0x10 },       { DIFF_ARG__WORD, DIFF_ARG__LOOP } },                  // LDA abs, BPL
+};
+
+#define DIFF_FUSED ( sizeof diffFused / sizeof diffFused[0] )
+
+// loops the fast engine fast-forwards to the end of the budget
+
+static const struct diffPiece diffIdle[] = {
+    { 2, { 0xa5, 0xf0 }, { DIFF_ARG__BYTE, DIFF_ARG__LOOP } },  // LDA zp, BEQ
+    { 2, { 0xa5, 0xd0 }, { DIFF_ARG__BYTE, DIFF_ARG__LOOP } },  // LDA zp, BNE
+    { 1, { 0x4c },       { DIFF_ARG__HERE } },                  // JMP *
+    { 2, { 0x2c, 0x10 }, { DIFF_ARG__POLL, DIFF_ARG__LOOP } },  // BIT abs, BPL
+    { 2, { 0xad, 0x30 }, { DIFF_ARG__POLL, DIFF_ARG__LOOP } },  // LDA abs, BMI
+};
+
+#define DIFF_IDLE ( sizeof diffIdle / sizeof diffIdle[0] )
+
+static unsigned int diffArgBytes( const unsigned int arg ) {
+    switch ( arg ) {
+        case DIFF_ARG__NONE:
+            return 0;
+        case DIFF_ARG__WORD:
+        case DIFF_ARG__HERE:
+        case DIFF_ARG__POLL:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+// writes the piece at mem[ at ], returns where the next one goes or
+// NES_MEM_SIZE if it didn't fit
+
+static unsigned int diffPlace( uint8_t *mem, unsigned int at, const struct diffPiece *piece ) {
+    const unsigned int start = at;
+    unsigned int i;
+
+    for ( i = 0; i < piece->count; i++ ) {
+        if ( at + 1 + diffArgBytes( piece->arg[i] ) > NES_MEM_SIZE ) {
+            return NES_MEM_SIZE;
+        }
+        mem[ at++ ] = piece->opcode[i];
+        switch ( piece->arg[i] ) {
+            case DIFF_ARG__BYTE:
+                mem[ at++ ] = rand() & ( rand() % 4 ? 0x0f : 0xff );
+                break;
+            case DIFF_ARG__WORD:
+                mem[ at++ ] = rand() & ( rand() % 4 ? 0x0f : 0xff );
+                mem[ at++ ] = rand() % 8;
+                break;
+            case DIFF_ARG__LOOP:
+                mem[ at ] = rand() % 2 ? start - ( at + 1 ) : rand() & 0x0f;
+                at++;
+                break;
+            case DIFF_ARG__HERE:
+                mem[ at++ ] = start;
+                mem[ at++ ] = start >> 8;
+                break;
+            case DIFF_ARG__POLL:
+                if ( rand() % 2 ) {
+                    mem[ at++ ] = 0x02;
+                    mem[ at++ ] = 0x20;
+                } else {
+                    mem[ at++ ] = rand() % 16;
+                    mem[ at++ ] = 0x00;
+                }
+                break;
+        }
+    }
+    if ( rand() % 5 == 0 && at < NES_MEM_SIZE ) {
+        mem[ at++ ] = rand();
+    }
+    return at;
+}
+
+static void diffFillFused( uint8_t *mem ) {
+    unsigned int i = 0;
+
+    diffFillRandom( mem );
+    while ( i < NES_MEM_SIZE ) {
+        i = diffPlace( mem, i, &diffFused[ rand() % DIFF_FUSED ] );
+    }
+}
+
+// the fused runs with idle loops among them
+
+static void diffFillIdle( uint8_t *mem ) {
+    unsigned int i = 0;
+
+    diffFillRandom( mem );
+    while ( i < NES_MEM_SIZE ) {
+        if ( rand() % 4 ) {
+            i = diffPlace( mem, i, &diffFused[ rand() % DIFF_FUSED ] );
+        } else {
+            i = diffPlace( mem, i, &diffIdle[ rand() % DIFF_IDLE ] );
+        }
+    }
+}
+
+// STA abs,X / INX / BNE style fill loops and LDA abs,X / STA abs,X copy
+// loops, which the fast engine runs as memset and memcpy. Their addresses
+// land in RAM, its mirrors, the IO page, ROM, the top of memory where an
+// index wraps, the loop's own page, or anywhere.
+
+static uint16_t diffLoopAddress( void ) {
+    switch ( rand() % 6 ) {
+        case 0:
+            return rand() & 0x07ff;
+        case 1:
+            return 0x0200 + ( rand() & 0x03ff );
+        case 2:
+            return 0x2000 | ( rand() & 0x01ff );
+        case 3:
+            return 0x8000 | rand();
+        case 4:
+            return 0xff00 | rand();
+        default:
+            return rand();
+    }
+}
+
+static void diffFillMemLoops( uint8_t *mem ) {
+    unsigned int i = 0;
+    unsigned int start;
+    unsigned int stores;
+    unsigned int k;
+    uint16_t addr;
+    int x;
+    int inc;
+
+    diffFillRandom( mem );
+    // the longest loop and what leads up to it
+    while ( i + 4 + 3 + 4 * 3 + 3 < NES_MEM_SIZE ) {
+        x = rand() % 2;
+        inc = rand() % 2;
+        stores = 1 + rand() % 4;
+        if ( rand() % 3 == 0 ) {
+            // LDA #
+            mem[ i++ ] = 0xa9;
+            mem[ i++ ] = rand();
+        }
+        if ( rand() % 3 == 0 ) {
+            // LDX # or LDY #, often from zero
+            mem[ i++ ] = x ? 0xa2 : 0xa0;
+            mem[ i++ ] = rand() % 2 ? 0 : rand();
+        }
+        start = i;
+        if ( rand() % 2 ) {
+            // LDA abs,X or LDA abs,Y
+            addr = diffLoopAddress();
+            mem[ i++ ] = x ? 0xbd : 0xb9;
+            mem[ i++ ] = addr;
+            mem[ i++ ] = addr >> 8;
+        }
+        for ( k = 0; k < stores; k++ ) {
+            // STA abs,X or STA abs,Y, now and then over the loop itself
+            addr = rand() % 10 ? diffLoopAddress() : ( start & 0xff00 ) | ( rand() & 0xff );
+            mem[ i++ ] = x ? 0x9d : 0x99;
+            mem[ i++ ] = addr;
+            mem[ i++ ] = addr >> 8;
+        }
+        // INX, DEX, INY or DEY, then BNE back to the start
+        mem[ i++ ] = x ? ( inc ? 0xe8 : 0xca ) : ( inc ? 0xc8 : 0x88 );
+        mem[ i++ ] = 0xd0;
+        mem[ i ] = start - ( i + 1 );
+        i++;
+        i += rand() % 64;
+    }
+}
+
+// TESTS
+
+struct diffTest {
+    const char *name;
+    unsigned int engine;        // CPU_6502_ENGINE__* checked against the reference
+    unsigned int map;           // DIFF_MAP__*
+    unsigned int budget;        // longest run, half of them are under 200 cycles
+    void (*fill)( uint8_t *mem );
+    unsigned int lanes;         // run as a cpu6502Batch of this many, engines picked at random
+    int traced;                 // with a trace attached
+};
+
+static const struct diffTest diffTests[] = {
+    { "fast",    CPU_6502_ENGINE__FAST, 0,                                            200,   &diffFillRandom, 0, 0 },
+    { "jit",     CPU_6502_ENGINE__JIT,  DIFF_MAP__ROM | DIFF_MAP__IO,                 200,   &diffFillRandom, 0, 0 },
+    { "jitsmc",  CPU_6502_ENGINE__JIT,  DIFF_MAP__ROM | DIFF_MAP__IO,                 200,   &diffFillSelfModifying, 0, 0 },
+    { "fused",   CPU_6502_ENGINE__FAST, 0,                                            200,   &diffFillFused, 0, 0 },
+    { "idle",    CPU_6502_ENGINE__FAST, DIFF_MAP__IO,                                 30000, &diffFillIdle, 0, 0 },
+    { "idlejit", CPU_6502_ENGINE__JIT,  DIFF_MAP__ROM | DIFF_MAP__IO,                 30000, &diffFillIdle, 0, 0 },
+    { "mem",     CPU_6502_ENGINE__FAST, DIFF_MAP__RAM | DIFF_MAP__IO,                 30000, &diffFillMemLoops, 0, 0 },
+    { "memrom",  CPU_6502_ENGINE__FAST, DIFF_MAP__ROM,                                30000, &diffFillMemLoops, 0, 0 },
+    { "memjit",  CPU_6502_ENGINE__JIT,  DIFF_MAP__ROM | DIFF_MAP__RAM | DIFF_MAP__IO, 30000, &diffFillMemLoops, 0, 0 },
+    { "batch",   CPU_6502_ENGINE__FAST, DIFF_MAP__ROM | DIFF_MAP__RAM | DIFF_MAP__IO | DIFF_MAP__BANK, 20000, &diffFillIdle, DIFF_LANES, 0 },
+    { "traced",  CPU_6502_ENGINE__FAST, DIFF_MAP__ROM | DIFF_MAP__IO | DIFF_MAP__BANK, 2000, &diffFillIdle, 0, 1 },
+};
+
+#define DIFF_TESTS ( sizeof diffTests / sizeof diffTests[0] )
+
+// each CPU's memory map is the first member of its struct diffMemory
+
+#define DIFF_MEM(CPU) ( ( (const struct diffMemory *) (CPU)->mm )->mem )
+
+static int diffSame( const struct cpu6502 *a, const struct cpu6502 *b ) {
+    return a->PC == b->PC && a->A == b->A && a->X == b->X && a->Y == b->Y &&
+        a->P == b->P && a->SP == b->SP && a->clk == b->clk &&
+        !memcmp( DIFF_MEM( a ), DIFF_MEM( b ), NES_MEM_SIZE );
+}
+
+static void diffReport( const struct diffTest *t, const unsigned int seed, const unsigned int run,
+                        const int ra, const int rb, const struct cpu6502 *a, const struct cpu6502 *b ) {
+    unsigned int i;
+
+    printf( "%s: seed %u run %u stop %d %d\n", t->name, seed, run, ra, rb );
+    printf( "  PC %04x %04x A %02x %02x X %02x %02x Y %02x %02x P %02x %02x SP %02x %02x clk %" PRIu64 " %" PRIu64 "\n",
+            a->PC, b->PC, a->A, b->A, a->X, b->X, a->Y, b->Y, a->P, b->P, a->SP, b->SP, a->clk, b->clk );
+    for ( i = 0; i < NES_MEM_SIZE; i++ ) {
+        if ( DIFF_MEM( a )[i] != DIFF_MEM( b )[i] ) {
+            printf( "  [ %04x ] %02x %02x\n", i, DIFF_MEM( a )[i], DIFF_MEM( b )[i] );
+        }
+    }
+}
+
+// an in-memory ring, as cpu6502TraceOpen makes where there is no mmap
+
+static void diffTraceInit( struct cpu6502Trace *t, const unsigned int i ) {
+    memset( t, 0, sizeof *t );
+    memset( &diffTraceHeaders[i], 0, sizeof diffTraceHeaders[i] );
+    t->header = &diffTraceHeaders[i];
+    t->records = diffTraceRecords[i];
+    t->mask = ( 1 << DIFF_TRACE ) - 1;
+    t->fd = -1;
+}
+
+static int diffSameRecord( const struct cpu6502TraceRecord *a, const struct cpu6502TraceRecord *b ) {
+    return a->clk == b->clk && a->PC == b->PC && a->addr == b->addr && a->opcode == b->opcode &&
+        a->o1 == b->o1 && a->o2 == b->o2 && a->A == b->A && a->X == b->X && a->Y == b->Y &&
+        a->P == b->P && a->SP == b->SP && a->access == b->access &&
+        a->before == b->before && a->after == b->after;
+}
+
+// the records both traces wrote since from, which must be the same ones
+
+static int diffSameTrace( const struct diffTest *t, const unsigned int seed, const unsigned int run,
+                          const struct cpu6502Trace *a, const struct cpu6502Trace *b, const uint64_t from ) {
+    char line[2][128];
+    uint64_t n;
+
+    if ( a->header->head != b->header->head ) {
+        printf( "%s: seed %u run %u records %" PRIu64 " %" PRIu64 "\n", t->name, seed, run, a->header->head, b->header->head );
+        return 0;
+    }
+    for ( n = from; n < a->header->head; n++ ) {
+        if ( !diffSameRecord( &a->records[ n & a->mask ], &b->records[ n & b->mask ] ) ) {
+            cpu6502TraceFormat( line[0], sizeof line[0], &a->records[ n & a->mask ] );
+            cpu6502TraceFormat( line[1], sizeof line[1], &b->records[ n & b->mask ] );
+            printf( "%s: seed %u run %u record %" PRIu64 "\n  %s\n  %s\n", t->name, seed, run, n, line[0], line[1] );
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// 0 if the engine and the reference agreed all the way through the seed
+
+static int diffSeed( const struct diffTest *t, const unsigned int seed ) {
+    struct cpu6502 a = {0};
+    struct cpu6502 b = {0};
+    struct cpu6502Trace ta;
+    struct cpu6502Trace tb;
+    unsigned int run;
+    uint64_t budget;
+    uint64_t from;
+    int fail = 0;
+    int ra;
+    int rb;
+
+    srand( seed );
+    t->fill( diffA.mem );
+    memcpy( diffB.mem, diffA.mem, NES_MEM_SIZE );
+    diffMap( &diffA, t->map );
+    diffMap( &diffB, t->map );
+
+    cpu6502Init( &a );
+    cpu6502Init( &b );
+    a.mm = &diffA.mm;
+    b.mm = &diffB.mm;
+    a.engine = t->engine;
+    b.engine = CPU_6502_ENGINE__REFERENCE;
+    // JIT blocks only start in ROM
+    a.PC = b.PC = ( t->map & DIFF_MAP__ROM ) ? 0x8000 | rand() : rand();
+    a.A = b.A = rand();
+    a.X = b.X = rand();
+    a.Y = b.Y = rand();
+    a.P = b.P = rand();
+    if ( t->traced ) {
+        diffTraceInit( &ta, 0 );
+        diffTraceInit( &tb, 1 );
+        a.trace = &ta;
+        b.trace = &tb;
+    }
+
+    for ( run = 0; run < DIFF_RUNS; run++ ) {
+        from = t->traced ? ta.header->head : 0;
+        budget = rand() % ( rand() % 2 ? 200 : t->budget );
+        if ( rand() % 8 == 0 ) {
+            cpu6502Raise( &a, CPU_6502_SIGNAL__NMI );
+            cpu6502Raise( &b, CPU_6502_SIGNAL__NMI );
+        }
+        if ( rand() % 2 ) {
+            ra = cpu6502Run( &a, budget );
+            rb = cpu6502Run( &b, budget );
+        } else {
+            cpu6502Step( &a );
+            cpu6502Step( &b );
+            ra = rb = CPU_6502_STOP__BUDGET;
+        }
+        if ( ra != rb || !diffSame( &a, &b ) ) {
+            diffReport( t, seed, run, ra, rb, &a, &b );
+            fail = 1;
+            break;
+        }
+        if ( t->traced && !diffSameTrace( t, seed, run, &ta, &tb, from ) ) {
+            fail = 1;
+            break;
+        }
+        // step over the jam and keep going
+        if ( ra == CPU_6502_STOP__JAM ) {
+            a.PC++;
+            b.PC++;
+        }
+    }
+
+    cpu6502Destroy( &a );
+    cpu6502Destroy( &b );
+    return fail;
+}
+
+// the lanes share code but each has a few bytes of its own in RAM and
+// some in ROM, and some start elsewhere, so they split from the group and
+// rejoin it. Interrupts arrive on single lanes.
+
+static int diffBatchSeed( const struct diffTest *t, const unsigned int seed ) {
+    static struct cpu6502 a[DIFF_LANES];
+    static struct cpu6502 b[DIFF_LANES];
+    struct cpu6502Batch batch;
+    unsigned int run;
+    unsigned int l;
+    unsigned int k;
+    uint64_t budget;
+    uint16_t pc;
+    uint8_t A, X, P;
+    int signal;
+    int fail = 0;
+    int ra;
+    int rb;
+
+    srand( seed );
+    t->fill( diffLanes[0][0].mem );
+    pc = 0x8000 | rand();
+    A = rand();
+    X = rand();
+    P = rand();
+
+    for ( l = 0; l < t->lanes; l++ ) {
+        if ( l > 0 ) {
+            memcpy( diffLanes[0][l].mem, diffLanes[0][0].mem, NES_MEM_SIZE );
+        }
+        for ( k = 0; k < 8; k++ ) {
+            diffLanes[0][l].mem[ rand() & 0x07ff ] = rand();
+        }
+        if ( l % 5 == 0 ) {
+            diffLanes[0][l].mem[ 0x8000 | ( rand() & 0x7fff ) ] = rand();
+        }
+        memcpy( diffLanes[1][l].mem, diffLanes[0][l].mem, NES_MEM_SIZE );
+        diffMap( &diffLanes[0][l], t->map );
+        diffMap( &diffLanes[1][l], t->map );
+
+        memset( &a[l], 0, sizeof a[l] );
+        memset( &b[l], 0, sizeof b[l] );
+        cpu6502Init( &a[l] );
+        cpu6502Init( &b[l] );
+        a[l].mm = &diffLanes[0][l].mm;
+        b[l].mm = &diffLanes[1][l].mm;
+        a[l].engine = rand() % 3;
+        b[l].engine = CPU_6502_ENGINE__REFERENCE;
+        a[l].PC = b[l].PC = ( l % 7 == 6 ) ? 0x8000 | rand() : pc;
+        a[l].A = b[l].A = A;
+        a[l].X = b[l].X = X;
+        a[l].P = b[l].P = P;
+    }
+
+    if ( cpu6502BatchInit( &batch, a, t->lanes ) ) {
+        printf( "%s: seed %u batch init failed\n", t->name, seed );
+        return 1;
+    }
+
+    for ( run = 0; run < DIFF_RUNS / 5 && !fail; run++ ) {
+        budget = rand() % ( rand() % 2 ? 300 : t->budget );
+        if ( rand() % 6 == 0 ) {
+            l = rand() % t->lanes;
+            signal = rand() % 2 ? CPU_6502_SIGNAL__NMI : CPU_6502_SIGNAL__IRQ;
+            cpu6502Raise( &a[l], signal );
+            cpu6502Raise( &b[l], signal );
+        }
+        if ( rand() % 6 == 0 ) {
+            l = rand() % t->lanes;
+            cpu6502Release( &a[l], CPU_6502_SIGNAL__IRQ );
+            cpu6502Release( &b[l], CPU_6502_SIGNAL__IRQ );
+        }
+        cpu6502BatchRun( &batch, budget );
+        for ( l = 0; l < t->lanes; l++ ) {
+            ra = batch.stop[l];
+            rb = cpu6502Run( &b[l], budget );
+            if ( ra != rb || !diffSame( &a[l], &b[l] ) ) {
+                printf( "lane %u\n", l );
+                diffReport( t, seed, run, ra, rb, &a[l], &b[l] );
+                fail = 1;
+                break;
+            }
+            if ( ra == CPU_6502_STOP__JAM ) {
+                a[l].PC++;
+                b[l].PC++;
+            }
+        }
+    }
+
+    cpu6502BatchDestroy( &batch );
+    for ( l = 0; l < t->lanes; l++ ) {
+        cpu6502Destroy( &a[l] );
+        cpu6502Destroy( &b[l] );
+    }
+    return fail;
+}
+
+int main( int argc, char *argv[] ) {
+    const struct diffTest *t;
+    unsigned int fails;
+    unsigned int total = 0;
+    unsigned int seeds;
+    unsigned int seed;
+    unsigned int i;
+    int j;
+
+    for ( i = 0; i < DIFF_TESTS; i++ ) {
+        t = &diffTests[i];
+        for ( j = 1; j < argc && strcmp( argv[j], t->name ); j++ ) {
+        }
+        if ( argc > 1 && j == argc ) {
+            continue;
+        }
+
+        // a batch seed runs as many CPUs as it has lanes
+        seeds = t->lanes ? DIFF_SEEDS / t->lanes : DIFF_SEEDS;
+        fails = 0;
+        for ( seed = 0; seed < seeds; seed++ ) {
+            fails += t->lanes ? diffBatchSeed( t, seed ) : diffSeed( t, seed );
+        }
+        printf( "%-8s %u seeds, %u failed\n", t->name, seeds, fails );
+        total += fails;
+    }
+
+    return total != 0;
+}
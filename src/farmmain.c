@@ -0,0 +1,80 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "6502.h"
+#include "nesfarm.h"
+
+// farmtest rom frames jobs [workers]
+//
+// Runs the ROM as many times as asked, each job holding a different
+// button for its whole run, and prints every job's RAM hash.
+
+int main(int argc, char *argv[]) {
+
+    struct nesFarm farm;
+    struct nesRom rom;
+    struct nesFarmJob *jobs;
+    uint8_t *input;
+    unsigned int frames;
+    unsigned int count;
+    unsigned int workers;
+    unsigned int i;
+    unsigned int f;
+    struct timespec t0, t1;
+    double secs;
+    uint64_t cycles;
+
+    if ( argc < 4 ) {
+        fprintf( stderr, "usage: %s rom frames jobs [workers]\n", argv[0] );
+        return 1;
+    }
+
+    frames = strtoul( argv[2], NULL, 10 );
+    count = strtoul( argv[3], NULL, 10 );
+    workers = ( argc > 4 ) ? strtoul( argv[4], NULL, 10 ) : 0;
+
+    if ( nesRomLoad( &rom, argv[1] ) < 0 ) {
+        fprintf( stderr, "cannot load %s\n", argv[1] );
+        return 1;
+    }
+
+    jobs = calloc( count, sizeof( struct nesFarmJob ) );
+    input = malloc( (size_t) count * frames + 1 );
+    if ( jobs == NULL || input == NULL || nesFarmInit( &farm, workers, 1 ) ) {
+        fprintf( stderr, "out of memory\n" );
+        return 1;
+    }
+
+    for ( i = 0; i < count; i++ ) {
+        for ( f = 0; f < frames; f++ ) {
+            input[ i * frames + f ] = 1 << ( i % 8 );
+        }
+        jobs[i].rom = &rom;
+        jobs[i].input = input + i * frames;
+        jobs[i].inputFrames = frames;
+        jobs[i].frames = frames;
+        jobs[i].engine = CPU_6502_ENGINE__FAST;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &t0 );
+    nesFarmRun( &farm, jobs, count );
+    clock_gettime( CLOCK_MONOTONIC, &t1 );
+
+    cycles = 0;
+    for ( i = 0; i < count; i++ ) {
+        printf( "job %u: status %d, %u frames, ram %016" PRIx64 ", frame %016" PRIx64 "\n",
+            i, jobs[i].status, jobs[i].framesRun, jobs[i].ramHash, jobs[i].frameHash );
+        cycles += jobs[i].cycles;
+    }
+
+    secs = ( t1.tv_sec - t0.tv_sec ) + ( t1.tv_nsec - t0.tv_nsec ) / 1e9;
+    fprintf( stderr, "%u workers: %.3f s, %.1f Mcyc/s\n", farm.workers, secs, cycles / secs / 1e6 );
+
+    nesFarmDestroy( &farm );
+    free( input );
+    free( jobs );
+    nesRomFree( &rom );
+
+    return 0;
+}
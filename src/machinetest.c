@@ -0,0 +1,846 @@
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "6502.h"
+#include "nesmem.h"
+#include "2c02.h"
+#include "nes.h"
+
+// machinetest [test ...]
+//
+// Tests of the whole console on small programs assembled here. The lazy
+// test runs the same cartridge on a machine that brings the PPU up to
+// date only when it has to and on one in lockstep; every frame, the RAM
+// and the cycles at which the NMI and IRQ handlers were entered must be
+// the same. The draw test does the same for drawing the lines between
+// PPU accesses in one pass against drawing each at its own dot. The mmc3
+// and ppu tests check the scanlines and cycles IRQs, NMIs and the status
+// flags come at, and every pixel of a frame. With no arguments every test
+// runs.
+
+#define MACHINE_FRAMES 30
+#define MACHINE_MARKS  1024
+
+// The programs read MACHINE_MARK( kind ), which nothing else answers, so
+// that the cycle they did it at can be logged: first thing in their
+// handlers, or once they have seen a flag in PPU_STATUS
+
+#define MACHINE_MARK__NMI     0
+#define MACHINE_MARK__IRQ     1
+#define MACHINE_MARK__HIT     2  // sprite 0 hit
+#define MACHINE_MARK__VBLANK  3
+#define MACHINE_MARK_KINDS    4
+
+#define MACHINE_MARK(KIND) ( 0x4018 + (KIND) )
+
+static const char *const machineMarkNames[ MACHINE_MARK_KINDS ] = { "NMI", "IRQ", "hit", "vblank" };
+
+// the few opcodes the programs need
+
+#define OP_BIT_ABS  0x2c
+#define OP_BPL      0x10
+#define OP_BVC      0x50
+#define OP_BVS      0x70
+#define OP_BNE      0xd0
+#define OP_JMP      0x4c
+#define OP_RTI      0x40
+#define OP_SEI      0x78
+#define OP_CLI      0x58
+#define OP_CLD      0xd8
+#define OP_PHA      0x48
+#define OP_PLA      0x68
+#define OP_TXS      0x9a
+#define OP_INX      0xe8
+#define OP_DEY      0x88
+#define OP_ASL      0x0a
+#define OP_LDA_IMM  0xa9
+#define OP_LDA_ZP   0xa5
+#define OP_LDA_ABX  0xbd
+#define OP_LDX_IMM  0xa2
+#define OP_LDY_IMM  0xa0
+#define OP_STA_ABS  0x8d
+#define OP_STA_ABX  0x9d
+#define OP_INC_ZP   0xe6
+#define OP_AND_IMM  0x29
+#define OP_ORA_IMM  0x09
+#define OP_CPX_IMM  0xe0
+
+// ASSEMBLER
+//
+// programs are written a byte at a time into a 32KB PRG ROM at $8000,
+// which NROM and MMC3 as it powers on both map straight through
+
+#define MACHINE_PRG_SIZE 0x8000
+
+static uint8_t machinePrg[ MACHINE_PRG_SIZE ];
+static uint16_t machinePc;
+
+static void machineByte( const uint8_t b ) {
+    machinePrg[ machinePc++ - 0x8000 ] = b;
+}
+
+static void machineWord( const uint16_t w ) {
+    machineByte( w & 0xff );
+    machineByte( w >> 8 );
+}
+
+static void machineOp1( const uint8_t op, const uint8_t b ) {
+    machineByte( op );
+    machineByte( b );
+}
+
+static void machineOp2( const uint8_t op, const uint16_t w ) {
+    machineByte( op );
+    machineWord( w );
+}
+
+static void machineBranch( const uint8_t op, const uint16_t target ) {
+    machineByte( op );
+    machineByte( target - ( machinePc + 1 ) );
+}
+
+static void machineTable( const uint16_t addr, const uint8_t *data, const unsigned int size ) {
+    memcpy( machinePrg + addr - 0x8000, data, size );
+}
+
+// size bytes from table to PPU_DATA, count times; a size of 0 is 256
+
+static void machineUpload( const uint16_t table, const uint8_t size, const uint8_t count ) {
+    uint16_t outer;
+    uint16_t inner;
+
+    machineOp1( OP_LDY_IMM, count );
+    outer = machinePc;
+    machineOp1( OP_LDX_IMM, 0 );
+    inner = machinePc;
+    machineOp2( OP_LDA_ABX, table );
+    machineOp2( OP_STA_ABS, PPU_DATA );
+    machineByte( OP_INX );
+    machineOp1( OP_CPX_IMM, size );
+    machineBranch( OP_BNE, inner );
+    machineByte( OP_DEY );
+    machineBranch( OP_BNE, outer );
+}
+
+static void machinePpuAddr( const uint16_t addr ) {
+    machineOp1( OP_LDA_IMM, addr >> 8 );
+    machineOp2( OP_STA_ABS, PPU_ADDR );
+    machineOp1( OP_LDA_IMM, addr & 0xff );
+    machineOp2( OP_STA_ABS, PPU_ADDR );
+}
+
+// PICTURE
+//
+// four tiles in both pattern tables, every pixel of the last three
+// opaque, two nametables, the palettes and OAM, all uploaded by the
+// program before it turns rendering on
+
+#define MACHINE_CHR      0x9000  // 64 bytes
+#define MACHINE_NT0      0x9100  // 256 bytes, repeated over the nametable
+#define MACHINE_NT1      0x9200
+#define MACHINE_PALETTE  0x9300  // 32 bytes
+#define MACHINE_OAM      0x9400  // 256 bytes
+
+static const uint8_t machineChr[ 64 ] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xf0, 0xcc, 0xaa, 0x0f, 0xf0, 0xcc, 0xaa, 0x0f,  0x0f, 0x33, 0x55, 0xf0, 0x0f, 0x33, 0x55, 0xf0,
+};
+
+static const uint8_t machinePalette[ 32 ] = {
+    0x0f, 0x01, 0x02, 0x03,  0x0f, 0x11, 0x12, 0x13,  0x0f, 0x21, 0x22, 0x23,  0x0f, 0x31, 0x32, 0x33,
+    0x0f, 0x05, 0x06, 0x07,  0x0f, 0x15, 0x16, 0x17,  0x0f, 0x25, 0x26, 0x27,  0x0f, 0x35, 0x36, 0x37,
+};
+
+static void machinePicture( void ) {
+    uint8_t nt[ 256 ];
+    uint8_t oam[ 256 ];
+    unsigned int i;
+
+    machineTable( MACHINE_CHR, machineChr, sizeof machineChr );
+    machineTable( MACHINE_PALETTE, machinePalette, sizeof machinePalette );
+
+    // tiles 1-3 in an uneven pattern, so that any scroll shows
+    for ( i = 0; i < 256; i++ ) {
+        nt[i] = 1 + ( i * 7 + i / 32 ) % 3;
+    }
+    machineTable( MACHINE_NT0, nt, sizeof nt );
+    for ( i = 0; i < 256; i++ ) {
+        nt[i] = 1 + ( i * 5 + i / 11 ) % 3;
+    }
+    machineTable( MACHINE_NT1, nt, sizeof nt );
+
+    // sprite 0 on the opaque background from line 101, the rest spread
+    // over the screen, some behind it and some flipped
+    for ( i = 0; i < 64; i++ ) {
+        oam[ i * 4 + 0 ] = ( i * 37 + 11 ) % 232;
+        oam[ i * 4 + 1 ] = 1 + i % 3;
+        oam[ i * 4 + 2 ] = ( i * 0x45 ) & 0xe3;
+        oam[ i * 4 + 3 ] = ( i * 59 + 3 ) & 0xff;
+    }
+    oam[0] = 100;
+    oam[1] = 1;
+    oam[2] = 0;
+    oam[3] = 80;
+    machineTable( MACHINE_OAM, oam, sizeof oam );
+}
+
+// the start of every program: waits out the PPU's warm up, uploads the
+// picture and points the scroll at the top left, leaving rendering off
+
+static void machineReset( void ) {
+    uint16_t loop;
+
+    machineByte( OP_SEI );
+    machineByte( OP_CLD );
+    machineOp1( OP_LDX_IMM, 0xff );
+    machineByte( OP_TXS );
+    machineOp1( OP_LDA_IMM, 0 );
+    machineOp2( OP_STA_ABS, PPU_CTRL_0 );
+    machineOp2( OP_STA_ABS, PPU_CTRL_1 );
+
+    loop = machinePc;
+    machineOp2( OP_BIT_ABS, PPU_STATUS );
+    machineBranch( OP_BPL, loop );
+    loop = machinePc;
+    machineOp2( OP_BIT_ABS, PPU_STATUS );
+    machineBranch( OP_BPL, loop );
+
+    machinePpuAddr( PATTERN_TABLE_0 );
+    machineUpload( MACHINE_CHR, sizeof machineChr, 1 );
+    machinePpuAddr( PATTERN_TABLE_1 );
+    machineUpload( MACHINE_CHR, sizeof machineChr, 1 );
+    machinePpuAddr( NAME_TABLE_0 );
+    machineUpload( MACHINE_NT0, 0, 4 );
+    machinePpuAddr( NAME_TABLE_2 );
+    machineUpload( MACHINE_NT1, 0, 4 );
+    machinePpuAddr( IMAGE_PALETTE );
+    machineUpload( MACHINE_PALETTE, sizeof machinePalette, 1 );
+
+    // OAM goes through RAM and DMA
+    machineOp1( OP_LDX_IMM, 0 );
+    loop = machinePc;
+    machineOp2( OP_LDA_ABX, MACHINE_OAM );
+    machineOp2( OP_STA_ABX, 0x0200 );
+    machineByte( OP_INX );
+    machineBranch( OP_BNE, loop );
+    machineOp1( OP_LDA_IMM, 0 );
+    machineOp2( OP_STA_ABS, OAM_ADDR );
+    machineOp1( OP_LDA_IMM, 0x02 );
+    machineOp2( OP_STA_ABS, OAM_DMA );
+
+    machineOp2( OP_BIT_ABS, PPU_STATUS );
+    machineOp1( OP_LDA_IMM, 0 );
+    machineOp2( OP_STA_ABS, PPU_SCROLL );
+    machineOp2( OP_STA_ABS, PPU_SCROLL );
+}
+
+static void machineVectors( const uint16_t nmi, const uint16_t reset, const uint16_t irq ) {
+    machinePc = 0xfffa;
+    machineWord( nmi );
+    machineWord( reset );
+    machineWord( irq );
+}
+
+// MACHINES
+
+struct machineRun {
+    struct nesMachine m;
+    uint8_t (*read)( struct nesMemoryMap *, uint16_t );  // the machine's own
+    uint64_t mark[ MACHINE_MARK_KINDS ][ MACHINE_MARKS ];  // cycles of the marks read
+    unsigned int marks[ MACHINE_MARK_KINDS ];
+    uint64_t frameHash[ MACHINE_FRAMES ];
+    int stop;
+};
+
+static struct machineRun machineA, machineB;
+
+static uint8_t machineRead( struct nesMemoryMap *mm, uint16_t addr ) {
+    struct machineRun *r = (struct machineRun *) ( (char *) mm - offsetof( struct machineRun, m.mm ) );
+
+    const unsigned int kind = addr - MACHINE_MARK( 0 );
+
+    if ( kind < MACHINE_MARK_KINDS && r->marks[ kind ] < MACHINE_MARKS ) {
+        r->mark[ kind ][ r->marks[ kind ]++ ] = r->m.cpu.clk;
+    }
+    return r->read( mm, addr );
+}
+
+// runs the program for frames frames or until the CPU stops early
+
+static void machineRun( struct machineRun *r, const struct nesRom *rom, const unsigned int engine,
+                        const unsigned int lockstep, const unsigned int frames ) {
+    unsigned int f;
+
+    memset( r->marks, 0, sizeof r->marks );
+    r->stop = CPU_6502_STOP__BUDGET;
+    nesMachineInit( &r->m, rom, engine );
+    r->m.lockstep = lockstep;
+    r->read = r->m.mm.read;
+    r->m.mm.read = &machineRead;
+
+    for ( f = 0; f < frames; f++ ) {
+        r->stop = nesMachineRunFrame( &r->m, 0, 0 );
+        if ( r->stop != CPU_6502_STOP__BUDGET ) {
+            break;
+        }
+        r->frameHash[f] = nesMachineFrameHash( &r->m );
+    }
+}
+
+static void machineRom( struct nesRom *rom, const unsigned int mapper ) {
+    memset( rom, 0, sizeof *rom );
+    rom->prg = machinePrg;
+    rom->prgSize = MACHINE_PRG_SIZE;
+    rom->mapper = mapper;
+    rom->mirroring = NES_MIRROR__HORIZONTAL;
+}
+
+static unsigned int machineFail( const char *test, const char *what ) {
+    printf( "%s: %s\n", test, what );
+    return 1;
+}
+
+// LAZY PPU
+//
+// An MMC3 cartridge whose IRQ comes every 21 lines and moves the scroll.
+// The main loop polls PPU_STATUS for sprite 0 and then writes PPU_SCROLL
+// and PPU_CTRL_0 mid picture; the NMI handler moves both every frame.
+
+#define MACHINE_LAZY_LATCH 20
+
+static void machineLazyProgram( void ) {
+    uint16_t top;
+    uint16_t loop;
+    uint16_t nmi;
+    uint16_t irq;
+
+    memset( machinePrg, 0, sizeof machinePrg );
+    machinePicture();
+
+    machinePc = 0xe000;
+    machineReset();
+    machineOp1( OP_LDA_IMM, MACHINE_LAZY_LATCH );
+    machineOp2( OP_STA_ABS, 0xc000 );
+    machineOp2( OP_STA_ABS, 0xc001 );
+    machineOp2( OP_STA_ABS, 0xe001 );
+    machineOp1( OP_LDA_IMM, PPU_CTRL_0__VBLANK_NMI_ENABLE | PPU_CTRL_0__SPRITE_PATTERN_TABLE );
+    machineOp2( OP_STA_ABS, PPU_CTRL_0 );
+    machineOp1( OP_LDA_IMM, 0x1e );
+    machineOp2( OP_STA_ABS, PPU_CTRL_1 );
+    machineByte( OP_CLI );
+
+    top = machinePc;
+    loop = machinePc;
+    machineOp2( OP_BIT_ABS, PPU_STATUS );
+    machineBranch( OP_BVS, loop );
+    loop = machinePc;
+    machineOp2( OP_BIT_ABS, PPU_STATUS );
+    machineBranch( OP_BVC, loop );
+    machineOp1( OP_LDA_ZP, 0x10 );
+    machineOp2( OP_STA_ABS, PPU_SCROLL );
+    machineOp1( OP_LDA_IMM, 0 );
+    machineOp2( OP_STA_ABS, PPU_SCROLL );
+    machineOp1( OP_LDA_ZP, 0x11 );
+    machineOp1( OP_AND_IMM, 0x01 );
+    machineOp1( OP_ORA_IMM, PPU_CTRL_0__VBLANK_NMI_ENABLE | PPU_CTRL_0__SPRITE_PATTERN_TABLE );
+    machineOp2( OP_STA_ABS, PPU_CTRL_0 );
+    machineOp1( OP_INC_ZP, 0x12 );
+    machineOp2( OP_JMP, top );
+
+    nmi = machinePc;
+    machineOp2( OP_BIT_ABS, MACHINE_MARK( MACHINE_MARK__NMI ) );
+    machineByte( OP_PHA );
+    machineOp1( OP_INC_ZP, 0x10 );
+    machineOp1( OP_INC_ZP, 0x11 );
+    machineOp2( OP_BIT_ABS, PPU_STATUS );
+    machineOp1( OP_LDA_IMM, 0 );
+    machineOp2( OP_STA_ABS, PPU_SCROLL );
+    machineOp2( OP_STA_ABS, PPU_SCROLL );
+    machineOp1( OP_LDA_IMM, PPU_CTRL_0__VBLANK_NMI_ENABLE | PPU_CTRL_0__SPRITE_PATTERN_TABLE );
+    machineOp2( OP_STA_ABS, PPU_CTRL_0 );
+    machineOp1( OP_LDA_IMM, MACHINE_LAZY_LATCH );
+    machineOp2( OP_STA_ABS, 0xc000 );
+    machineOp2( OP_STA_ABS, 0xc001 );
+    machineOp2( OP_STA_ABS, 0xe001 );
+    machineByte( OP_PLA );
+    machineByte( OP_RTI );
+
+    irq = machinePc;
+    machineOp2( OP_BIT_ABS, MACHINE_MARK( MACHINE_MARK__IRQ ) );
+    machineByte( OP_PHA );
+    machineOp2( OP_STA_ABS, 0xe000 );
+    machineOp2( OP_STA_ABS, 0xe001 );
+    machineOp2( OP_BIT_ABS, PPU_STATUS );
+    machineOp1( OP_LDA_ZP, 0x10 );
+    machineByte( OP_ASL );
+    machineOp2( OP_STA_ABS, PPU_SCROLL );
+    machineOp2( OP_STA_ABS, PPU_SCROLL );
+    machineByte( OP_PLA );
+    machineByte( OP_RTI );
+
+    machineVectors( nmi, 0xe000, irq );
+}
+
+// 0 if a and b ran the same
+
+static unsigned int machineCompare( const char *test, struct machineRun *a, struct machineRun *b ) {
+    unsigned int f;
+    unsigned int k;
+    unsigned int i;
+
+    if ( a->stop != b->stop || a->m.frame != b->m.frame ) {
+        printf( "%s: stop %d %d after %" PRIu64 " %" PRIu64 " frames\n", test, a->stop, b->stop, a->m.frame, b->m.frame );
+        return 1;
+    }
+    for ( f = 0; f < a->m.frame; f++ ) {
+        if ( a->frameHash[f] != b->frameHash[f] ) {
+            printf( "%s: frame %u %016" PRIx64 " %016" PRIx64 "\n", test, f, a->frameHash[f], b->frameHash[f] );
+            return 1;
+        }
+    }
+    if ( nesMachineRamHash( &a->m ) != nesMachineRamHash( &b->m ) ) {
+        return machineFail( test, "RAM differs" );
+    }
+    for ( k = 0; k < MACHINE_MARK_KINDS; k++ ) {
+        if ( a->marks[k] != b->marks[k] ) {
+            printf( "%s: %u %u %s marks\n", test, a->marks[k], b->marks[k], machineMarkNames[k] );
+            return 1;
+        }
+        for ( i = 0; i < a->marks[k]; i++ ) {
+            if ( a->mark[k][i] != b->mark[k][i] ) {
+                printf( "%s: %s %u at %" PRIu64 " %" PRIu64 "\n", test, machineMarkNames[k], i, a->mark[k][i], b->mark[k][i] );
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static unsigned int machineTestLazy( const char *test ) {
+    static const unsigned int engines[] = {
+        CPU_6502_ENGINE__FAST, CPU_6502_ENGINE__REFERENCE, CPU_6502_ENGINE__JIT
+    };
+    struct nesRom rom;
+    unsigned int fails = 0;
+    unsigned int i;
+
+    machineLazyProgram();
+    machineRom( &rom, 4 );
+
+    for ( i = 0; i < sizeof engines / sizeof engines[0]; i++ ) {
+        machineRun( &machineA, &rom, engines[i], 0, MACHINE_FRAMES );
+        machineRun( &machineB, &rom, engines[i], NES_LOCKSTEP__CPU, MACHINE_FRAMES );
+        fails += machineCompare( test, &machineA, &machineB );
+        // the program has to have done what it is there for, once past
+        // the PPU's warm up and its own
+        if ( machineA.marks[ MACHINE_MARK__NMI ] < MACHINE_FRAMES - 4 ||
+             machineA.marks[ MACHINE_MARK__IRQ ] < ( MACHINE_FRAMES - 4 ) * 10 ) {
+            fails += machineFail( test, "too few interrupts" );
+        }
+        nesMachineDestroy( &machineA.m );
+        nesMachineDestroy( &machineB.m );
+    }
+    return fails;
+}
+
+// MMC3 IRQ
+//
+// The counter is reloaded with the latch every frame by the NMI handler
+// and then clocked once a line by the sprite fetches from $1000. The IRQ
+// handler either acknowledges with $E000 and enables again with $E001,
+// so that the counter reloads on reaching 0 and goes round again, or
+// only enables, leaving the IRQ asserted.
+
+#define MACHINE_MMC3_LATCH 30
+
+static void machineMmc3Program( const int ack ) {
+    uint16_t top;
+    uint16_t nmi;
+    uint16_t irq;
+
+    memset( machinePrg, 0, sizeof machinePrg );
+    machinePicture();
+
+    machinePc = 0xe000;
+    machineReset();
+    machineOp1( OP_LDA_IMM, PPU_CTRL_0__VBLANK_NMI_ENABLE | PPU_CTRL_0__SPRITE_PATTERN_TABLE );
+    machineOp2( OP_STA_ABS, PPU_CTRL_0 );
+    machineOp1( OP_LDA_IMM, 0x1e );
+    machineOp2( OP_STA_ABS, PPU_CTRL_1 );
+    machineByte( OP_CLI );
+    top = machinePc;
+    machineOp2( OP_JMP, top );
+
+    nmi = machinePc;
+    machineOp2( OP_BIT_ABS, MACHINE_MARK( MACHINE_MARK__NMI ) );
+    machineOp1( OP_LDA_IMM, MACHINE_MMC3_LATCH );
+    machineOp2( OP_STA_ABS, 0xc000 );
+    machineOp2( OP_STA_ABS, 0xc001 );
+    machineOp2( OP_STA_ABS, 0xe001 );
+    machineByte( OP_RTI );
+
+    irq = machinePc;
+    machineOp2( OP_BIT_ABS, MACHINE_MARK( MACHINE_MARK__IRQ ) );
+    if ( ack ) {
+        machineOp2( OP_STA_ABS, 0xe000 );
+    }
+    machineOp2( OP_STA_ABS, 0xe001 );
+    machineByte( OP_RTI );
+
+    machineVectors( nmi, 0xe000, irq );
+}
+
+// the scanline and dot of the frame a cycle falls in
+
+static unsigned int machineLine( const uint64_t clk, unsigned int *dot ) {
+    const unsigned int d = ( clk * 3 ) % NES_FRAME_DOTS;
+
+    *dot = d % NES_DOTS_PER_SCANLINE;
+    return d / NES_DOTS_PER_SCANLINE;
+}
+
+// once the program has settled, every frame has to take its IRQs on the
+// lines given, ending with 0, in the cycles after the A12 rise it takes
+// to finish the JMP, push the return address and flags, fetch the vector
+// and get to the BIT's read
+
+static unsigned int machineMmc3Lines( const char *test, const struct machineRun *r, const unsigned int *lines ) {
+    const uint64_t *irq = r->mark[ MACHINE_MARK__IRQ ];
+    const unsigned int irqs = r->marks[ MACHINE_MARK__IRQ ];
+    uint64_t frame;
+    unsigned int line;
+    unsigned int dot;
+    unsigned int n = 0;
+    unsigned int i;
+
+    for ( i = 0; i < irqs; i++ ) {
+        frame = irq[i] * 3 / NES_FRAME_DOTS;
+        if ( frame < 4 ) {
+            continue;
+        }
+        if ( i == 0 || irq[ i - 1 ] * 3 / NES_FRAME_DOTS != frame ) {
+            if ( n && lines[n] ) {
+                printf( "%s: frame %" PRIu64 " IRQ %u missing\n", test, frame - 1, n );
+                return 1;
+            }
+            n = 0;
+        }
+        line = machineLine( irq[i], &dot );
+        if ( line != lines[n] || dot < NES_A12_DOT__SPRITES || dot > NES_A12_DOT__SPRITES + 3 * ( 3 + 7 + 4 ) ) {
+            printf( "%s: frame %" PRIu64 " IRQ %u at line %u dot %u, not line %u\n", test, frame, n, line, dot, lines[n] );
+            return 1;
+        }
+        n++;
+    }
+    if ( n == 0 ) {
+        return machineFail( test, "no IRQs" );
+    }
+    return 0;
+}
+
+// without the acknowledge every IRQ is followed by another as soon as the
+// handler returns: its STA and RTI, then the interrupt sequence and the
+// next BIT
+
+static unsigned int machineMmc3Again( const char *test, const struct machineRun *r ) {
+    const uint64_t *irq = r->mark[ MACHINE_MARK__IRQ ];
+    const unsigned int irqs = r->marks[ MACHINE_MARK__IRQ ];
+    unsigned int i;
+
+    for ( i = 0; i + 1 < irqs && irq[i] * 3 / NES_FRAME_DOTS < 4; i++ ) {
+    }
+    if ( i + 1 >= irqs ) {
+        return machineFail( test, "no IRQs" );
+    }
+    if ( irq[ i + 1 ] - irq[i] > 4 + 6 + 7 + 4 ) {
+        printf( "%s: IRQ taken again %" PRIu64 " cycles later\n", test, irq[ i + 1 ] - irq[i] );
+        return 1;
+    }
+    return 0;
+}
+
+static unsigned int machineTestMmc3( const char *test ) {
+    struct nesRom rom;
+    unsigned int lines[ NES_VISIBLE_SCANLINES ];
+    unsigned int fails = 0;
+    unsigned int lockstep;
+    unsigned int line;
+    unsigned int n;
+
+    machineRom( &rom, 4 );
+
+    // the first IRQ after latch lines, each after that a line later
+    // since reaching 0 only reloads
+    n = 0;
+    for ( line = MACHINE_MMC3_LATCH - 1; line < NES_VISIBLE_SCANLINES; line += MACHINE_MMC3_LATCH + 1 ) {
+        lines[ n++ ] = line;
+    }
+    lines[n] = 0;
+
+    for ( lockstep = 0; lockstep <= NES_LOCKSTEP__CPU; lockstep += NES_LOCKSTEP__CPU ) {
+        machineMmc3Program( 1 );
+        machineRun( &machineA, &rom, CPU_6502_ENGINE__FAST, lockstep, MACHINE_FRAMES );
+        fails += machineMmc3Lines( test, &machineA, lines );
+        nesMachineDestroy( &machineA.m );
+
+        machineMmc3Program( 0 );
+        machineRun( &machineA, &rom, CPU_6502_ENGINE__FAST, lockstep, MACHINE_FRAMES );
+        fails += machineMmc3Again( test, &machineA );
+        nesMachineDestroy( &machineA.m );
+    }
+    return fails;
+}
+
+// PPU
+//
+// An NROM cartridge with CHR RAM and a picture whose every pixel the test
+// works out for itself: the background with two columns of tiles left
+// transparent, and a few sprites in front of and behind it, overlapping
+// each other and sprite 0 on an opaque tile. With NMI the program does
+// nothing else; without, it polls PPU_STATUS for the sprite 0 hit and
+// for vblank.
+
+#define MACHINE_PPU_FRAMES 8
+
+static void machinePpuTables( uint8_t *nt, uint8_t *oam ) {
+    unsigned int i;
+
+    for ( i = 0; i < 256; i++ ) {
+        nt[i] = ( i % 32 == 16 || i % 32 == 17 ) ? 0 : 1 + ( i * 7 + i / 32 ) % 3;
+    }
+
+    // y, tile, attributes, x: the rest are below the picture
+    memset( oam, 0xf0, 256 );
+    memcpy( oam, (const uint8_t[]) {
+        100,  1, 0x00,  80,   // sprite 0 on an opaque tile
+         50,  2, 0x21, 128,   // behind, over the transparent columns
+         50,  3, 0x02, 160,
+         50,  1, 0x20,  40,   // behind an opaque tile
+        150,  1, 0x03, 200,   // in front of the next one
+        150,  2, 0x00, 204,
+    }, 24 );
+}
+
+static void machinePpuProgram( const int nmi ) {
+    uint8_t nt[ 256 ];
+    uint8_t oam[ 256 ];
+    uint16_t top;
+    uint16_t loop;
+    uint16_t handler;
+
+    memset( machinePrg, 0, sizeof machinePrg );
+    machinePicture();
+    machinePpuTables( nt, oam );
+    machineTable( MACHINE_NT0, nt, sizeof nt );
+    machineTable( MACHINE_OAM, oam, sizeof oam );
+
+    machinePc = 0xe000;
+    machineReset();
+    machineOp1( OP_LDA_IMM, ( nmi ? PPU_CTRL_0__VBLANK_NMI_ENABLE : 0 ) | PPU_CTRL_0__SPRITE_PATTERN_TABLE );
+    machineOp2( OP_STA_ABS, PPU_CTRL_0 );
+    machineOp1( OP_LDA_IMM, 0x1e );
+    machineOp2( OP_STA_ABS, PPU_CTRL_1 );
+
+    top = machinePc;
+    if ( nmi ) {
+        machineOp2( OP_JMP, top );
+    } else {
+        loop = machinePc;
+        machineOp2( OP_BIT_ABS, PPU_STATUS );
+        machineBranch( OP_BVS, loop );
+        loop = machinePc;
+        machineOp2( OP_BIT_ABS, PPU_STATUS );
+        machineBranch( OP_BVC, loop );
+        machineOp2( OP_BIT_ABS, MACHINE_MARK( MACHINE_MARK__HIT ) );
+        loop = machinePc;
+        machineOp2( OP_BIT_ABS, PPU_STATUS );
+        machineBranch( OP_BPL, loop );
+        machineOp2( OP_BIT_ABS, MACHINE_MARK( MACHINE_MARK__VBLANK ) );
+        machineOp2( OP_JMP, top );
+    }
+
+    handler = machinePc;
+    machineOp2( OP_BIT_ABS, MACHINE_MARK( MACHINE_MARK__NMI ) );
+    machineByte( OP_RTI );
+
+    machineVectors( handler, 0xe000, handler );
+}
+
+// the palette RAM index of a pixel of the picture: the first opaque
+// sprite pixel in OAM order unless it is behind an opaque background
+
+static uint8_t machinePpuPixel( const uint8_t *nt, const uint8_t *oam, const unsigned int x, const unsigned int y ) {
+    const uint8_t *s;
+    unsigned int tile;
+    unsigned int attr;
+    unsigned int bit;
+    unsigned int bg;
+    unsigned int sp;
+    unsigned int i;
+
+    // the nametable is nt over and over, its last 64 bytes the attributes
+    tile = nt[ ( y / 8 * 32 + x / 8 ) % 256 ];
+    attr = nt[ 192 + y / 32 * 8 + x / 32 ];
+    attr = ( attr >> ( ( y & 16 ) / 4 + ( x & 16 ) / 8 ) ) & 3;
+    bit = 7 - x % 8;
+    bg = ( ( machineChr[ tile * 16 + y % 8 ] >> bit ) & 1 ) | ( ( ( machineChr[ tile * 16 + 8 + y % 8 ] >> bit ) & 1 ) << 1 );
+
+    for ( i = 0; i < PPU_SPRITES; i++ ) {
+        s = oam + i * 4;
+        if ( y < s[0] + 1u || y >= s[0] + 9u || x < s[3] || x >= s[3] + 8u ) {
+            continue;
+        }
+        bit = 7 - ( x - s[3] );
+        tile = s[1] * 16 + ( y - s[0] - 1 );
+        sp = ( ( machineChr[ tile ] >> bit ) & 1 ) | ( ( ( machineChr[ tile + 8 ] >> bit ) & 1 ) << 1 );
+        if ( sp == 0 ) {
+            continue;
+        }
+        if ( ( s[2] & 0x20 ) && bg ) {
+            break;
+        }
+        return machinePalette[ 16 + ( s[2] & 3 ) * 4 + sp ];
+    }
+    return bg ? machinePalette[ attr * 4 + bg ] : machinePalette[0];
+}
+
+// the mark's cycle in the given frame must be on line, from dot on but
+// no more than cycles later
+
+static unsigned int machinePpuMark( const char *test, const struct machineRun *r, const unsigned int kind,
+                                    const uint64_t frame, const unsigned int line, const unsigned int dot, const unsigned int cycles ) {
+    const uint64_t at = ( frame * NES_FRAME_DOTS + line * NES_DOTS_PER_SCANLINE + dot + 2 ) / 3;
+    unsigned int i;
+
+    for ( i = 0; i < r->marks[ kind ]; i++ ) {
+        if ( r->mark[ kind ][i] >= at && r->mark[ kind ][i] <= at + cycles ) {
+            return 0;
+        }
+    }
+    printf( "%s: no %s at line %u dot %u of frame %" PRIu64 "\n", test, machineMarkNames[ kind ], line, dot, frame );
+    for ( i = 0; i < r->marks[ kind ]; i++ ) {
+        printf( "  %" PRIu64 "\n", r->mark[ kind ][i] );
+    }
+    return 1;
+}
+
+static unsigned int machineTestPpu( const char *test ) {
+    static const unsigned int lockstep[] = { 0, NES_LOCKSTEP__CPU | NES_LOCKSTEP__DRAW };
+    uint8_t nt[ 256 ];
+    uint8_t oam[ 256 ];
+    struct nesRom rom;
+    unsigned int fails = 0;
+    unsigned int wrong;
+    unsigned int x;
+    unsigned int y;
+    unsigned int i;
+    uint64_t f;
+
+    machinePpuTables( nt, oam );
+    machineRom( &rom, 0 );
+
+    for ( i = 0; i < sizeof lockstep / sizeof lockstep[0]; i++ ) {
+        machinePpuProgram( 0 );
+        machineRun( &machineA, &rom, CPU_6502_ENGINE__FAST, lockstep[i], MACHINE_PPU_FRAMES );
+
+        wrong = 0;
+        for ( y = 0; y < PPU_FRAME_HEIGHT; y++ ) {
+            for ( x = 0; x < PPU_FRAME_WIDTH; x++ ) {
+                if ( machineA.m.ppu.frame[y][x] != machinePpuPixel( nt, oam, x, y ) && wrong++ == 0 ) {
+                    printf( "%s: pixel %u,%u is %02x, not %02x\n", test, x, y, machineA.m.ppu.frame[y][x], machinePpuPixel( nt, oam, x, y ) );
+                }
+            }
+        }
+        fails += wrong != 0;
+
+        // sprite 0 hits as its first line is drawn, at dot 256, and
+        // vblank starts at dot 1 of line 241. The flag is seen by the
+        // BIT reading after it, one BIT and branch later at the most,
+        // then the mark after the branch not taken and the next BIT.
+        for ( f = 4; f < MACHINE_PPU_FRAMES; f++ ) {
+            fails += machinePpuMark( test, &machineA, MACHINE_MARK__HIT, f, oam[0] + 1, NES_RENDER_DOT, 4 + 3 + 2 + 4 );
+            fails += machinePpuMark( test, &machineA, MACHINE_MARK__VBLANK, f, NES_VBLANK_DOT / NES_DOTS_PER_SCANLINE,
+                                     NES_VBLANK_DOT % NES_DOTS_PER_SCANLINE, 4 + 3 + 2 + 4 );
+        }
+        nesMachineDestroy( &machineA.m );
+
+        // the NMI is taken once the JMP it interrupts is done, then the
+        // handler's first read
+        machinePpuProgram( 1 );
+        machineRun( &machineA, &rom, CPU_6502_ENGINE__FAST, lockstep[i], MACHINE_PPU_FRAMES );
+        for ( f = 4; f < MACHINE_PPU_FRAMES; f++ ) {
+            fails += machinePpuMark( test, &machineA, MACHINE_MARK__NMI, f, NES_VBLANK_DOT / NES_DOTS_PER_SCANLINE,
+                                     NES_VBLANK_DOT % NES_DOTS_PER_SCANLINE, 3 + 7 + 4 );
+        }
+        nesMachineDestroy( &machineA.m );
+    }
+    return fails;
+}
+
+// DRAWING
+//
+// the lazy program again, its frames drawn a line at a time and in the
+// passes its scroll writes split them into
+
+static unsigned int machineTestDraw( const char *test ) {
+    struct nesRom rom;
+    unsigned int fails = 0;
+
+    machineLazyProgram();
+    machineRom( &rom, 4 );
+
+    machineRun( &machineA, &rom, CPU_6502_ENGINE__FAST, 0, MACHINE_FRAMES );
+    machineRun( &machineB, &rom, CPU_6502_ENGINE__FAST, NES_LOCKSTEP__DRAW, MACHINE_FRAMES );
+    fails += machineCompare( test, &machineA, &machineB );
+    if ( memcmp( machineA.m.ppu.frame, machineB.m.ppu.frame, sizeof machineA.m.ppu.frame ) ) {
+        fails += machineFail( test, "last frame differs" );
+    }
+    if ( machineA.m.split == NES_VISIBLE_SCANLINES ) {
+        fails += machineFail( test, "the frame was drawn in one pass" );
+    }
+    nesMachineDestroy( &machineA.m );
+    nesMachineDestroy( &machineB.m );
+    return fails;
+}
+
+// TESTS
+
+struct machineTest {
+    const char *name;
+    unsigned int (*run)( const char *test );  // failures
+};
+
+static const struct machineTest machineTests[] = {
+    { "lazy", machineTestLazy },
+    { "mmc3", machineTestMmc3 },
+    { "draw", machineTestDraw },
+    { "ppu", machineTestPpu },
+};
+
+#define MACHINE_TESTS ( sizeof machineTests / sizeof machineTests[0] )
+
+int main( int argc, char *argv[] ) {
+    const struct machineTest *t;
+    unsigned int fails;
+    unsigned int total = 0;
+    unsigned int i;
+    int j;
+
+    for ( i = 0; i < MACHINE_TESTS; i++ ) {
+        t = &machineTests[i];
+        for ( j = 1; j < argc && strcmp( argv[j], t->name ); j++ ) {
+        }
+        if ( argc > 1 && j == argc ) {
+            continue;
+        }
+
+        fails = t->run( t->name );
+        printf( "%-8s %u failed\n", t->name, fails );
+        total += fails;
+    }
+
+    return total != 0;
+}
@@ -1,37 +1,68 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "6502.h"
 #include "nesmem.h"
+#include "6502trace.h"
+#include "6502tracelog.h"
 
 int main(int argc, char *argv[]) {
 
     int i; int r; int c; int n;
-    int initial_steps;
+    uint64_t initial_cycles;
     struct nesMemoryMap testMM;
+    struct nesRom rom;
     struct cpu6502 cpu = {0};
-    cpu6502Signal sig = 0;
+    struct nesTrace trace;
+    struct cpu6502Trace execTrace;
+    int execLog = 0;
+    FILE *f;
 
-    nesMemoryMapTestInit( &testMM );
-    r = nesMemLoadINES( &testMM, argv[1] );
+    r = nesRomLoad( &rom, argv[1] );
 
     if (r<0) {
         exit(-r);
     }
 
-    initial_steps = atoi(argv[2]);
+    nesMemoryMapTestInit( &testMM );
+    if ( nesMemInsert( &testMM, &rom ) < 0 ) {
+        fprintf( stderr, "mapper %u is not supported\n", rom.mapper );
+        exit(1);
+    }
+
+    initial_cycles = strtoull(argv[2],NULL,10);
 
     cpu6502Init(&cpu);
     cpu.mm = &testMM;
+    testMM.cpu = &cpu;
+
+    // emutest rom cycles [trace [exectrace]]: records handler traffic and
+    // saves it on quit, and every instruction into the second file as it
+    // runs, both for tracedump. An exectrace named *.tlog keeps the whole
+    // run compressed instead of the last records raw.
+    if ( argc > 3 ) {
+        if ( nesTraceInit( &trace, 20 ) < 0 ) {
+            exit(1);
+        }
+        testMM.trace = &trace;
+    }
+    if ( argc > 4 ) {
+        n = strlen( argv[4] );
+        execLog = n > 5 && !strcmp( argv[4] + n - 5, ".tlog" );
+        if ( ( execLog ? cpu6502TraceLogOpen( &execTrace, argv[4], 16 ) : cpu6502TraceOpen( &execTrace, argv[4], 22 ) ) < 0 ) {
+            fprintf( stderr, "cannot create %s\n", argv[4] );
+            exit(1);
+        }
+        cpu.trace = &execTrace;
+    }
     cpu.PC = 0x8000;
 
-    for (i=0;i<6;i++) printf("[ %04x = $%02" PRIx8 " ] ", 0xfffa + i , cpu.mm->mem[0xfffa + i]);
+    for (i=0;i<6;i++) printf("[ %04x = $%02" PRIx8 " ] ", 0xfffa + i , nesMemRead( cpu.mm, 0xfffa + i ));
 
     cpu6502PrintDebugInfo(&cpu);
 
-    for (i=0; i<initial_steps; i++) {
-        cpu6502Step(&cpu,sig);
-    }
+    cpu6502Run(&cpu,initial_cycles);
 
     while (1) {
 
@@ -39,48 +70,61 @@ int main(int argc, char *argv[]) {
         switch(c) {
             case '1':
                 n = 16;
-                sig = 0;
                 for (i=0; i<n; i++) {
-                    cpu6502Step(&cpu,sig);
+                    cpu6502Step(&cpu);
                     cpu6502PrintInstruction(&cpu);
                     cpu6502PrintDebugInfo(&cpu);
                 }
                 break;
             case '2':
                 n = 256;
-                sig = 0;
                 for (i=0; i<n; i++) {
-                    cpu6502Step(&cpu,sig);
+                    cpu6502Step(&cpu);
                     cpu6502PrintInstruction(&cpu);
                     cpu6502PrintDebugInfo(&cpu);
                 }
                 break;
             default:
                 n = 1;
-                sig = 0;
                 for (i=0; i<n; i++) {
-                    cpu6502Step(&cpu,sig);
+                    cpu6502Step(&cpu);
                     cpu6502PrintInstruction(&cpu);
                     cpu6502PrintDebugInfo(&cpu);
                 }
                 break;
             case 'i':
                 n = 1;
-                sig = CPU_6502_SIGNAL__NMI;
+                cpu6502Raise(&cpu,CPU_6502_SIGNAL__NMI);
                 for (i=0; i<n; i++) {
-                    cpu6502Step(&cpu,sig);
+                    cpu6502Step(&cpu);
                     cpu6502PrintInstruction(&cpu);
                     cpu6502PrintDebugInfo(&cpu);
                 }
                 break;
             case 'q':
+                if ( testMM.trace ) {
+                    f = fopen( argv[3], "wb" );
+                    if ( f == NULL || nesTraceSave( &trace, f ) < 0 ) {
+                        fprintf( stderr, "cannot write %s\n", argv[3] );
+                    }
+                    if ( f ) {
+                        fclose( f );
+                    }
+                }
+                if ( cpu.trace && execLog ) {
+                    if ( cpu6502TraceLogClose( &execTrace ) < 0 ) {
+                        fprintf( stderr, "cannot write %s\n", argv[4] );
+                    }
+                } else if ( cpu.trace ) {
+                    cpu6502TraceClose( &execTrace );
+                }
                 exit(0);
                 break;
             case 'n':
-                ppuMemDumpNameTable(0);
+                ppuMemDumpNameTable(cpu.mm,0);
                 break;
             case 'm':
-                ppuMemDumpNameTable(1);
+                ppuMemDumpNameTable(cpu.mm,1);
                 break;
             case 'z':
                 cpuMemDumpPage(cpu.mm,0);
@@ -91,6 +135,9 @@ int main(int argc, char *argv[]) {
             case 'x':
                 cpuMemDumpNonZero(cpu.mm);
                 break;
+            case 'f':
+                cpu6502PrintFusedCounts(&cpu);
+                break;
     
         }
     }
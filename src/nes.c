@@ -0,0 +1,352 @@
+#include <stddef.h>
+#include <string.h>
+#include "6502.h"
+#include "nesmem.h"
+#include "2c02.h"
+#include "nes.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x00000100000001b3ULL
+
+static void nesMachineSync( struct nesMemoryMap *mm, const uint16_t addr, const int write );
+
+// powers the console on with rom in the cartridge slot. NES_MEM_ERR__MAPPER
+// if the emulator does not have the cartridge's mapper.
+
+int nesMachineInit( struct nesMachine *m, const struct nesRom *rom, const unsigned int engine ) {
+    int r;
+
+    memset( &m->cpu, 0, sizeof m->cpu );
+    m->frame = 0;
+    m->event = 0;
+    m->a12 = 0;
+    m->drawn = 0;
+    m->split = NES_VISIBLE_SCANLINES;
+    m->lockstep = 0;
+
+    nesMemoryMapTestInit( &m->mm );
+    r = nesMemInsert( &m->mm, rom );
+    if ( r < 0 ) {
+        return r;
+    }
+
+    ppu2C02Init( &m->ppu, &m->mm );
+    m->mm.sync = &nesMachineSync;
+
+    cpu6502Init( &m->cpu );
+    m->cpu.mm = &m->mm;
+    m->mm.cpu = &m->cpu;
+    m->cpu.engine = engine;
+    cpu6502Raise( &m->cpu, CPU_6502_SIGNAL__RESET );
+    return 0;
+}
+
+void nesMachineDestroy( struct nesMachine *m ) {
+    cpu6502Destroy( &m->cpu );
+}
+
+// The dot of the scanline at which A12 rises, 0 if it does not. Rather
+// than watching every pattern fetch this follows from where the PPU
+// takes background and sprite patterns from: A12 goes high when the
+// fetches move to the $1000 table. The MMC3 ignores a rise that comes
+// within a few dots of the last fall, so with both in the same table
+// it never sees one.
+
+static unsigned int nesMachineA12Dot( struct nesMachine *m ) {
+    const uint8_t ctrl = m->mm.ppuReg[ PPU_CTRL_0 & 0x7 ];
+    const uint8_t mask = m->mm.ppuReg[ PPU_CTRL_1 & 0x7 ];
+
+    if ( !( mask & ( PPU_CTRL_1__SPRITE_VISIBILITY | PPU_CTRL_1__BG_VISIBILITY ) ) ) {
+        return 0;
+    }
+    // 8x16 sprites pick their table per tile, games put them at $1000
+    if ( ( ctrl & PPU_CTRL_0__SPRITE_SIZE ) ||
+         ( ( ctrl & PPU_CTRL_0__SPRITE_PATTERN_TABLE ) && !( ctrl & PPU_CTRL_0__BG_PATTERN_TABLE ) ) ) {
+        return NES_A12_DOT__SPRITES;
+    }
+    if ( ( ctrl & PPU_CTRL_0__BG_PATTERN_TABLE ) && !( ctrl & PPU_CTRL_0__SPRITE_PATTERN_TABLE ) ) {
+        return NES_A12_DOT__BACKGROUND;
+    }
+    return 0;
+}
+
+// PPU EVENTS
+//
+// Each scanline has four points at which the PPU can do something the
+// rest of the machine sees: a visible line is drawn, or on the two lines
+// that have them vblank starts or ends; A12 can rise for the sprite
+// patterns; the pre-render line reloads the scroll; A12 can rise for the
+// next line's background.
+//
+// The PPU lags behind the CPU and only takes its events when it has to.
+// Before the CPU touches the PPU's registers, OAM DMA or the cartridge's
+// registers, nesMachineSync brings it up to the CPU's clock. Drawing lags
+// further: the lines passed are only drawn then and at the end of the
+// picture, so a frame in which the CPU leaves the PPU alone while it draws
+// is drawn in one pass, and one with raster effects in a pass for each
+// stretch between them. The CPU
+// itself only stops at the events it has to see on time: vblank starting
+// and ending, a line whose drawing could set a status flag, the A12 rise
+// that raises the mapper's IRQ, and the end of the frame. A write that
+// could move one of those stops the CPU early to plan again. Everything
+// happens at the same cycles as it would stopping at every event.
+//
+// Tests check that against a machine in lockstep, which stops the CPU
+// after every instruction to bring the PPU up to date, or at every
+// visible line to draw it by itself.
+
+#define NES_EVENT__DRAW            0
+#define NES_EVENT__A12_SPRITES     1
+#define NES_EVENT__RELOAD          2
+#define NES_EVENT__A12_BACKGROUND  3
+
+#define NES_EVENT(LINE,KIND) ( (LINE) * NES_LINE_EVENTS + (KIND) )
+
+static const unsigned int nesEventDot[ NES_LINE_EVENTS ] = {
+    NES_RENDER_DOT, NES_A12_DOT__SPRITES, NES_RELOAD_DOT, NES_A12_DOT__BACKGROUND
+};
+
+// the CPU cycle the event falls in: it takes place once every instruction
+// that started before it has run
+
+static uint64_t nesMachineEventClk( const struct nesMachine *m, const unsigned int event ) {
+    const unsigned int line = event / NES_LINE_EVENTS;
+    unsigned int dot;
+
+    dot = nesEventDot[ event % NES_LINE_EVENTS ];
+    if ( event % NES_LINE_EVENTS == NES_EVENT__DRAW && line >= NES_VISIBLE_SCANLINES ) {
+        dot = 1;
+    }
+    return ( m->frame * NES_FRAME_DOTS + line * NES_DOTS_PER_SCANLINE + dot ) / 3;
+}
+
+// draws the visible lines whose rendering dot has passed
+
+static void nesMachineDraw( struct nesMachine *m ) {
+    unsigned int end;
+
+    end = ( m->event + NES_LINE_EVENTS - 1 ) / NES_LINE_EVENTS;
+    if ( end > NES_VISIBLE_SCANLINES ) {
+        end = NES_VISIBLE_SCANLINES;
+    }
+    ppu2C02Draw( &m->ppu, m->drawn, end );
+    m->drawn = end;
+}
+
+static void nesMachineEvent( struct nesMachine *m, const unsigned int event ) {
+    const unsigned int line = event / NES_LINE_EVENTS;
+    const int counter = m->mm.mapper && m->mm.mapper->scanline &&
+        ( line < NES_VISIBLE_SCANLINES || line == NES_PRERENDER_SCANLINE );
+
+    switch ( event % NES_LINE_EVENTS ) {
+        case NES_EVENT__DRAW:
+            if ( line == 0 ) {
+                m->split = NES_VISIBLE_SCANLINES;
+            } else if ( line == NES_VISIBLE_SCANLINES ) {
+                nesMachineDraw( m );
+            } else if ( line == NES_VBLANK_DOT / NES_DOTS_PER_SCANLINE ) {
+                ppu2C02VBlankStart( &m->mm );
+            } else if ( line == NES_PRERENDER_SCANLINE ) {
+                ppu2C02VBlankEnd( &m->mm );
+            }
+            break;
+        case NES_EVENT__A12_SPRITES:
+            m->a12 = counter && nesMachineA12Dot( m ) == NES_A12_DOT__SPRITES;
+            if ( m->a12 ) {
+                m->mm.mapper->scanline( &m->mm );
+            }
+            break;
+        case NES_EVENT__RELOAD:
+            if ( line == NES_PRERENDER_SCANLINE ) {
+                ppu2C02Reload( &m->mm );
+            }
+            break;
+        case NES_EVENT__A12_BACKGROUND:
+            if ( counter && !m->a12 && nesMachineA12Dot( m ) == NES_A12_DOT__BACKGROUND ) {
+                m->mm.mapper->scanline( &m->mm );
+            }
+            break;
+    }
+}
+
+// takes every event of the frame up to the CPU's clock
+
+static void nesMachineCatchUp( struct nesMachine *m ) {
+    while ( m->event < NES_FRAME_EVENTS && nesMachineEventClk( m, m->event ) <= m->cpu.clk ) {
+        nesMachineEvent( m, m->event );
+        m->event++;
+        if ( m->lockstep & NES_LOCKSTEP__DRAW ) {
+            nesMachineDraw( m );
+        }
+    }
+}
+
+// the event at which the A12 rise raising the mapper's IRQ comes, if it
+// does this frame, else NES_FRAME_EVENTS. With the registers as they are,
+// every rendered line has one rise, at the same dot.
+
+static unsigned int nesMachineIrqEvent( struct nesMachine *m ) {
+    unsigned int rises;
+    unsigned int kind;
+    unsigned int line;
+    unsigned int e;
+
+    if ( m->mm.mapper == NULL || m->mm.mapper->irqAfter == NULL ) {
+        return NES_FRAME_EVENTS;
+    }
+    rises = m->mm.mapper->irqAfter( &m->mm );
+    if ( rises == 0 ) {
+        return NES_FRAME_EVENTS;
+    }
+    switch ( nesMachineA12Dot( m ) ) {
+        case NES_A12_DOT__SPRITES:
+            kind = NES_EVENT__A12_SPRITES;
+            break;
+        case NES_A12_DOT__BACKGROUND:
+            kind = NES_EVENT__A12_BACKGROUND;
+            break;
+        default:
+            return NES_FRAME_EVENTS;
+    }
+
+    for ( line = m->event / NES_LINE_EVENTS; line <= NES_PRERENDER_SCANLINE; line++ ) {
+        if ( line >= NES_VISIBLE_SCANLINES && line != NES_PRERENDER_SCANLINE ) {
+            continue;
+        }
+        e = NES_EVENT( line, kind );
+        if ( e < m->event ) {
+            continue;
+        }
+        // the line's sprites took its rise already
+        if ( kind == NES_EVENT__A12_BACKGROUND && m->a12 && m->event > NES_EVENT( line, NES_EVENT__A12_SPRITES ) ) {
+            continue;
+        }
+        if ( --rises == 0 ) {
+            return e;
+        }
+    }
+    return NES_FRAME_EVENTS;
+}
+
+// the next event the CPU has to stop at, as a cycle; the end of the frame
+// if there is none
+
+static uint64_t nesMachineNextStop( struct nesMachine *m ) {
+    const unsigned int vblank = NES_EVENT( NES_VBLANK_DOT / NES_DOTS_PER_SCANLINE, NES_EVENT__DRAW );
+    const unsigned int prerender = NES_EVENT( NES_PRERENDER_SCANLINE, NES_EVENT__DRAW );
+    unsigned int stop = NES_FRAME_EVENTS;
+    unsigned int e;
+
+    if ( m->lockstep & NES_LOCKSTEP__CPU ) {
+        return m->cpu.clk + 1;
+    }
+
+    if ( m->event <= vblank ) {
+        stop = vblank;
+    } else if ( m->event <= prerender ) {
+        stop = prerender;
+    }
+
+    e = ppu2C02StatusLine( &m->mm, ( m->event + NES_LINE_EVENTS - 1 ) / NES_LINE_EVENTS );
+    if ( e < PPU_FRAME_HEIGHT && NES_EVENT( e, NES_EVENT__DRAW ) < stop ) {
+        stop = NES_EVENT( e, NES_EVENT__DRAW );
+    }
+
+    e = nesMachineIrqEvent( m );
+    if ( e < stop ) {
+        stop = e;
+    }
+
+    e = ( m->event + NES_LINE_EVENTS - 1 ) / NES_LINE_EVENTS;
+    if ( ( m->lockstep & NES_LOCKSTEP__DRAW ) && e < NES_VISIBLE_SCANLINES && NES_EVENT( e, NES_EVENT__DRAW ) < stop ) {
+        stop = NES_EVENT( e, NES_EVENT__DRAW );
+    }
+
+    if ( stop == NES_FRAME_EVENTS ) {
+        return ( ( m->frame + 1 ) * NES_FRAME_DOTS ) / 3;
+    }
+    return nesMachineEventClk( m, stop );
+}
+
+// mm->sync: the CPU is about to touch the PPU or the cartridge
+
+static void nesMachineSync( struct nesMemoryMap *mm, const uint16_t addr, const int write ) {
+    struct nesMachine *m = (struct nesMachine *) ( (char *) mm - offsetof( struct nesMachine, mm ) );
+
+    nesMachineCatchUp( m );
+
+    // whatever the CPU does next could show in the lines still to come, or
+    // depend on those already passed
+    if ( m->split == NES_VISIBLE_SCANLINES && m->event > NES_EVENT( 0, NES_EVENT__DRAW ) &&
+         m->event <= NES_EVENT( NES_VISIBLE_SCANLINES - 1, NES_EVENT__DRAW ) ) {
+        m->split = ( m->event + NES_LINE_EVENTS - 1 ) / NES_LINE_EVENTS;
+    }
+    nesMachineDraw( m );
+
+    // the sprite size, rendering, OAM and the mapper's registers decide
+    // where the CPU has to stop
+    if ( write && ( addr >= 0x8000 || addr == OAM_DMA ||
+                    ( addr & 0x7 ) == ( PPU_CTRL_0 & 0x7 ) ||
+                    ( addr & 0x7 ) == ( PPU_CTRL_1 & 0x7 ) ||
+                    ( addr & 0x7 ) == ( OAM_DATA & 0x7 ) ) ) {
+        cpu6502Raise( &m->cpu, CPU_6502_SIGNAL__STOP );
+    }
+}
+
+// runs one frame with the controllers held as given for all of it, drawing
+// it into m->ppu.frame. CPU_6502_STOP__BUDGET once the frame is complete,
+// otherwise why the CPU stopped early.
+
+int nesMachineRunFrame( struct nesMachine *m, const uint8_t pad1, const uint8_t pad2 ) {
+    const uint64_t end = ( ( m->frame + 1 ) * NES_FRAME_DOTS ) / 3;
+    uint64_t stop;
+    int r;
+
+    m->mm.pad[0] = pad1;
+    m->mm.pad[1] = pad2;
+
+    while ( m->event < NES_FRAME_EVENTS || m->cpu.clk < end ) {
+        stop = nesMachineNextStop( m );
+        if ( m->cpu.clk < stop ) {
+            r = cpu6502Run( &m->cpu, stop - m->cpu.clk );
+            if ( r != CPU_6502_STOP__BUDGET ) {
+                return r;
+            }
+        }
+        nesMachineCatchUp( m );
+    }
+
+    m->frame++;
+    m->event = 0;
+    m->drawn = 0;
+    return CPU_6502_STOP__BUDGET;
+}
+
+// FNV-1a of the 2KB work RAM, to compare runs by
+
+uint64_t nesMachineRamHash( struct nesMachine *m ) {
+    uint64_t h;
+    unsigned int i;
+
+    h = FNV_OFFSET;
+    for ( i = 0; i < NES_RAM_SIZE; i++ ) {
+        h = ( h ^ m->mm.ram[i] ) * FNV_PRIME;
+    }
+    return h;
+}
+
+// FNV-1a of the last frame drawn, palette indices as the PPU left them
+
+uint64_t nesMachineFrameHash( struct nesMachine *m ) {
+    uint64_t h;
+    unsigned int x;
+    unsigned int y;
+
+    h = FNV_OFFSET;
+    for ( y = 0; y < PPU_FRAME_HEIGHT; y++ ) {
+        for ( x = 0; x < PPU_FRAME_WIDTH; x++ ) {
+            h = ( h ^ m->ppu.frame[y][x] ) * FNV_PRIME;
+        }
+    }
+    return h;
+}
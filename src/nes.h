@@ -0,0 +1,63 @@
+#ifndef __NES_H
+#define __NES_H
+
+// One emulated console: a CPU, its memory map and the PPU drawing its
+// frames. Instances share nothing but the cartridge ROM.
+
+#include <stdint.h>
+#include "6502.h"
+#include "nesmem.h"
+#include "2c02.h"
+
+// NTSC: 262 scanlines of 341 PPU dots, three dots per CPU cycle
+
+#define NES_DOTS_PER_SCANLINE 341
+#define NES_FRAME_DOTS ( 262 * NES_DOTS_PER_SCANLINE )
+#define NES_VBLANK_DOT ( 241 * NES_DOTS_PER_SCANLINE + 1 )
+#define NES_VISIBLE_SCANLINES 240
+#define NES_PRERENDER_SCANLINE 261
+
+// dot of a visible scanline it is drawn at, all of it at once, and of the
+// pre-render scanline the scroll is reloaded at
+
+#define NES_RENDER_DOT 256
+#define NES_RELOAD_DOT 304
+
+// the PPU's events, a few per scanline, see nes.c
+
+#define NES_LINE_EVENTS  4
+#define NES_FRAME_EVENTS ( 262 * NES_LINE_EVENTS )
+
+// dots of a scanline at which PPU A12 can rise for a mapper to count:
+// when the sprite patterns are fetched, and when the next line's first
+// background tiles are
+
+#define NES_A12_DOT__SPRITES    260
+#define NES_A12_DOT__BACKGROUND 324
+
+// for tests: give up the lazy PPU for what it stands in for, see nes.c
+
+#define NES_LOCKSTEP__CPU  0x01  // the PPU catches up after every instruction
+#define NES_LOCKSTEP__DRAW 0x02  // each visible line is drawn on its own at its dot
+
+struct nesMachine {
+    struct cpu6502 cpu;
+    struct nesMemoryMap mm;
+    struct ppu2C02 ppu;
+    uint64_t frame;      // frames run since power on
+    unsigned int event;  // the PPU's next event in the frame
+    int a12;             // A12 rose for the sprites on the current line
+    unsigned int drawn;  // visible lines of the frame drawn so far
+    unsigned int split;  // lines drawn when the CPU first touched the PPU or
+                         // the cartridge mid picture this frame, splitting
+                         // the drawing; NES_VISIBLE_SCANLINES if it did not
+    unsigned int lockstep;  // NES_LOCKSTEP__* flags, 0 to run lazily
+};
+
+int nesMachineInit( struct nesMachine *m, const struct nesRom *rom, const unsigned int engine );
+void nesMachineDestroy( struct nesMachine *m );
+int nesMachineRunFrame( struct nesMachine *m, const uint8_t pad1, const uint8_t pad2 );
+uint64_t nesMachineRamHash( struct nesMachine *m );
+uint64_t nesMachineFrameHash( struct nesMachine *m );
+
+#endif /* __NES_H */
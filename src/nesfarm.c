@@ -0,0 +1,344 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "6502.h"
+#include "nes.h"
+#include "nesfarm.h"
+
+// Each worker thread owns one machine, allocated by the thread itself once
+// it is pinned so that it lands in memory local to that core, and reuses it
+// for every job it runs.
+//
+// A batch of jobs is split into one contiguous range of job indices per
+// worker. Workers take jobs from the front of their own range and, once it
+// is empty, steal the back half of another worker's. Both ends of a range
+// live in one word that is only ever changed by compare and swap, so taking
+// a job costs one atomic operation and no locks. A worker is done with the
+// batch when every range is empty; the batch is done when every worker is.
+
+#ifndef __GNUC__
+#error "nesfarm.c needs the GCC __atomic builtins"
+#endif
+
+#define FARM_CACHE_LINE 64
+
+#define RANGE(LO,HI)  ( ( (uint64_t) ( HI ) << 32 ) | ( LO ) )
+#define RANGE_LO(R)   ( (uint32_t) ( R ) )
+#define RANGE_HI(R)   ( (uint32_t) ( ( R ) >> 32 ) )
+
+struct nesFarmWorker {
+    uint64_t range;             // jobs [lo, hi) still queued here, see RANGE
+    struct nesFarm *farm;
+    pthread_t thread;
+    unsigned int id;
+    int cpu;                    // CPU to run on, -1 to leave it to the OS
+    unsigned int batch;         // last batch it took part in
+    struct nesMachine *machine;
+} __attribute__(( aligned( FARM_CACHE_LINE ) ));
+
+// JOBS
+
+static void farmJob( struct nesMachine *m, struct nesFarmJob *job ) {
+    unsigned int f;
+    uint8_t pad;
+    int r;
+
+    job->stop = CPU_6502_STOP__BUDGET;
+    job->framesRun = 0;
+    job->ramHash = 0;
+    job->frameHash = 0;
+    job->cycles = 0;
+
+    if ( job->rom == NULL ) {
+        job->status = NES_FARM_JOB__NO_ROM;
+        return;
+    }
+    if ( nesMachineInit( m, job->rom, job->engine ) < 0 ) {
+        job->status = NES_FARM_JOB__MAPPER;
+        return;
+    }
+
+    job->status = NES_FARM_JOB__DONE;
+    for ( f = 0; f < job->frames; f++ ) {
+        pad = ( job->input && f < job->inputFrames ) ? job->input[f] : 0;
+        r = nesMachineRunFrame( m, pad, 0 );
+        if ( r != CPU_6502_STOP__BUDGET ) {
+            job->status = NES_FARM_JOB__STOPPED;
+            job->stop = r;
+            break;
+        }
+        job->framesRun++;
+    }
+
+    job->ramHash = nesMachineRamHash( m );
+    job->frameHash = nesMachineFrameHash( m );
+    job->cycles = m->cpu.clk;
+    nesMachineDestroy( m );
+}
+
+// takes the next job of w's own range
+
+static int farmPop( struct nesFarmWorker *w, unsigned int *job ) {
+    uint64_t r;
+
+    r = __atomic_load_n( &w->range, __ATOMIC_ACQUIRE );
+    do {
+        if ( RANGE_LO( r ) >= RANGE_HI( r ) ) {
+            return 0;
+        }
+    } while ( !__atomic_compare_exchange_n( &w->range, &r, RANGE( RANGE_LO( r ) + 1, RANGE_HI( r ) ),
+                                            1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) );
+
+    *job = RANGE_LO( r );
+    return 1;
+}
+
+// moves the back half of another worker's range to w, whose own is empty
+// so that nobody else changes it meanwhile
+
+static int farmSteal( struct nesFarm *farm, struct nesFarmWorker *w ) {
+    struct nesFarmWorker *v;
+    unsigned int k;
+    uint32_t half;
+    uint64_t r;
+
+    for ( k = 1; k < farm->workers; k++ ) {
+        v = &farm->worker[ ( w->id + k ) % farm->workers ];
+        r = __atomic_load_n( &v->range, __ATOMIC_ACQUIRE );
+        while ( RANGE_LO( r ) < RANGE_HI( r ) ) {
+            half = ( RANGE_HI( r ) - RANGE_LO( r ) + 1 ) / 2;
+            if ( __atomic_compare_exchange_n( &v->range, &r, RANGE( RANGE_LO( r ), RANGE_HI( r ) - half ),
+                                              1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) ) {
+                __atomic_store_n( &w->range, RANGE( RANGE_HI( r ) - half, RANGE_HI( r ) ), __ATOMIC_RELEASE );
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// WORKERS
+
+static void farmPin( struct nesFarmWorker *w ) {
+#ifdef __linux__
+    cpu_set_t set;
+
+    if ( w->cpu < 0 ) {
+        return;
+    }
+    CPU_ZERO( &set );
+    CPU_SET( w->cpu, &set );
+    // best effort, an unpinned worker still works
+    pthread_setaffinity_np( pthread_self(), sizeof set, &set );
+#else
+    (void) w;
+#endif
+}
+
+static void * farmWorker( void *arg ) {
+    struct nesFarmWorker *w = arg;
+    struct nesFarm *farm = w->farm;
+    struct nesFarmJob *jobs;
+    unsigned int job;
+
+    farmPin( w );
+
+    w->machine = malloc( sizeof( struct nesMachine ) );
+    if ( w->machine ) {
+        memset( w->machine, 0, sizeof( struct nesMachine ) );
+    }
+
+    pthread_mutex_lock( &farm->lock );
+    if ( --farm->busy == 0 ) {
+        pthread_cond_signal( &farm->done );
+    }
+
+    while ( 1 ) {
+
+        while ( !farm->quit && w->batch == farm->batch ) {
+            pthread_cond_wait( &farm->start, &farm->lock );
+        }
+        if ( farm->quit ) {
+            break;
+        }
+        w->batch = farm->batch;
+        jobs = farm->jobs;
+        pthread_mutex_unlock( &farm->lock );
+
+        do {
+            while ( farmPop( w, &job ) ) {
+                farmJob( w->machine, &jobs[job] );
+            }
+        } while ( farmSteal( farm, w ) );
+
+        pthread_mutex_lock( &farm->lock );
+        if ( --farm->busy == 0 ) {
+            pthread_cond_signal( &farm->done );
+        }
+
+    }
+
+    pthread_mutex_unlock( &farm->lock );
+
+    free( w->machine );
+    w->machine = NULL;
+    return NULL;
+}
+
+// the CPU worker i runs on: the i-th of those this process may use
+
+static int farmCpu( const unsigned int i ) {
+#ifdef __linux__
+    cpu_set_t set;
+    unsigned int n;
+    int c;
+
+    if ( sched_getaffinity( 0, sizeof set, &set ) || CPU_COUNT( &set ) == 0 ) {
+        return -1;
+    }
+    n = i % CPU_COUNT( &set );
+    for ( c = 0; c < CPU_SETSIZE; c++ ) {
+        if ( CPU_ISSET( c, &set ) && n-- == 0 ) {
+            return c;
+        }
+    }
+#else
+    (void) i;
+#endif
+    return -1;
+}
+
+// SETUP
+
+static void farmStop( struct nesFarm *farm, const unsigned int started ) {
+    unsigned int i;
+
+    pthread_mutex_lock( &farm->lock );
+    farm->quit = 1;
+    pthread_cond_broadcast( &farm->start );
+    pthread_mutex_unlock( &farm->lock );
+
+    for ( i = 0; i < started; i++ ) {
+        pthread_join( farm->worker[i].thread, NULL );
+    }
+}
+
+// starts the given number of workers, one per online CPU for 0, each on a
+// CPU of its own if pin is set. Returns 0, or -1 if threads or memory ran
+// out.
+
+int nesFarmInit( struct nesFarm *farm, const unsigned int workers, const int pin ) {
+
+    struct nesFarmWorker *w;
+    unsigned int i;
+    long n;
+    int ok;
+
+    memset( farm, 0, sizeof( struct nesFarm ) );
+
+    farm->workers = workers;
+    if ( farm->workers == 0 ) {
+        n = sysconf( _SC_NPROCESSORS_ONLN );
+        farm->workers = ( n > 0 ) ? n : 1;
+    }
+
+    if ( posix_memalign( (void **) &farm->worker, FARM_CACHE_LINE, farm->workers * sizeof( struct nesFarmWorker ) ) ) {
+        return -1;
+    }
+    memset( farm->worker, 0, farm->workers * sizeof( struct nesFarmWorker ) );
+
+    pthread_mutex_init( &farm->lock, NULL );
+    pthread_cond_init( &farm->start, NULL );
+    pthread_cond_init( &farm->done, NULL );
+
+    // workers count themselves off once their machine is allocated
+    farm->busy = farm->workers;
+
+    for ( i = 0; i < farm->workers; i++ ) {
+        w = &farm->worker[i];
+        w->farm = farm;
+        w->id = i;
+        w->cpu = pin ? farmCpu( i ) : -1;
+        if ( pthread_create( &w->thread, NULL, farmWorker, w ) ) {
+            pthread_mutex_lock( &farm->lock );
+            farm->busy -= farm->workers - i;
+            pthread_mutex_unlock( &farm->lock );
+            farmStop( farm, i );
+            nesFarmDestroy( farm );
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock( &farm->lock );
+    while ( farm->busy ) {
+        pthread_cond_wait( &farm->done, &farm->lock );
+    }
+    pthread_mutex_unlock( &farm->lock );
+
+    ok = 1;
+    for ( i = 0; i < farm->workers; i++ ) {
+        ok &= ( farm->worker[i].machine != NULL );
+    }
+    if ( !ok ) {
+        nesFarmDestroy( farm );
+        return -1;
+    }
+
+    return 0;
+
+}
+
+void nesFarmDestroy( struct nesFarm *farm ) {
+
+    if ( farm->worker == NULL ) {
+        return;
+    }
+    if ( !farm->quit ) {
+        farmStop( farm, farm->workers );
+    }
+
+    pthread_cond_destroy( &farm->done );
+    pthread_cond_destroy( &farm->start );
+    pthread_mutex_destroy( &farm->lock );
+    free( farm->worker );
+    memset( farm, 0, sizeof( struct nesFarm ) );
+
+}
+
+// RUN
+
+// runs every job and returns once they have all finished. Jobs only share
+// their ROMs, and finish in no particular order.
+
+void nesFarmRun( struct nesFarm *farm, struct nesFarmJob *jobs, const unsigned int count ) {
+    struct nesFarmWorker *w;
+    unsigned int i;
+
+    if ( count == 0 ) {
+        return;
+    }
+
+    pthread_mutex_lock( &farm->lock );
+
+    for ( i = 0; i < farm->workers; i++ ) {
+        w = &farm->worker[i];
+        __atomic_store_n( &w->range, RANGE( (uint64_t) count * i / farm->workers,
+                                            (uint64_t) count * ( i + 1 ) / farm->workers ), __ATOMIC_RELAXED );
+    }
+
+    farm->jobs = jobs;
+    farm->busy = farm->workers;
+    farm->batch++;
+    pthread_cond_broadcast( &farm->start );
+
+    while ( farm->busy ) {
+        pthread_cond_wait( &farm->done, &farm->lock );
+    }
+
+    pthread_mutex_unlock( &farm->lock );
+}
@@ -0,0 +1,59 @@
+#ifndef __NESFARM_H
+#define __NESFARM_H
+
+// Runs batches of independent emulator jobs on a pool of worker threads.
+// See nesfarm.c.
+
+#include <stdint.h>
+#include <pthread.h>
+#include "nesmem.h"
+
+// JOB STATUS
+
+#define NES_FARM_JOB__DONE      0  // ran all its frames
+#define NES_FARM_JOB__NO_ROM    1  // no ROM was given
+#define NES_FARM_JOB__STOPPED   2  // the CPU stopped early, see stop
+#define NES_FARM_JOB__MAPPER    3  // the ROM's mapper is not supported
+
+struct nesFarmJob {
+
+    // filled in by the caller
+    const struct nesRom *rom;  // cartridge, shared with any other jobs
+    const uint8_t *input;      // controller 1 buttons per frame, NULL for none
+    unsigned int inputFrames;  // entries in input, none are pressed after them
+    unsigned int frames;       // frames to run
+    unsigned int engine;       // CPU_6502_ENGINE__*
+
+    // results
+    int status;                // NES_FARM_JOB__*
+    int stop;                  // CPU_6502_STOP__* when stopped early
+    unsigned int framesRun;
+    uint64_t ramHash;          // nesMachineRamHash after the last frame
+    uint64_t frameHash;        // nesMachineFrameHash of the last frame
+    uint64_t cycles;           // CPU cycles run
+
+};
+
+struct nesFarmWorker;
+
+struct nesFarm {
+
+    struct nesFarmWorker *worker;
+    unsigned int workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;      // a batch was posted, or quit
+    pthread_cond_t done;       // busy dropped to 0
+
+    struct nesFarmJob *jobs;   // the batch being run
+    unsigned int batch;        // bumped for every batch posted
+    unsigned int busy;         // workers starting up or still in the batch
+    int quit;
+
+};
+
+int nesFarmInit( struct nesFarm *farm, const unsigned int workers, const int pin );
+void nesFarmDestroy( struct nesFarm *farm );
+void nesFarmRun( struct nesFarm *farm, struct nesFarmJob *jobs, const unsigned int count );
+
+#endif /* __NESFARM_H */
@@ -0,0 +1,358 @@
+#include <stddef.h>
+#include <string.h>
+#include "6502.h"
+#include "nesmem.h"
+#include "nesmapper.h"
+
+// Each mapper keeps its registers in mm->mapperState and, whenever one of
+// them changes, maps every bank again from all of them. That is a fixed
+// number of page table entries no matter how large the ROM is, and
+// entries that already point where they should are left alone, so
+// rewriting a bank register with the same value costs the CPU nothing.
+
+#define PRG_BANK_8K   0x2000
+#define PRG_BANK_16K  0x4000
+#define PRG_BANK_32K  0x8000
+
+// BANKS
+
+// number of size byte PRG banks, at least one even if the ROM is smaller
+
+static unsigned int mapperPrgBanks( struct nesMemoryMap *mm, const unsigned int size ) {
+    unsigned int n = mm->rom->prgSize / size;
+    return n ? n : 1;
+}
+
+// maps PRG bank number bank, counting in size byte banks, at addr
+
+static void mapperPrg( struct nesMemoryMap *mm, const uint16_t addr, const unsigned int size, const unsigned int bank ) {
+    const struct nesRom *rom = mm->rom;
+    unsigned int offset;
+    unsigned int len;
+
+    offset = ( bank % mapperPrgBanks( mm, size ) ) * size;
+    len = ( rom->prgSize < size ) ? rom->prgSize : size;
+
+    // ROM is never written through, the write pages stay NULL
+    nesMemMapPages( mm, addr, size, (uint8_t *) rom->prg + offset, NULL, len );
+}
+
+// maps CHR bank number bank, counting in banks of count 1KB pages, at
+// PPU page page. Carts without CHR ROM bank their CHR RAM.
+
+static void mapperChr( struct nesMemoryMap *mm, const unsigned int page, const unsigned int count, const unsigned int bank ) {
+    const struct nesRom *rom = mm->rom;
+    uint8_t *base;
+    unsigned int size;
+    unsigned int offset;
+    unsigned int i;
+
+    base = rom->chr ? (uint8_t *) rom->chr : mm->chrRam;
+    size = rom->chr ? rom->chrSize : NES_CHR_RAM_SIZE;
+
+    for ( i = 0; i < count; i++ ) {
+        offset = ( ( bank * count + i ) * NES_PPU_PAGE_SIZE ) % size;
+        mm->chrPage[ page + i ] = base + offset;
+        mm->chrWrite[ page + i ] = rom->chr ? NULL : base + offset;
+    }
+}
+
+// drives the cartridge's IRQ line, which stays asserted until the
+// mapper is acknowledged
+
+static void mapperIrq( struct nesMemoryMap *mm, const int asserted ) {
+    if ( mm->cpu == NULL ) {
+        return;
+    }
+    if ( asserted ) {
+        cpu6502Raise( mm->cpu, CPU_6502_SIGNAL__IRQ );
+    } else {
+        cpu6502Release( mm->cpu, CPU_6502_SIGNAL__IRQ );
+    }
+}
+
+// NROM (0): 16 or 32KB PRG, 8KB CHR, no registers
+
+static void nromReset( struct nesMemoryMap *mm ) {
+    (void) mm;
+}
+
+static void nromApply( struct nesMemoryMap *mm ) {
+    mapperPrg( mm, 0x8000, PRG_BANK_32K, 0 );
+    mapperChr( mm, 0, 8, 0 );
+    nesMemMirror( mm, mm->rom->mirroring );
+}
+
+static void nromWrite( struct nesMemoryMap *mm, const uint16_t addr, const uint8_t data ) {
+    (void) mm;
+    (void) addr;
+    (void) data;
+}
+
+// UxROM (2): switchable 16KB at $8000, last bank fixed at $C000
+
+static void uxromApply( struct nesMemoryMap *mm ) {
+    mapperPrg( mm, 0x8000, PRG_BANK_16K, mm->mapperState.reg[0] );
+    mapperPrg( mm, 0xc000, PRG_BANK_16K, mapperPrgBanks( mm, PRG_BANK_16K ) - 1 );
+    mapperChr( mm, 0, 8, 0 );
+    nesMemMirror( mm, mm->rom->mirroring );
+}
+
+static void uxromWrite( struct nesMemoryMap *mm, const uint16_t addr, const uint8_t data ) {
+    (void) addr;
+    mm->mapperState.reg[0] = data;
+    uxromApply( mm );
+}
+
+// CNROM (3): fixed PRG, switchable 8KB CHR
+
+static void cnromApply( struct nesMemoryMap *mm ) {
+    mapperPrg( mm, 0x8000, PRG_BANK_32K, 0 );
+    mapperChr( mm, 0, 8, mm->mapperState.reg[0] );
+    nesMemMirror( mm, mm->rom->mirroring );
+}
+
+static void cnromWrite( struct nesMemoryMap *mm, const uint16_t addr, const uint8_t data ) {
+    (void) addr;
+    mm->mapperState.reg[0] = data;
+    cnromApply( mm );
+}
+
+// MMC1 (1): registers are loaded one bit per write, five writes each.
+// reg[0] and reg[1] are the CHR banks, reg[2] the PRG bank.
+
+#define MMC1_CONTROL__MIRRORING  0x03
+#define MMC1_CONTROL__PRG_MODE   0x0c
+#define MMC1_CONTROL__CHR_4K     0x10
+
+#define MMC1_PRG_MODE__32K       0x00  // and 0x04
+#define MMC1_PRG_MODE__FIX_FIRST 0x08  // $8000 fixed, $C000 switched
+#define MMC1_PRG_MODE__FIX_LAST  0x0c  // $8000 switched, $C000 fixed
+
+static void mmc1Reset( struct nesMemoryMap *mm ) {
+    mm->mapperState.control = MMC1_PRG_MODE__FIX_LAST;
+}
+
+static void mmc1Apply( struct nesMemoryMap *mm ) {
+    static const unsigned int mirroring[4] = {
+        NES_MIRROR__SINGLE_LOWER, NES_MIRROR__SINGLE_UPPER, NES_MIRROR__VERTICAL, NES_MIRROR__HORIZONTAL
+    };
+    struct nesMapperState *s = &mm->mapperState;
+    unsigned int prg;
+
+    prg = s->reg[2] & 0x0f;
+
+    switch ( s->control & MMC1_CONTROL__PRG_MODE ) {
+        case MMC1_PRG_MODE__FIX_FIRST:
+            mapperPrg( mm, 0x8000, PRG_BANK_16K, 0 );
+            mapperPrg( mm, 0xc000, PRG_BANK_16K, prg );
+            break;
+        case MMC1_PRG_MODE__FIX_LAST:
+            mapperPrg( mm, 0x8000, PRG_BANK_16K, prg );
+            mapperPrg( mm, 0xc000, PRG_BANK_16K, mapperPrgBanks( mm, PRG_BANK_16K ) - 1 );
+            break;
+        default:
+            mapperPrg( mm, 0x8000, PRG_BANK_32K, prg >> 1 );
+            break;
+    }
+
+    if ( s->control & MMC1_CONTROL__CHR_4K ) {
+        mapperChr( mm, 0, 4, s->reg[0] );
+        mapperChr( mm, 4, 4, s->reg[1] );
+    } else {
+        mapperChr( mm, 0, 8, s->reg[0] >> 1 );
+    }
+
+    nesMemMirror( mm, mirroring[ s->control & MMC1_CONTROL__MIRRORING ] );
+}
+
+static void mmc1Write( struct nesMemoryMap *mm, const uint16_t addr, const uint8_t data ) {
+    struct nesMapperState *s = &mm->mapperState;
+
+    if ( data & 0x80 ) {
+        s->shift = 0;
+        s->shiftCount = 0;
+        s->control |= MMC1_PRG_MODE__FIX_LAST;
+        mmc1Apply( mm );
+        return;
+    }
+
+    s->shift |= ( data & 1 ) << s->shiftCount;
+    if ( ++s->shiftCount < 5 ) {
+        return;
+    }
+
+    // the fifth write picks the register by its address
+    switch ( addr & 0x6000 ) {
+        case 0x0000:
+            s->control = s->shift;
+            break;
+        case 0x2000:
+            s->reg[0] = s->shift;
+            break;
+        case 0x4000:
+            s->reg[1] = s->shift;
+            break;
+        case 0x6000:
+            s->reg[2] = s->shift;
+            break;
+    }
+    s->shift = 0;
+    s->shiftCount = 0;
+    mmc1Apply( mm );
+}
+
+// MMC3 (4): eight bank registers written through a select / data pair.
+// reg[0] and reg[1] are 2KB CHR banks, reg[2] to reg[5] 1KB CHR banks,
+// reg[6] and reg[7] 8KB PRG banks. The IRQ counter counts A12 rises,
+// one per rendered scanline with the usual pattern table setup.
+
+#define MMC3_SELECT__REG        0x07
+#define MMC3_SELECT__PRG_SWAP   0x40  // reg[6] at $C000, second last bank at $8000
+#define MMC3_SELECT__CHR_INVERT 0x80  // 2KB banks at $1000, 1KB banks at $0000
+
+#define MMC3_PRG_RAM__PROTECT   0x40  // writes to $6000-$7FFF are ignored
+#define MMC3_PRG_RAM__ENABLE    0x80  // $6000-$7FFF is open bus without it
+
+static void mmc3Reset( struct nesMemoryMap *mm ) {
+    struct nesMapperState *s = &mm->mapperState;
+
+    s->reg[0] = 0;
+    s->reg[1] = 2;
+    s->reg[2] = 4;
+    s->reg[3] = 5;
+    s->reg[4] = 6;
+    s->reg[5] = 7;
+    s->reg[6] = 0;
+    s->reg[7] = 1;
+    s->mirroring = ( mm->rom->mirroring == NES_MIRROR__VERTICAL ) ? 0 : 1;
+    // games that never write $A001 expect their RAM to be there
+    s->prgRamProtect = MMC3_PRG_RAM__ENABLE;
+}
+
+static void mmc3Apply( struct nesMemoryMap *mm ) {
+    struct nesMapperState *s = &mm->mapperState;
+    unsigned int last;
+    unsigned int lo;
+    unsigned int hi;
+
+    last = mapperPrgBanks( mm, PRG_BANK_8K ) - 1;
+
+    if ( s->control & MMC3_SELECT__PRG_SWAP ) {
+        mapperPrg( mm, 0x8000, PRG_BANK_8K, last - 1 );
+        mapperPrg( mm, 0xc000, PRG_BANK_8K, s->reg[6] );
+    } else {
+        mapperPrg( mm, 0x8000, PRG_BANK_8K, s->reg[6] );
+        mapperPrg( mm, 0xc000, PRG_BANK_8K, last - 1 );
+    }
+    mapperPrg( mm, 0xa000, PRG_BANK_8K, s->reg[7] );
+    mapperPrg( mm, 0xe000, PRG_BANK_8K, last );
+
+    // 1KB pages of the 2KB and of the 1KB banks
+    lo = ( s->control & MMC3_SELECT__CHR_INVERT ) ? 4 : 0;
+    hi = 4 - lo;
+    mapperChr( mm, lo + 0, 2, s->reg[0] >> 1 );
+    mapperChr( mm, lo + 2, 2, s->reg[1] >> 1 );
+    mapperChr( mm, hi + 0, 1, s->reg[2] );
+    mapperChr( mm, hi + 1, 1, s->reg[3] );
+    mapperChr( mm, hi + 2, 1, s->reg[4] );
+    mapperChr( mm, hi + 3, 1, s->reg[5] );
+
+    nesMemMirror( mm, ( s->mirroring & 1 ) ? NES_MIRROR__HORIZONTAL : NES_MIRROR__VERTICAL );
+
+    // a NULL page reads as open bus and drops writes
+    if ( !( s->prgRamProtect & MMC3_PRG_RAM__ENABLE ) ) {
+        nesMemMapPages( mm, 0x6000, 0x2000, NULL, NULL, NES_PRG_RAM_SIZE );
+    } else if ( s->prgRamProtect & MMC3_PRG_RAM__PROTECT ) {
+        nesMemMapPages( mm, 0x6000, 0x2000, mm->prgRam, NULL, NES_PRG_RAM_SIZE );
+    } else {
+        nesMemMapPages( mm, 0x6000, 0x2000, mm->prgRam, mm->prgRam, NES_PRG_RAM_SIZE );
+    }
+}
+
+static void mmc3Write( struct nesMemoryMap *mm, const uint16_t addr, const uint8_t data ) {
+    struct nesMapperState *s = &mm->mapperState;
+
+    // four register pairs, told apart by A13-A14 and A0
+    switch ( ( addr & 0x6000 ) | ( addr & 1 ) ) {
+        case 0x0000:
+            s->control = data;
+            break;
+        case 0x0001:
+            s->reg[ s->control & MMC3_SELECT__REG ] = data;
+            break;
+        case 0x2000:
+            s->mirroring = data;
+            break;
+        case 0x2001:
+            s->prgRamProtect = data;
+            break;
+        case 0x4000:
+            s->irqLatch = data;
+            return;
+        case 0x4001:
+            s->irqReload = 1;
+            return;
+        case 0x6000:
+            // disabling also acknowledges
+            s->irqEnabled = 0;
+            mapperIrq( mm, 0 );
+            return;
+        case 0x6001:
+            s->irqEnabled = 1;
+            return;
+    }
+    mmc3Apply( mm );
+}
+
+static void mmc3Scanline( struct nesMemoryMap *mm ) {
+    struct nesMapperState *s = &mm->mapperState;
+
+    if ( s->irqCounter == 0 || s->irqReload ) {
+        s->irqCounter = s->irqLatch;
+        s->irqReload = 0;
+    } else {
+        s->irqCounter--;
+    }
+
+    if ( s->irqCounter == 0 && s->irqEnabled ) {
+        mapperIrq( mm, 1 );
+    }
+}
+
+// a reload takes a call of its own before the count down starts
+
+static unsigned int mmc3IrqAfter( const struct nesMemoryMap *mm ) {
+    const struct nesMapperState *s = &mm->mapperState;
+
+    if ( !s->irqEnabled ) {
+        return 0;
+    }
+    if ( s->irqCounter == 0 || s->irqReload ) {
+        return 1 + s->irqLatch;
+    }
+    return s->irqCounter;
+}
+
+// MAPPERS
+
+static const struct nesMapper mappers[] = {
+    { 0, "NROM",  nromReset, nromApply,  nromWrite,  NULL,         NULL         },
+    { 1, "MMC1",  mmc1Reset, mmc1Apply,  mmc1Write,  NULL,         NULL         },
+    { 2, "UxROM", nromReset, uxromApply, uxromWrite, NULL,         NULL         },
+    { 3, "CNROM", nromReset, cnromApply, cnromWrite, NULL,         NULL         },
+    { 4, "MMC3",  mmc3Reset, mmc3Apply,  mmc3Write,  mmc3Scanline, mmc3IrqAfter },
+};
+
+// NULL for a mapper that is not supported
+
+const struct nesMapper * nesMapperFind( const unsigned int number ) {
+    unsigned int i;
+
+    for ( i = 0; i < sizeof mappers / sizeof mappers[0]; i++ ) {
+        if ( mappers[i].number == number ) {
+            return &mappers[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,47 @@
+#ifndef __NESMAPPER_H
+#define __NESMAPPER_H
+
+// Cartridge mappers. A mapper only keeps its registers; switching a bank
+// points entries of the memory map's CPU and PPU page tables at another
+// part of the ROM, nothing is copied. See nesmapper.c.
+
+#include <stdint.h>
+
+struct nesMemoryMap;
+
+// register file of whichever mapper the cartridge has, part of the
+// machine state
+
+struct nesMapperState {
+    uint8_t reg[8];       // bank registers, numbered as the mapper does
+    uint8_t control;      // MMC1 control, MMC3 bank select
+    uint8_t shift;        // MMC1 serial port
+    uint8_t shiftCount;
+    uint8_t mirroring;    // MMC3 nametable mirroring
+    uint8_t prgRamProtect; // MMC3 $A001, PRG RAM enable and write protect
+    uint8_t irqLatch;     // MMC3 scanline counter
+    uint8_t irqCounter;
+    uint8_t irqReload;
+    uint8_t irqEnabled;
+};
+
+struct nesMapper {
+    unsigned int number;  // iNES mapper number
+    const char *name;
+    // registers at power on
+    void (*reset)( struct nesMemoryMap *mm );
+    // points the page tables at the banks the registers select
+    void (*apply)( struct nesMemoryMap *mm );
+    // a CPU write to $8000-$FFFF
+    void (*write)( struct nesMemoryMap *mm, const uint16_t addr, const uint8_t data );
+    // a PPU A12 rise the mapper would see, about once per rendered
+    // scanline. NULL if the mapper does not watch A12.
+    void (*scanline)( struct nesMemoryMap *mm );
+    // scanline calls until the mapper raises its IRQ, 0 if it will not
+    // before another register write. NULL with scanline.
+    unsigned int (*irqAfter)( const struct nesMemoryMap *mm );
+};
+
+const struct nesMapper * nesMapperFind( const unsigned int number );
+
+#endif /* __NESMAPPER_H */
@@ -1,213 +1,432 @@
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include "6502.h"
 #include "nesmem.h"
+#include "nestrace.h"
 #include "2c02.h"
 
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #define INES_HEADER_SIZE 16
+#define INES_TRAINER_SIZE 512
 #define PRG_ROM_BANK_SIZE 16384 // 16KB 
 #define CHR_ROM_BANK_SIZE 8192 // 8KB
 
-#define PPU_ADDR_STATE_HI 0
-#define PPU_ADDR_STATE_LO 1
-
-#define DEBUG
-
-uint8_t ppuMem[0x10000] = {0};
-
-void ppuMemWrite( const uint16_t addr , const uint8_t data );
-
-void nesMemDebugFindRegionName(const uint16_t addr, char *name ) {
-
-    if (addr==PPU_CTRL_0) {
-        strcpy(name,"PPU_CTRL_0");
-    } else if (addr==PPU_CTRL_1) {
-        strcpy(name,"PPU_CTRL_1");
-    } else if (addr==PPU_STATUS) {
-        strcpy(name,"PPU_STATUS");
-    } else if (addr==OAM_ADDR) {
-        strcpy(name,"OAM_ADDR");
-    } else if (addr==OAM_DATA) {
-        strcpy(name,"OAM_DATA");
-    } else if (addr==PPU_SCROLL) {
-        strcpy(name,"PPU_SCROLL");
-    } else if (addr==PPU_ADDR) {
-        strcpy(name,"PPU_ADDR");
-    } else if (addr==PPU_DATA) {
-        strcpy(name,"PPU_DATA");
-    } else if (addr==OAM_DMA) {
-        strcpy(name,"OAM_DMA");
-    } else {
-        strcpy(name,"OTHER");
-    }
-    
-}
+#define INES_FLAGS6__VERTICAL 0x01
+#define INES_FLAGS6__BATTERY  0x02
+#define INES_FLAGS6__TRAINER  0x04
 
-uint8_t testRead( struct nesMemoryMap * mm,  const uint16_t addr ) {
-    uint8_t data;
+// the eight PPU registers repeat every 8 bytes up to $3FFF
 
-// #ifdef DEBUG
+#define PPU_REG_MIRROR(A) ( ( (A) >= 0x2000 && (A) < 0x4000 ) ? ( 0x2000 | ( (A) & 0x7 ) ) : (A) )
 
-//     char rnm[32]; 
-//     nesMemDebugFindRegionName( addr, rnm );
+// the buttons come out one per read, A first, then 1s once all eight are
+// read. While the strobe is high the shift register keeps reloading.
 
-//     printf("R $%" PRIx16 " (%s)\n",addr,rnm);
+static uint8_t nesMemReadPad( struct nesMemoryMap *mm, const unsigned int n ) {
+    uint8_t bit;
 
-// #endif
+    if ( mm->padStrobe ) {
+        mm->padShift[n] = mm->pad[n];
+    }
+    bit = mm->padShift[n] & 1;
+    mm->padShift[n] = ( mm->padShift[n] >> 1 ) | 0x80;
+    // open bus leaves the upper address byte in the top bits
+    return 0x40 | bit;
+}
+
+uint8_t testRead( struct nesMemoryMap * mm,  uint16_t addr ) {
+    uint8_t data;
 
-    data = mm->mem[addr];
+    if ( addr == NES_PAD_1 || addr == NES_PAD_2 ) {
+        data = nesMemReadPad( mm, addr - NES_PAD_1 );
+        NES_TRACE_EVENT( mm, NES_TRACE__CPU_READ, addr, data );
+        return data;
+    }
+
+    if ( addr < 0x4000 ) {
+        if ( mm->sync ) {
+            mm->sync( mm, addr, 0 );
+        }
+        data = ppu2C02Read( mm, addr );
+    } else if ( addr < 0x4020 ) {
+        data = mm->io[ addr - 0x4000 ];
+    } else {
+        // nothing answers: open bus, the last byte fetched was the high
+        // byte of the address
+        data = addr >> 8;
+    }
+    NES_TRACE_EVENT( mm, NES_TRACE__CPU_READ, addr, data );
     return data;
 }
 
-void testWrite( struct nesMemoryMap * mm, const uint16_t addr, const uint8_t data ) {
+// the status register's flags only change with vblank starting or ending
+// and sprite 0 hit or overflow being drawn, which the machine makes CPU
+// stops. Only the first read between them has an effect: it clears vblank
+// and the address latch, and any after it return the same.
 
-    static int ppu_addr_st = PPU_ADDR_STATE_LO;
-    static uint16_t ppu_addr = 0x0;
-    static uint16_t ppu_addr_inc = 0;
-
-#ifdef DEBUG
+int testQuiet( struct nesMemoryMap * mm, uint16_t addr ) {
+    (void) mm;
+    return PPU_REG_MIRROR( addr ) == PPU_STATUS;
+}
 
-    char rnm[32]; 
-    nesMemDebugFindRegionName( addr, rnm );
+void testWrite( struct nesMemoryMap * mm, uint16_t addr, const uint8_t data ) {
 
-    printf("W $%" PRIx16 " (%s)\n",addr,rnm);
+    NES_TRACE_EVENT( mm, NES_TRACE__CPU_WRITE, PPU_REG_MIRROR( addr ), data );
 
-#endif
+    if ( mm->sync && ( addr >= 0x8000 || addr < 0x4000 || addr == OAM_DMA ) ) {
+        mm->sync( mm, addr, 1 );
+    }
 
-    if ( addr == PPU_ADDR ) {
-        printf("(PPU_ADDR)");
-        ppu_addr_st = !ppu_addr_st;
-        if ( ppu_addr_st == PPU_ADDR_STATE_LO ) {
-            printf("(LO)");
-            ppu_addr |= ( uint16_t ) data;
-            ppu_addr_inc = 0;
-
-        } else {
-            printf("(HI)");
-            ppu_addr = ( ( ( uint16_t ) data ) << 8 );
+    if ( addr >= 0x8000 ) {
+        // PRG ROM is read only, writes to it talk to the mapper
+        if ( mm->mapper ) {
+            mm->mapper->write( mm, addr, data );
         }
-    } else if ( addr == PPU_DATA ) {
-        printf("(PPU_DATA)");
-        printf("PPU_CTRL_0: $%02" PRIx8, mm->mem[PPU_CTRL_0] );
-        if ( ppu_addr_st == PPU_ADDR_STATE_LO ) {
-            ppuMemWrite( ppu_addr + ppu_addr_inc , data );
+        return;
+    }
+
+    if ( addr == NES_PAD_1 ) {
+        mm->padStrobe = data & 1;
+        if ( mm->padStrobe ) {
+            mm->padShift[0] = mm->pad[0];
+            mm->padShift[1] = mm->pad[1];
         }
-        ppu_addr_inc++;
     }
 
-    mm->mem[addr] = data;
+    if ( addr < 0x4000 ) {
+        ppu2C02Write( mm, addr, data );
+    } else if ( addr < 0x4020 ) {
+        mm->io[ addr - 0x4000 ] = data;
+        if ( addr == OAM_DMA ) {
+            ppu2C02Dma( mm, data );
+        }
+    }
     return;
 
 }
 
 
-int nesMemLoadINES( struct nesMemoryMap * mm, const char * fname ) {
+// ROM LOADING
 
-    FILE *fp;
-    int r,i;
-    uint8_t header[INES_HEADER_SIZE];
+#ifdef __unix__
 
-    fp = fopen(fname,"r");
+static int nesRomMap( struct nesRom *rom, const char *fname ) {
+    struct stat st;
+    void *p;
+    int fd;
 
-    if (fp==NULL) {
+    fd = open( fname, O_RDONLY );
+    if ( fd < 0 ) {
         return -1;
     }
+    if ( fstat( fd, &st ) || st.st_size == 0 ) {
+        close( fd );
+        return -1;
+    }
+    p = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if ( p == MAP_FAILED ) {
+        return -1;
+    }
+
+    rom->image = p;
+    rom->imageSize = st.st_size;
+    return 0;
+}
 
+static void nesRomUnmap( struct nesRom *rom ) {
+    munmap( (void *) rom->image, rom->imageSize );
+}
 
+#else
 
-    r = fread(header,INES_HEADER_SIZE,1,fp);
+// without mmap the file is read into memory once, still shared by every
+// machine
 
-    if (r!=1) {
-        return -2;
+static int nesRomMap( struct nesRom *rom, const char *fname ) {
+    FILE *fp;
+    uint8_t *p;
+    long size;
+
+    fp = fopen( fname, "rb" );
+    if ( fp == NULL ) {
+        return -1;
     }
+    if ( fseek( fp, 0, SEEK_END ) || ( size = ftell( fp ) ) <= 0 || fseek( fp, 0, SEEK_SET ) ) {
+        fclose( fp );
+        return -1;
+    }
+    p = malloc( size );
+    if ( p == NULL || fread( p, size, 1, fp ) != 1 ) {
+        free( p );
+        fclose( fp );
+        return -1;
+    }
+    fclose( fp );
 
-    if ( header[0]!='N' || header[1]!='E' || header[2]!='S' || header[3]!=0x1A ) {
-        return -3;
+    rom->image = p;
+    rom->imageSize = size;
+    return 0;
+}
+
+static void nesRomUnmap( struct nesRom *rom ) {
+    free( (void *) rom->image );
+}
+
+#endif
+
+// maps an iNES file and finds the PRG and CHR ROM in it. 0, or one of
+// NES_ROM_ERR__*.
+
+int nesRomLoad( struct nesRom *rom, const char *fname ) {
+
+    const uint8_t *header;
+    size_t trainer;
+    size_t need;
+
+    memset( rom, 0, sizeof( struct nesRom ) );
+
+    if ( nesRomMap( rom, fname ) ) {
+        return NES_ROM_ERR__OPEN;
     }
 
-    for(i=0;i<2;i++) {
-        r = fread( (mm->mem)+0x8000 + i*PRG_ROM_BANK_SIZE , PRG_ROM_BANK_SIZE, 1,fp);
-        if (r!=1) {
-            return (-3 - i); 
-        }
+    header = rom->image;
+
+    if ( rom->imageSize < INES_HEADER_SIZE ) {
+        nesRomFree( rom );
+        return NES_ROM_ERR__HEADER;
+    }
+    if ( header[0]!='N' || header[1]!='E' || header[2]!='S' || header[3]!=0x1A || header[4] == 0 ) {
+        nesRomFree( rom );
+        return NES_ROM_ERR__FORMAT;
     }
 
-    r = fread( ppuMem, CHR_ROM_BANK_SIZE, 1, fp);
+    trainer = ( header[6] & INES_FLAGS6__TRAINER ) ? INES_TRAINER_SIZE : 0;
+    rom->prgSize = header[4] * PRG_ROM_BANK_SIZE;
+    rom->chrSize = header[5] * CHR_ROM_BANK_SIZE;
 
-    if (r!=1) {
-        return (-3 - i);
+    need = INES_HEADER_SIZE + trainer + rom->prgSize + rom->chrSize;
+    if ( rom->imageSize < need ) {
+        nesRomFree( rom );
+        return NES_ROM_ERR__SIZE;
     }
 
+    rom->trainer = trainer ? header + INES_HEADER_SIZE : NULL;
+    rom->prg = header + INES_HEADER_SIZE + trainer;
+    rom->chr = rom->chrSize ? rom->prg + rom->prgSize : NULL;
+
+    rom->mirroring = ( header[6] & INES_FLAGS6__VERTICAL ) ? NES_MIRROR__VERTICAL : NES_MIRROR__HORIZONTAL;
+    rom->battery = !!( header[6] & INES_FLAGS6__BATTERY );
+    rom->mapper = header[6] >> 4;
+
+    // old dumping tools left text in bytes 7-15, the upper mapper nibble
+    // is only good if those are clear or the header is NES 2.0
+    if ( ( header[7] & 0x0c ) == 0x08 ||
+         !( header[12] | header[13] | header[14] | header[15] ) ) {
+        rom->mapper |= header[7] & 0xf0;
+    }
+
+    return 0;
+
 }
 
+void nesRomFree( struct nesRom *rom ) {
+    if ( rom->image ) {
+        nesRomUnmap( rom );
+    }
+    memset( rom, 0, sizeof( struct nesRom ) );
+}
 
 
-void nesMemoryMapTestInit(struct nesMemoryMap * mm) {
 
-    memset(mm->mem,0, (sizeof mm->mem) );
-    mm->mem[0x2002] = 0x80;
+// points size bytes at addr at rd / wr, repeating every len bytes. The
+// epoch only moves if an entry really changed: mappers map all their banks
+// again on every register write, and the CPU drops the code it decoded
+// from a page whenever the epoch moves.
+
+void nesMemMapPages( struct nesMemoryMap *mm, const uint16_t addr, const unsigned int size, uint8_t *rd, uint8_t *wr, const unsigned int len ) {
+    unsigned int p;
+    unsigned int offset;
+    uint8_t *r;
+    uint8_t *w;
+    int changed = 0;
+
+    for ( p = 0; p < size / NES_MEM_PAGE_SIZE; p++ ) {
+        offset = ( p * NES_MEM_PAGE_SIZE ) % len;
+        r = rd ? rd + offset : NULL;
+        w = wr ? wr + offset : NULL;
+        if ( mm->readPage[ ( addr >> 8 ) + p ] != r || mm->writePage[ ( addr >> 8 ) + p ] != w ) {
+            mm->readPage[ ( addr >> 8 ) + p ] = r;
+            mm->writePage[ ( addr >> 8 ) + p ] = w;
+            changed = 1;
+        }
+    }
+
+    if ( changed ) {
+        mm->epoch++;
+    }
+}
+
+// an empty console: RAM and registers cleared, no cartridge inserted
+
+void nesMemoryMapTestInit(struct nesMemoryMap * mm) {
+    unsigned int i;
+
+    memset( mm, 0, NES_MEM_STATE_SIZE );
+    // nesMemMapPages compares against the page tables and bumps the epoch,
+    // and the map may be fresh off the stack
+    memset( mm->readPage, 0, sizeof mm->readPage );
+    memset( mm->writePage, 0, sizeof mm->writePage );
+    memset( mm->chrPage, 0, sizeof mm->chrPage );
+    memset( mm->ntPage, 0, sizeof mm->ntPage );
+    mm->epoch = 0;
+    mm->rom = NULL;
+    mm->mapper = NULL;
+    mm->cpu = NULL;
+    mm->trace = NULL;
     mm->read = &testRead;
     mm->write = &testWrite;
+    mm->quiet = &testQuiet;
+    mm->sync = NULL;
+
+    // 2KB internal RAM mirrored up to $1FFF
+    nesMemMapPages( mm, 0x0000, 0x2000, mm->ram, mm->ram, NES_RAM_SIZE );
+    // PPU and APU / IO registers and the unused expansion area go through
+    // the handlers
+    nesMemMapPages( mm, 0x2000, 0x4000, NULL, NULL, 0x4000 );
+    // cartridge RAM
+    nesMemMapPages( mm, 0x6000, 0x2000, mm->prgRam, mm->prgRam, NES_PRG_RAM_SIZE );
+    // PRG ROM, left to the handler until a cartridge is inserted
+    nesMemMapPages( mm, 0x8000, 0x8000, NULL, NULL, 0x8000 );
+
+    for ( i = 0; i < NES_CHR_PAGES; i++ ) {
+        mm->chrPage[i] = mm->chrRam + i * NES_PPU_PAGE_SIZE;
+        mm->chrWrite[i] = mm->chrPage[i];
+        mm->chrDirty[i] = ~(uint64_t) 0;
+    }
+    nesMemMirror( mm, NES_MIRROR__HORIZONTAL );
 }
 
-void ppuMemWrite( const uint16_t addr , const uint8_t data ) {
-
-    char name[32];
-    int offset;
-
-    ppuMem[addr] = data;
-    
-
-#ifdef DEBUG
-    
-    if ( ( addr - PATTERN_TABLE_0 ) < PATTERN_TABLE_LENGTH ) {
-        offset = ( addr - PATTERN_TABLE_0 );
-        strcpy(name,"PATTERN_TABLE_0");
-    } else if ( ( addr - PATTERN_TABLE_1 ) < PATTERN_TABLE_LENGTH ) {
-        offset = ( addr - PATTERN_TABLE_1 );
-        strcpy(name,"PATTERN_TABLE_1");
-    } else if ( ( addr - NAME_TABLE_0 ) < NAME_TABLE_LENGTH ) {
-        offset = ( addr - NAME_TABLE_0 );
-        strcpy(name,"NAME_TABLE_0");
-    } else if ( ( addr - ATTR_TABLE_0 ) < ATTR_TABLE_LENGTH ) {
-        offset = ( addr - ATTR_TABLE_0 );
-        strcpy(name,"ATTR_TABLE_0");
-    } else if ( ( addr - NAME_TABLE_1 ) < NAME_TABLE_LENGTH ) {
-        offset = ( addr - NAME_TABLE_1 );
-        strcpy(name,"NAME_TABLE_1");
-    } else if ( ( addr - ATTR_TABLE_1 ) < ATTR_TABLE_LENGTH ) {
-        offset = ( addr - ATTR_TABLE_1 );
-        strcpy(name,"ATTR_TABLE_1");
-    } else if ( ( addr - NAME_TABLE_2 ) < NAME_TABLE_LENGTH ) {
-        offset = ( addr - NAME_TABLE_2 );
-        strcpy(name,"NAME_TABLE_2");
-    } else if ( ( addr - ATTR_TABLE_2 ) < ATTR_TABLE_LENGTH ) {
-        offset = ( addr - ATTR_TABLE_2 );
-        strcpy(name,"ATTR_TABLE_2");
-    } else if ( ( addr - NAME_TABLE_3 ) < NAME_TABLE_LENGTH ) {
-        offset = ( addr - NAME_TABLE_3 );
-        strcpy(name,"NAME_TABLE_3");
-    } else if ( ( addr - ATTR_TABLE_3 ) < ATTR_TABLE_LENGTH ) {
-        offset = ( addr - ATTR_TABLE_3 );
-        strcpy(name,"ATTR_TABLE_3");
-    } else if ( ( addr - IMAGE_PALETTE ) < PALETTE_LENGTH ) {
-        offset = ( addr - IMAGE_PALETTE );
-        strcpy(name,"IMAGE_PALETTE");
-    } else if ( ( addr - SPRITE_PALETTE ) < PALETTE_LENGTH ) {
-        offset = ( addr - SPRITE_PALETTE );
-        strcpy(name,"SPRITE_PALETTE"); 
-    } else {
-        offset = 0;
-        strcpy(name,"OTHER");
+// maps the cartridge's ROM in place, without copying it, in the banks its
+// mapper starts with
+
+nesMemErr nesMemInsert( struct nesMemoryMap *mm, const struct nesRom *rom ) {
+    const struct nesMapper *mapper;
+
+    mapper = nesMapperFind( rom->mapper );
+    if ( mapper == NULL ) {
+        return NES_MEM_ERR__MAPPER;
+    }
+
+    mm->rom = rom;
+    mm->mapper = mapper;
+
+    if ( rom->trainer ) {
+        memcpy( mm->prgRam + 0x1000, rom->trainer, INES_TRAINER_SIZE );
+    }
+
+    memset( &mm->mapperState, 0, sizeof mm->mapperState );
+    mapper->reset( mm );
+    mapper->apply( mm );
+    return 0;
+}
+
+// points the page tables at the banks the mapper registers select, after
+// the machine state was copied back in
+
+void nesMemRemap( struct nesMemoryMap *mm ) {
+    unsigned int i;
+
+    if ( mm->mapper ) {
+        mm->mapper->apply( mm );
+    }
+    // CHR RAM came back without being written
+    for ( i = 0; i < NES_CHR_PAGES; i++ ) {
+        mm->chrDirty[i] = ~(uint64_t) 0;
     }
+}
+
+void nesMemMirror( struct nesMemoryMap *mm, const unsigned int mirroring ) {
+    uint8_t *second = mm->vram + NES_PPU_PAGE_SIZE;
+
+    switch ( mirroring ) {
+        case NES_MIRROR__SINGLE_LOWER:
+            mm->ntPage[0] = mm->ntPage[1] = mm->ntPage[2] = mm->ntPage[3] = mm->vram;
+            break;
+        case NES_MIRROR__SINGLE_UPPER:
+            mm->ntPage[0] = mm->ntPage[1] = mm->ntPage[2] = mm->ntPage[3] = second;
+            break;
+        default:
+            mm->ntPage[0] = mm->vram;
+            mm->ntPage[1] = ( mirroring == NES_MIRROR__VERTICAL ) ? second : mm->vram;
+            mm->ntPage[2] = ( mirroring == NES_MIRROR__VERTICAL ) ? mm->vram : second;
+            mm->ntPage[3] = second;
+            break;
+    }
+}
+
+// where PPU address addr is kept, NULL for a write to ROM
 
-    printf("PPU MEM W: [$%02" PRIx16 "]=$%02" PRIx8 " %s + $%02x", addr, data, name, offset);
+static uint8_t * ppuMemAt( struct nesMemoryMap *mm, uint16_t addr, const int write ) {
+    uint8_t *page;
 
-#endif /* DEBUG */
+    addr &= 0x3fff;
 
+    if ( addr < 0x2000 ) {
+        page = write ? mm->chrWrite[ addr / NES_PPU_PAGE_SIZE ] : mm->chrPage[ addr / NES_PPU_PAGE_SIZE ];
+        return page ? page + ( addr % NES_PPU_PAGE_SIZE ) : NULL;
+    }
+    if ( addr < IMAGE_PALETTE ) {
+        return mm->ntPage[ ( addr / NES_PPU_PAGE_SIZE ) % NES_NT_PAGES ] + ( addr % NES_PPU_PAGE_SIZE );
+    }
+
+    addr &= NES_PALETTE_SIZE - 1;
+    // the sprite palettes share their first entry with the background's
+    if ( ( addr & 0x13 ) == 0x10 ) {
+        addr &= 0x0f;
+    }
+    return mm->palette + addr;
 }
 
-void ppuMemDumpNameTable(const int nt) {
+uint8_t ppuMemRead( struct nesMemoryMap *mm, uint16_t addr ) {
+    return *ppuMemAt( mm, addr, 0 );
+}
+
+void ppuMemWrite( struct nesMemoryMap *mm, uint16_t addr , const uint8_t data ) {
+    uint8_t *page;
+    uint8_t *at;
+    unsigned int i;
+
+    NES_TRACE_EVENT( mm, NES_TRACE__PPU_WRITE, addr, data );
+
+    at = ppuMemAt( mm, addr, 1 );
+    if ( at == NULL ) {
+        return;
+    }
+    *at = data;
+
+    // tell the PPU which tile changed, wherever the page is banked in
+    if ( ( addr & 0x3fff ) < 0x2000 ) {
+        page = mm->chrWrite[ ( addr & 0x3fff ) / NES_PPU_PAGE_SIZE ];
+        for ( i = 0; i < NES_CHR_PAGES; i++ ) {
+            if ( mm->chrPage[i] == page ) {
+                mm->chrDirty[i] |= (uint64_t) 1 << ( ( addr / 16 ) & 63 );
+            }
+        }
+    }
+}
+
+void ppuMemDumpNameTable( struct nesMemoryMap *mm, const int nt ) {
     int x,y;
     uint16_t base;
     uint8_t a;
@@ -215,22 +434,34 @@ void ppuMemDumpNameTable(const int nt) {
     base = NAME_TABLE_0 + 0x400*nt;
     for (y=0;y<30;y++) {
         for (x=0;x<32;x++) {
-            a = ppuMem[base + 32*y + x];
+            a = ppuMemRead( mm, base + 32*y + x );
             printf("%02" PRIx8 " ",a);
         }
         printf("\n");
     }
 }
 
+// the byte the CPU would read at addr, -1 where reading has side effects
+
+static int cpuMemPeek( struct nesMemoryMap *mm, const uint16_t addr ) {
+    uint8_t *page = mm->readPage[ addr >> 8 ];
+
+    return page ? page[ addr & 0xff ] : -1;
+}
+
 void cpuMemDumpPage( struct nesMemoryMap * mm, const int p) {
     int i,j;
-    uint8_t a;
+    int a;
 
     for(i=0;i<16;i++) {
         printf("$%02x ",i);
         for(j=0;j<16;j++) {
-            a = mm->mem[p + i*16 + j];
-            printf("%02" PRIx8 " ",a);
+            a = cpuMemPeek( mm, p + i*16 + j );
+            if ( a < 0 ) {
+                printf("-- ");
+            } else {
+                printf("%02x ",a);
+            }
         }
         printf("\n");
     }
@@ -238,11 +469,10 @@ void cpuMemDumpPage( struct nesMemoryMap * mm, const int p) {
 
 void cpuMemDumpNonZero( struct nesMemoryMap *mm ) {
     uint16_t i;
-    uint8_t v;
+    int v;
 
     for(i=0;i<0x8000;i++) {
-        v = mm->mem[i];
-        if( v != 0 ) printf("[$%04" PRIx16 "] = $%02" PRIx8 "\n", i,v);
+        v = cpuMemPeek( mm, i );
+        if( v > 0 ) printf("[$%04" PRIx16 "] = $%02x\n", i,v);
     }
 }
-
@@ -1,24 +1,179 @@
 #ifndef __NESMEM_H
 #define __NESMEM_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include "nesmapper.h"
+#include "nestrace.h"
+
+struct cpu6502;
 
 #define NES_MEM_SIZE 0x10000
+#define NES_MEM_PAGE_SIZE 0x100
+#define NES_MEM_PAGES ( NES_MEM_SIZE / NES_MEM_PAGE_SIZE )
+
+#define NES_PAD_1 0x4016
+#define NES_PAD_2 0x4017
 
 typedef int nesMemErr;
 
+// the parts of the machine that hold memory
+
+#define NES_RAM_SIZE      0x0800  // work RAM, mirrored up to $1FFF
+#define NES_VRAM_SIZE     0x0800  // two nametables
+#define NES_PALETTE_SIZE  0x20
+#define NES_OAM_SIZE      0x100   // sprite attributes
+#define NES_PRG_RAM_SIZE  0x2000  // cartridge RAM at $6000-$7FFF
+#define NES_CHR_RAM_SIZE  0x2000  // pattern tables of carts without CHR ROM
+
+// PPU pages: the pattern tables and nametables come in 1KB pieces that
+// cartridges can each point somewhere else
+
+#define NES_PPU_PAGE_SIZE 0x400
+#define NES_CHR_PAGES     8
+#define NES_NT_PAGES      4
+
+// NAMETABLE MIRRORING
+
+#define NES_MIRROR__HORIZONTAL  0  // $2000 = $2400, $2800 = $2C00
+#define NES_MIRROR__VERTICAL    1  // $2000 = $2800, $2400 = $2C00
+#define NES_MIRROR__SINGLE_LOWER 2  // all four are the first nametable
+#define NES_MIRROR__SINGLE_UPPER 3  // all four are the second nametable
+
+// CARTRIDGE ERRORS
+
+#define NES_MEM_ERR__MAPPER  ( -1 )  // the cartridge's mapper is not supported
+
+// ROM LOADER ERRORS
+
+#define NES_ROM_ERR__OPEN    ( -1 )  // the file cannot be read
+#define NES_ROM_ERR__HEADER  ( -2 )  // shorter than an iNES header
+#define NES_ROM_ERR__FORMAT  ( -3 )  // not an iNES file, or no PRG ROM
+#define NES_ROM_ERR__SIZE    ( -4 )  // shorter than its header says
+
+// A cartridge image. The file is mapped read only and PRG / CHR point
+// straight into it, so any number of machines can share one and only the
+// pages a game actually reads are ever loaded.
+
+struct nesRom {
+    const uint8_t *image;       // the whole file
+    size_t imageSize;
+    const uint8_t *prg;         // PRG ROM
+    unsigned int prgSize;
+    const uint8_t *chr;         // CHR ROM, NULL if the cart has CHR RAM
+    unsigned int chrSize;
+    const uint8_t *trainer;     // 512 bytes for $7000, NULL for none
+    unsigned int mapper;        // iNES mapper number
+    unsigned int mirroring;     // NES_MIRROR__*
+    int battery;                // PRG RAM is kept across power cycles
+};
+
+// Every CPU page is either backed directly by a pointer in readPage /
+// writePage or, when the entry is NULL, handled by the read / write
+// callbacks. Only the I/O pages ($2000-$401F) and writes to ROM should
+// need the callbacks.
+//
+// Everything a running game can change sits at the start of the struct,
+// about 5KB of console state and the mapper's registers followed by the
+// cartridge's RAM, and ROM is only pointed to. Saving the first bytes up
+// to NES_MEM_STATE_SIZE and copying them back into the same map, then
+// calling nesMemRemap to bring the banks in line, restores the machine's
+// memory.
+
 struct nesMemoryMap {
-    uint8_t mem[NES_MEM_SIZE];
+
+    // MACHINE STATE
+
+    uint8_t ram[NES_RAM_SIZE];
+    uint8_t vram[NES_VRAM_SIZE];
+    uint8_t palette[NES_PALETTE_SIZE];
+    uint8_t oam[NES_OAM_SIZE];
+    uint8_t ppuReg[8];     // PPU registers $2000-$2007 as last written
+    uint8_t io[0x20];      // APU and I/O registers $4000-$401F as last written
+
+    // the PPU's internal registers, see 2c02.c
+    uint16_t ppuV;         // VRAM address, and the scroll position while rendering
+    uint16_t ppuT;         // what ppuV reloads from: the scroll the game set
+    uint8_t ppuX;          // fine X scroll
+    uint8_t ppuW;          // the next PPU_SCROLL / PPU_ADDR write is the second
+    uint8_t ppuStatus;     // PPU_STATUS__* flags
+    uint8_t ppuBuffer;     // PPU_DATA read buffer
+    uint8_t ppuLatch;      // last byte written to any of them
+    uint8_t oamAddr;
+
+    // standard controllers on $4016 / $4017
+    uint8_t pad[2];       // buttons held: A, B, Select, Start, Up, Down, Left, Right from bit 0
+    uint8_t padShift[2];  // buttons not yet read out since the last strobe
+    uint8_t padStrobe;    // strobe bit last written to $4016
+
+    struct nesMapperState mapperState;
+
+    uint8_t prgRam[NES_PRG_RAM_SIZE];
+    uint8_t chrRam[NES_CHR_RAM_SIZE];
+
+    // MAPPING
+
+    const struct nesRom *rom;
+    const struct nesMapper *mapper;  // NULL while no cartridge is inserted
+    struct cpu6502 *cpu;             // the CPU on this bus, for the cartridge's IRQ line
+    struct nesTrace *trace;          // NULL unless handler traffic is being recorded
+    uint8_t *readPage[NES_MEM_PAGES];
+    uint8_t *writePage[NES_MEM_PAGES];
+    unsigned int epoch;  // bumped whenever the page tables change
+    uint8_t *chrPage[NES_CHR_PAGES];   // pattern tables
+    uint8_t *chrWrite[NES_CHR_PAGES];  // NULL where they are ROM
+    uint64_t chrDirty[NES_CHR_PAGES];  // tiles written since the PPU last looked, a bit per 16 bytes
+    uint8_t *ntPage[NES_NT_PAGES];     // nametables, $3000-$3EFF repeats them
+
     uint8_t (*read)( struct nesMemoryMap *, uint16_t );
     void (*write)( struct nesMemoryMap *, uint16_t, uint8_t );
+    // optional: nonzero if, until the CPU next stops, only the first read
+    // of addr through the callback has an effect and every read after it
+    // returns the same value, so that idle loops may poll it. Whatever
+    // else changes the value (for the PPU: vblank starting or ending,
+    // sprite 0 hit) has to be an event the CPU stops at.
+    int (*quiet)( struct nesMemoryMap *, uint16_t );
+    // optional: called by the callbacks before the CPU reads or, with
+    // write set, writes the PPU's registers, OAM_DMA or the cartridge's,
+    // for whatever draws the picture to catch up with the CPU first
+    void (*sync)( struct nesMemoryMap *, uint16_t, int );
+
 };
 
+#define NES_MEM_STATE_SIZE ( offsetof( struct nesMemoryMap, rom ) )
+
+static inline uint8_t nesMemRead( struct nesMemoryMap *mm, const uint16_t addr ) {
+    uint8_t *page = mm->readPage[ addr >> 8 ];
+    if ( page ) {
+        return page[ addr & 0xff ];
+    }
+    return mm->read( mm, addr );
+}
+
+static inline void nesMemWrite( struct nesMemoryMap *mm, const uint16_t addr, const uint8_t data ) {
+    uint8_t *page = mm->writePage[ addr >> 8 ];
+    if ( page ) {
+        page[ addr & 0xff ] = data;
+    } else {
+        mm->write( mm, addr, data );
+    }
+}
 
-int nesMemLoadINES( struct nesMemoryMap * mm, const char * fname );
+void nesMemMapPages( struct nesMemoryMap *mm, const uint16_t addr, const unsigned int size, uint8_t *rd, uint8_t *wr, const unsigned int len );
+
+
+int nesRomLoad( struct nesRom *rom, const char *fname );
+void nesRomFree( struct nesRom *rom );
 
 void nesMemoryMapTestInit( struct nesMemoryMap * mm);
+nesMemErr nesMemInsert( struct nesMemoryMap *mm, const struct nesRom *rom );
+void nesMemRemap( struct nesMemoryMap *mm );
+void nesMemMirror( struct nesMemoryMap *mm, const unsigned int mirroring );
+
+uint8_t ppuMemRead( struct nesMemoryMap *mm, uint16_t addr );
+void ppuMemWrite( struct nesMemoryMap *mm, uint16_t addr, const uint8_t data );
 
-void ppuMemDumpNameTable(const int nt);
+void ppuMemDumpNameTable( struct nesMemoryMap *mm, const int nt );
 
 void cpuMemDumpPage( struct nesMemoryMap *mm, const int p);
 
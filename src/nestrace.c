@@ -0,0 +1,138 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "nestrace.h"
+#include "2c02.h"
+
+// REGIONS
+//
+// only the decoder needs names, recording never looks them up
+
+struct traceRegion {
+    uint16_t base;
+    uint16_t length;
+    const char *name;
+};
+
+static const struct traceRegion cpuRegions[] = {
+    { PPU_CTRL_0, 1, "PPU_CTRL_0" },
+    { PPU_CTRL_1, 1, "PPU_CTRL_1" },
+    { PPU_STATUS, 1, "PPU_STATUS" },
+    { OAM_ADDR,   1, "OAM_ADDR"   },
+    { OAM_DATA,   1, "OAM_DATA"   },
+    { PPU_SCROLL, 1, "PPU_SCROLL" },
+    { PPU_ADDR,   1, "PPU_ADDR"   },
+    { PPU_DATA,   1, "PPU_DATA"   },
+    { OAM_DMA,    1, "OAM_DMA"    },
+    { 0x4016,     1, "PAD_1"      },
+    { 0x4017,     1, "PAD_2"      },
+    { 0x8000, 0x8000, "MAPPER"    },
+};
+
+static const struct traceRegion ppuRegions[] = {
+    { PATTERN_TABLE_0, PATTERN_TABLE_LENGTH, "PATTERN_TABLE_0" },
+    { PATTERN_TABLE_1, PATTERN_TABLE_LENGTH, "PATTERN_TABLE_1" },
+    { NAME_TABLE_0,    NAME_TABLE_LENGTH,    "NAME_TABLE_0"    },
+    { ATTR_TABLE_0,    ATTR_TABLE_LENGTH,    "ATTR_TABLE_0"    },
+    { NAME_TABLE_1,    NAME_TABLE_LENGTH,    "NAME_TABLE_1"    },
+    { ATTR_TABLE_1,    ATTR_TABLE_LENGTH,    "ATTR_TABLE_1"    },
+    { NAME_TABLE_2,    NAME_TABLE_LENGTH,    "NAME_TABLE_2"    },
+    { ATTR_TABLE_2,    ATTR_TABLE_LENGTH,    "ATTR_TABLE_2"    },
+    { NAME_TABLE_3,    NAME_TABLE_LENGTH,    "NAME_TABLE_3"    },
+    { ATTR_TABLE_3,    ATTR_TABLE_LENGTH,    "ATTR_TABLE_3"    },
+    { IMAGE_PALETTE,   PALETTE_LENGTH,       "IMAGE_PALETTE"   },
+    { SPRITE_PALETTE + PALETTE_LENGTH, PALETTE_LENGTH, "SPRITE_PALETTE" },
+};
+
+static const struct traceRegion * traceFindRegion( const struct traceRegion *r, const size_t n, const uint16_t addr ) {
+    size_t i;
+
+    for ( i = 0; i < n; i++ ) {
+        if ( (uint16_t) ( addr - r[i].base ) < r[i].length ) {
+            return &r[i];
+        }
+    }
+    return NULL;
+}
+
+// TRACES
+
+int nesTraceInit( struct nesTrace *t, const unsigned int order ) {
+    t->events = malloc( sizeof( struct nesTraceEvent ) << order );
+    if ( t->events == NULL ) {
+        return -1;
+    }
+    t->mask = ( 1u << order ) - 1;
+    t->head = 0;
+    t->total = 0;
+    return 0;
+}
+
+void nesTraceDestroy( struct nesTrace *t ) {
+    free( t->events );
+    t->events = NULL;
+}
+
+// writes the events still in the ring to f, oldest first
+
+int nesTraceSave( struct nesTrace *t, FILE *f ) {
+    struct nesTraceFileHeader h;
+    uint32_t size;
+    uint32_t first;
+    uint32_t n;
+
+    size = t->mask + 1;
+    n = ( t->total < size ) ? (uint32_t) t->total : size;
+    first = ( t->head - n ) & t->mask;
+
+    h.magic = NES_TRACE_MAGIC;
+    h.count = n;
+    if ( fwrite( &h, sizeof h, 1, f ) != 1 ) {
+        return -1;
+    }
+
+    // the ring may wrap once
+    if ( first + n > size ) {
+        if ( fwrite( t->events + first, sizeof( struct nesTraceEvent ), size - first, f ) != size - first ) {
+            return -1;
+        }
+        n -= size - first;
+        first = 0;
+    }
+    if ( fwrite( t->events + first, sizeof( struct nesTraceEvent ), n, f ) != n ) {
+        return -1;
+    }
+    return 0;
+}
+
+// one line per event
+
+void nesTracePrint( FILE *out, const struct nesTraceEvent *ev, const size_t n ) {
+    const struct traceRegion *r;
+    size_t i;
+
+    for ( i = 0; i < n; i++ ) {
+        fprintf( out, "%10" PRIu32 " ", ev[i].clk );
+
+        switch ( ev[i].type ) {
+            case NES_TRACE__CPU_READ:
+            case NES_TRACE__CPU_WRITE:
+                r = traceFindRegion( cpuRegions, sizeof cpuRegions / sizeof cpuRegions[0], ev[i].addr );
+                fprintf( out, "%c $%04" PRIX16 " = $%02" PRIX8 " (%s)\n",
+                    ( ev[i].type == NES_TRACE__CPU_READ ) ? 'R' : 'W',
+                    ev[i].addr, ev[i].data, r ? r->name : "OTHER" );
+                break;
+            case NES_TRACE__PPU_ADDR:
+                fprintf( out, "PPU_ADDR $%04" PRIX16 "\n", ev[i].addr );
+                break;
+            case NES_TRACE__PPU_WRITE:
+                r = traceFindRegion( ppuRegions, sizeof ppuRegions / sizeof ppuRegions[0], ev[i].addr );
+                fprintf( out, "PPU MEM W [$%04" PRIX16 "] = $%02" PRIX8 " %s + $%02" PRIX16 "\n",
+                    ev[i].addr, ev[i].data, r ? r->name : "OTHER", r ? (uint16_t) ( ev[i].addr - r->base ) : 0 );
+                break;
+            default:
+                fprintf( out, "? type %u $%04" PRIX16 " $%02" PRIX8 "\n", ev[i].type, ev[i].addr, ev[i].data );
+                break;
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef __NESTRACE_H
+#define __NESTRACE_H
+
+// Bus event tracing. A machine with a trace attached records what goes
+// through the memory map handlers as fixed size binary events in a ring
+// buffer; turning them into text is left to nesTracePrint, usually in
+// tracedump after the run.
+//
+// Building with NES_TRACE 0 compiles the hooks out. Otherwise a map
+// without a trace pays one never taken branch, and only in the handlers,
+// which the page tables keep off the hot path anyway.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef NES_TRACE
+#define NES_TRACE 1
+#endif
+
+// EVENTS
+
+#define NES_TRACE__CPU_READ   1  // handler read, addr / data as the CPU saw them
+#define NES_TRACE__CPU_WRITE  2  // handler write, including mapper writes
+#define NES_TRACE__PPU_ADDR   3  // PPU_ADDR latched a full address
+#define NES_TRACE__PPU_WRITE  4  // PPU memory written through PPU_DATA
+
+struct nesTraceEvent {
+    uint32_t clk;   // CPU cycle, low 32 bits
+    uint16_t addr;
+    uint8_t type;   // NES_TRACE__*
+    uint8_t data;
+};
+
+// the last 1 << order events of one machine
+
+struct nesTrace {
+    struct nesTraceEvent *events;
+    uint32_t mask;
+    uint32_t head;    // next slot, counting up forever
+    uint64_t total;   // events recorded since init
+};
+
+// trace files are a header followed by the events, oldest first
+
+#define NES_TRACE_MAGIC 0x4352544e  // "NTRC"
+
+struct nesTraceFileHeader {
+    uint32_t magic;
+    uint32_t count;
+};
+
+int nesTraceInit( struct nesTrace *t, const unsigned int order );
+void nesTraceDestroy( struct nesTrace *t );
+int nesTraceSave( struct nesTrace *t, FILE *f );
+void nesTracePrint( FILE *out, const struct nesTraceEvent *ev, const size_t n );
+
+static inline void nesTraceRecord( struct nesTrace *t, const uint64_t clk, const uint8_t type, const uint16_t addr, const uint8_t data ) {
+    struct nesTraceEvent *e = &t->events[ t->head++ & t->mask ];
+
+    e->clk = (uint32_t) clk;
+    e->addr = addr;
+    e->type = type;
+    e->data = data;
+    t->total++;
+}
+
+#if NES_TRACE
+#ifdef __GNUC__
+#define NES_TRACE_OFF(T) __builtin_expect( (T) == NULL, 1 )
+#else
+#define NES_TRACE_OFF(T) ( (T) == NULL )
+#endif
+// mm is a struct nesMemoryMap *, the cycle comes from the CPU on its bus
+#define NES_TRACE_EVENT(MM,TYPE,ADDR,DATA) \
+    do { \
+        if ( !NES_TRACE_OFF( (MM)->trace ) ) { \
+            nesTraceRecord( (MM)->trace, (MM)->cpu ? (MM)->cpu->clk : 0, (TYPE), (ADDR), (DATA) ); \
+        } \
+    } while ( 0 )
+#else
+#define NES_TRACE_EVENT(MM,TYPE,ADDR,DATA) do { } while ( 0 )
+#endif
+
+#endif /* __NESTRACE_H */
@@ -0,0 +1,236 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nestrace.h"
+#include "6502trace.h"
+#include "6502tracelog.h"
+
+// tracedump [filters] file
+//
+// Prints a bus trace saved with nesTraceSave, or an execution trace or
+// trace log in nestest.log format. Either may still be being written.
+// Filters, for execution traces and logs:
+//
+//     -pc LO-HI     PC within LO-HI (hex)
+//     -op XX        opcode XX (hex)
+//     -addr A       reads or writes A (hex)
+//     -cyc F-T      started on a cycle within F-T
+//     -last N       only the last N records that pass
+
+struct filter {
+    unsigned long pcLo, pcHi;
+    long op;
+    long addr;
+    uint64_t cycFrom, cycTo;
+    unsigned long last;
+};
+
+static int filterPass( const struct filter *f, const struct cpu6502TraceRecord *r ) {
+    if ( r->PC < f->pcLo || r->PC > f->pcHi ) {
+        return 0;
+    }
+    if ( f->op >= 0 && r->opcode != f->op ) {
+        return 0;
+    }
+    if ( f->addr >= 0 && !( r->access && r->addr == f->addr ) ) {
+        return 0;
+    }
+    return r->clk >= f->cycFrom && r->clk <= f->cycTo;
+}
+
+static int dumpBus( FILE *f, const char *fname ) {
+    struct nesTraceFileHeader h;
+    struct nesTraceEvent *ev;
+
+    if ( fread( &h, sizeof h, 1, f ) != 1 ) {
+        fprintf( stderr, "%s is truncated\n", fname );
+        return 1;
+    }
+    ev = malloc( sizeof( struct nesTraceEvent ) * ( h.count ? h.count : 1 ) );
+    if ( ev == NULL ) {
+        fprintf( stderr, "out of memory\n" );
+        return 1;
+    }
+    if ( fread( ev, sizeof( struct nesTraceEvent ), h.count, f ) != h.count ) {
+        fprintf( stderr, "%s is truncated\n", fname );
+        return 1;
+    }
+
+    nesTracePrint( stdout, ev, h.count );
+
+    free( ev );
+    return 0;
+}
+
+static int dumpExec( FILE *f, const char *fname, const struct filter *flt ) {
+    struct cpu6502TraceHeader h;
+    struct cpu6502TraceRecord *rec;
+    uint64_t first, end, n, shown;
+    char line[160];
+
+    if ( fread( &h, sizeof h, 1, f ) != 1 || h.recordSize != sizeof( struct cpu6502TraceRecord ) ||
+         h.capacity == 0 || ( h.capacity & ( h.capacity - 1 ) ) ) {
+        fprintf( stderr, "%s has a bad header\n", fname );
+        return 1;
+    }
+    rec = malloc( sizeof( struct cpu6502TraceRecord ) * h.capacity );
+    if ( rec == NULL ) {
+        fprintf( stderr, "out of memory\n" );
+        return 1;
+    }
+    if ( fread( rec, sizeof( struct cpu6502TraceRecord ), h.capacity, f ) != h.capacity ) {
+        fprintf( stderr, "%s is truncated\n", fname );
+        return 1;
+    }
+    end = h.head;
+
+    // while the CPU is still running, records it wrote since the header
+    // was read may have overwritten the oldest ones copied
+    rewind( f );
+    if ( fread( &h, sizeof h, 1, f ) != 1 ) {
+        fprintf( stderr, "%s is truncated\n", fname );
+        return 1;
+    }
+    first = ( h.head > h.capacity ) ? h.head - h.capacity : 0;
+
+    if ( flt->last ) {
+        shown = 0;
+        for ( n = end; n > first && shown < flt->last; n-- ) {
+            shown += filterPass( flt, &rec[ ( n - 1 ) & ( h.capacity - 1 ) ] );
+        }
+        first = n;
+    }
+
+    for ( n = first; n < end; n++ ) {
+        if ( !filterPass( flt, &rec[ n & ( h.capacity - 1 ) ] ) ) {
+            continue;
+        }
+        cpu6502TraceFormat( line, sizeof line, &rec[ n & ( h.capacity - 1 ) ] );
+        puts( line );
+    }
+
+    free( rec );
+    return 0;
+}
+
+// logs are decoded front to back, so the last N are kept in a ring as
+// they go by
+
+struct logDump {
+    const struct filter *flt;
+    struct cpu6502TraceRecord *last;
+    uint64_t n;
+};
+
+static int dumpLogRecord( const struct cpu6502TraceRecord *r, void *ctx ) {
+    struct logDump *d = ctx;
+    char line[160];
+
+    if ( !filterPass( d->flt, r ) ) {
+        return 0;
+    }
+    if ( d->last ) {
+        d->last[ d->n++ % d->flt->last ] = *r;
+        return 0;
+    }
+    cpu6502TraceFormat( line, sizeof line, r );
+    puts( line );
+    return 0;
+}
+
+static int dumpLog( FILE *f, const char *fname, const struct filter *flt ) {
+    struct logDump d;
+    uint64_t n;
+    char line[160];
+
+    d.flt = flt;
+    d.last = NULL;
+    d.n = 0;
+    if ( flt->last ) {
+        d.last = malloc( sizeof( struct cpu6502TraceRecord ) * flt->last );
+        if ( d.last == NULL ) {
+            fprintf( stderr, "out of memory\n" );
+            return 1;
+        }
+    }
+
+    if ( cpu6502TraceLogDecode( f, dumpLogRecord, &d ) < 0 ) {
+        fprintf( stderr, "%s has a bad header\n", fname );
+        free( d.last );
+        return 1;
+    }
+
+    if ( d.last ) {
+        for ( n = ( d.n > flt->last ) ? d.n - flt->last : 0; n < d.n; n++ ) {
+            cpu6502TraceFormat( line, sizeof line, &d.last[ n % flt->last ] );
+            puts( line );
+        }
+        free( d.last );
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+
+    struct filter flt;
+    uint32_t magic;
+    FILE *f;
+    int i;
+    int r;
+
+    flt.pcLo = 0;
+    flt.pcHi = 0xffff;
+    flt.op = -1;
+    flt.addr = -1;
+    flt.cycFrom = 0;
+    flt.cycTo = UINT64_MAX;
+    flt.last = 0;
+
+    for ( i = 1; i < argc - 1; i += 2 ) {
+        if ( !strcmp( argv[i], "-pc" ) ) {
+            sscanf( argv[i+1], "%lx-%lx", &flt.pcLo, &flt.pcHi );
+        } else if ( !strcmp( argv[i], "-op" ) ) {
+            flt.op = strtol( argv[i+1], NULL, 16 );
+        } else if ( !strcmp( argv[i], "-addr" ) ) {
+            flt.addr = strtol( argv[i+1], NULL, 16 );
+        } else if ( !strcmp( argv[i], "-cyc" ) ) {
+            sscanf( argv[i+1], "%" SCNu64 "-%" SCNu64, &flt.cycFrom, &flt.cycTo );
+        } else if ( !strcmp( argv[i], "-last" ) ) {
+            flt.last = strtoul( argv[i+1], NULL, 10 );
+        } else {
+            break;
+        }
+    }
+
+    if ( i != argc - 1 ) {
+        fprintf( stderr, "usage: %s [-pc LO-HI] [-op XX] [-addr A] [-cyc F-T] [-last N] trace\n", argv[0] );
+        return 1;
+    }
+
+    f = fopen( argv[i], "rb" );
+    if ( f == NULL ) {
+        fprintf( stderr, "cannot open %s\n", argv[i] );
+        return 1;
+    }
+
+    if ( fread( &magic, sizeof magic, 1, f ) != 1 ) {
+        fprintf( stderr, "%s is not a trace\n", argv[i] );
+        return 1;
+    }
+    rewind( f );
+
+    if ( magic == NES_TRACE_MAGIC ) {
+        r = dumpBus( f, argv[i] );
+    } else if ( magic == CPU_6502_TRACE_MAGIC ) {
+        r = dumpExec( f, argv[i], &flt );
+    } else if ( magic == CPU_6502_TRACE_LOG_MAGIC ) {
+        r = dumpLog( f, argv[i], &flt );
+    } else {
+        fprintf( stderr, "%s is not a trace\n", argv[i] );
+        r = 1;
+    }
+
+    fclose( f );
+    return r;
+}
@@ -8,12 +8,10 @@
 #define SCREEN_WIDTH 256
 #define SCREEN_HEIGHT 240
 
-#define PPU_ADDR_STATE_HI 0
-#define PPU_ADDR_STATE_LO 1
+// the PPU_ADDR / PPU_DATA latch is ppuV, ppuT and ppuW in the memory map,
+// see 2c02.c
 
 void monitorPPUTransfer( struct nesMemoryMap * mm ) {
-    static int x = PPU_ADDR_STATE_HI;
-
     
 
 }
\ No newline at end of file